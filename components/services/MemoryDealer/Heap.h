@@ -47,7 +47,9 @@ struct Chunk {
 
 #if 1 
 
-typedef SReadWriteLocker RWLock;
+// The base pointer is read on every access to the area and only
+// written when it goes away.
+typedef SReadMostlyLocker RWLock;
 
 #else
 
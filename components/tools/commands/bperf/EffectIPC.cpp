@@ -43,6 +43,18 @@ RemoteObjectProcess::AtomLeakReport(int32_t, int32_t, uint32_t)
 {
 }
 
+SValue
+RemoteObjectProcess::AtomAllocatorStats()
+{
+	return SValue();
+}
+
+SValue
+RemoteObjectProcess::ParcelCacheStats()
+{
+	return SValue();
+}
+
 void
 RemoteObjectProcess::PrintBinderReferences()
 {
@@ -93,6 +105,41 @@ RemoteObjectProcess::RestartBinderIPCProfiling()
 {
 }
 
+void
+RemoteObjectProcess::SetLockProfiling(int32_t, int32_t)
+{
+}
+
+void
+RemoteObjectProcess::RestartLockProfiling()
+{
+}
+
+void
+RemoteObjectNodeObserver::NodeChanged(const sptr<INode>&, uint32_t, const SValue&)
+{
+}
+
+void
+RemoteObjectNodeObserver::EntryCreated(const sptr<INode>&, const SString&, const sptr<IBinder>&)
+{
+}
+
+void
+RemoteObjectNodeObserver::EntryModified(const sptr<INode>&, const SString&, const sptr<IBinder>&)
+{
+}
+
+void
+RemoteObjectNodeObserver::EntryRemoved(const sptr<INode>&, const SString&)
+{
+}
+
+void
+RemoteObjectNodeObserver::EntryRenamed(const sptr<INode>&, const SString&, const SString&, const sptr<IBinder>&)
+{
+}
+
 #if TEST_PALMOS_APIS
 
 SString RemoteObjectView::ViewName() const
@@ -11,6 +11,7 @@
  */
 
 #include <support/INode.h>
+#include <support/INodeObserver.h>
 #include <support/IProcess.h>
 #include <support/Package.h>
 
@@ -37,6 +38,8 @@ class RemoteObjectProcess : public BnProcess, public SPackageSptr
 	
 	virtual	int32_t					AtomMarkLeakReport();
 	virtual	void					AtomLeakReport(int32_t mark, int32_t last, uint32_t flags);
+	virtual	SValue					AtomAllocatorStats();
+	virtual	SValue					ParcelCacheStats();
 	virtual	void					PrintBinderReferences();
 	virtual	void					RestartMallocProfiling();
 	virtual	void					SetMallocProfiling(bool enabled, int32_t dumpPeriod, int32_t maxItems, int32_t stackDepth);
@@ -47,9 +50,21 @@ class RemoteObjectProcess : public BnProcess, public SPackageSptr
 	virtual	void					SetBinderIPCProfiling(bool enabled, int32_t dumpPeriod, int32_t maxItems, int32_t stackDepth);
 	virtual void					RestartBinderIPCProfiling();
 	virtual	void					PrintBinderIPCProfiling();
+	virtual	void					SetLockProfiling(int32_t samplePeriod, int32_t stackDepth);
+	virtual	void					RestartLockProfiling();
 
 };
 
+// Its methods are all [oneway].
+class RemoteObjectNodeObserver : public BnNodeObserver, public SPackageSptr
+{
+	virtual	void					NodeChanged(const sptr<INode>& node, uint32_t flags, const SValue& hints);
+	virtual	void					EntryCreated(const sptr<INode>& node, const SString& name, const sptr<IBinder>& entry);
+	virtual	void					EntryModified(const sptr<INode>& node, const SString& name, const sptr<IBinder>& entry);
+	virtual	void					EntryRemoved(const sptr<INode>& node, const SString& name);
+	virtual	void					EntryRenamed(const sptr<INode>& node, const SString& old_name, const SString& new_name, const sptr<IBinder>& entry);
+};
+
 #if TEST_PALMOS_APIS
 
 class ADerivedClass : public BUISpecialEffects
@@ -107,4 +107,57 @@ private:
 	handler_test_state*	m_state;
 };
 
+// One of many handlers each holding a single delayed message, for
+// measuring how scheduling scales with the number of pending handlers.
+class DelayedHandlerTest : public BHandler, public SPackageSptr
+{
+public:
+
+	DelayedHandlerTest(handler_test_state* state)
+		:	m_state(state)
+	{
+	}
+
+	virtual	status_t HandleMessage(const SMessage &msg)
+	{
+		if (msg.What() == kTestHandler)
+		{
+			if (SysAtomicAdd32(&m_state->current, 1) == m_state->iterations-1)
+				m_state->finished.Open();
+			return B_OK;
+		}
+
+		return BHandler::HandleMessage(msg);
+	}
+
+private:
+	handler_test_state*	m_state;
+};
+
+// Handler that just reports each message it gets, so the poster can
+// measure the cost of waking an idle looper to run it.
+class WakeupHandlerTest : public BHandler, public SPackageSptr
+{
+public:
+
+	WakeupHandlerTest(handler_test_state* state)
+		:	m_state(state)
+	{
+	}
+
+	virtual	status_t HandleMessage(const SMessage &msg)
+	{
+		if (msg.What() == kTestHandler)
+		{
+			m_state->finished.Open();
+			return B_OK;
+		}
+
+		return BHandler::HandleMessage(msg);
+	}
+
+private:
+	handler_test_state*	m_state;
+};
+
 #endif /* _TRANSACTION_TEST_H */
@@ -36,7 +36,8 @@ enum {
 	kIncStrongTransaction = 'ISTR',
 	kDecStrongTransaction = 'DSTR',
 	kHoldTransaction = 'HOLD',
-	kPingPongTransaction = 'PONG'
+	kPingPongTransaction = 'PONG',
+	kSinkTransaction = 'SINK'
 };
 
 B_STATIC_STRING_VALUE_LARGE(key_validate, "validate", );
@@ -137,6 +138,10 @@ public:
 			}
 			// Do nothing.
 			return B_OK;
+		} else if (code == kSinkTransaction) {
+			// Reply with only the amount of data received.
+			if (reply) reply->WriteInt32(data.Length());
+			return B_OK;
 		} else if (code == kKeepTransaction) {
 			SAutolock _l(m_lock.Lock());
 			if (m_validate) {
@@ -202,6 +207,13 @@ public:
 		return BBinder::Transact(code, data, reply, flags);
 	}
 
+	virtual status_t Effect(const SValue& in, const SValue& /*inBindings*/, const SValue& /*outBindings*/, SValue* out)
+	{
+		// Echo the request back, for timing values in both directions.
+		if (out) *out = in;
+		return B_OK;
+	}
+
 	const sptr<IBinder> PongDatum() const { return m_pongDatum; }
 	
 protected:
@@ -20,6 +20,9 @@
 #include <support/Autolock.h>
 #include <support/CallStack.h>
 #include <support/Looper.h>
+#include <support/Autobinder.h>
+#include <support/AsyncTransaction.h>
+#include <support/ValueBuilder.h>
 #include <app/BCommand.h>
 #include <app/SGetOpts.h>
 #include <math.h>
@@ -27,6 +30,10 @@
 #include <support/Iterator.h>
 #include <SysThreadConcealed.h>
 
+#if TARGET_HOST == TARGET_HOST_LINUX
+#include <sys/resource.h>
+#endif
+
 #if defined(LINUX_DEMO_HACK)
 #define B_PERFCNT_MAX_NAME_SIZE 28
 #endif
@@ -104,6 +111,7 @@ const uint64_t kValueBuildStrTestMask				= B_MAKE_UINT64(1) << 26;
 
 const uint64_t kSingleHandlerTestMask				= B_MAKE_UINT64(1) << 27;
 const uint64_t kDoubleHandlerTestMask				= B_MAKE_UINT64(1) << 28;
+const uint64_t kManyHandlersTestMask				= B_MAKE_UINT64(1) << 29;
 
 const uint64_t kLocalInstantiateTestMask			= B_MAKE_UINT64(1) << 30;
 const uint64_t kRemoteInstantiateTestMask			= B_MAKE_UINT64(1) << 31;
@@ -125,6 +133,7 @@ const uint64_t kFloatSimpleTestMask					= B_MAKE_UINT64(1) << 45;
 const uint64_t kLocalEffectIPCTestMask				= B_MAKE_UINT64(1) << 46;
 const uint64_t kRemoteEffectIPCTestMask				= B_MAKE_UINT64(1) << 47;
 const uint64_t kLibcTestMask						= B_MAKE_UINT64(1) << 48;
+const uint64_t kReadWriteLockerTestMask				= B_MAKE_UINT64(1) << 49;
 
 const uint64_t kDmNextTestMask						= B_MAKE_UINT64(1) << 50;
 const uint64_t kDmInfoTestMask						= B_MAKE_UINT64(1) << 51;
@@ -140,6 +149,15 @@ const uint64_t kDmReadTestMask						= B_MAKE_UINT64(1) << 60;
 
 const uint64_t kICacheTestMask						= B_MAKE_UINT64(1) << 61;
 
+const uint64_t kRemoteAutobinderTestMask			= B_MAKE_UINT64(1) << 62;
+const uint64_t kRemoteCompactEffectTestMask			= B_MAKE_UINT64(1) << 63;
+
+// The masks above fill m_which; these are for m_whichMore.
+const uint64_t kRemoteOneWayTestMask				= B_MAKE_UINT64(1) << 0;
+const uint64_t kRemoteAsyncFanOutTestMask			= B_MAKE_UINT64(1) << 1;
+
+const uint64_t kRemoteMoreTestsMask					= kRemoteOneWayTestMask | kRemoteAsyncFanOutTestMask;
+
 enum
 {
 	kShowCallStack				= 1000,
@@ -147,7 +165,9 @@ enum
 	kProfileRate,
 	kUsePMU,
 	kPMUEventType,
-	kIncludeLoop
+	kIncludeLoop,
+	kTestRemoteOneWay,
+	kTestRemoteAsyncFanOut
 };
 
 static const SLongOption options[] =
@@ -202,7 +222,7 @@ static const SLongOption options[] =
 		"value-add-int, value-add-str." },
 	{ sizeof(SLongOption), "all-handler", B_NO_ARGUMENT, 'H',
 		"Run all handler tests:\n"
-		"pulse-handler, pingpong-handler." },
+		"pulse-handler, pingpong-handler, many-handlers." },
 	{ sizeof(SLongOption), "all-package", B_NO_ARGUMENT, 'P',
 		"Run all package tests:\n"
 		"local-instantiate, remote-instantiate." },
@@ -224,7 +244,9 @@ static const SLongOption options[] =
 		"remote-old-binder, remote-same-binder,\n"
 		"remote-new-binder, remote-attempt-inc-strong,\n"
 		"multiple-attempt-inc-strong,\n"
-		"ping-pong-transaction, remote-effect.\n" },
+		"ping-pong-transaction, remote-effect,\n"
+		"remote-autobinder, remote-compact-effect,\n"
+		"remote-oneway, remote-async-fan-out.\n" },
 	{ sizeof(SLongOption), "all-float", B_NO_ARGUMENT, 'F',
 		"Run all floating point tests:\n"
 		"float-simple" },
@@ -246,7 +268,7 @@ static const SLongOption options[] =
 	{ sizeof(SLongOption), "test-system-time", B_NO_ARGUMENT, 1000,
 		"Test calling KALGetTime(B_TIMEBASE_RUN_TIME)." },
 	{ sizeof(SLongOption), "test-context-switch", B_NO_ARGUMENT, 1000,
-		"Test context switch between two threads." },
+		"Test context switch between two threads, and waking a looper to run a handler." },
 	{ sizeof(SLongOption), "test-keys", B_NO_ARGUMENT, 1000,
 		"Test allocate and free kernel keys." },
 	{ sizeof(SLongOption), "test-mem-ptr-new", B_NO_ARGUMENT, 1000,
@@ -275,6 +297,8 @@ static const SLongOption options[] =
 		"Test creation of smart pointer on a SAtom." },
 	{ sizeof(SLongOption), "test-mutex", B_NO_ARGUMENT, 1000,
 		"Test locking and unlocking a Kernel mutex." },
+	{ sizeof(SLongOption), "test-read-write-locker", B_NO_ARGUMENT, 1000,
+		"Test read locks of SReadWriteLocker and SReadMostlyLocker on 1 to 64 threads." },
 
 	{ sizeof(SLongOption), "test-value-simple", B_NO_ARGUMENT, 1000,
 		"Test creation of simple value." },
@@ -295,6 +319,8 @@ static const SLongOption options[] =
 		"Test messaging with a single BHandler." },
 	{ sizeof(SLongOption), "test-pingpong-handler", B_NO_ARGUMENT, 1000,
 		"Test messaging alternating two BHandlers." },
+	{ sizeof(SLongOption), "test-many-handlers", B_NO_ARGUMENT, 1000,
+		"Test scheduling and dispatching 100000 BHandlers\nwith random delays." },
 
 	{ sizeof(SLongOption), "test-local-instantiate", B_NO_ARGUMENT, 1000,
 		"Test local instantiation of new binder component." },
@@ -330,6 +356,15 @@ static const SLongOption options[] =
 		"Test Effect() on a remote binder." },
 	{ sizeof(SLongOption), "test-remote-effect", B_NO_ARGUMENT, 1000,
 		"Test Effect() on a remote binder." },
+	{ sizeof(SLongOption), "test-remote-autobinder", B_NO_ARGUMENT, 1000,
+		"Test remote pidgen calls by method ID and by name." },
+	{ sizeof(SLongOption), "test-remote-compact-effect", B_NO_ARGUMENT, 1000,
+		"Test remote Effect() with compact and standard value encodings." },
+	{ sizeof(SLongOption), "test-remote-oneway", B_NO_ARGUMENT, kTestRemoteOneWay,
+		"Test remote [oneway] pidgen calls against synchronous ones." },
+	{ sizeof(SLongOption), "test-remote-async-fan-out", B_NO_ARGUMENT, kTestRemoteAsyncFanOut,
+		"Test calling several remote objects at once with SAsyncTransaction,\n"
+		"against calling them one after another.  --concurrency sets how many." },
 
 	{ sizeof(SLongOption), "test-float-simple", B_NO_ARGUMENT, 1000,
 		"Test floating point basic operations." },
@@ -394,7 +429,8 @@ static const uint64_t optionTests[] =
 		| kMemPtrNewTestMask | kMemHandleLockTestMask | kMallocTestMask
 		| kNewMessageTestMask | kNewBinderTestMask | kNewComponentTestMask
 		| kCriticalSectionTestMask | kLockerTestMask | kAutolockTestMask | kNestedLockerTestMask
-		| kIncStrongTestMask | kAtomPtrTestMask | kMutexTestMask,
+		| kIncStrongTestMask | kAtomPtrTestMask | kMutexTestMask
+		| kReadWriteLockerTestMask,
 
 	// Value
 	kValueSimpleTestMask | kValueJoin2TestMask | kValueJoinManyTestMask
@@ -402,7 +438,7 @@ static const uint64_t optionTests[] =
 		| kValueBuildIntTestMask | kValueBuildStrTestMask,
 
 	// Handler
-	kSingleHandlerTestMask | kDoubleHandlerTestMask,
+	kSingleHandlerTestMask | kDoubleHandlerTestMask | kManyHandlersTestMask,
 
 	// Package
 	kLocalInstantiateTestMask | kRemoteInstantiateTestMask,
@@ -430,7 +466,8 @@ static const uint64_t optionTests[] =
 		| kRemoteOldBinderTestMask | kRemoteSameBinderTestMask | kRemoteNewBinderTestMask
 		| kRemoteAttemptIncStrongTestMask | kMultipleAttemptIncStrongTestMask
 		| kPingPongTransactionMask
-		| kRemoteEffectIPCTestMask,
+		| kRemoteEffectIPCTestMask | kRemoteAutobinderTestMask
+		| kRemoteCompactEffectTestMask,
 
 	// Float
 	kFloatSimpleTestMask,
@@ -463,6 +500,7 @@ static const uint64_t optionTests[] =
 	kIncStrongTestMask,
 	kAtomPtrTestMask,
 	kMutexTestMask,
+	kReadWriteLockerTestMask,
 
 	kValueSimpleTestMask,
 	kValueJoin2TestMask,
@@ -474,6 +512,7 @@ static const uint64_t optionTests[] =
 
 	kSingleHandlerTestMask,
 	kDoubleHandlerTestMask,
+	kManyHandlersTestMask,
 
 	kLocalInstantiateTestMask,
 	kRemoteInstantiateTestMask,
@@ -493,6 +532,10 @@ static const uint64_t optionTests[] =
 
 	kLocalEffectIPCTestMask,
 	kRemoteEffectIPCTestMask,
+	kRemoteAutobinderTestMask,
+	kRemoteCompactEffectTestMask,
+	0,	// test-remote-oneway; see m_whichMore
+	0,	// test-remote-async-fan-out
 	
 	kFloatSimpleTestMask,
 
@@ -581,6 +624,9 @@ private:
 	SValue RunAutolockTest();
 	SValue RunMutexTest();	
 	SValue RunNestedLockerTest();
+	SValue RunLockContentionTest(const char* label, void (*loop)(void* lock, int32_t N), void* lock,
+								int32_t maxThreads = 0);
+	SValue RunReadWriteLockerTest();
 	SValue RunIncStrongTest();
 	SValue RunAtomPtrTest();
 	SValue RunValueSimpleTest();
@@ -588,15 +634,25 @@ private:
 	SValue RunValueJoinManyTest();
 	SValue RunValueIntegerLookupTest();
 	SValue RunValueStringLookupTest();
+	SValue RunValueStringMapLookupTest(size_t amount);
+	SValue RunValueSnapshotEditTest(size_t amount);
 	SValue RunValueIntegerBuildTest(size_t amount);
 	SValue RunValueStringBuildTest(size_t amount);
+	SValue RunValueArchiveTest(size_t amount);
 	SValue RunHandlerTest(int32_t num);
+	SValue RunManyHandlersTest(int32_t num);
 	SValue RunInstantiateTest(bool remote);
 	SValue RunTransactionTest(bool remote, size_t sizeFactor=1);
+	SValue RunLargeValueTransactionTest(size_t size, bool gather);
+	SValue RunSharedTransactionTest(size_t size, bool shared);
 	SValue RunPingPongTransactionTest();
 	SValue RunFloatSimpleTest();
 	SValue RunLibcTest();
 	SValue RunEffectIPCTest(bool remote);
+	SValue RunAutobinderTest();
+	SValue RunCompactEffectTest(bool catalog, bool compact);
+	SValue RunOneWayTest();
+	SValue RunAsyncFanOutTest();
 	enum {
 		kOldBinder, kOldWeakBinder, kWeakToStrongBinder,
 		kSameBinder, kSameWeakBinder,
@@ -630,6 +686,7 @@ private:
 	const sptr<IProcess> BackgroundProcess();
 	
 	uint64_t m_which;
+	uint64_t m_whichMore;
 	int32_t m_iterations;
 	int32_t m_priority;
 	int32_t m_concurrency;
@@ -668,7 +725,7 @@ uint32_t BinderPerformance::m_pmu_config[B_MAX_EVENT_COUNTERS];
 
 BinderPerformance::BinderPerformance(const SContext& context)
 	:	BCommand(context),
-		m_which(0), m_iterations(1000), m_priority(sysThreadPriorityNormal), m_concurrency(1),
+		m_which(0), m_whichMore(0), m_iterations(1000), m_priority(sysThreadPriorityNormal), m_concurrency(1),
 		m_dataSize(128), m_seed(0), m_origSeed(0),
 		m_qc(false), m_includeLoop(false), m_validating(false), m_concurrencySpecified(false)
 {
@@ -865,6 +922,8 @@ SValue BinderPerformance::Run(const ArgList& args)
 			TextError() << cmdName << ": does not take arguments" << endl;
 			break;
 		}
+		if (opt == 'A') m_whichMore = B_MAKE_UINT64(0xffffffffffffffff);
+		else if (opt == 'B' || opt == 'R') m_whichMore |= kRemoteMoreTestsMask;
 		if (optionTests[getOpts.OptionIndex()] != 0) {
 			m_which |= optionTests[getOpts.OptionIndex()];
 			continue;
@@ -982,6 +1041,12 @@ SValue BinderPerformance::Run(const ArgList& args)
 			case kIncludeLoop: {
 				m_includeLoop = true;
 			} break;
+			case kTestRemoteOneWay: {
+				m_whichMore |= kRemoteOneWayTestMask;
+			} break;
+			case kTestRemoteAsyncFanOut: {
+				m_whichMore |= kRemoteAsyncFanOutTestMask;
+			} break;
 			case kShowCallStack: {
 				SCallStack stack;
 				TextOutput() << "Running stack.Update()..." << endl;
@@ -1005,9 +1070,12 @@ SValue BinderPerformance::Run(const ArgList& args)
 		return SValue::Status(B_OK);
 	}
 
-	if (m_which == 0 && m_qc) m_which = B_MAKE_UINT64(0xffffffffffffffff);
+	if (m_which == 0 && m_whichMore == 0 && m_qc) {
+		m_which = B_MAKE_UINT64(0xffffffffffffffff);
+		m_whichMore = B_MAKE_UINT64(0xffffffffffffffff);
+	}
 
-	if (getOpts.IsHelpNeeded() || m_which == 0) {
+	if (getOpts.IsHelpNeeded() || (m_which == 0 && m_whichMore == 0)) {
 		getOpts.PrintShortHelp(TextError(), args);
 		return SValue::Status(B_BAD_VALUE);
 	}
@@ -1109,7 +1177,11 @@ SValue BinderPerformance::RunTests()
 		TextOutput() << "VALIDATION ENABLED" << endl;
 	}
 	TextOutput() << "Iterations: " << m_iterations << endl
-		<< "Thread priority: " << m_priority << endl
+		<< "Thread priority: " << m_priority << endl;
+#if TARGET_HOST == TARGET_HOST_LINUX
+	TextOutput() << "IPC transport: " << SLooper::TransportName() << endl;
+#endif
+	TextOutput()
 		<< "Payload size: ";
 	if (m_dataSize >= 0) TextOutput() << m_dataSize << endl;
 	else TextOutput() << "Random (seed " << m_seed << ")" << endl;
@@ -1161,11 +1233,23 @@ SValue BinderPerformance::RunTests()
 	if ((m_which&kIncStrongTestMask) != 0) result.Join(RunIncStrongTest());
 	if ((m_which&kAtomPtrTestMask) != 0) result.Join(RunAtomPtrTest());
 	if ((m_which&kMutexTestMask) != 0) result.Join(RunMutexTest());
+	if ((m_which&kReadWriteLockerTestMask) != 0) result.Join(RunReadWriteLockerTest());
 	if ((m_which&kValueSimpleTestMask) != 0) result.Join(RunValueSimpleTest());
 	if ((m_which&kValueJoin2TestMask) != 0) result.Join(RunValueJoin2Test());
 	if ((m_which&kValueJoinManyTestMask) != 0) result.Join(RunValueJoinManyTest());
 	if ((m_which&kValueLookupIntTestMask) != 0) result.Join(RunValueIntegerLookupTest());
-	if ((m_which&kValueLookupStrTestMask) != 0) result.Join(RunValueStringLookupTest());
+	if ((m_which&kValueLookupStrTestMask) != 0) {
+		result.Join(RunValueStringLookupTest());
+		result.Join(RunValueStringMapLookupTest(10));
+		result.Join(RunValueStringMapLookupTest(100));
+		result.Join(RunValueStringMapLookupTest(1000));
+		result.Join(RunValueStringMapLookupTest(10000));
+		result.Join(RunValueStringMapLookupTest(100000));
+		result.Join(RunValueSnapshotEditTest(100));
+		result.Join(RunValueSnapshotEditTest(1000));
+		result.Join(RunValueSnapshotEditTest(10000));
+		result.Join(RunValueSnapshotEditTest(100000));
+	}
 	if ((m_which&kValueBuildIntTestMask) != 0) {
 		result.Join(RunValueIntegerBuildTest(2));
 		result.Join(RunValueIntegerBuildTest(10));
@@ -1177,11 +1261,15 @@ SValue BinderPerformance::RunTests()
 		result.Join(RunValueStringBuildTest(10));
 		result.Join(RunValueStringBuildTest(100));
 		result.Join(RunValueStringBuildTest(1000));
+		result.Join(RunValueArchiveTest(10));
+		result.Join(RunValueArchiveTest(100));
+		result.Join(RunValueArchiveTest(1000));
 	}
 	if ((m_which&kFloatSimpleTestMask) != 0) result.Join(RunFloatSimpleTest());
 	if ((m_which&kLibcTestMask) != 0) result.Join(RunLibcTest());
 	if ((m_which&kSingleHandlerTestMask) != 0) result.Join(RunHandlerTest(1));
 	if ((m_which&kDoubleHandlerTestMask) != 0) result.Join(RunHandlerTest(2));
+	if ((m_which&kManyHandlersTestMask) != 0) result.Join(RunManyHandlersTest(100000));
 	if ((m_which&kLocalInstantiateTestMask) != 0) result.Join(RunInstantiateTest(false));
 	if ((m_which&kRemoteInstantiateTestMask) != 0) result.Join(RunInstantiateTest(true));
 	if ((m_which&kLocalTransactionTestMask) != 0) result.Join(RunTransactionTest(false, 0));
@@ -1189,6 +1277,21 @@ SValue BinderPerformance::RunTests()
 	if ((m_which&kRemoteTransactionTestMask) != 0) result.Join(RunTransactionTest(true, 0));
 	if ((m_which&kRemoteTransactionTestMask) != 0) result.Join(RunTransactionTest(true));
 	if ((m_which&kRemoteLargeTransactionTestMask) != 0) result.Join(RunTransactionTest(true, 20));
+	if ((m_which&kRemoteLargeTransactionTestMask) != 0) {
+		static const size_t sizes[] = { 64*1024, 1024*1024, 4*1024*1024 };
+		for (size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+			result.Join(RunLargeValueTransactionTest(sizes[i], false));
+			result.Join(RunLargeValueTransactionTest(sizes[i], true));
+		}
+#if TARGET_HOST == TARGET_HOST_LINUX
+		// The transaction buffer is only 8MB, so beyond a few megabytes
+		// only shared memory can carry the data at all.
+		for (size_t size=4*1024; size<=64*1024*1024; size*=4) {
+			if (size <= 4*1024*1024) result.Join(RunSharedTransactionTest(size, false));
+			result.Join(RunSharedTransactionTest(size, true));
+		}
+#endif
+	}
 	if ((m_which&kLocalOldBinderTestMask) != 0) {
 		result.Join(RunBinderTransferTest(false, kOldBinder));
 		result.Join(RunBinderTransferTest(false, kOldWeakBinder));
@@ -1222,6 +1325,15 @@ SValue BinderPerformance::RunTests()
 
 	if ((m_which&kLocalEffectIPCTestMask) != 0) result.Join(RunEffectIPCTest(false));
 	if ((m_which&kRemoteEffectIPCTestMask) != 0) result.Join(RunEffectIPCTest(true));
+	if ((m_which&kRemoteAutobinderTestMask) != 0) result.Join(RunAutobinderTest());
+	if ((m_which&kRemoteCompactEffectTestMask) != 0) {
+		result.Join(RunCompactEffectTest(false, false));
+		result.Join(RunCompactEffectTest(false, true));
+		result.Join(RunCompactEffectTest(true, false));
+		result.Join(RunCompactEffectTest(true, true));
+	}
+	if ((m_whichMore&kRemoteOneWayTestMask) != 0) result.Join(RunOneWayTest());
+	if ((m_whichMore&kRemoteAsyncFanOutTestMask) != 0) result.Join(RunAsyncFanOutTest());
 
 	if ((m_which&kDmNextTestMask) != 0) result.Join(RunDmNextTest());
 	if ((m_which&kDmInfoTestMask) != 0) result.Join(RunDmInfoTest());
@@ -2192,8 +2304,42 @@ static void context_switch_func(void* argument)
 		state->finished.Open();
 }
 
+// Voluntary and involuntary context switches of the whole process,
+// for reporting alongside the context switch timings.
+struct context_switch_counts
+{
+	int64_t voluntary;
+	int64_t involuntary;
+
+	void Read()
+	{
+#if TARGET_HOST == TARGET_HOST_LINUX
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+			voluntary = usage.ru_nvcsw;
+			involuntary = usage.ru_nivcsw;
+			return;
+		}
+#endif
+		voluntary = involuntary = -1;
+	}
+};
+
+static void WriteSwitchResult(const sptr<ITextOutput>& io, const char* label, const Timer& t,
+	const context_switch_counts& start, const context_switch_counts& end)
+{
+	io << label << "\t" << t;
+	if (start.voluntary >= 0 && end.voluntary >= 0) {
+		io << " voluntary-cs " << (end.voluntary-start.voluntary)
+			<< " involuntary-cs " << (end.involuntary-start.involuntary);
+	}
+	io << endl;
+}
+
 SValue BinderPerformance::RunContextSwitchTest()
 {
+	context_switch_counts startCS, endCS;
+
 	Timer t(m_iterations*10);
 	context_switch_state state;
 	state.N = t.N;
@@ -2219,6 +2365,7 @@ SValue BinderPerformance::RunContextSwitchTest()
 	}
 
 	state.finished.Close();
+	startCS.Read();
 	t.Start();
 
 	SysThreadStart(state.t1);
@@ -2226,8 +2373,36 @@ SValue BinderPerformance::RunContextSwitchTest()
 
 	state.finished.Wait();
 	t.Stop();
+	endCS.Read();
 
-	WriteResult(TextOutput(), "Context Switch", t);
+	WriteSwitchResult(TextOutput(), "Context Switch", t, startCS, endCS);
+
+	// Now bounce messages off a handler, so every message has to wake
+	// an idle looper to dispatch it.
+	{
+		Timer w(m_iterations*2);
+		handler_test_state wakeup;
+		wakeup.iterations = w.N;
+		wakeup.priority = m_priority;
+		wakeup.dataSize = 0;
+		wakeup.current = 0;
+
+		sptr<WakeupHandlerTest> handler = new WakeupHandlerTest(&wakeup);
+		SMessage msg(kTestHandler);
+		msg.SetPriority(m_priority);
+
+		startCS.Read();
+		w.Start();
+		for (int32_t i=0; i<w.N; i++) {
+			wakeup.finished.Close();
+			handler->PostMessage(msg);
+			wakeup.finished.Wait();
+		}
+		w.Stop();
+		endCS.Read();
+
+		WriteSwitchResult(TextOutput(), "Handler Wakeup", w, startCS, endCS);
+	}
 
 	return SValue::Status(B_OK);
 }
@@ -2497,6 +2672,138 @@ SValue BinderPerformance::RunNewComponentTest()
 	return SValue::Status(B_OK);
 }
 
+struct lock_contention_state
+{
+	int32_t N;
+	void (*loop)(void* lock, int32_t N);
+	void* lock;
+	volatile int32_t numReady;
+	SConditionVariable ready;
+	SConditionVariable start;
+	volatile int32_t numRunning;
+	SConditionVariable finished;
+	SConditionVariable exit;
+};
+
+static void critical_section_loop(void* lock, int32_t N)
+{
+	SysCriticalSectionType* cs = (SysCriticalSectionType*)lock;
+	for (int32_t i=0; i<N; i++) {
+		SysCriticalSectionEnter(cs);
+		SysCriticalSectionExit(cs);
+	}
+}
+
+static void locker_loop(void* lock, int32_t N)
+{
+	SLocker* locker = (SLocker*)lock;
+	for (int32_t i=0; i<N; i++) {
+		locker->LockQuick();
+		locker->Unlock();
+	}
+}
+
+static void nested_locker_loop(void* lock, int32_t N)
+{
+	SNestedLocker* locker = (SNestedLocker*)lock;
+	for (int32_t i=0; i<N; i++) {
+		locker->LockQuick();
+		locker->Unlock();
+	}
+}
+
+static void read_write_locker_loop(void* lock, int32_t N)
+{
+	SReadWriteLocker* locker = (SReadWriteLocker*)lock;
+	for (int32_t i=0; i<N; i++) {
+		locker->ReadLockQuick();
+		locker->ReadUnlock();
+	}
+}
+
+static void read_mostly_locker_loop(void* lock, int32_t N)
+{
+	SReadMostlyLocker* locker = (SReadMostlyLocker*)lock;
+	for (int32_t i=0; i<N; i++) {
+		locker->ReadLockQuick();
+		locker->ReadUnlock();
+	}
+}
+
+static void lock_contention_func(void* argument)
+{
+	lock_contention_state& state = *(lock_contention_state*)argument;
+
+	// Same handshaking as atomic_op_func().
+	if (SysAtomicDec32(&state.numReady) == 1) state.ready.Open();
+	state.start.Wait();
+
+	state.loop(state.lock, state.N);
+
+	if (SysAtomicDec32(&state.numRunning) == 1) state.finished.Open();
+	state.exit.Wait();
+}
+
+// Run a lock test on 2, 4, ... threads, up to maxThreads (by default
+// --concurrency, or 4), all using the same lock.  The single thread
+// case is left to the caller, which can time it more accurately.
+SValue BinderPerformance::RunLockContentionTest(const char* label, void (*loop)(void* lock, int32_t N), void* lock,
+												int32_t maxThreads)
+{
+	if (maxThreads <= 0) maxThreads = m_concurrencySpecified ? m_concurrency : 4;
+	if (maxThreads < 2) return SValue::Status(B_OK);
+
+	lock_contention_state state;
+	state.loop = loop;
+	state.lock = lock;
+
+	int32_t numThreads = 2;
+	while (true) {
+		if (numThreads > maxThreads) numThreads = maxThreads;
+
+		state.N = (m_iterations*100)/numThreads;
+		state.numReady = numThreads;
+		state.ready.Close();
+		state.start.Close();
+		state.numRunning = numThreads;
+		state.finished.Close();
+		state.exit.Close();
+
+		Timer t(state.N*numThreads);
+		for (int32_t j=0; j<numThreads; j++) {
+			SysHandle h;
+			status_t err = SysThreadCreate(NULL, "Lock contention test thread",
+										(uint8_t)m_priority, sysThreadStackBasic,
+										lock_contention_func, &state, &h);
+			if (err != errNone) {
+				// XXX May leak threads.
+				SValue result;
+				result.SetError(err);
+				return result;
+			}
+			SysThreadStart(h);
+		}
+
+		state.ready.Wait();
+		t.Start();
+		state.start.Open();
+		state.finished.Wait();
+		t.Stop();
+
+		state.exit.Open();
+		SysThreadDelay(B_MS2NS(100), B_RELATIVE_TIMEOUT);
+
+		SString str;
+		str << numThreads << "x-" << label;
+		WriteResult(TextOutput(), str.String(), t);
+
+		if (numThreads == maxThreads) break;
+		numThreads *= 2;
+	}
+
+	return SValue::Status(B_OK);
+}
+
 SValue BinderPerformance::RunCriticalSectionTest()
 {
 	Timer t(m_iterations*100);
@@ -2510,7 +2817,7 @@ SValue BinderPerformance::RunCriticalSectionTest()
 
 	WriteResult(TextOutput(), "SysCriticalSection (pair)", t);
 
-	return SValue::Status(B_OK);
+	return RunLockContentionTest("SysCriticalSection (pair)", critical_section_loop, &cs);
 }
 
 SValue BinderPerformance::RunLockerTest()
@@ -2526,7 +2833,7 @@ SValue BinderPerformance::RunLockerTest()
 
 	WriteResult(TextOutput(), "SLocker (pair)", t);
 
-	return SValue::Status(B_OK);
+	return RunLockContentionTest("SLocker (pair)", locker_loop, &lock);
 }
 
 SValue BinderPerformance::RunAutolockTest()
@@ -2557,7 +2864,60 @@ SValue BinderPerformance::RunNestedLockerTest()
 
 	WriteResult(TextOutput(), "SNestedLocker (pair)", t);
 
-	return SValue::Status(B_OK);
+	return RunLockContentionTest("SNestedLocker (pair)", nested_locker_loop, &lock);
+}
+
+// Readers only, scaling to 64 threads (or --concurrency), to show
+// how much the shared reader count costs.  Write pairs are timed on
+// one thread for comparison.
+SValue BinderPerformance::RunReadWriteLockerTest()
+{
+	const int32_t maxThreads = m_concurrencySpecified ? m_concurrency : 64;
+
+	{
+		SReadWriteLocker lock;
+		Timer t(m_iterations*100);
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			lock.ReadLockQuick();
+			lock.ReadUnlock();
+		}
+		t.Stop();
+		WriteResult(TextOutput(), "SReadWriteLocker (read pair)", t);
+
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			lock.WriteLockQuick();
+			lock.WriteUnlock();
+		}
+		t.Stop();
+		WriteResult(TextOutput(), "SReadWriteLocker (write pair)", t);
+
+		SValue result(RunLockContentionTest("SReadWriteLocker (read pair)",
+			read_write_locker_loop, &lock, maxThreads));
+		if (result.AsStatus() != B_OK) return result;
+	}
+
+	SReadMostlyLocker lock;
+	Timer t(m_iterations*100);
+	t.Start();
+	for (int32_t i=0; i<t.N; i++) {
+		lock.ReadLockQuick();
+		lock.ReadUnlock();
+	}
+	t.Stop();
+	WriteResult(TextOutput(), "SReadMostlyLocker (read pair)", t);
+
+	t.Start();
+	for (int32_t i=0; i<t.N; i++) {
+		lock.WriteLockQuick();
+		lock.WriteUnlock();
+	}
+	t.Stop();
+	WriteResult(TextOutput(), "SReadMostlyLocker (write pair)", t);
+
+	return RunLockContentionTest("SReadMostlyLocker (read pair)",
+		read_mostly_locker_loop, &lock, maxThreads);
 }
 
 SValue BinderPerformance::RunIncStrongTest()
@@ -2832,6 +3192,78 @@ SValue BinderPerformance::RunValueStringLookupTest()
 	return SValue::Status(B_OK);
 }
 
+SValue BinderPerformance::RunValueStringMapLookupTest(size_t amount)
+{
+	{
+		RestartDataSize();
+		Timer t(m_iterations*100);
+
+		// Keys are added in sorted order, so building even the largest
+		// map is quick.
+		SVector<SValue> keys;
+		SValue data;
+		SValue found;
+		keys.SetCapacity(amount);
+		for (size_t j=0; j<amount; j++) {
+			char buf[32];
+			sprintf(buf, "Key %06ld", (long)j);
+			keys.AddItem(SValue::String(buf));
+			data.JoinItem(keys[j], keys[j]);
+		}
+
+		// Step through the keys in a scattered order.
+		size_t k = 0;
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			found = data[keys[k]];
+			k = (k+7919)%amount;
+		}
+		t.Stop();
+
+		SString str;
+		str << "SValue Lookup " << amount << " Str";
+		WriteResult(TextOutput(), str.String(), t);
+	}
+
+	return SValue::Status(B_OK);
+}
+
+SValue BinderPerformance::RunValueSnapshotEditTest(size_t amount)
+{
+	{
+		RestartDataSize();
+		Timer t(m_iterations*10);
+
+		SVector<SValue> keys;
+		SValue data;
+		keys.SetCapacity(amount);
+		for (size_t j=0; j<amount; j++) {
+			char buf[32];
+			sprintf(buf, "Key %06ld", (long)j);
+			keys.AddItem(SValue::String(buf));
+			data.JoinItem(keys[j], keys[j]);
+		}
+
+		// Keep a copy of the map, as a service handing out its state
+		// would, and then change one item of it.
+		SValue snapshot;
+		size_t k = 0;
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			snapshot = data;
+			data.Overlay(SValue(keys[k], SValue::Int32(i)));
+			k = (k+7919)%amount;
+		}
+		t.Stop();
+
+		SString str;
+		str << "SValue Snapshot Edit " << amount << " Str";
+		WriteResult(TextOutput(), str.String(), t);
+	}
+
+	return SValue::Status(B_OK);
+}
+
 SValue BinderPerformance::RunValueIntegerBuildTest(size_t amount)
 {
 	{
@@ -2932,6 +3364,70 @@ SValue BinderPerformance::RunValueIntegerBuildTest(size_t amount)
 		WriteResult(TextOutput(), str.String(), t);
 	}
 
+	{
+		RestartDataSize();
+		Timer t((m_iterations*100)/amount + 1);
+		int32_t i;
+
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			SValueBuilder builder;
+			for (size_t j=0; j<amount; j++) {
+				builder.AddItem(SSimpleValue<int32_t>((int32_t)j), SSimpleValue<int32_t>((int32_t)j));
+			}
+			SValue data(builder.Build());
+		}
+		t.Stop();
+
+		SString str;
+		str << "SValueBuilder Build " << amount << " Int";
+		WriteResult(TextOutput(), str.String(), t);
+	}
+
+	return SValue::Status(B_OK);
+}
+
+SValue BinderPerformance::RunValueArchiveTest(size_t amount)
+{
+	// A map of small maps, like a typical reply.
+	SVector<SValue> keys;
+	SValue data;
+	keys.SetCapacity(amount);
+	for (size_t j=0; j<amount; j++) {
+		char buf[32];
+		sprintf(buf, "Key %06ld", (long)j);
+		keys.AddItem(SValue::String(buf));
+		SValue item;
+		item.JoinItem(SValue::String("name"), m_values[j%MAX_DATA]);
+		item.JoinItem(SValue::String("id"), SValue::Int32(j));
+		data.JoinItem(keys[j], item);
+	}
+
+	// Each round changes one item, which forgets the archived size of it
+	// and of the outer map, as building a new reply would.  The first
+	// pass sizes the value before writing it, which is what Archive()
+	// did before it patched the map lengths in afterwards.
+	SParcel parcel;
+	for (int32_t pass=0; pass<2; pass++) {
+		RestartDataSize();
+		Timer t((m_iterations*100)/amount + 1);
+
+		size_t k = 0;
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			data.Overlay(SValue(keys[k], SValue(SValue::String("id"), SValue::Int32(i))));
+			k = (k+7919)%amount;
+			if (pass == 0) (void)data.ArchivedSize();
+			parcel.Reset();
+			data.Archive(parcel);
+		}
+		t.Stop();
+
+		SString str;
+		str << "SValue Archive " << amount << " Str" << (pass == 0 ? " Sized" : "");
+		WriteResult(TextOutput(), str.String(), t);
+	}
+
 	return SValue::Status(B_OK);
 }
 
@@ -3036,6 +3532,26 @@ SValue BinderPerformance::RunValueStringBuildTest(size_t amount)
 		WriteResult(TextOutput(), str.String(), t);
 	}
 
+	{
+		RestartDataSize();
+		Timer t((m_iterations*100)/amount + 1);
+		int32_t i;
+
+		t.Start();
+		for (int32_t i=0; i<t.N; i++) {
+			SValueBuilder builder;
+			for (size_t j=0; j<amount; j++) {
+				builder.AddItem(m_values[j%MAX_DATA], m_values[j%MAX_DATA]);
+			}
+			SValue data(builder.Build());
+		}
+		t.Stop();
+
+		SString str;
+		str << "SValueBuilder Build " << amount << " Str";
+		WriteResult(TextOutput(), str.String(), t);
+	}
+
 	return SValue::Status(B_OK);
 }
 
@@ -3068,6 +3584,52 @@ SValue BinderPerformance::RunHandlerTest(int32_t num)
 	return SValue::Status(B_OK);
 }
 
+SValue BinderPerformance::RunManyHandlersTest(int32_t num)
+{
+	handler_test_state state;
+	state.iterations = num;
+	state.priority = m_priority;
+	state.dataSize = 0;
+	state.current = 0;
+	state.finished.Close();
+
+	sptr<DelayedHandlerTest>* handlers = new sptr<DelayedHandlerTest>[num];
+	int32_t i;
+	for (i=0; i<num; i++) handlers[i] = new DelayedHandlerTest(&state);
+
+	SMessage msg(kTestHandler);
+	msg.SetPriority(m_priority);
+
+	// Spread the messages over 10ms, so most of them are already due
+	// by the time they have all been posted and the dispatch time is
+	// dominated by popping handlers off the pending queue.
+	uint32_t seed = 1;
+	Timer schedule(num, kRandomLoop);
+	schedule.Start();
+	for (i=0; i<num; i++) {
+		int32_t delay = myrand(&seed);
+		if (delay < 0) delay = -delay;
+		delay %= 10000;
+		handlers[i]->PostDelayedMessage(msg, B_MICROSECONDS(delay));
+	}
+	schedule.Stop();
+
+	Timer dispatch(num);
+	dispatch.Start();
+	state.finished.Wait();
+	dispatch.Stop();
+
+	SString scheduleStr, dispatchStr;
+	scheduleStr << "Schedule " << num << " Handlers";
+	dispatchStr << "Dispatch " << num << " Handlers";
+	WriteResult(TextOutput(), scheduleStr.String(), schedule);
+	WriteResult(TextOutput(), dispatchStr.String(), dispatch);
+
+	delete[] handlers;
+
+	return SValue::Status(B_OK);
+}
+
 B_STATIC_STRING_VALUE_40(kTransactionTestName, "org.openbinder.tools.commands.BPerf.TransactionTest", );
 
 SValue BinderPerformance::RunInstantiateTest(bool remote)
@@ -3111,6 +3673,9 @@ SValue BinderPerformance::RunTransactionTest(bool remote, size_t sizeFactor)
 		str << "xSize ";
 	}
 	str << "Transaction";
+#if TARGET_HOST == TARGET_HOST_LINUX
+	if (remote) str << " (" << SLooper::TransportName() << ")";
+#endif
 	
 	sptr<IProcess> proc;
 	SValue componentArgs(key_validate, SValue::Bool(m_validating));
@@ -3187,6 +3752,124 @@ SValue BinderPerformance::RunTransactionTest(bool remote, size_t sizeFactor)
 	return result;
 }
 
+SValue BinderPerformance::RunLargeValueTransactionTest(size_t size, bool gather)
+{
+	SValue result(SValue::Status(B_OK));
+	
+	SString str("Remote ");
+	str << (size/1024) << "K Value Transaction";
+	str << (gather ? " (gathered" : " (copied");
+#if TARGET_HOST == TARGET_HOST_LINUX
+	str << ", " << SLooper::TransportName();
+#endif
+	str << ")";
+	
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << str << ": <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+	
+	sptr<IBinder> target = Context().RemoteNew(kTransactionTestName, proc, SValue::Undefined());
+	if (target == NULL) {
+		TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.TransactionTest!" << endl;
+		return SValue::Status(B_ENTRY_NOT_FOUND);
+	}
+	
+	void* payload = malloc(size);
+	if (payload == NULL) return SValue::Status(B_NO_MEMORY);
+	memset(payload, 0xff, size);
+	const SValue value(B_RAW_TYPE, payload, size);
+	free(payload);
+	
+	// Gathered sends write the value by reference; copied sends put
+	// the same bytes into the parcel's own buffer.
+	Timer t(m_iterations/10 > 0 ? m_iterations/10 : 1);
+	SParcel send;
+	SParcel *reply = SParcel::GetParcel();
+	t.Start();
+	for (int32_t i=0; i<t.N; i++) {
+		send.Reset();
+		if (gather) value.Archive(send);
+		else send.WriteLargeData(B_PACK_LARGE_TYPE(B_RAW_TYPE), size, value.Data());
+		target->Transact(kSinkTransaction, send, reply);
+		if (m_validating && reply->ReadInt32() != send.Length()) {
+			result = SValue::Status(B_BAD_DATA);
+			break;
+		}
+	}
+	t.Stop();
+	SParcel::PutParcel(reply);
+	
+	if (result.AsStatus() == B_OK)
+		WriteResult(TextOutput(), str.String(), t);
+	else
+		TextOutput() << str << ": FAILED" << endl;
+	
+	return result;
+}
+
+#if TARGET_HOST == TARGET_HOST_LINUX
+SValue BinderPerformance::RunSharedTransactionTest(size_t size, bool shared)
+{
+	SValue result(SValue::Status(B_OK));
+	
+	SString str("Remote ");
+	if (size >= 1024*1024) str << (size/(1024*1024)) << "M";
+	else str << (size/1024) << "K";
+	str << " Transaction (" << (shared ? "shared memory, " : "inline, ")
+		<< SLooper::TransportName() << ")";
+	
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << str << ": <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+	
+	sptr<IBinder> target = Context().RemoteNew(kTransactionTestName, proc, SValue::Undefined());
+	if (target == NULL) {
+		TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.TransactionTest!" << endl;
+		return SValue::Status(B_ENTRY_NOT_FOUND);
+	}
+	
+	SParcel send;
+	void* data = send.Alloc(size);
+	if (data == NULL) {
+		TextError() << "Unable to create payload in send parcel!" << endl;
+		return SValue::Status(B_NO_MEMORY);
+	}
+	memset(data, 0xff, size);
+	
+	const ssize_t oldThreshold = SLooper::SharedTransactionThreshold();
+	SLooper::SetSharedTransactionThreshold(shared ? 1 : 0);
+	
+	int32_t iterations = m_iterations / (int32_t)(size/(4*1024));
+	if (iterations < 4) iterations = 4;
+	Timer t(iterations);
+	SParcel *reply = SParcel::GetParcel();
+	t.Start();
+	for (int32_t i=0; i<t.N; i++) {
+		status_t err = target->Transact(kSinkTransaction, send, reply);
+		if (err == B_OK && m_validating && reply->ReadInt32() != (int32_t)size) err = B_BAD_DATA;
+		if (err != B_OK) {
+			result = SValue::Status(err);
+			break;
+		}
+	}
+	t.Stop();
+	SParcel::PutParcel(reply);
+	
+	SLooper::SetSharedTransactionThreshold(oldThreshold);
+	
+	if (result.AsStatus() == B_OK)
+		WriteResult(TextOutput(), str.String(), t);
+	else
+		TextOutput() << str << ": FAILED" << endl;
+	
+	return result;
+}
+#endif
+
 SValue BinderPerformance::RunPingPongTransactionTest()
 {
 	SValue result(SValue::Status(B_OK));
@@ -3209,6 +3892,11 @@ SValue BinderPerformance::RunPingPongTransactionTest()
 		return SValue::Status(B_ENTRY_NOT_FOUND);
 	}
 
+	SString str("Ping-Pong Transaction");
+#if TARGET_HOST == TARGET_HOST_LINUX
+	str << " (" << SLooper::TransportName() << ")";
+#endif
+
 	sptr<TransactionTest> server = new TransactionTest(Context(), m_validating, true);
 
 	SParcel *send = SParcel::GetParcel();
@@ -3231,9 +3919,9 @@ SValue BinderPerformance::RunPingPongTransactionTest()
 	SParcel::PutParcel(reply);
 
 	if (result.AsStatus() == B_OK)
-		WriteResult(TextOutput(), "Ping-Pong Transaction", t);
+		WriteResult(TextOutput(), str.String(), t);
 	else
-		TextOutput() << "Ping-Pong Transaction: FAILED (Pong reply did not contain our Binder)" << endl;
+		TextOutput() << str << ": FAILED (Pong reply did not contain our Binder)" << endl;
 
 	SParcel::PutParcel(send);
 	return result;
@@ -3458,6 +4146,16 @@ BinderPerformance::RunEffectIPCTest(bool remote)
 	text += "EffectIPC complex args, no return";
 	WriteResult(TextOutput(), text.String(), timer);
 
+	sptr<IProcess> t2;
+	timer.Start();
+	for (int32_t i=0; i<timer.N; i++) {
+		t2 = IProcess::AsInterface(bt);
+	}
+	timer.Stop();
+	text = prefix;
+	text += "EffectIPC AsInterface";
+	WriteResult(TextOutput(), text.String(), timer);
+
 	
 #if TEST_PALMOS_APIS
 
@@ -3505,6 +4203,284 @@ BinderPerformance::RunEffectIPCTest(bool remote)
 	return SValue::Status(B_OK);
 }
 
+SValue
+BinderPerformance::RunAutobinderTest()
+{
+	SContext context = Context();
+
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << "Remote Autobinder: <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+
+	// Each mode gets its own proxy, so a target that turned down method
+	// IDs for one can't skew the other.
+	const bool oldById = autobinder_invoke_by_id();
+	for (int32_t byId=1; byId>=0; byId--) {
+		set_autobinder_invoke_by_id(byId != 0);
+
+		sptr<IProcess> t = IProcess::AsInterface(
+			context.RemoteNew(SValue::String("org.openbinder.tools.commands.BPerf.ImplementsIProcess"), proc));
+		if (t == NULL) {
+			set_autobinder_invoke_by_id(oldById);
+			TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.ImplementsIProcess!" << endl;
+			return SValue::Status(B_ERROR);
+		}
+
+		const char* suffix = byId ? " (by ID)" : " (by name)";
+		SString text;
+		Timer timer(m_iterations);
+
+		timer.Start();
+		for (int32_t i=0; i<timer.N; i++) {
+			t->RestartMallocProfiling();
+		}
+		timer.Stop();
+		text = "Remote Autobinder 0 args, no return";
+		text += suffix;
+		WriteResult(TextOutput(), text.String(), timer);
+
+		timer.Start();
+		for (int32_t i=0; i<timer.N; i++) {
+			t->AtomMarkLeakReport();
+		}
+		timer.Stop();
+		text = "Remote Autobinder 0 args, int32 return";
+		text += suffix;
+		WriteResult(TextOutput(), text.String(), timer);
+
+		timer.Start();
+		for (int32_t i=0; i<timer.N; i++) {
+			t->AtomLeakReport(1,2,3);
+		}
+		timer.Stop();
+		text = "Remote Autobinder 3 int args, no return";
+		text += suffix;
+		WriteResult(TextOutput(), text.String(), timer);
+	}
+	set_autobinder_invoke_by_id(oldById);
+
+	return SValue::Status(B_OK);
+}
+
+
+SValue
+BinderPerformance::RunOneWayTest()
+{
+	SContext context = Context();
+
+	SString suffix;
+#if TARGET_HOST == TARGET_HOST_LINUX
+	suffix << " (" << SLooper::TransportName() << ")";
+#endif
+
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << "Remote Autobinder oneway: <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+
+	sptr<IProcess> t = IProcess::AsInterface(
+		context.RemoteNew(SValue::String("org.openbinder.tools.commands.BPerf.ImplementsIProcess"), proc));
+	if (t == NULL) {
+		TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.ImplementsIProcess!" << endl;
+		return SValue::Status(B_ERROR);
+	}
+	sptr<INodeObserver> o = INodeObserver::AsInterface(
+		context.RemoteNew(SValue::String("org.openbinder.tools.commands.BPerf.ImplementsINodeObserver"), proc));
+	if (o == NULL) {
+		TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.ImplementsINodeObserver!" << endl;
+		return SValue::Status(B_ERROR);
+	}
+
+	SString text;
+	Timer timer(m_iterations);
+
+	timer.Start();
+	for (int32_t i=0; i<timer.N; i++) {
+		t->AtomLeakReport(1,2,3);
+	}
+	timer.Stop();
+	text = "Remote Autobinder 3 args, synchronous";
+	text += suffix;
+	WriteResult(TextOutput(), text.String(), timer);
+
+	// The first call finds out whether the target takes oneway calls;
+	// keep it out of the timing.
+	const SValue hints(SValue::Int32(3));
+	o->NodeChanged(NULL, 2, hints);
+
+	// This is the sender's side only; the target runs the calls after
+	// they have been counted.
+	timer.Start();
+	for (int32_t i=0; i<timer.N; i++) {
+		o->NodeChanged(NULL, 2, hints);
+	}
+	timer.Stop();
+	text = "Remote Autobinder 3 args, oneway";
+	text += suffix;
+	WriteResult(TextOutput(), text.String(), timer);
+
+	return SValue::Status(B_OK);
+}
+
+SValue
+BinderPerformance::RunAsyncFanOutTest()
+{
+	SContext context = Context();
+
+	// Four targets unless --concurrency says otherwise.
+	const int32_t count = m_concurrencySpecified && m_concurrency > 0 ? m_concurrency : 4;
+
+	SString suffix(" (");
+	suffix << count << " targets, " << SAsyncTransaction::MaxInFlight() << " in flight)";
+
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << "Remote async fan-out: <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+
+	SVector<sptr<IProcess> > targets;
+	for (int32_t i=0; i<count; i++) {
+		sptr<IProcess> t = IProcess::AsInterface(
+			context.RemoteNew(SValue::String("org.openbinder.tools.commands.BPerf.ImplementsIProcess"), proc));
+		if (t == NULL) {
+			TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.ImplementsIProcess!" << endl;
+			return SValue::Status(B_ERROR);
+		}
+		targets.AddItem(t);
+	}
+
+	SString text;
+	Timer timer(m_iterations);
+
+	timer.Start();
+	for (int32_t i=0; i<timer.N; i++) {
+		for (int32_t j=0; j<count; j++) {
+			targets[j]->AtomLeakReport(1,2,3);
+		}
+	}
+	timer.Stop();
+	text = "Remote fan-out, one after another";
+	text += suffix;
+	WriteResult(TextOutput(), text.String(), timer);
+
+	SVector<sptr<SAsyncTransaction> > txns;
+	txns.SetSize(count);
+	timer.Start();
+	for (int32_t i=0; i<timer.N; i++) {
+		for (int32_t j=0; j<count; j++) {
+			txns.EditItemAt(j) = targets[j]->AtomLeakReportAsync(1,2,3);
+		}
+		for (int32_t j=0; j<count; j++) {
+			txns[j]->Wait();
+		}
+	}
+	timer.Stop();
+	text = "Remote fan-out, SAsyncTransaction";
+	text += suffix;
+	WriteResult(TextOutput(), text.String(), timer);
+
+	return SValue::Status(B_OK);
+}
+
+// A settings record: short string keys with small integers, flags and
+// short strings.
+static SValue make_settings_value()
+{
+	SValue value;
+	for (int32_t i=0; i<32; i++) {
+		SString key("setting_");
+		key << i;
+		SString str("value_");
+		str << i;
+		switch (i%3) {
+			case 0:		value.JoinItem(SValue::String(key), SValue::Int32(i*7));		break;
+			case 1:		value.JoinItem(SValue::String(key), SValue::Bool((i&2) != 0));	break;
+			default:	value.JoinItem(SValue::String(key), SValue::String(str));		break;
+		}
+	}
+	return value;
+}
+
+// A page of catalog entries, keyed by ID, each a small record.
+static SValue make_catalog_value()
+{
+	SValue value;
+	for (int32_t i=0; i<40; i++) {
+		SString name("Catalog item number ");
+		name << i;
+		SValue item;
+		item.JoinItem(SValue::String("name"), SValue::String(name));
+		item.JoinItem(SValue::String("category"), SValue::String((i&1) ? "books" : "music"));
+		item.JoinItem(SValue::String("price"), SValue::Int32(999 + i*100));
+		item.JoinItem(SValue::String("stock"), SValue::Int32(i%7));
+		item.JoinItem(SValue::String("available"), SValue::Bool((i%7) != 0));
+		value.JoinItem(SValue::Int32(10000+i), item);
+	}
+	return value;
+}
+
+SValue
+BinderPerformance::RunCompactEffectTest(bool catalog, bool compact)
+{
+	SValue result(SValue::Status(B_OK));
+
+	const SValue value(catalog ? make_catalog_value() : make_settings_value());
+
+	// The size of the request; the reply echoes it back.
+	SParcel sizer;
+	sizer.SetCompactValues(compact);
+	sizer.SetValues(&value, NULL);
+
+	SString str("Remote ");
+	str << (catalog ? "catalog" : "settings") << " Effect ("
+		<< (compact ? "compact, " : "standard, ") << sizer.Length() << " bytes";
+#if TARGET_HOST == TARGET_HOST_LINUX
+	str << ", " << SLooper::TransportName();
+#endif
+	str << ")";
+
+	sptr<IProcess> proc = BackgroundProcess();
+	if (proc == NULL) {
+		TextOutput() << str << ": <processes disabled>" << endl;
+		return SValue::Undefined();
+	}
+
+	sptr<IBinder> target = Context().RemoteNew(kTransactionTestName, proc, SValue::Undefined());
+	if (target == NULL) {
+		TextError() << "Unable to instantiate org.openbinder.tools.commands.BPerf.TransactionTest!" << endl;
+		return SValue::Status(B_ENTRY_NOT_FOUND);
+	}
+
+	const bool oldCompact = SParcel::CompactEffects();
+	SParcel::SetCompactEffects(compact);
+
+	Timer t(m_iterations);
+	SValue out;
+	t.Start();
+	for (int32_t i=0; i<t.N; i++) {
+		status_t err = target->Effect(value, B_WILD_VALUE, B_UNDEFINED_VALUE, &out);
+		if (err == B_OK && m_validating && out != value) err = B_BAD_DATA;
+		if (err != B_OK) {
+			result = SValue::Status(err);
+			break;
+		}
+	}
+	t.Stop();
+
+	SParcel::SetCompactEffects(oldCompact);
+
+	if (result.AsStatus() == B_OK)
+		WriteResult(TextOutput(), str.String(), t);
+	else
+		TextOutput() << str << ": FAILED" << endl;
+
+	return result;
+}
+
 
 class WeakTestBinder : public BBinder, public SPackageSptr
 {
@@ -4373,6 +5349,10 @@ sptr<IBinder> InstantiateComponent(const SString& component, const SContext& con
 	{
 		obj = new B_NO_THROW RemoteObjectProcess();
 	}
+	else if (component == "ImplementsINodeObserver")
+	{
+		obj = new B_NO_THROW RemoteObjectNodeObserver();
+	}
 #if TEST_PALMOS_APIS
 	else if (component == "ImplementsIView")
 	{
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include <app/BCommand.h>
+#include <support/Package.h>
+#include <support/InstantiateComponent.h>
+#include <support/INode.h>
+#include <support/IProcess.h>
+#include <support/Iterator.h>
+#include <support/Locker.h>
+#include <support/Vector.h>
+
+#include <support/StdIO.h>
+
+class LockProfCommand : public BCommand, public SPackageSptr
+{
+public:
+	LockProfCommand(const SContext& context);
+
+	virtual SValue Run(const ArgList& args);
+	virtual SString Documentation() const;
+
+private:
+	SValue Report(const sptr<INode>& profile, int32_t maxLocks);
+	SValue List();
+};
+
+
+LockProfCommand::LockProfCommand(const SContext& context)
+	: BCommand(context)
+{
+}
+
+SValue LockProfCommand::Run(const ArgList& args)
+{
+	SString one;
+	sptr<IProcess> team;
+	int32_t period;
+	int32_t depth;
+	status_t error;
+
+	const SValue arg(args.CountItems() > 1 ? args[1] : B_UNDEFINED_VALUE);
+	const SValue arg2(args.CountItems() > 2 ? args[2] : B_UNDEFINED_VALUE);
+	const SValue arg3(args.CountItems() > 3 ? args[3] : B_UNDEFINED_VALUE);
+	const SValue arg4(args.CountItems() > 4 ? args[4] : B_UNDEFINED_VALUE);
+	one = arg.AsString();
+
+	// The profiles are published in the catalog, so reports are
+	// read from there rather than from the process.
+	if (one == "report")
+	{
+		if (!arg2.IsDefined()) return List();
+
+		SString path(arg2.AsString());
+		if (arg2.AsInt32(&error) > 0 && error == B_OK) {
+			path = B_LOCK_PROFILE_PATH;
+			path.PathAppend(arg2.AsString());
+		}
+		sptr<INode> profile = interface_cast<INode>(ArgToBinder(SValue::String(path)));
+		if (profile == NULL) {
+			TextError() << "lockprof: no lock profile at " << path << endl;
+			return SValue::Status(B_NAME_NOT_FOUND);
+		}
+
+		period = arg3.AsInt32(&error);
+		if (error != B_OK) period = 20;
+
+		return Report(profile, period);
+	}
+
+	team = IProcess::AsInterface(ArgToBinder(arg2));
+	if (team == NULL) {
+		if (arg2.IsDefined())
+			TextError() << "lockprof: " << arg2 << " is not a process" << endl;
+		else
+			TextError() << "lockprof: no process supplied" << endl;
+		goto ERROR;
+	}
+
+	if (one == "start")
+	{
+		period = arg3.AsInt32(&error);
+		if (error != B_OK || period <= 0) period = 100;
+		depth = arg4.AsInt32(&error);
+		if (error != B_OK) depth = 8;
+
+		team->SetLockProfiling(period, depth);
+	}
+	else if (one == "stop")
+	{
+		team->SetLockProfiling(0, 0);
+	}
+	else if (one == "reset")
+	{
+		team->RestartLockProfiling();
+	}
+	else
+	{
+ERROR:
+		TextError() << Documentation() << endl;
+		return SValue::Status(B_BAD_VALUE);
+	}
+
+	return SValue::Int32(B_OK);
+}
+
+SValue LockProfCommand::List()
+{
+	sptr<ITextOutput> out = TextOutput();
+
+	SIterator it(Context(), SString(B_LOCK_PROFILE_PATH));
+	SValue result;
+	SValue key, value;
+	while (it.Next(&key, &value) == B_OK) {
+		out << B_LOCK_PROFILE_PATH "/" << key.AsString() << endl;
+		result.JoinItem(key, value);
+	}
+	return result;
+}
+
+SValue LockProfCommand::Report(const sptr<INode>& profile, int32_t maxLocks)
+{
+	sptr<ITextOutput> out = TextOutput();
+
+	SIterator it(profile);
+	if (it.ErrorCheck() != B_OK) {
+		TextError() << "lockprof: can't read the lock profile" << endl;
+		return SValue::Status(it.ErrorCheck());
+	}
+
+	// Collect every lock, worst total wait first.
+	SVector<SValue> names;
+	SVector<SValue> stats;
+	SValue key, value;
+	while (it.Next(&key, &value, INode::REQUEST_DATA|INode::COLLAPSE_NODE) == B_OK) {
+		const nsecs_t wait = value["wait_time"].AsTime();
+		size_t i = 0;
+		while (i < stats.CountItems() && stats[i]["wait_time"].AsTime() >= wait) i++;
+		names.AddItemAt(key, i);
+		stats.AddItemAt(value, i);
+	}
+
+	SValue result;
+	const size_t N = stats.CountItems();
+	for (size_t i=0; i<N && (maxLocks <= 0 || i < (size_t)maxLocks); i++) {
+		const SValue& s = stats[i];
+		out << names[i].AsString() << ":" << indent << endl
+			<< "acquired " << s["acquisitions"].AsInt64()
+			<< ", contended " << s["contentions"].AsInt64() << endl
+			<< "wait " << (s["wait_time"].AsTime()/1000) << "us"
+			<< " (max " << (s["max_wait_time"].AsTime()/1000) << "us)" << endl
+			<< "held " << (s["hold_time"].AsTime()/1000) << "us"
+			<< " (max " << (s["max_hold_time"].AsTime()/1000) << "us)" << endl;
+
+		const SValue callers(s["callers"]);
+		for (int32_t j=0; callers[SValue::Int32(j)].IsDefined(); j++) {
+			const SValue caller(callers[SValue::Int32(j)]);
+			out << "waited " << caller["count"].AsInt32() << " times from:" << indent << endl
+				<< caller["stack"].AsString() << dedent;
+		}
+		if (callers["other"].IsDefined()) {
+			out << "waited " << callers["other"].AsInt32() << " times from other callers" << endl;
+		}
+		out << dedent;
+
+		result.JoinItem(names[i], s);
+	}
+
+	return result;
+}
+
+SString LockProfCommand::Documentation() const
+{
+	return SString(
+		"usage:\n"
+		"   lockprof start PROCESS [PERIOD] [DEPTH]\n"
+		"       Sample one in every PERIOD (default 100)\n"
+		"       acquisitions of the named locks in PROCESS,\n"
+		"       keeping call stacks DEPTH (default 8) deep,\n"
+		"       and publish its profile at\n"
+		"       " B_LOCK_PROFILE_PATH "/<process id>\n"
+		"\n"
+		"   lockprof stop PROCESS\n"
+		"       Stop sampling; collected data is kept\n"
+		"\n"
+		"   lockprof reset PROCESS\n"
+		"       Clear the data collected so far\n"
+		"\n"
+		"   lockprof report [PROFILE] [COUNT]\n"
+		"       Show the COUNT (default 20) locks with the\n"
+		"       most total wait time in PROFILE (a process id\n"
+		"       or the path of a published profile), and\n"
+		"       where they were waited for.  Without a\n"
+		"       PROFILE, list the published profiles\n"
+		"\n"
+		"Profiling can also be started at launch by setting\n"
+		"the LOCK_PROFILE environment variable to the sample\n"
+		"period; the profile is published by the first\n"
+		"lockprof start.  Only locks constructed with a name\n"
+		"are profiled, in builds with SUPPORTS_LOCK_PROFILE."
+	);
+}
+
+sptr<IBinder> InstantiateComponent(const SString& component, const SContext& context, const SValue &/*args*/)
+{
+	if (component == "")
+	{
+		return new LockProfCommand(context);
+	}
+
+	return NULL;
+}
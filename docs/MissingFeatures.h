@@ -86,4 +86,28 @@ and not the interface because of the scripting nature of the binder
 protocol), and then with little work pidgen can use all of the information
 it is already generating to implement it.
 
+@section LocalAsInterfaceInspects Local AsInterface() Always Inspects
+@todo Let IInterface::AsInterface() skip Inspect() for local objects that don't filter it.
+
+Calls through a pidgen interface on an object in the same process do not
+marshal anything: AsInterface() returns the BnXxx object itself (through
+InterfaceFor()), and its methods are plain virtual calls.  Only remote
+objects get a proxy that goes through Effect() and parcels.  bperf's
+"Local EffectIPC" results (--test-local-effect) time exactly these calls,
+so a separate typed dispatch for local targets would not change them.
+
+What local callers do still pay for is AsInterface() itself, which calls
+Inspect() and so builds an SValue for the interface descriptor
+("Local EffectIPC AsInterface" in the same test).  This can't simply be
+skipped, because a number of local classes use Inspect() to hide
+interfaces they only sometimes implement: BCatalogDelegate and its
+iterator, BStreamDatum::Stream, BIOSStream, BCatalogMirror and the schema
+nodes.  Skipping it gives local callers interfaces that remote callers
+are refused, with NULL bases behind them.
+
+Doing this safely needs pidgen to know which classes leave Inspect()
+alone (for example by generating the flag in the BnXxx class, and
+clearing it in any class that overrides Inspect()), so that a class
+added later can't get it wrong by omission.
+
 */
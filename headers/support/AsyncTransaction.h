@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef	_SUPPORT_ASYNCTRANSACTION_H
+#define	_SUPPORT_ASYNCTRANSACTION_H
+
+/*!	@file support/AsyncTransaction.h
+	@ingroup CoreSupportBinder
+	@brief Binder transactions that don't block their caller.
+*/
+
+#include <support/Handler.h>
+#include <support/IBinder.h>
+#include <support/Parcel.h>
+#include <support/ConditionVariable.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+/*!	@addtogroup CoreSupportBinder
+	@{
+*/
+
+struct BAutobinderDef;
+
+/*-------------------------------------------------------------*/
+/*----- SAsyncTransaction class -------------------------------*/
+
+//!	An IBinder::Transact() that runs without blocking its caller.
+/*!	Start() hands the transaction to a looper thread and returns
+	immediately.  The caller can then poll IsDone(), block in Wait()
+	for the result, or derive from this class and override Completed()
+	to be called on the looper thread when the reply arrives.
+
+	Any number of transactions may be started at once, from any thread,
+	so a request can be sent to many targets in parallel rather than one
+	round trip after another.  The driver returns a reply to the thread
+	that sent the request, so each transaction occupies a looper thread
+	while it is in flight.  To leave threads for incoming calls, at most
+	MaxInFlight() transactions in the process are in flight at a time;
+	the rest wait, in the order they were started, for one of those to
+	finish.
+
+	pidgen generates an asynchronous version of each interface method
+	that only takes input parameters, named with an "Async" suffix,
+	which starts one of these with StartAutobinder().  (If the interface
+	is built without USE_AUTOBINDER, these fail with B_UNSUPPORTED.)
+
+	@nosubgrouping
+*/
+class SAsyncTransaction : public SHandler
+{
+public:
+							SAsyncTransaction();
+
+			//!	Most transactions in this process that run at once.
+			/*!	By default this is the number of looper threads the process
+				may have beyond the ones it keeps for incoming calls
+				(BProcess::MaximumLoopers() - BProcess::MinimumLoopers()),
+				and at least 1. */
+	static	int32_t			MaxInFlight();
+			//!	Change MaxInFlight(); 0 or less goes back to the default.
+			/*!	Transactions already in flight are not affected. */
+	static	void			SetMaxInFlight(int32_t count);
+
+			//!	Start target->Transact(code, data, reply, flags) on a looper thread.
+			/*!	The contents of @a data are taken by the transaction.
+				If the transaction can't be started it is completed right
+				away with the error, which is also returned here. */
+			status_t		Start(	const sptr<IBinder>& target, uint32_t code,
+									SParcel& data, uint32_t flags = 0);
+
+			//!	Start an IBinder::AutobinderInvoke() of @a def with @a params.
+			/*!	Only input parameters are allowed.  Used by the asynchronous
+				methods pidgen generates. */
+			status_t		StartAutobinder(const sptr<IBinder>& target,
+											const BAutobinderDef* def, void** params);
+
+			//!	Complete with @a error, without sending anything.
+			/*!	Use instead of Start().  Returns Result(). */
+			status_t		Fail(status_t error);
+
+			//!	Has the reply arrived?
+			bool			IsDone() const;
+			//!	Block until the reply arrives, and return Result().
+			/*!	Don't call this from Completed(), or from a looper thread
+				that other transactions may be waiting for. */
+			status_t		Wait();
+			//!	The result of the transaction, or B_WOULD_BLOCK until it is done.
+			status_t		Result() const;
+			//!	The reply, once the transaction is done.
+			SParcel&		Reply();
+
+			//!	Read the return value of a StartAutobinder() call out of the reply.
+			/*!	Waits for the transaction first.  @a result follows the same
+				conventions as for IBinder::AutobinderInvoke(). */
+			status_t		AutobinderResult(void* result);
+
+protected:
+	virtual					~SAsyncTransaction();
+
+			//!	Called on the looper thread once the reply has arrived.
+			/*!	The default implementation does nothing. */
+	virtual	void			Completed(status_t result, SParcel& reply);
+
+	virtual	status_t		HandleMessage(const SMessage& msg);
+
+private:
+							SAsyncTransaction(const SAsyncTransaction&);
+			SAsyncTransaction& operator=(const SAsyncTransaction&);
+
+			status_t		post(status_t err);
+	static	void			start_next();
+			void			finish(status_t result);
+
+			sptr<SAsyncTransaction>	m_self;		// held while in flight
+			sptr<IBinder>			m_target;
+			uint32_t				m_code;
+			uint32_t				m_flags;
+			SParcel					m_data;
+			SParcel					m_reply;
+			const BAutobinderDef*	m_def;
+			volatile int32_t		m_result;
+			SConditionVariable		m_done;
+};
+
+//!	Start an asynchronous transaction; see SAsyncTransaction.
+sptr<SAsyncTransaction>	TransactAsync(	const sptr<IBinder>& target, uint32_t code,
+										SParcel& data, uint32_t flags = 0);
+
+/*!	@} */
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
+
+#endif	/* _SUPPORT_ASYNCTRANSACTION_H */
@@ -55,6 +55,15 @@ enum {
 	B_OUT_PARAM		= 0x00000002
 };
 
+//!	Flags for BAutobinderDef::flags.
+enum {
+	//!	The method is declared [oneway]: a remote call doesn't wait for
+	//!	it to run.  The first call to a target waits for it to queue the
+	//!	call; after that they are sent with B_TRANSACT_ONE_WAY and don't
+	//!	wait at all, where the IPC transport supports it.
+	B_AUTOBINDER_ONE_WAY	= 0x00000001
+};
+
 struct BAutobinderDef;
 struct BEffectMethodDef;
 struct PTypeMarshaller;
@@ -86,6 +95,15 @@ status_t	execute_autobinder(uint32_t code, const sptr<IInterface>& target,
 								const BAutobinderDef **defs, size_t def_count,
 								uint32_t flags);
 
+//!	Whether remote AutobinderInvoke() calls are sent by method ID.
+/*!	When enabled (the default), a proxy sends a pidgen method's index and
+	BAutobinderDef::methodID instead of its name, and falls back to the name
+	if the target doesn't understand B_INVOKE_ID_TRANSACTION.  The initial
+	setting comes from the AUTOBINDER_INVOKE_BY_ID environment variable;
+	changing it is mostly useful for comparing the two in benchmarks. */
+bool		autobinder_invoke_by_id();
+void		set_autobinder_invoke_by_id(bool enabled);
+
 status_t	parameter_from_value(type_code type, const struct PTypeMarshaller* marshaller, const SValue &v, void *result);
 status_t	parameter_to_value(type_code type, const struct PTypeMarshaller* marshaller, const void *value, SValue *out);
 
@@ -234,6 +252,8 @@ struct BAutobinderDef
 	const BEffectMethodDef	* get;
 	const BEffectMethodDef	* invoke;
 	int32_t					classOffset;	// B_FIND_CLASS_OFFSET(LSuck, ISuck)
+	uint32_t				methodID;		// hash of interface and method name, 0 if none
+	uint32_t				flags;			// B_AUTOBINDER_ONE_WAY
 	
 	const SValue&		key() const;
 };
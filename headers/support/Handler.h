@@ -320,8 +320,15 @@ private:
 			SMessageList	m_msgQueue;
 			uint32_t		m_state;
 			
-			SHandler *		m_next;
-			SHandler *		m_prev;
+			// Position in BProcess's pending handler heap, or -1 if
+			// not scheduled, and the key it is ordered on there.
+			int32_t			m_pendingIndex;
+			uint32_t		m_pendingSeq;
+			nsecs_t			m_pendingTime;
+			// Run queue this handler is ready on, or -1, and its links there.
+			int32_t			m_runQueue;
+			SHandler *		m_runNext;
+			SHandler *		m_runPrev;
 
 			SLocker*		m_externalLock;
 };
@@ -64,7 +64,19 @@ enum {
 
 	B_PUT_TRANSACTION		= '_put',		//!< IBinder::AutobinderPut()
 	B_GET_TRANSACTION		= '_get',		//!< IBinder::AutobinderGet()
-	B_INVOKE_TRANSACTION	= 'invk'		//!< IBinder::AutobinderInvoke()
+	B_INVOKE_TRANSACTION	= 'invk',		//!< IBinder::AutobinderInvoke()
+	B_INVOKE_ID_TRANSACTION	= 'invi',		//!< IBinder::AutobinderInvoke(), by method ID
+	B_EFFECT_COMPACT_TRANSACTION = 'efcc',	//!< IBinder::Effect(), values in the compact encoding
+	B_INVOKE_ONEWAY_TRANSACTION = 'invw'	//!< IBinder::AutobinderInvoke() of a oneway method
+};
+
+//!	Flags for IBinder::Transact().
+enum {
+	//!	Don't wait for the target to handle the transaction; there is no reply.
+	/*!	Only honored when no reply parcel is given, by a remote binder whose
+		IPC transport supports it.  Otherwise the call waits for the target
+		to handle it as usual. */
+	B_TRANSACT_ONE_WAY		= 0x00000001
 };
 
 //!	Options for Binder links.
@@ -189,7 +201,7 @@ public:
 				value, though some standard codes are defined for parts of the
 				higher-level IBinder protocol (B_EFFECT_TRANSACTION, B_INSPECT_TRANSACTION,
 				etc).  The flags are used for internal IPC implementation and must always
-				be set to 0 when calling.  If your implementation of Transact() returns
+				be set to 0 when calling, except for B_TRANSACT_ONE_WAY.  If your implementation of Transact() returns
 				an error code (instead of B_OK), that code will be propagated back
 				to the caller WITHOUT any @a reply data. */
 	virtual	status_t					Transact(	uint32_t code,
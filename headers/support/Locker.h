@@ -36,6 +36,10 @@ namespace support {
 
 class SConditionVariable;
 
+//!	Where each process's lock contention profile is published.
+/*!	See IProcess::SetLockProfiling(). */
+#define B_LOCK_PROFILE_PATH "/lock_profile"
+
 /*-------------------------------------------------------------*/
 
 //!	Lightweight mutex.
@@ -73,7 +77,16 @@ private:
 						SLocker(const SLocker&);
 		SLocker& 		operator = (const SLocker&);
 
+#if SUPPORTS_LOCK_PROFILE
+		void			_LockSampled(bool quick);
+static	void			_UnlockFunc(SLocker* l);
+#endif
+
 		volatile int32_t			m_lockValue;
+#if SUPPORTS_LOCK_PROFILE
+		const char*		m_name;
+		nsecs_t			m_heldSince;
+#endif
 };
 
 /*-------------------------------------------------------------*/
@@ -120,10 +133,15 @@ private:
 		SNestedLocker& 	operator = (const SNestedLocker&);
 
 static	void			_UnlockFunc(SNestedLocker* l);
+		void			_LockOuter();
 
 		volatile int32_t			m_lockValue;
 		int32_t			m_owner;
 		int32_t			m_ownerCount;
+#if SUPPORTS_LOCK_PROFILE
+		const char*		m_name;
+		nsecs_t			m_heldSince;
+#endif
 };
 
 //!	@note Do not use, may be broken.
@@ -131,6 +149,7 @@ class SReadWriteLocker
 {
 public:
 						SReadWriteLocker();
+						SReadWriteLocker(const char* name);
 						~SReadWriteLocker();
 
 		lock_status_t	ReadLock();
@@ -149,10 +168,77 @@ private:
 #if TARGET_HOST == TARGET_HOST_WIN32
 		SysHandle		m_sem;
 #else
+#if SUPPORTS_LOCK_PROFILE
+		void			_ReadLockSampled();
+		void			_WriteLockSampled();
+static	void			_WriteUnlockFunc(SReadWriteLocker* l);
+#endif
+
 		pthread_rwlock_t m_lock;
+#if SUPPORTS_LOCK_PROFILE
+		const char*		m_name;
+		nsecs_t			m_writeHeldSince;
+#endif
 #endif
 };
 
+//!	Read/write lock for data that is read much more often than written.
+/*!	Each reader only touches a counter in one of several cache-line
+	sized slots, chosen by its thread, so readers running on different
+	CPUs do not contend with each other.  A writer has to flag itself
+	and then wait for every slot to drain, which makes writing much
+	more expensive than with SReadWriteLocker.  Writers take priority
+	over new readers.
+
+	@note Read locks do not nest: a thread asking for a second read
+	lock while a writer is waiting will deadlock.
+*/
+class SReadMostlyLocker
+{
+public:
+						SReadMostlyLocker();
+						SReadMostlyLocker(const char* name);
+						~SReadMostlyLocker();
+
+		lock_status_t	ReadLock();
+		void			ReadLockQuick();
+		void			ReadUnlock();
+
+		lock_status_t	WriteLock();
+		void			WriteLockQuick();
+		void			WriteUnlock();
+
+		//!	Wait for every read lock held at the time of the call to be released.
+		/*!	Use this after unpublishing something readers may have seen,
+			before freeing it.  When no reader is active this only looks
+			at the reader slots; otherwise it does a WriteLock() and
+			WriteUnlock().  Readers that arrive later are not kept out. */
+		void			Synchronize();
+
+private:
+		// SReadMostlyLocker can't be copied
+						SReadMostlyLocker(const SReadMostlyLocker&);
+		SReadMostlyLocker&	operator = (const SReadMostlyLocker&);
+
+		enum { kReaderSlots = 16 };
+
+		// Padded out to a cache line.
+		struct reader_slot {
+			volatile int32_t	count;
+			int32_t				_reserved[15];
+		};
+
+		volatile int32_t*	_LockReadSlot();
+		void			_WaitForReaders();
+static	void			_ReadUnlockFunc(volatile int32_t* count);
+static	void			_WriteUnlockFunc(SReadMostlyLocker* l);
+
+		SLocker			m_writeLock;
+		volatile int32_t	m_writer;
+		int32_t			_reserved[15];
+		reader_slot		m_slots[kReaderSlots];
+};
+
 /*!	@} */
 
 /*-------------------------------------------------------------*/
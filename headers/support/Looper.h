@@ -152,6 +152,24 @@ class SLooper
 		
 		typedef bool (*ContextPermissionCheckFunc)(const SString& name, const sptr<IBinder>& caller, void* userData);
 		static	bool					BecomeContextManager(ContextPermissionCheckFunc checkFunc, void* userData);
+
+		//!	Returns the name of the IPC transport in use.
+		/*!	This is "kernel" for the binder driver, "broker" for the
+			user-space binder broker, or "none" when running single-process. */
+		static	const char*				TransportName();
+
+		//!	Transactions with at least this much data are sent through shared memory.
+		/*!	The data is copied into a shared memory segment that the receiver
+			maps read-only, and only the segment's descriptor goes through the
+			transport.  Parcels containing binders are always sent inline.
+			The segment can only be attached by the user that created it, so
+			only turn this on for processes that talk to processes of the
+			same user; a receiver running as another user fails the
+			transaction.  It is only used if the driver or broker passes
+			tfSharedMemory through.  The default comes from
+			BINDER_SHM_THRESHOLD, and is 0 (off). */
+		static	ssize_t					SharedTransactionThreshold();
+		static	void					SetSharedTransactionThreshold(ssize_t bytes);
 #endif
 #if TARGET_HOST == TARGET_HOST_WIN32 || TARGET_HOST == TARGET_HOST_LINUX
 				SLooper*				GetNext();
@@ -163,6 +181,7 @@ class SLooper
 	
 		friend	class BProcess;
 		friend	class BProcess::ComponentImage;
+		friend	void __initialize_looper();
 
 				// --------------------------------------------------------------------
 				// The following methods have generic implementations for all platforms
@@ -174,6 +193,8 @@ class SLooper
 		static	void					_DeleteSelf(void *blooper);
 		static	bool					_ResumingScheduling();
 		static	void					_ClearSchedulingResumed();
+		static	bool					_EnterBlocking();
+		static	void					_ExitBlocking();
 		static	int32_t					_ThreadEntry(void *info);
 		static	int32_t					_Loop(SLooper *parent);
 				void					_SetThreadPriority(int32_t priority);
@@ -194,6 +215,7 @@ class SLooper
 				status_t				m_lastError;
 				uint32_t				m_stackBottom;
 				SLooper*				m_nextRegistered;
+				int32_t					m_runQueue;		// BProcess run queue while dispatching, else -1
 
 				SSortedVector< wptr<BProcess::ComponentImage> >	m_dyingPackages;
 
@@ -291,20 +313,18 @@ class SLooper
 				status_t				_Reply(uint32_t flags, const SParcel& reply);
 				status_t				_TransactWithDriver(bool doRead = true);
 
+				int32_t					m_binderDesc;
 				SParcel					m_in;
 				SParcel					m_out;
 
 
 				bool					m_spawnedInternally : 1;
 				bool					m_rescheduling : 1;
-				pthread_cond_t			m_condition;
-				pthread_mutex_t			m_mutex;
 				nsecs_t					m_idleTime;
 				nsecs_t					m_lastTimeISlept;
 				SLocker					m_teamLock;
 				SLooper*				m_next;			// This pointer is owned by the team.
-				uint32_t				m_signaled;
-				SLocker					m_signalLock;
+				volatile int32_t		m_signaled;		// Futex word the idle looper parks on.
 
 #endif
 };
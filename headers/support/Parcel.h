@@ -37,6 +37,8 @@ BNS(namespace support {)
 */
 
 class IBinder;
+class SSharedBuffer;
+class SVectorIO;
 
 struct binder_ipc_info;
 struct flat_binder_object;
@@ -50,7 +52,12 @@ struct large_flat_header;
 class SParcel
 {
 	public:
-		static	SParcel*		GetParcel(void);
+		//!	Get a parcel from the calling thread's cache.
+		/*!	The parcel has room for at least \a sizeHint bytes without
+			reallocating.  Set PARCEL_CACHE=0 in the environment to always
+			allocate a new one. */
+		static	SParcel*		GetParcel(size_t sizeHint = 0);
+		//!	Return a parcel from GetParcel() to the calling thread's cache.
 		static	void			PutParcel(SParcel *);
 	
 		typedef	void			(*free_func)(	const void* data,
@@ -95,9 +102,27 @@ class SParcel
 				//!	Return the current operating status of the parcel.
 				status_t		ErrorCheck() const;
 				
-				//!	Will PutParcel() be able to return this parcel to the cache?
+				//!	Will PutParcel() be able to keep this parcel's buffer in the cache?
 				bool			IsCacheable() const;
 
+				//!	Archive values in the compact encoding.
+				/*!	SValue::Archive() and SValue::Unarchive() on this parcel use
+					variable-length integers and lengths with no padding, instead
+					of the standard flattened form.  Both sides must agree on it,
+					so it is only used for transactions that say so; see
+					B_EFFECT_COMPACT_TRANSACTION.  Only for parcels that hold
+					their data in memory.  This is kept across Reset() and
+					SetValues(). */
+				void			SetCompactValues(bool compact);
+				bool			IsCompactValues() const;
+
+				//!	Whether proxies offer compact values in Effect() calls.
+				/*!	The initial setting comes from the BINDER_COMPACT_VALUES
+					environment variable (on by default); a proxy stops offering
+					them to a target that doesn't understand them. */
+		static	bool			CompactEffects();
+		static	void			SetCompactEffects(bool enabled);
+
 				//!	Set the parcel to reference an external block of data.
 				void			Reference(	const void* data, ssize_t len,
 											free_func freeFunc = NULL,
@@ -146,6 +171,15 @@ class SParcel
 				void			SetPosition(off_t pos);
 				status_t		SetLength(ssize_t len);
 				
+				//!	Can data be changed after it has been written?
+				/*!	This is false for parcels that stream to an IByteOutput,
+					which may already have sent the data. */
+				bool			CanPatchData() const;
+				//!	Overwrite data that was previously written at Position() 'pos'.
+				/*!	Use this to fill in a header whose contents are only
+					known after writing what follows it. */
+				status_t		PatchData(off_t pos, const void* data, size_t len);
+				
 				/*!	@name Typed Data Handling
 					These functions read and write typed data in the parcel.
 					This data is formatted the same way as SValue's archived
@@ -182,6 +216,11 @@ class SParcel
 				//! Core API for writing a large type header and its data.
 				/*!	If 'data' is NULL, only the header will be written. */
 				ssize_t			WriteLargeData(uint32_t packedType, size_t length, const void* data);
+				//!	Write a large type header and the contents of a shared buffer.
+				/*!	Large buffers are not copied.  The parcel keeps a reference
+					on the buffer and sends it in place, if the transport can
+					gather; see GatherVectors(). */
+				ssize_t			WriteLargeData(uint32_t packedType, const SSharedBuffer* buffer);
 				//!	Core API for writing a binder type.
 				ssize_t			WriteBinder(const flat_binder_object& val);
 
@@ -307,6 +346,14 @@ class SParcel
 				//@{
 				const void*		BinderOffsetsData() const;
 				size_t			BinderOffsetsLength() const;
+
+				//!	Return the parcel's data as a list of segments.
+				/*!	If large buffers were written by reference, this is the
+					parcel's own data with those buffers between it, in order.
+					Otherwise it returns NULL and Data() is the whole parcel.
+					Calling Data() copies everything into one buffer, after
+					which this returns NULL. */
+				const SVectorIO*	GatherVectors() const;
 #if TARGET_HOST == TARGET_HOST_PALMOS
 				status_t		SetBinderOffsets(	binder_ipc_info const * const offsets,
 													size_t count,
@@ -329,7 +376,11 @@ class SParcel
 								SParcel(const SParcel& o);
 				SParcel&		operator=(const SParcel& o);
 				
+				struct gather_info;
+
 				void			do_free();
+				void			flatten();
+				void			release_gather();
 				void			acquire_binders();
 				void			release_binders();
 				ssize_t			finish_write(ssize_t amt);
@@ -352,10 +403,13 @@ class SParcel
 				
 				uint32_t				m_dirty : 1;
 				uint32_t				m_ownsBinders : 1;
-				uint32_t				m_reserved: 30;
+				uint32_t				m_compact : 1;
+				uint32_t				m_reserved: 29;
 				
 				SVector<size_t>		m_binders;
 				
+				gather_info*		m_gather;
+				
 				uint8_t				m_inline[32];
 };
 
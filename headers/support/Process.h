@@ -91,6 +91,9 @@ public:
 	virtual	void				PrintBinderReferences(void);
 #endif
 
+	virtual	SValue				AtomAllocatorStats(void);
+	virtual	SValue				ParcelCacheStats(void);
+
 	virtual	void				RestartMallocProfiling(void);
 	virtual	void				SetMallocProfiling(bool enabled, int32_t dumpPeriod, int32_t maxItems, int32_t stackDepth);
 	virtual	void				RestartVectorProfiling(void);
@@ -100,6 +103,8 @@ public:
 	virtual	void				RestartBinderIPCProfiling(void);
 	virtual	void				SetBinderIPCProfiling(bool enabled, int32_t dumpPeriod, int32_t maxItems, int32_t stackDepth);
 	virtual void				PrintBinderIPCProfiling(void);
+	virtual	void				SetLockProfiling(int32_t samplePeriod, int32_t stackDepth);
+	virtual	void				RestartLockProfiling(void);
 
 	typedef	void				(*catchReleaseFunc)(IBinder* obj);
 			void				CatchHandleRelease(const sptr<IBinder>& remoteObject, catchReleaseFunc callbackFunc);
@@ -170,17 +175,33 @@ private:
 
 	friend	class SHandler;
 	friend	class SLooper;
+	friend	class SAsyncTransaction;
 	friend	class ProcessFreeKey;
 	
 	static	bool				ResumingScheduling();
 	static	void				ClearSchedulingResumed();
-	static	bool				InsertHandler(SHandler **handlerP, SHandler *handler);
+	static	bool				PendingBefore(const SHandler* a, const SHandler* b);
+			void				InsertHandler(SHandler* h);
+			void				RemovePendingHandler(size_t index);
+			void				SiftPendingUp(size_t index);
+			void				SiftPendingDown(size_t index);
+			SHandler*			NextPendingHandler() const;
+			int32_t				AcquireRunQueue();
+			void				ReleaseRunQueue(int32_t queue);
+			int32_t				LockRunQueueOf(SHandler* h);
+			bool				UnlinkHandler(SHandler* h, int32_t lockedQueue);
+			void				PushReadyHandler(int32_t queue, SHandler* h);
+			SHandler*			PopReadyHandler(int32_t queue);
+			SHandler*			StealReadyHandler(int32_t home);
 			void				UnscheduleHandler(SHandler* h, bool lock=true);
 			bool				ScheduleNextEvent();
+			void				HandlerBlocked();
+			void				HandlerUnblocked();
 			void				ScheduleHandler(SHandler* h);
 			// This function is called with the lock held, and returns with it released.
 			void				ScheduleNextHandler();
-			IBinder* & 			BinderForHandle(int32_t handle);
+			IBinder* volatile*	HandleSlot(int32_t handle, bool create);
+			IBinder*			AttemptWeakProxyForHandle(int32_t handle);
 			sptr<ComponentImage>	get_shared_object(const SValue& file, const SValue& info, bool fake=false, attach_func attach = NULL);
 			sptr<IBinder>		DoInstantiate(	const SContext& context,
 												const SValue &componentInfo,
@@ -192,12 +213,26 @@ private:
 			void				ReleaseRemoteReferences();
 
 			enum {
-				MAX_LOOPERS_PER_TEAM= 63
+				MAX_LOOPERS_PER_TEAM= 63,
+				MAX_RUN_QUEUES		= 16,
+				// Segment n of the handle table holds 64<<n handles,
+				// enough segments to cover every positive int32_t.
+				HANDLE_SEGMENT_SHIFT= 6,
+				HANDLE_SEGMENTS		= 26
 			};
 	
 			const team_id				m_id;
 	mutable	SLocker						m_lock;
-			SHandler*					m_pendingHandlers;
+			// Scheduled handlers, kept as a binary min-heap on the time
+			// of each handler's next message.
+			SVector<SHandler*>			m_pendingHandlers;
+			uint32_t					m_pendingSeq;
+			// Handlers that are ready to run, queued on the run queue of
+			// the looper that made them ready.  Each dispatching looper
+			// owns one queue and steals from the others when it is empty.
+			struct RunQueue;
+			RunQueue*					m_runQueues;
+			volatile int32_t			m_readyHandlers;
 			nsecs_t						m_nextEventTime;
 			int32_t						m_maxEventConcurrency;
 			int32_t						m_currentEventConcurrency;
@@ -211,7 +246,13 @@ private:
 			// Information about remote binders.
 	mutable	SNestedLocker				m_handleRefLock;
 			bool						m_remoteRefsReleased;
-			SVector<IBinder*>			m_handleRefs;
+			// Proxies by handle.  Segments are only ever added, never
+			// moved, so lookups read them without m_handleRefLock.
+			IBinder* volatile* volatile	m_handleSegments[HANDLE_SEGMENTS];
+			// Lock-free lookups read-lock this while they hold a proxy
+			// pointer without a reference on it.  ExpungeHandle() waits
+			// for them with Synchronize() before the proxy is freed.
+			SReadMostlyLocker			m_handleReaders;
 			SKeyedVector<IBinder*, catchReleaseFunc>
 										m_catchers;
 	
@@ -124,7 +124,12 @@ public:
 				pool, this buffer is modified and placed in the pool.
 				Otherwise, your reference on this buffer is released,
 				a reference on the on in the pool added and that buffer
-				returned to you. */
+				returned to you.
+				
+				The pool is split into shards by the hash of the data.
+				Finding a buffer in the pool takes its shard's lock, so
+				lookups are not lock-free; threads only wait for each
+				other when pooling data that hashes to the same shard. */
 	const	SSharedBuffer*	Pool() const;
 
 			//!	Perform a comparison of the data in two buffers.
@@ -169,6 +169,7 @@ class _IMPEXP_SUPPORT SNestedLocker;
 class _IMPEXP_SUPPORT SParcel;
 class _IMPEXP_SUPPORT BPipe;
 class _IMPEXP_SUPPORT SPrintf;
+class _IMPEXP_SUPPORT SReadMostlyLocker;
 class _IMPEXP_SUPPORT SReadWriteLocker;
 class _IMPEXP_SUPPORT BRoot;
 class _IMPEXP_SUPPORT SSharedBuffer;
@@ -63,6 +63,18 @@
 #endif
 #endif
 
+// Named lockers can report to the lock contention profiler.  This
+// changes the size of SLocker and friends, so everything has to be
+// built with the same setting.  Define it to 1 to profile a release
+// build.
+#ifndef SUPPORTS_LOCK_PROFILE
+#if BUILD_TYPE == BUILD_TYPE_DEBUG
+#define SUPPORTS_LOCK_PROFILE 1
+#else
+#define SUPPORTS_LOCK_PROFILE 0
+#endif
+#endif
+
 /*-------------------------------------------------------------*/
 /*----- Kernel APIs -------------------------------------------*/
 
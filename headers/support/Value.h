@@ -966,6 +966,7 @@ public:
 private:
 	
 	friend	class			BValueMap;
+	friend	class			SValueBuilder;
 	
 			// These are technically public because some inline methods call them.
 			void			InitAsCopy(const SValue& o);
@@ -997,6 +998,8 @@ private:
 			status_t		copy_small_data(type_code type, void* buf, size_t len) const;
 			status_t		copy_big_data(type_code type, void* buf, size_t len) const;
 			ssize_t			unarchive_internal(SParcel& from, size_t amount);
+			ssize_t			archive_compact(SParcel& into) const;
+			status_t		unarchive_compact(SParcel& from, const uint8_t* data, size_t end, size_t* pos);
 			BValueMap**		edit_map();
 			BValueMap**		make_map_without_sets();
 			status_t		set_error(ssize_t code);
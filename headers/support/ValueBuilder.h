@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef _SUPPORT_VALUEBUILDER_H_
+#define _SUPPORT_VALUEBUILDER_H_
+
+/*!	@file support/ValueBuilder.h
+	@ingroup CoreSupportUtilities
+	@brief Efficient construction of large SValue mappings.
+*/
+
+#include <support/Value.h>
+
+BNS(namespace palmos {)
+BNS(namespace support {)
+
+/*!	@addtogroup CoreSupportUtilities
+	@{
+*/
+
+/*-------------------------------------------------------------*/
+/*----- SValueBuilder class -----------------------------------*/
+
+//!	Collects mappings for an SValue and sorts them once.
+/*!	Each SValue::JoinItem() on a map finds where the new key goes and
+	moves everything after it, so building a map of N items one at a
+	time costs O(N^2).  SValueBuilder instead appends the items as they
+	come and sorts them once, when the value is asked for.
+
+	The result is the same as calling SValue::JoinItem() with each
+	item in turn, including combining items that have the same key
+	with SValue::Join().  Items that can't simply be appended, such as
+	ones with wild or map keys, are joined as they are added.
+
+	@nosubgrouping
+*/
+class SValueBuilder
+{
+public:
+							SValueBuilder();
+							~SValueBuilder();
+
+			//!	Add the mapping @a key -> @a value, as with SValue::JoinItem().
+			void			AddItem(const SValue& key, const SValue& value);
+
+			//!	Return the value of everything added, and empty the builder.
+			SValue			Build();
+			//!	SValue::Join() everything added into @a target, and empty the builder.
+			void			JoinInto(SValue& target);
+			//!	Throw away everything added.
+			void			MakeEmpty();
+
+private:
+							SValueBuilder(const SValueBuilder&);
+			SValueBuilder&	operator=(const SValueBuilder&);
+
+			void			flush();
+
+			SValue			m_value;	// items that have been sorted
+			SValue*			m_items;	// key, value, key, value...
+			size_t			m_count;
+			size_t			m_avail;
+};
+
+/*!	@} */
+
+BNS(} })	// namespace palmos::support
+
+#endif	/* _SUPPORT_VALUEBUILDER_H_ */
@@ -124,6 +124,26 @@ INLINE_FNC int cmpxchg64(volatile int64_t *atom, int64_t *value, int64_t newValu
 #ifdef __cplusplus
 }
 
+//!	Perform a pointer-sized atomic compare and swap
+/*!	If @a *location is @a oldValue, atomically sets it to @a newValue
+	and returns true; otherwise returns false.  Use this rather than
+	casting a pointer's address for compare_and_swap32(), which
+	truncates the pointer where pointers are 64 bits.
+	@ingroup CoreSupportUtilities */
+inline bool compare_and_swap_ptr(void* volatile* location, void* oldValue, void* newValue)
+{
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+	return __sync_bool_compare_and_swap(location, oldValue, newValue);
+#else
+	if (sizeof(void*) == sizeof(int32_t)) {
+		return compare_and_swap32((volatile int32_t*)location,
+			(int32_t)(intptr_t)oldValue, (int32_t)(intptr_t)newValue) != 0;
+	}
+	return compare_and_swap64((volatile int64_t*)location,
+		(int64_t)(intptr_t)oldValue, (int64_t)(intptr_t)newValue) != 0;
+#endif
+}
+
 inline int32_t SAtomicInt32::Value() const
 {
 	return m_value;
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef _SUPPORT_ATOMALLOCATOR_H
+#define _SUPPORT_ATOMALLOCATOR_H
+
+#include <support/SupportDefs.h>
+#include <support/Value.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+// Per-thread size-class allocator for SAtom memory.
+//
+// Each thread carves fixed-size blocks out of its own slabs and keeps
+// a free list per size class, so allocating and freeing an atom on
+// the same thread takes no lock and no atomic operation.  A block freed
+// by another thread is pushed on its owner's remote list, which the
+// owner takes back the next time that size class runs dry.  Allocations
+// too big for any size class go straight to malloc().
+//
+// It is off unless the ATOM_ALLOCATOR environment variable is set to 1
+// when the library is initialized, and can't change after that.  Atoms
+// that static constructors allocated before then don't carry a block
+// header, and atom_free() hands them back to operator delete.
+extern bool g_atomAllocatorEnabled;
+
+void init_atom_allocator();
+
+void* atom_allocate(size_t size);
+void atom_free(void* ptr);
+
+// Totals over all threads, and per size class.  The counts are read
+// without stopping anybody, so they are only approximately consistent.
+SValue atom_allocator_stats();
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
+
+#endif // _SUPPORT_ATOMALLOCATOR_H
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef _SUPPORT_LOCKPROFILE_H
+#define _SUPPORT_LOCKPROFILE_H
+
+#include <support/SupportDefs.h>
+#include <support/Locker.h>
+#include <support/String.h>
+#include <support/Value.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+// Sampling lock contention profiler.
+//
+// In builds with SUPPORTS_LOCK_PROFILE, named SLocker, SNestedLocker and
+// SReadWriteLocker objects report one in every g_lockProfilePeriod
+// acquisitions: how long the caller waited, how long it held the lock,
+// and where it was called from when it had to wait.  Samples are collected per lock name.  A period of 0 turns
+// sampling off, which costs each lock a single test.  The initial period
+// comes from the LOCK_PROFILE environment variable; use
+// IProcess::SetLockProfiling() to change it at runtime.
+extern int32_t g_lockProfilePeriod;
+extern int32_t g_lockProfileCount;
+
+inline bool sample_lock_profile()
+{
+	// The counter isn't atomic; losing the odd increment just makes
+	// the sampling a little less regular.
+	const int32_t period = g_lockProfilePeriod;
+	return period != 0 && (++g_lockProfileCount % period) == 0;
+}
+
+// Called by the lockers for a sampled acquisition or release.
+void lock_profile_acquired(const char* name, nsecs_t waited, bool contended);
+void lock_profile_released(const char* name, nsecs_t held);
+
+void set_lock_profiling(int32_t period, int32_t stackDepth);
+void reset_lock_profiling();
+
+// Collected data, one entry per lock name in the order they were first
+// sampled.  Resetting clears the numbers but keeps the entries, so an
+// index stays valid for the life of the process.
+size_t count_lock_profiles();
+SString lock_profile_name_at(size_t index);
+ssize_t lock_profile_index_of(const SString& name);
+SValue lock_profile_value_at(size_t index);
+
+#if !LIBBE_BOOTSTRAP
+// Publish a read-only node over the data above in the catalog, at
+// B_LOCK_PROFILE_PATH/<process id>.  Only the first call that
+// succeeds does anything.
+status_t publish_lock_profile();
+#endif
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
+
+#endif // _SUPPORT_LOCKPROFILE_H
@@ -116,6 +116,14 @@ class BpBinder : public IBinder
 				SLocker					m_lock;
 				SVector<Obituary>*		m_obituaries;
 				bool					m_alive;
+				// Cleared once the target rejects B_INVOKE_ID_TRANSACTION.
+				bool					m_invokeById;
+				// Cleared once the target rejects B_EFFECT_COMPACT_TRANSACTION.
+				bool					m_compactValues;
+				// Cleared once the target rejects B_INVOKE_ONEWAY_TRANSACTION.
+				bool					m_oneWay;
+				// Set once the target accepts one; later ones don't wait for it.
+				bool					m_oneWayAccepted;
 	// XXX : FIXME : HACK ALERT!
 	friend class BProcess;
 };
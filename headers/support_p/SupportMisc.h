@@ -33,6 +33,14 @@
 
 #include <SysThreadConcealed.h>
 
+// GCC on Linux has a real thread-local storage class, which is much
+// cheaper than going through the TSD functions.
+#if TARGET_HOST == TARGET_HOST_LINUX
+#define SUPPORTS_THREAD_KEYWORD 1
+#else
+#define SUPPORTS_THREAD_KEYWORD 0
+#endif
+
 #if _SUPPORTS_NAMESPACE
 namespace palmos {
 namespace support {
@@ -66,6 +74,24 @@ void dbg_init_gehnaphore(volatile int32_t* value);
 void dbg_lock_gehnaphore(volatile int32_t* value);
 void dbg_unlock_gehnaphore(volatile int32_t* value);
 
+// Blocking hooks.  SLocker and SConditionVariable call these before
+// and after they block.  SLooper installs them so a handler that is
+// about to wait can give its event slot to another handler; until
+// then they are NULL.  enter returns true if exit must be called.
+typedef bool (*enter_blocking_func)();
+typedef void (*exit_blocking_func)();
+extern enter_blocking_func g_enterBlocking;
+extern exit_blocking_func g_exitBlocking;
+
+// FNV-1a hash, for the hash tables of pooled buffers and value maps.
+// Pass a previous result as 'h' to continue hashing more data.
+inline uint32_t hash_bytes(const void* data, size_t length, uint32_t h = 2166136261UL)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	while (length-- > 0) h = (h ^ *p++) * 16777619UL;
+	return h;
+}
+
 // Cleanup helpers.
 typedef void (*binder_cleanup_func)();
 void add_binder_cleanup_func(binder_cleanup_func func);
@@ -157,6 +183,10 @@ struct parcel_pool_cleanup {
 };
 extern parcel_pool_cleanup g_parcel_pool_cleanup;
 
+// Counters from SParcel::GetParcel() and PutParcel(), for
+// IProcess::ParcelCacheStats().
+SValue parcel_cache_stats();
+
 extern sysThreadDirectFuncs g_threadDirectFuncs;
 
 #if _SUPPORTS_NAMESPACE
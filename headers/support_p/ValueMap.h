@@ -49,7 +49,20 @@ public:
 	int32_t Hits() const { return m_hits; }
 	int32_t Misses() const { return m_misses; }
 
+	enum { NUM_POOLS = 3, THREAD_SLOTS = 16 };
+
+	// Small maps are kept per thread first, so most of them are
+	// created and deleted without taking m_lock.
+	struct thread_cache {
+		int32_t counts[NUM_POOLS];
+		BValueMap* objects[NUM_POOLS][THREAD_SLOTS];
+	};
+
 private:
+	thread_cache* CurrentCache();
+	void PutShared(BValueMap* map);
+	static void ReleaseCache(void* cache);
+
 	SLocker m_lock;
 	struct pool {
 		int32_t count;
@@ -57,7 +70,6 @@ private:
 
 		pool() : count(0), objects(NULL) { }
 	};
-	enum { NUM_POOLS = 3 };
 	pool m_pools[NUM_POOLS];
 	int32_t m_hits, m_misses;
 };
@@ -80,7 +92,20 @@ public:
 			};
 			
 	static	BValueMap*		Create(size_t initSize = 1);
-	static	BValueMap*		Create(SParcel& from, size_t avail, size_t count, ssize_t* out_size);
+			// 'ordered' is the archive's value_map_info::order.  Pairs
+			// from any other writer are put in our order after reading.
+	static	BValueMap*		Create(SParcel& from, size_t avail, size_t count, int32_t ordered,
+								   ssize_t* out_size);
+			// Read 'count' pairs in the compact encoding, starting at
+			// data[*pos]; see SParcel::SetCompactValues().
+	static	BValueMap*		CreateCompact(SParcel& from, const uint8_t* data, size_t end,
+										  size_t* pos, size_t count, status_t* out_err);
+			// Make a map of 'count' pairs stored as key, value, key,
+			// value... at 'pairs', in any order.  The pairs are moved
+			// out, leaving that memory uninitialized.  Pairs that are
+			// the same mapping are combined with SValue::Join(), in the
+			// order they appear.
+	static	BValueMap*		CreateUnsorted(SValue* pairs, size_t count);
 			BValueMap*		Clone() const;
 
 			void			SetFirstMap(const SValue& key, const SValue& value);
@@ -90,11 +115,17 @@ public:
 			bool			IsShared() const;
 	
 			ssize_t			ArchivedSize() const;
+			//!	ArchivedSize() if it is already known, else a negative value.
+			ssize_t			CachedArchivedSize() const;
 			ssize_t			Archive(SParcel& into) const;
 			ssize_t			IndexFor(	const SValue& key,
 										const SValue& value = B_UNDEFINED_VALUE) const;
 			ssize_t			IndexFor(	uint32_t type, const void* data, size_t length) const;
 			const pair&		MapAt(size_t index) const;
+			//!	Writable access to the value at @a index, or NULL if out of memory.
+			/*!	The map must not be shared.  This may need to copy the
+				mapping out of storage shared with another map. */
+			SValue*			EditValueAt(size_t index);
 
 			size_t			CountMaps() const;
 			int32_t			Compare(const BValueMap& o) const;
@@ -125,7 +156,7 @@ private:
 							BValueMap(const BValueMap& o);
 							~BValueMap();
 
-			void			Construct(int32_t avail);
+			void			Construct(int32_t avail, uint32_t flags);
 			void			Destroy();
 
 			void			Delete();
@@ -137,12 +168,54 @@ private:
 			bool			GetIndexOf(	const SValue& k, const SValue& v,
 										size_t* index) const;
 			ssize_t			ComputeArchivedSize() const;
+			bool			IsSorted() const;
+	static	BValueMap*		Sort(BValueMap* map);
+
+			// Maps of the sizes kept in BValueMapPool have only the
+			// fields below.  Larger maps are preceded by a large_state,
+			// for their hash index and chunks; see ValueMap.cpp.
+			enum { LARGE_MAP = 0x0001, CHUNKED_MAP = 0x0002 };
+			struct			large_state;
+
+	static	BValueMap*		CreateLarge(size_t avail);
+			large_state*	Large() const;
+
+			// Large maps that are looked up more than they are changed
+			// get a hash index over their keys; see ValueMap.cpp.
+			enum { HASH_INDEX_MIN_MAPS = 32 };
+			struct			hash_index;
+
+			ssize_t			HashedIndexFor(	const SValue& key, const SValue& value) const;
+			ssize_t			HashedIndexFor(	uint32_t type, const void* data, size_t length) const;
+			ssize_t			LookupHashed(	const hash_index* index, uint32_t type,
+											const void* data, size_t length) const;
+			const hash_index* HashIndex() const;
+			void			FreeHashIndex();
+
+			// Large maps keep their mappings in chunks that copies of
+			// the map share; see ValueMap.cpp.
+			enum { CHUNKED_MIN_MAPS = 256, CHUNK_PAIRS = 64, CHUNK_FILL = 48 };
+			struct			chunk;
+			struct			chunk_table;
+
+	static	BValueMap*		CreateChunked(pair* pairs, size_t count, bool move);
+	static	chunk*			NewChunk();
+	static	void			ReleaseChunk(chunk* data);
+	static	chunk_table*	NewChunkTable(int32_t avail);
+			chunk_table*	Chunks() const;
+			void			FreeChunks();
+			int32_t			ChunkFor(size_t index) const;
+			const pair&		ChunkedMapAt(size_t index) const;
+			chunk*			EditChunk(int32_t which);
+			ssize_t			ChunkedAddAt(size_t index, const SValue& key, const SValue& value);
+			void			ChunkedRemoveAt(size_t index);
+			void			MergeChunks(int32_t left);
 
 	mutable	int32_t			m_users;
+			uint32_t		m_flags;	// LARGE_MAP, CHUNKED_MAP
 	mutable	ssize_t			m_dataSize;
 			ssize_t			m_size;
 			ssize_t			m_avail;
-			int32_t			m_pad0;
 			ssize_t			m_editIndex;
 
 			// Mappings start here.
@@ -175,21 +248,29 @@ inline ssize_t BValueMap::ArchivedSize() const
 	return ComputeArchivedSize();
 }
 
+inline ssize_t BValueMap::CachedArchivedSize() const
+{
+	return m_dataSize;
+}
+
 inline ssize_t BValueMap::IndexFor(const SValue& key, const SValue& value) const
 {
+	if (m_size >= HASH_INDEX_MIN_MAPS) return HashedIndexFor(key, value);
 	size_t index;
 	return GetIndexOf(key, value, &index) ? index : B_NAME_NOT_FOUND;
 }
 
 inline ssize_t BValueMap::IndexFor(uint32_t type, const void* data, size_t length) const
 {
+	if (m_size >= HASH_INDEX_MIN_MAPS) return HashedIndexFor(type, data, length);
 	size_t index;
 	return GetIndexOf(type, data, length, &index) ? index : B_NAME_NOT_FOUND;
 }
 
 inline const BValueMap::pair& BValueMap::MapAt(size_t index) const
 {
-	return m_maps[index];
+	if ((m_flags&CHUNKED_MAP) == 0) return m_maps[index];
+	return ChunkedMapAt(index);
 }
 
 inline size_t BValueMap::CountMaps() const
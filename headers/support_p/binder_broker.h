@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef _BINDER_BROKER_H_
+#define _BINDER_BROKER_H_
+
+#include <support_p/binder_module.h>
+
+#ifdef __cplusplus
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+#endif
+
+// Wire protocol between libbinder and the user-space binder broker
+// (servers/binderd).  The broker speaks exactly the same bc*/br* command
+// protocol as the binder driver; this file only describes how a
+// BINDER_WRITE_READ (or one of the other driver ioctls) is framed on a
+// Unix-domain stream socket.
+//
+// Each looper thread owns one connection, which the broker treats as one
+// driver thread.  The first message on a connection is a broker_hello,
+// sent with the process's transaction memory (a memfd of vm_size bytes)
+// attached as SCM_RIGHTS.  The process maps that memory read-only at
+// vm_start, and the broker copies incoming transaction data directly into
+// it, so received parcels are read in place exactly as with the driver's
+// mmap.  The reply to the hello lists the optional protocol features the
+// broker supports, like BINDER_FEATURES does for the driver.
+//
+// After the hello, every request is a broker_request followed by:
+//   - BROKER_OP_WRITE_READ: write_size bytes of commands, then the data
+//     and offsets of every bcTRANSACTION/bcREPLY in the commands, in order.
+//   - Other ops: arg_size bytes of ioctl argument.
+// and is answered with a broker_reply followed by read_consumed bytes of
+// return commands.  A request with read_size > 0 is not answered until
+// there is something to read, just like the driver blocks the ioctl.
+
+#define BINDER_BROKER_ENV			"BINDER_BROKER"
+#define BINDER_BROKER_DEFAULT_PATH	"/tmp/binderd.socket"
+#define BINDER_BROKER_MAGIC			0x62726b72		// 'brkr'
+
+enum {
+	BROKER_OP_WRITE_READ = 1,
+	BROKER_OP_SET_CONTEXT_MGR,
+	BROKER_OP_SET_WAKEUP_TIME,
+	BROKER_OP_THREAD_EXIT
+};
+
+typedef struct broker_hello {
+	uint32_t	magic;
+	uint32_t	protocol_version;	// BINDER_CURRENT_PROTOCOL_VERSION
+	int32_t		pid;
+	uint32_t	reserved;
+	uint64_t	vm_start;			// where the client mapped the memfd
+	uint64_t	vm_size;
+} broker_hello_t;
+
+typedef struct broker_request {
+	uint32_t	op;
+	uint32_t	write_size;
+	uint32_t	read_size;
+	uint32_t	arg_size;
+} broker_request_t;
+
+typedef struct broker_reply {
+	int32_t		status;				// 0 or a negative errno
+	uint32_t	write_consumed;
+	uint32_t	read_consumed;
+	uint32_t	features;			// bf* flags; only in the reply to the hello
+} broker_reply_t;
+
+// Number of parameter bytes that follow a bc* command in the write
+// buffer.  These mirror what SLooper writes, not the driver's native
+// pointer size.  Returns -1 for commands the broker does not know.
+static inline int32_t broker_command_size(int32_t cmd)
+{
+	switch (cmd) {
+		case bcNOOP:
+		case bcTRANSACTION_COMPLETE:
+		case bcREGISTER_LOOPER:
+		case bcENTER_LOOPER:
+		case bcEXIT_LOOPER:
+		case bcSYNC:
+			return 0;
+		case bcTRANSACTION:
+		case bcREPLY:
+			return sizeof(binder_transaction_data);
+		case bcACQUIRE_RESULT:
+		case bcFREE_BUFFER:
+		case bcINCREFS:
+		case bcACQUIRE:
+		case bcRELEASE:
+		case bcDECREFS:
+		case bcRETRIEVE_ROOT_OBJECT:
+		case bcSTOP_SELF:
+		case bcDEAD_BINDER_DONE:
+			return sizeof(int32_t);
+		case bcINCREFS_DONE:
+		case bcACQUIRE_DONE:
+		case bcATTEMPT_ACQUIRE:
+		case bcSET_THREAD_ENTRY:
+		case bcSTOP_PROCESS:
+		case bcREQUEST_DEATH_NOTIFICATION:
+		case bcCLEAR_DEATH_NOTIFICATION:
+			return 2*sizeof(int32_t);
+	}
+	return -1;
+}
+
+#ifdef __cplusplus
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
+#endif
+
+#endif // _BINDER_BROKER_H_
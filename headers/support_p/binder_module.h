@@ -83,6 +83,18 @@ typedef struct binder_version {
 	signed long		protocol_version;	// driver protocol version -- increment with incompatible change
 } binder_version_t;
 
+// Use with BINDER_FEATURES, driver fills in fields.  Optional additions
+// to the protocol that don't change the version; a driver without this
+// ioctl (it fails with ENOTTY) has none of them.
+typedef struct binder_features {
+	unsigned long		features;			// bf* flags below
+} binder_features_t;
+
+enum binder_feature_flags {
+	bfSharedMemory = 0x01,			// tfSharedMemory reaches the receiver
+	bfOneWay = 0x02					// tfOneWay transactions get no reply
+};
+
 // This is the current protocol version.
 #define BINDER_CURRENT_PROTOCOL_VERSION 4
 
@@ -92,6 +104,7 @@ typedef struct binder_version {
 #define	BINDER_SET_CONTEXT_MGR	_IOW(BINDER_IOC_MAGIC, 7, int)
 #define	BINDER_THREAD_EXIT	_IOW(BINDER_IOC_MAGIC, 8, int)
 #define BINDER_VERSION _IOWR(BINDER_IOC_MAGIC, 9, binder_version_t)
+#define BINDER_FEATURES _IOR(BINDER_IOC_MAGIC, 10, binder_features_t)
 
 // the following 4 are not implemented in protocol v7/v8
 #define BINDER_SET_WAKEUP_TIME _IOW(BINDER_IOC_MAGIC, 2, binder_wakeup_time_t)
@@ -99,7 +112,7 @@ typedef struct binder_version {
 #define BINDER_SET_REPLY_TIMEOUT _IOW(BINDER_IOC_MAGIC, 4, bigtime_t)
 #define BINDER_SET_IDLE_PRIORITY _IOW(BINDER_IOC_MAGIC, 6, int)
 
-#define BINDER_IOC_MAXNR 9
+#define BINDER_IOC_MAXNR 10
 
 // NOTE: Two special error codes you should check for when calling
 // in to the driver are:
@@ -120,7 +133,10 @@ enum transaction_flags {
 	tfInline = 0x01,			// not yet implemented
 	tfSynchronous = 0x02,		// obsolete
 	tfRootObject = 0x04,		// contents are the component's root object
-	tfStatusCode = 0x08			// contents are a 32-bit status code
+	tfStatusCode = 0x08,		// contents are a 32-bit status code
+	tfSharedMemory = 0x10,		// contents are a shared memory segment descriptor
+	tfOneWay = 0x20,			// no reply; the sender only gets brTRANSACTION_COMPLETE
+	tfGather = 0x8000			// buffer is an SVectorIO (never leaves the process)
 };
 
 typedef struct binder_transaction_data
@@ -15,6 +15,7 @@
 
 #include <xml/XMLParser.h>
 #include <support/Package.h>
+#include <support/ValueBuilder.h>
 
 #if _SUPPORTS_NAMESPACE
 namespace palmos {
@@ -41,6 +42,10 @@ private:
 	static status_t ParseSignedInteger (const BNS(palmos::support::) SString &from, int64_t maximum, int64_t *val);
 	SPackage m_resources;
 	BNS(palmos::support::) SValue &m_targetValue;
+	// Where a nested value goes instead of m_targetValue.
+	BNS(palmos::support::) SValueBuilder *m_targetItems;
+	// Nested values, sorted into m_value in one go by Done().
+	BNS(palmos::support::) SValueBuilder m_items;
 	BNS(palmos::support::) SValue m_key;
 	BNS(palmos::support::) SValue m_value;
 	BNS(palmos::support::) SString m_data;
@@ -348,6 +348,32 @@ The C++ binding passes all interfaces as smart pointers; the default
 is to use a strong reference, so if you need to use a weak reference,
 be sure to specify the weak attribute.
 
+@subsubsection oneway
+
+The @e oneway attribute marks a method as a notification: a remote
+caller returns as soon as the target process has queued the call,
+without waiting for the method to run.  A oneway method must return
+void and can only take input parameters.
+
+@code
+methods:
+	[oneway] void NodeChanged(INode who, uint32_t flags, SValue hints);
+@endcode
+
+The target runs the oneway calls made on an object one at a time,
+in the order they arrived, on a looper thread.  The caller never sees
+an error from the method itself, and a call may still be waiting to
+run when the caller's next synchronous call to the same object
+arrives.  If the target doesn't know about oneway calls (for example
+because it implements Transact() itself), the proxy falls back to
+ordinary synchronous calls.
+
+@note A oneway call is not free to send.  The driver pairs every
+transaction with a reply, so the caller still blocks for a full round
+trip to the target process; it just gets its reply before the method
+runs.  Use oneway so that callers don't wait on slow observers, not to
+make cheap calls cheaper.
+
 @subsubsection reserved
 
 The @e reserved attribute can be applied to either functions or
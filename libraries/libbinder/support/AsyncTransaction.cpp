@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include <support/AsyncTransaction.h>
+
+#include <support/Autobinder.h>
+#include <support/Locker.h>
+#include <support/Looper.h>
+#include <support/Process.h>
+#include <support/Vector.h>
+#include <support/atomic.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+enum {
+	kTransactMessage = 'tran'
+};
+
+// Transactions beyond SAsyncTransaction::MaxInFlight() wait here, in
+// the order they were started, for one in flight to finish.
+static SLocker g_asyncLock("SAsyncTransaction");
+static int32_t g_asyncInFlight = 0;
+static int32_t g_asyncMaxInFlight = 0;		// 0 means the default
+static SVector<sptr<SAsyncTransaction> >* g_asyncWaiting = NULL;
+
+/**************************************************************************************/
+
+SAsyncTransaction::SAsyncTransaction()
+	:	m_code(0), m_flags(0), m_def(NULL), m_result(B_WOULD_BLOCK),
+		m_done("SAsyncTransaction")
+{
+}
+
+SAsyncTransaction::~SAsyncTransaction()
+{
+}
+
+int32_t SAsyncTransaction::MaxInFlight()
+{
+	if (g_asyncMaxInFlight > 0) return g_asyncMaxInFlight;
+
+	const sptr<BProcess> process(SLooper::Process());
+	if (process == NULL) return 1;
+	const int32_t spare = process->MaximumLoopers() - process->MinimumLoopers();
+	return spare > 1 ? spare : 1;
+}
+
+void SAsyncTransaction::SetMaxInFlight(int32_t count)
+{
+	g_asyncMaxInFlight = count > 0 ? count : 0;
+}
+
+status_t SAsyncTransaction::Start(const sptr<IBinder>& target, uint32_t code,
+	SParcel& data, uint32_t flags)
+{
+	DbgOnlyFatalErrorIf(m_self != NULL || IsDone(), "SAsyncTransaction started twice!");
+
+	if (target == NULL) {
+		finish(B_BAD_VALUE);
+		return B_BAD_VALUE;
+	}
+
+	m_target = target;
+	m_code = code;
+	m_flags = flags;
+	m_data.Transfer(&data);
+
+	// Keep ourself around until the reply has been delivered, even if
+	// the caller only wants Completed().
+	m_self = this;
+
+	const int32_t maxInFlight = MaxInFlight();
+	g_asyncLock.Lock();
+	if (g_asyncInFlight >= maxInFlight) {
+		if (g_asyncWaiting == NULL) g_asyncWaiting = new SVector<sptr<SAsyncTransaction> >;
+		const ssize_t index = g_asyncWaiting->AddItem(m_self);
+		g_asyncLock.Unlock();
+		return index >= B_OK ? B_OK : post(B_NO_MEMORY);
+	}
+	g_asyncInFlight++;
+	g_asyncLock.Unlock();
+
+	const status_t err = post(B_OK);
+	if (err != B_OK) start_next();
+	return err;
+}
+
+status_t SAsyncTransaction::post(status_t err)
+{
+	if (err == B_OK) err = PostMessage(SMessage(kTransactMessage));
+	if (err != B_OK) {
+		// m_self may be the last reference, so finish before
+		// letting go of it.
+		finish(err);
+		m_self = NULL;
+	}
+	return err;
+}
+
+void SAsyncTransaction::start_next()
+{
+	// Hand our place to the oldest waiting transaction; if none can
+	// be posted, give it up.
+	while (true) {
+		sptr<SAsyncTransaction> next;
+		g_asyncLock.Lock();
+		if (g_asyncWaiting != NULL && g_asyncWaiting->CountItems() > 0) {
+			next = g_asyncWaiting->ItemAt(0);
+			g_asyncWaiting->RemoveItemsAt(0);
+		} else {
+			g_asyncInFlight--;
+		}
+		g_asyncLock.Unlock();
+
+		if (next == NULL || next->post(B_OK) == B_OK) return;
+	}
+}
+
+status_t SAsyncTransaction::StartAutobinder(const sptr<IBinder>& target,
+	const BAutobinderDef* def, void** params)
+{
+	const BEffectMethodDef* const inv = def->invoke;
+	SParcel* data = SParcel::GetParcel();
+	uint32_t dirs = 0;
+
+	m_def = def;
+
+	// Sent by name, which every target understands.
+	data->WriteInt32(def->index);
+	data->WriteValue(def->key());
+	status_t err = autobinder_marshal_args(inv->paramTypes, inv->paramTypes+inv->paramCount,
+		B_IN_PARAM, params, *data, &dirs);
+	if (err >= B_OK) {
+		DbgOnlyFatalErrorIf((dirs&B_OUT_PARAM) != 0, "Asynchronous calls can't have output parameters!");
+		err = Start(target, B_INVOKE_TRANSACTION, *data);
+	} else {
+		finish(err);
+	}
+
+	SParcel::PutParcel(data);
+	return err;
+}
+
+status_t SAsyncTransaction::Fail(status_t error)
+{
+	DbgOnlyFatalErrorIf(m_self != NULL || IsDone(), "SAsyncTransaction started twice!");
+
+	finish(error);
+	return m_result;
+}
+
+bool SAsyncTransaction::IsDone() const
+{
+	return m_result != B_WOULD_BLOCK;
+}
+
+status_t SAsyncTransaction::Wait()
+{
+	m_done.Wait();
+	return m_result;
+}
+
+status_t SAsyncTransaction::Result() const
+{
+	return m_result;
+}
+
+SParcel& SAsyncTransaction::Reply()
+{
+	return m_reply;
+}
+
+status_t SAsyncTransaction::AutobinderResult(void* result)
+{
+	status_t err = Wait();
+	if (err != B_OK) return err;
+	if (m_def == NULL) return B_BAD_TYPE;
+
+	const BEffectMethodDef* const inv = m_def->invoke;
+	if (inv->returnType == B_UNDEFINED_TYPE) return B_OK;
+
+	m_reply.SetPosition(0);
+	if (inv->returnMarshaller) {
+		err = inv->returnMarshaller->unmarshal_parcel(m_reply, result);
+	} else {
+		err = m_reply.ReadTypedData(inv->returnType, result);
+	}
+	return err == B_BINDER_READ_NULL_VALUE ? B_OK : err;
+}
+
+void SAsyncTransaction::Completed(status_t /*result*/, SParcel& /*reply*/)
+{
+}
+
+status_t SAsyncTransaction::HandleMessage(const SMessage& msg)
+{
+	if (msg.What() != kTransactMessage) return SHandler::HandleMessage(msg);
+
+	// Hold a reference of our own, so we are still here after
+	// letting go of m_self.
+	sptr<SAsyncTransaction> self(m_self);
+	m_self = NULL;
+
+	// A local target reads the request and writes the reply in place,
+	// so both must start at the front.
+	m_data.SetPosition(0);
+	status_t result = m_target->Transact(m_code, m_data, &m_reply, m_flags);
+	if (result == B_OK) result = m_reply.ErrorCheck();
+	m_reply.SetPosition(0);
+
+	m_target = NULL;
+	m_data.Free();
+
+	finish(result);
+	start_next();
+	return B_OK;
+}
+
+void SAsyncTransaction::finish(status_t result)
+{
+	// B_WOULD_BLOCK means "not done yet"; don't let a target's error
+	// code be mistaken for it.
+	m_result = result != B_WOULD_BLOCK ? result : B_ERROR;
+	Completed(m_result, m_reply);
+	m_done.Open();
+}
+
+/**************************************************************************************/
+
+sptr<SAsyncTransaction> TransactAsync(const sptr<IBinder>& target, uint32_t code,
+	SParcel& data, uint32_t flags)
+{
+	sptr<SAsyncTransaction> transaction = new SAsyncTransaction;
+	transaction->Start(target, code, data, flags);
+	return transaction;
+}
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
@@ -26,6 +26,7 @@
 #include <support/Vector.h>
 #include <support/String.h>
 #include <support/Debug.h>
+#include <support_p/AtomAllocator.h>
 #include <support_p/SupportMisc.h>
 
 #include <stdio.h>
@@ -882,12 +883,50 @@ namespace support {
 
 // This is the TLS slot in which we store the base address of
 // an atom class when allocating it.  Doing this allows us to
-// get that information up to the SAtom constructor.
+// get that information up to the SAtom constructor.  Where the
+// compiler has thread-local variables we use one of those instead.
+#if SUPPORTS_THREAD_KEYWORD
+static __thread void* gPendingAtoms = NULL;
+#else
 static SysTSDSlotID gAtomBaseIndex = ~0;
+#endif
+
+static inline void* pending_atoms()
+{
+#if SUPPORTS_THREAD_KEYWORD
+	return gPendingAtoms;
+#else
+	return g_threadDirectFuncs.tsdGet(gAtomBaseIndex);
+#endif
+}
+
+static inline void set_pending_atoms(void* pending)
+{
+#if SUPPORTS_THREAD_KEYWORD
+	gPendingAtoms = pending;
+#else
+	g_threadDirectFuncs.tsdSet(gAtomBaseIndex, pending);
+#endif
+}
+
+static inline void* allocate_atom_memory(size_t size)
+{
+	if (g_atomAllocatorEnabled) return atom_allocate(size);
+	return ::operator new(size, B_SNS(std::)nothrow);
+}
+
+static inline void free_atom_memory(void* ptr)
+{
+	if (g_atomAllocatorEnabled) atom_free(ptr);
+	else ::operator delete(ptr);
+}
 
 void __initialize_atom()
 {
+#if !SUPPORTS_THREAD_KEYWORD
 	SysTSDAllocate(&gAtomBaseIndex, NULL, sysTSDAnonymous);
+#endif
+	init_atom_allocator();
 }
 
 void __terminate_atom()
@@ -940,10 +979,10 @@ SAtom::weak_atom_ptr* SAtom::CreateWeak(const void* cookie) const
 // Remove this base_data from the tls chain.
 void SAtom::base_data::unlink()
 {
-	base_data* pos = (base_data*)g_threadDirectFuncs.tsdGet(gAtomBaseIndex);
+	base_data* pos = (base_data*)pending_atoms();
 	if (pos == this) {
 		printf("Unlinking %p from top!\n", this);
-		g_threadDirectFuncs.tsdSet(gAtomBaseIndex, (void*)(pos->pending&~1));
+		set_pending_atoms((void*)(pos->pending&~1));
 		return;
 	}
 
@@ -966,14 +1005,14 @@ void SAtom::base_data::unlink()
 void* SAtom::operator new(size_t size)
 {
 	// Allocate extra space before the atom, rounded to 8 bytes.
-	base_data* ptr = (base_data*)::operator new(size + sizeof(base_data));
+	base_data* ptr = (base_data*)allocate_atom_memory(size + sizeof(base_data));
 	if (ptr) {
 	
 		ptr->strongCount = INITIAL_PRIMARY_VALUE;
 		ptr->weakCount = 0;
 
 		// Chain with previous allocation.
-		base_data* prev = (base_data*)g_threadDirectFuncs.tsdGet(gAtomBaseIndex);
+		base_data* prev = (base_data*)pending_atoms();
 		if (prev) {
 			base_data* pos = prev;
 #if 0
@@ -989,14 +1028,13 @@ void* SAtom::operator new(size_t size)
 		}
 		ptr->size = size + sizeof(base_data);
 	
-		PRINT(("Allocate atom base=%p, tls=%ld, off=%p\n",
-					ptr, gAtomBaseIndex, ptr+1));
+		PRINT(("Allocate atom base=%p, off=%p\n", ptr, ptr+1));
 	
 #if SUPPORTS_ATOM_DEBUG
 		ptr->debugPtr = NULL;
 		ptr->new_size = size;
 #endif
-		g_threadDirectFuncs.tsdSet(gAtomBaseIndex, ptr);
+		set_pending_atoms(ptr);
 		return ptr+1;
 	}
 
@@ -1010,14 +1048,14 @@ void* SAtom::operator new(size_t size)
 void* SAtom::operator new(size_t size, const B_SNS(std::)nothrow_t&) throw()
 {
 	// Allocate extra space before the atom, rounded to 8 bytes.
-	base_data* ptr = (base_data*)::operator new(size + sizeof(base_data), B_SNS(std::)nothrow);
+	base_data* ptr = (base_data*)allocate_atom_memory(size + sizeof(base_data));
 	if (ptr) {
 	
 		ptr->strongCount = INITIAL_PRIMARY_VALUE;
 		ptr->weakCount = 0;
 
 		// Chain with previous allocation.
-		base_data* prev = (base_data*)g_threadDirectFuncs.tsdGet(gAtomBaseIndex);
+		base_data* prev = (base_data*)pending_atoms();
 		if (prev) {
 			base_data* pos = prev;
 #if 0
@@ -1033,14 +1071,13 @@ void* SAtom::operator new(size_t size, const B_SNS(std::)nothrow_t&) throw()
 		}
 		ptr->size = size + sizeof(base_data);
 	
-		PRINT(("Allocate atom base=%p, tls=%ld, off=%p\n",
-					ptr, gAtomBaseIndex, ptr+1));
+		PRINT(("Allocate atom base=%p, off=%p\n", ptr, ptr+1));
 	
 #if SUPPORTS_ATOM_DEBUG
 		ptr->debugPtr = NULL;
 		ptr->new_size = size;
 #endif
-		g_threadDirectFuncs.tsdSet(gAtomBaseIndex, ptr);
+		set_pending_atoms(ptr);
 		return ptr+1;
 	}
 
@@ -1058,7 +1095,7 @@ void SAtom::operator delete(void* ptr, size_t size)
 		}
 		// Atom wasn't constructed, so just free the data.
 		data->unlink();
-		::operator delete(data);
+		free_atom_memory(data);
 	}
 }
 
@@ -1067,7 +1104,7 @@ void SAtom::delete_impl(size_t size)
 	if (weak_count() == 0) {
 		// The atom has already been destroyed, goodbye.
 		PRINT(("Freeing atom memory %p directly\n", this));
-		::operator delete(m_base);
+		free_atom_memory(m_base);
 		NOTE_FREE();
 		return;
 	}
@@ -1103,7 +1140,7 @@ SAtom::SAtom()
 	NOTE_CREATE();
 	
 	// Look for the memory allocation for this atom.
-	base_data* pos = (base_data*)g_threadDirectFuncs.tsdGet(gAtomBaseIndex);
+	base_data* pos = (base_data*)pending_atoms();
 	base_data* prev = NULL;
 	while ( pos && (this < ((void*)pos) || this >= ((void*)(((char*)pos)+pos->size))) ) {
 		// Not this one...  try the next!
@@ -1122,7 +1159,7 @@ SAtom::SAtom()
 #endif
 
 	m_base = pos;
-	if (!prev) g_threadDirectFuncs.tsdSet(gAtomBaseIndex, (void*)(pos->pending&~1));
+	if (!prev) set_pending_atoms((void*)(pos->pending&~1));
 	else prev->next = pos->next;
 
 	pos->atom = this;
@@ -1231,7 +1268,7 @@ int32_t SAtom::DecWeak(const void *id) const
 		if (m_base->size > 0) {
 			const_cast<SAtom*>(this)->destructor_impl();
 			PRINT(("Freeing atom memory %p after last ref\n", this));
-			::operator delete(m_base);
+			free_atom_memory(m_base);
 			NOTE_FREE();
 		} else {
 			if (const_cast<SAtom*>(this)->DeleteAtom(id) == B_OK)
@@ -1259,7 +1296,7 @@ void SAtom::DecWeakFast() const
 	if (m_base->size > 0) {
 		const_cast<SAtom*>(this)->destructor_impl();
 		PRINT(("Freeing atom memory %p after last ref\n", this));
-		::operator delete(m_base);
+		free_atom_memory(m_base);
 		NOTE_FREE();
 	} else {
 		if (const_cast<SAtom*>(this)->DeleteAtom(NULL) == B_OK)
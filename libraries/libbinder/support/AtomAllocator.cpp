@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include <support_p/AtomAllocator.h>
+
+#include <support/atomic.h>
+#include <support/Debug.h>
+
+#include <support_p/SupportMisc.h>
+
+#include <SysThread.h>
+
+#include <stdlib.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+bool g_atomAllocatorEnabled = false;
+
+char g_atomAllocatorEnvVar[] = "ATOM_ALLOCATOR";
+static BDebugInteger<g_atomAllocatorEnvVar, 0, 0, 1> g_atomAllocatorEnv;
+
+// Usable size of the blocks in each class.
+static const size_t kSizeClasses[] = { 16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512 };
+enum { kNumSizeClasses = sizeof(kSizeClasses)/sizeof(kSizeClasses[0]) };
+static const size_t kMaxSmallSize = 512;
+static const size_t kSlabSize = 16*1024;
+
+// Size class for each multiple of 16 bytes, up to kMaxSmallSize.
+static uint8_t g_classForSize[kMaxSmallSize/16 + 1];
+
+struct atom_thread_cache;
+
+// Every block starts with this header; the caller gets what follows.
+struct atom_block
+{
+	atom_thread_cache*		owner;		// NULL if allocated with malloc()
+	uint32_t				sizeClass;
+	uint32_t				magic;		// block_magic() of this block
+};
+
+// Atoms created before the allocator was turned on came from plain
+// operator new and have no header.  The magic is mixed with the
+// block's address, so whatever happens to sit in front of one of
+// those won't pass for it.
+static const uint32_t kAtomBlockMagic = 0x61746f6d;	// 'atom'
+
+static inline uint32_t block_magic(const atom_block* block)
+{
+	return kAtomBlockMagic ^ (uint32_t)(size_t)block;
+}
+
+// While a block is free its first word links it into a free list.
+struct free_block
+{
+	free_block*				next;
+};
+
+struct atom_thread_cache
+{
+	atom_thread_cache*		nextCache;
+	int32_t					inUse;		// cleared when the thread exits
+	free_block*				freeLists[kNumSizeClasses];
+	int32_t					allocations[kNumSizeClasses];
+	int32_t					frees[kNumSizeClasses];
+	int32_t					slabs[kNumSizeClasses];
+
+	// Blocks freed by other threads.  Kept apart from the fields above,
+	// which only the owning thread touches.
+	int32_t					_reserved[16];
+	free_block* volatile	remoteFrees;
+};
+
+// Caches are never deleted, since other threads may still be freeing
+// blocks back to them.  When a thread exits, the next new thread
+// adopts its cache along with whatever blocks it has.
+static SysCriticalSectionType g_cachesLock = sysCriticalSectionInitializer;
+static atom_thread_cache* g_caches = NULL;
+static SysTSDSlotID g_cacheTSD;
+#if SUPPORTS_THREAD_KEYWORD
+static __thread atom_thread_cache* t_cache = NULL;
+#endif
+
+static int32_t g_largeAllocations = 0;
+static int32_t g_largeFrees = 0;
+static int32_t g_remoteFrees = 0;
+
+static void release_thread_cache(void* data)
+{
+	atom_thread_cache* cache = (atom_thread_cache*)data;
+#if SUPPORTS_THREAD_KEYWORD
+	t_cache = NULL;
+#endif
+	SysCriticalSectionEnter(&g_cachesLock);
+	cache->inUse = 0;
+	SysCriticalSectionExit(&g_cachesLock);
+}
+
+void init_atom_allocator()
+{
+	size_t sc = 0;
+	for (size_t i=0; i<=kMaxSmallSize/16; i++) {
+		while (kSizeClasses[sc] < i*16) sc++;
+		g_classForSize[i] = (uint8_t)sc;
+	}
+
+	g_atomAllocatorEnabled = g_atomAllocatorEnv.Get() != 0;
+	if (g_atomAllocatorEnabled) {
+		SysTSDAllocate(&g_cacheTSD, release_thread_cache, sysTSDAnonymous);
+	}
+}
+
+static inline atom_thread_cache* current_cache()
+{
+#if SUPPORTS_THREAD_KEYWORD
+	return t_cache;
+#else
+	return (atom_thread_cache*)g_threadDirectFuncs.tsdGet(g_cacheTSD);
+#endif
+}
+
+static atom_thread_cache* attach_cache()
+{
+	atom_thread_cache* cache;
+
+	SysCriticalSectionEnter(&g_cachesLock);
+	for (cache = g_caches; cache != NULL; cache = cache->nextCache) {
+		if (cache->inUse == 0) {
+			cache->inUse = 1;
+			break;
+		}
+	}
+	SysCriticalSectionExit(&g_cachesLock);
+
+	if (cache == NULL) {
+		cache = (atom_thread_cache*)calloc(1, sizeof(atom_thread_cache));
+		if (cache == NULL) return NULL;
+		cache->inUse = 1;
+		SysCriticalSectionEnter(&g_cachesLock);
+		cache->nextCache = g_caches;
+		g_caches = cache;
+		SysCriticalSectionExit(&g_cachesLock);
+	}
+
+	// The TSD slot is what gets us told when the thread exits.
+	g_threadDirectFuncs.tsdSet(g_cacheTSD, cache);
+#if SUPPORTS_THREAD_KEYWORD
+	t_cache = cache;
+#endif
+	return cache;
+}
+
+static free_block* refill_cache(atom_thread_cache* cache, size_t sc)
+{
+	// First take back everything other threads have freed.
+	if (cache->remoteFrees != NULL) {
+		free_block* list;
+		do {
+			list = cache->remoteFrees;
+		} while (!compare_and_swap_ptr((void* volatile*)&cache->remoteFrees, list, NULL));
+
+		while (list != NULL) {
+			free_block* next = list->next;
+			const uint32_t listClass = (((atom_block*)list)-1)->sizeClass;
+			list->next = cache->freeLists[listClass];
+			cache->freeLists[listClass] = list;
+			cache->frees[listClass]++;
+			list = next;
+		}
+		if (cache->freeLists[sc] != NULL) return cache->freeLists[sc];
+	}
+
+	// Carve up a new slab, leaving the free list in address order.
+	const size_t blockSize = sizeof(atom_block) + kSizeClasses[sc];
+	const size_t count = kSlabSize/blockSize;
+	uint8_t* slab = (uint8_t*)malloc(count*blockSize);
+	if (slab == NULL) return NULL;
+
+	cache->slabs[sc]++;
+	for (size_t i=count; i>0; i--) {
+		atom_block* block = (atom_block*)(slab + (i-1)*blockSize);
+		block->owner = cache;
+		block->sizeClass = sc;
+		block->magic = block_magic(block);
+		free_block* f = (free_block*)(block+1);
+		f->next = cache->freeLists[sc];
+		cache->freeLists[sc] = f;
+	}
+	return cache->freeLists[sc];
+}
+
+void* atom_allocate(size_t size)
+{
+	if (size > kMaxSmallSize) {
+		atom_block* block = (atom_block*)malloc(sizeof(atom_block) + size);
+		if (block == NULL) return NULL;
+		block->owner = NULL;
+		block->sizeClass = kNumSizeClasses;
+		block->magic = block_magic(block);
+		atomic_add(&g_largeAllocations, 1);
+		return block+1;
+	}
+
+	const size_t sc = g_classForSize[(size+15)/16];
+	atom_thread_cache* cache = current_cache();
+	if (cache == NULL && (cache=attach_cache()) == NULL) return NULL;
+
+	free_block* f = cache->freeLists[sc];
+	if (f == NULL && (f=refill_cache(cache, sc)) == NULL) return NULL;
+	cache->freeLists[sc] = f->next;
+	cache->allocations[sc]++;
+	return f;
+}
+
+void atom_free(void* ptr)
+{
+	if (ptr == NULL) return;
+
+	atom_block* block = ((atom_block*)ptr)-1;
+	if (block->magic != block_magic(block)) {
+		// Allocated before we were turned on.
+		::operator delete(ptr);
+		return;
+	}
+
+	atom_thread_cache* owner = block->owner;
+	if (owner == NULL) {
+		atomic_add(&g_largeFrees, 1);
+		block->magic = 0;
+		free(block);
+		return;
+	}
+
+	free_block* f = (free_block*)ptr;
+	if (owner == current_cache()) {
+		f->next = owner->freeLists[block->sizeClass];
+		owner->freeLists[block->sizeClass] = f;
+		owner->frees[block->sizeClass]++;
+		return;
+	}
+
+	// Somebody else's block; give it back to them.
+	free_block* head;
+	do {
+		head = owner->remoteFrees;
+		f->next = head;
+	} while (!compare_and_swap_ptr((void* volatile*)&owner->remoteFrees, head, f));
+	atomic_add(&g_remoteFrees, 1);
+}
+
+SValue atom_allocator_stats()
+{
+	SValue result;
+	result.JoinItem(SValue::String("enabled"), SValue::Bool(g_atomAllocatorEnabled));
+	if (!g_atomAllocatorEnabled) return result;
+
+	int64_t allocations[kNumSizeClasses];
+	int64_t frees[kNumSizeClasses];
+	int32_t slabs[kNumSizeClasses];
+	int32_t caches = 0, threads = 0;
+	for (size_t i=0; i<kNumSizeClasses; i++) {
+		allocations[i] = frees[i] = 0;
+		slabs[i] = 0;
+	}
+
+	SysCriticalSectionEnter(&g_cachesLock);
+	for (atom_thread_cache* cache = g_caches; cache != NULL; cache = cache->nextCache) {
+		caches++;
+		if (cache->inUse) threads++;
+		for (size_t i=0; i<kNumSizeClasses; i++) {
+			allocations[i] += cache->allocations[i];
+			frees[i] += cache->frees[i];
+			slabs[i] += cache->slabs[i];
+		}
+	}
+	SysCriticalSectionExit(&g_cachesLock);
+
+	result.JoinItem(SValue::String("caches"), SValue::Int32(caches));
+	result.JoinItem(SValue::String("threads"), SValue::Int32(threads));
+	result.JoinItem(SValue::String("large_allocations"), SValue::Int32(g_largeAllocations));
+	result.JoinItem(SValue::String("large_frees"), SValue::Int32(g_largeFrees));
+	result.JoinItem(SValue::String("remote_frees"), SValue::Int32(g_remoteFrees));
+
+	SValue classes;
+	for (size_t i=0; i<kNumSizeClasses; i++) {
+		if (slabs[i] == 0) continue;
+		const size_t blocks = kSlabSize/(sizeof(atom_block) + kSizeClasses[i]);
+		SValue sc;
+		sc.JoinItem(SValue::String("allocations"), SValue::Int64(allocations[i]));
+		sc.JoinItem(SValue::String("in_use"), SValue::Int64(allocations[i]-frees[i]));
+		sc.JoinItem(SValue::String("slabs"), SValue::Int32(slabs[i]));
+		sc.JoinItem(SValue::String("blocks"), SValue::Int32(slabs[i]*blocks));
+		classes.JoinItem(SValue::Int32(kSizeClasses[i]), sc);
+	}
+	if (classes.IsDefined()) result.JoinItem(SValue::String("classes"), classes);
+
+	return result;
+}
+
+#if _SUPPORTS_NAMESPACE
+} }	// namespace palmos::support
+#endif
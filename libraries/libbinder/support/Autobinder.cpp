@@ -164,6 +164,20 @@ execute_autobinder(uint32_t code, const sptr<IInterface>& target,
 {
 	// Get the position in the array of the action.
 	uint32_t index = (uint32_t)data.ReadInt32();
+
+	// Calls by method ID go straight to the function at that index.  If
+	// the caller was built from a different version of the interface the
+	// ID won't match; tell it so, and it will send the name instead.
+	if (code == B_INVOKE_ID_TRANSACTION) {
+		const uint32_t id = (uint32_t)data.ReadInt32();
+		if (index >= def_count) return B_BINDER_UNKNOWN_TRANSACT;
+		const BAutobinderDef * const def = defs[index];
+		if (def->invoke == NULL || def->methodID == 0 || def->methodID != id) {
+			return B_BINDER_UNKNOWN_TRANSACT;
+		}
+		return def->invoke->localFunc(target, &data, reply);
+	}
+
 	if (index >= def_count) {
 #if BUILD_TYPE == BUILD_TYPE_DEBUG
 		char msg[200];
@@ -241,6 +255,26 @@ execute_autobinder(uint32_t code, const sptr<IInterface>& target,
 }
 
 
+char g_autobinderInvokeByIdEnvVar[] = "AUTOBINDER_INVOKE_BY_ID";
+static BDebugInteger<g_autobinderInvokeByIdEnvVar, 1, 0, 1> g_autobinderInvokeByIdEnv;
+
+// -1 until set_autobinder_invoke_by_id() overrides the environment.
+static int32_t g_autobinderInvokeById = -1;
+
+bool
+autobinder_invoke_by_id()
+{
+	const int32_t byId = g_autobinderInvokeById;
+	return (byId >= 0 ? byId : g_autobinderInvokeByIdEnv.Get()) != 0;
+}
+
+void
+set_autobinder_invoke_by_id(bool enabled)
+{
+	g_autobinderInvokeById = enabled ? 1 : 0;
+}
+
+
 status_t
 parameter_to_value(type_code type, const struct PTypeMarshaller* marshaller, const void *value, SValue *out)
 {
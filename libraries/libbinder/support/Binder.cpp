@@ -160,6 +160,88 @@ public:
 	}
 };
 
+// A oneway call that has been accepted but not run yet.
+struct oneway_call
+{
+	oneway_call* next;
+	sptr<IBinder> target;
+	SParcel data;
+};
+
+// Runs a binder's oneway calls, one at a time and in the order
+// they were queued.  The calls are kept here; the 'onew' message
+// only says that there is something to run.
+class OneWayHandler : public BHandler
+{
+public:
+	OneWayHandler()
+		:	m_lock("OneWayHandler calls"), m_head(NULL), m_tail(NULL)
+	{
+	}
+	
+	virtual ~OneWayHandler()
+	{
+		free_calls(m_head);
+	}
+	
+	status_t Enqueue(oneway_call* call)
+	{
+		call->next = NULL;
+		m_lock.Lock();
+		if (m_tail) m_tail->next = call;
+		else m_head = call;
+		m_tail = call;
+		m_lock.Unlock();
+		
+		// One pending message runs everything queued before it is handled.
+		SMessage msg('onew', SLooper::ThreadPriority());
+		// Make sure the handler doesn't go away until this message is processed.
+		msg.JoinItem(B_0_INT32, SValue::Atom(this));
+		status_t err = PostMessage(msg, POST_KEEP_UNIQUE);
+		if (err != B_OK) free_calls(take_calls());
+		return err;
+	}
+	
+	virtual status_t HandleMessage(const SMessage& msg)
+	{
+		if (msg.What() == 'onew')
+		{
+			oneway_call* call = take_calls();
+			while (call != NULL) {
+				oneway_call* next = call->next;
+				call->target->Transact(B_INVOKE_TRANSACTION, call->data, NULL);
+				delete call;
+				call = next;
+			}
+		}
+
+		return B_OK;
+	}
+
+private:
+	oneway_call* take_calls()
+	{
+		m_lock.Lock();
+		oneway_call* calls = m_head;
+		m_head = m_tail = NULL;
+		m_lock.Unlock();
+		return calls;
+	}
+	
+	static void free_calls(oneway_call* call)
+	{
+		while (call != NULL) {
+			oneway_call* next = call->next;
+			delete call;
+			call = next;
+		}
+	}
+	
+	SLocker m_lock;
+	oneway_call* m_head;
+	oneway_call* m_tail;
+};
+
 struct BBinder::extensions {
 	extensions();
 	extensions(const extensions& other);
@@ -168,6 +250,7 @@ struct BBinder::extensions {
 	SKeyedVector<SValue,SVector<links_rec> > links;
 	SVector<links_rec> other_links;
 	sptr<AsyncHandler> handler;			// unused if LIBBE_BOOTSTRAP
+	sptr<OneWayHandler> oneway;			// unused if LIBBE_BOOTSTRAP
 };
 
 struct EffectCache {
@@ -246,6 +329,9 @@ IInterface::ExecAsInterface(const sptr<IBinder>& binderIn,
 	sptr<IInterface> interface;
 	
 	if (binderIn != NULL) {
+		// This is done for local objects too, even though they could
+		// answer InterfaceFor() directly: some of them hide interfaces
+		// in Inspect().  See @ref LocalAsInterfaceInspects.
 		sptr<IBinder> binder = NULL;
 		SValue inspected = binderIn->Inspect(binderIn, descriptor);
 		// if we are dealing with a binder reported dead, then
@@ -1032,33 +1118,13 @@ BBinder::Transact(uint32_t code, SParcel& data, SParcel* reply, uint32_t /*flags
 		//	bout << "BBinder::Transact/INVOKE out value: " << out << endl;
 		
 		if (reply && err == B_OK) {
-			size_t required = 0;
-
-			// 1. calculate how much space is needed in the parcel
+			// Write the parcel in one pass; it grows as needed.
 			// return value
 			SValue returned = out[key_result];
-			required += returned.ArchivedSize();
-				
-			// inout and out parameters
-			SValue out_key, out_value;
-			int32_t i, j, out_count = out.CountItems()-(returned.IsDefined()?1:0);
-			for (i=0, j=0; j<out_count; i++) {
-				SValue out_param = out[SValue::Int32(i)];
-				if (out_param.IsDefined()) {
-					j++;
-				}
-				required += out_param.ArchivedSize();
-			}
-
-			// 2. allocate in the parcel
-			err = reply->Reserve(required);
-			if (err != B_OK) return err;
-			
-			// 3. write the parcel
-			// return value
 			reply->WriteValue(returned);
 				
 			// inout and out parameters
+			int32_t i, j, out_count = out.CountItems()-(returned.IsDefined()?1:0);
 			for (i=0, j=0; j<out_count; i++) {
 				SValue out_param = out[SValue::Int32(i)];
 				if (out_param.IsDefined()) {
@@ -1085,7 +1151,6 @@ BBinder::Transact(uint32_t code, SParcel& data, SParcel* reply, uint32_t /*flags
 		int32_t flags = data.ReadInt32();
 
 		const SValue result = Inspect(caller, which, flags);
-		reply->Reserve(result.ArchivedSize());
 		return reply->WriteValue(result);
 	}
 	else if (code == B_GET_TRANSACTION)
@@ -1131,12 +1196,18 @@ BBinder::Transact(uint32_t code, SParcel& data, SParcel* reply, uint32_t /*flags
 				
 		return Effect(in, B_WILD_VALUE, B_UNDEFINED_VALUE, &replyValue);
 	}
-	else if (code == B_EFFECT_TRANSACTION)
+	else if (code == B_EFFECT_TRANSACTION || code == B_EFFECT_COMPACT_TRANSACTION)
 	{
 		SValue values[3];
 		SValue replyValue;
 		SValue val;
 		
+		// The reply is encoded the same way as the request.
+		if (code == B_EFFECT_COMPACT_TRANSACTION) {
+			data.SetCompactValues(true);
+			if (reply) reply->SetCompactValues(true);
+		}
+
 		ssize_t status = data.GetValues(3, values);
 		if (status < B_OK) return status;
 		
@@ -1192,6 +1263,50 @@ BBinder::Transact(uint32_t code, SParcel& data, SParcel* reply, uint32_t /*flags
 		reply->Reserve(sizeof(int32_t));
 		return reply->WriteInt32(Unlink(node, binding, flags));
 	}
+	else if (code == B_INVOKE_ONEWAY_TRANSACTION)
+	{
+		// Keep a copy of the call and return right away; the caller
+		// doesn't wait for the call to run.  (If it came in as a one-way
+		// transaction it isn't waiting at all, and @a reply is NULL.)
+		oneway_call* call = new oneway_call;
+		if (call == NULL) return B_NO_MEMORY;
+		call->target = this;
+		status_t err = call->data.Copy(data);
+		if (err != B_OK) {
+			delete call;
+			return err;
+		}
+
+#if !LIBBE_BOOTSTRAP
+		extensions *e;
+		if (!m_extensions) {
+			e = new extensions;
+			if (!compare_and_swap_ptr(reinterpret_cast<void* volatile*>(&m_extensions),
+									  NULL, e)) {
+				delete e;
+			}
+		}
+		if ((e=m_extensions) == NULL) {
+			delete call;
+			return B_NO_MEMORY;
+		}
+
+		e->lock.Lock();
+		if (e->oneway == NULL) e->oneway = new OneWayHandler();
+		sptr<OneWayHandler> handler(e->oneway);
+		e->lock.Unlock();
+
+		if (handler == NULL) {
+			delete call;
+			return B_NO_MEMORY;
+		}
+		return handler->Enqueue(call);
+#else
+		err = Transact(B_INVOKE_TRANSACTION, call->data, NULL);
+		delete call;
+		return err;
+#endif
+	}
 	else if (code == B_PING_TRANSACTION)
 	{
 		status_t status = PingBinder();
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include "BinderTransport.h"
+
+#include <support/StdIO.h>
+#include <support/VectorIO.h>
+#include <support/atomic.h>
+#include <support_p/binder_broker.h>
+#include <ErrorMgr.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+BinderTransport::BinderTransport()
+{
+}
+
+BinderTransport::~BinderTransport()
+{
+}
+
+bool BinderTransport::SupportsGather() const
+{
+	return false;
+}
+
+uint32_t BinderTransport::Features() const
+{
+	return 0;
+}
+
+// -----------------------------------------------------------
+// The binder kernel module.
+// -----------------------------------------------------------
+
+class KernelBinderTransport : public BinderTransport
+{
+public:
+	static	KernelBinderTransport*	Open(size_t vmSize);
+
+	virtual						~KernelBinderTransport();
+
+	virtual	const char*			Name() const { return "kernel"; }
+	virtual	int32_t				OpenThread() { return m_desc; }
+	virtual	void				CloseThread(int32_t) { }
+	virtual	status_t			Control(int32_t desc, uint32_t cmd, void* data, size_t size);
+	virtual	uint32_t			Features() const { return m_features; }
+
+private:
+								KernelBinderTransport(int32_t desc, void* vmStart, size_t vmSize,
+													  uint32_t features);
+
+			int32_t				m_desc;
+			void*				m_vmStart;
+			size_t				m_vmSize;
+			uint32_t			m_features;
+};
+
+KernelBinderTransport* KernelBinderTransport::Open(size_t vmSize)
+{
+	int32_t fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		berr << "Opening '/dev/binder' failed: " << strerror(errno) << endl;
+		return NULL;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	binder_version_t vers;
+	if (ioctl(fd, BINDER_VERSION, &vers) == -1) {
+		berr << "binder ioctl to obtain version failed: " << strerror(errno) << endl;
+		close(fd);
+		return NULL;
+	}
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		ErrFatalError("Binder driver protocol does not match user space protocol!");
+		close(fd);
+		return NULL;
+	}
+
+	// Older drivers don't know BINDER_FEATURES and have none of them.
+	binder_features_t feat;
+	if (ioctl(fd, BINDER_FEATURES, &feat) == -1) feat.features = 0;
+
+	// mmap the binder, providing a chunk of virtual address space to receive transactions.
+	void* vmStart = mmap(0, vmSize, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	if (vmStart == MAP_FAILED) {
+		// *sigh*
+		berr << "Using /dev/binder failed: unable to mmap transaction memory." << endl;
+		close(fd);
+		return NULL;
+	}
+
+	return new KernelBinderTransport(fd, vmStart, vmSize, feat.features);
+}
+
+KernelBinderTransport::KernelBinderTransport(int32_t desc, void* vmStart, size_t vmSize,
+											 uint32_t features)
+	:	m_desc(desc), m_vmStart(vmStart), m_vmSize(vmSize), m_features(features)
+{
+}
+
+KernelBinderTransport::~KernelBinderTransport()
+{
+	munmap(m_vmStart, m_vmSize);
+	close(m_desc);
+}
+
+status_t KernelBinderTransport::Control(int32_t desc, uint32_t cmd, void* data, size_t /*size*/)
+{
+	return ioctl(desc, cmd, data) >= 0 ? B_OK : -errno;
+}
+
+// -----------------------------------------------------------
+// The user-space broker.  See support_p/binder_broker.h for the
+// framing; the commands themselves are passed through untouched.
+// -----------------------------------------------------------
+
+class BrokerBinderTransport : public BinderTransport
+{
+public:
+	static	BrokerBinderTransport*	Open(size_t vmSize);
+
+	virtual						~BrokerBinderTransport();
+
+	virtual	const char*			Name() const { return "broker"; }
+	virtual	bool				SupportsGather() const { return true; }
+	virtual	uint32_t			Features() const { return m_features; }
+	virtual	int32_t				OpenThread();
+	virtual	void				CloseThread(int32_t desc);
+	virtual	status_t			Control(int32_t desc, uint32_t cmd, void* data, size_t size);
+
+private:
+								BrokerBinderTransport(const char* path, int32_t memDesc,
+													  void* vmStart, size_t vmSize);
+
+			int32_t				_Connect(uint32_t* outFeatures = NULL) const;
+			status_t			_WriteRead(int32_t desc, binder_write_read* bwr);
+			status_t			_Call(int32_t desc, uint32_t op, const void* arg, size_t size);
+
+			char				m_path[sizeof(((sockaddr_un*)0)->sun_path)];
+			int32_t				m_memDesc;
+			void*				m_vmStart;
+			size_t				m_vmSize;
+			uint32_t			m_features;
+	volatile int32_t			m_spareDesc;
+};
+
+enum {
+	MAX_BROKER_IOVECS = 32
+};
+
+static status_t send_all(int32_t desc, iovec* iov, int count)
+{
+	while (count > 0) {
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t amt = sendmsg(desc, &msg, MSG_NOSIGNAL);
+		if (amt < 0) {
+			if (errno == EINTR) continue;
+			return (errno == EPIPE || errno == ECONNRESET) ? -ECONNREFUSED : -errno;
+		}
+		while (count > 0 && (size_t)amt >= iov->iov_len) {
+			amt -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (uint8_t*)iov->iov_base + amt;
+			iov->iov_len -= amt;
+		}
+	}
+	return B_OK;
+}
+
+static status_t recv_all(int32_t desc, void* buffer, size_t size)
+{
+	uint8_t* pos = (uint8_t*)buffer;
+	while (size > 0) {
+		ssize_t amt = recv(desc, pos, size, MSG_WAITALL);
+		if (amt < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		// The broker went away; treat it like the driver refusing us.
+		if (amt == 0) return -ECONNREFUSED;
+		pos += amt;
+		size -= amt;
+	}
+	return B_OK;
+}
+
+BrokerBinderTransport* BrokerBinderTransport::Open(size_t vmSize)
+{
+	const char* path = getenv(BINDER_BROKER_ENV);
+	if (path == NULL || *path == 0) path = BINDER_BROKER_DEFAULT_PATH;
+	if (strlen(path) >= sizeof(((sockaddr_un*)0)->sun_path)) {
+		berr << "Binder broker path '" << path << "' is too long." << endl;
+		return NULL;
+	}
+
+	// The transaction memory is a memfd we share with the broker: it
+	// writes incoming transactions into it and we read them in place.
+	int32_t memDesc = memfd_create("binder", MFD_CLOEXEC);
+	if (memDesc < 0) {
+		berr << "Binder broker: memfd_create failed: " << strerror(errno) << endl;
+		return NULL;
+	}
+	if (ftruncate(memDesc, vmSize) != 0) {
+		berr << "Binder broker: unable to size transaction memory: " << strerror(errno) << endl;
+		close(memDesc);
+		return NULL;
+	}
+	void* vmStart = mmap(0, vmSize, PROT_READ, MAP_SHARED | MAP_NORESERVE, memDesc, 0);
+	if (vmStart == MAP_FAILED) {
+		berr << "Binder broker: unable to mmap transaction memory." << endl;
+		close(memDesc);
+		return NULL;
+	}
+
+	BrokerBinderTransport* transport = new BrokerBinderTransport(path, memDesc, vmStart, vmSize);
+
+	// Make sure somebody is listening before we commit to using the broker;
+	// keep that first connection for the first looper.
+	transport->m_spareDesc = transport->_Connect(&transport->m_features);
+	if (transport->m_spareDesc < 0) {
+		delete transport;
+		return NULL;
+	}
+	return transport;
+}
+
+BrokerBinderTransport::BrokerBinderTransport(const char* path, int32_t memDesc,
+											 void* vmStart, size_t vmSize)
+	:	m_memDesc(memDesc), m_vmStart(vmStart), m_vmSize(vmSize), m_features(0), m_spareDesc(-1)
+{
+	strcpy(m_path, path);	// length checked by Open()
+}
+
+BrokerBinderTransport::~BrokerBinderTransport()
+{
+	if (m_spareDesc >= 0) close(m_spareDesc);
+	munmap(m_vmStart, m_vmSize);
+	close(m_memDesc);
+}
+
+int32_t BrokerBinderTransport::_Connect(uint32_t* outFeatures) const
+{
+	int32_t desc = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (desc < 0) return -errno;
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, m_path);
+	if (connect(desc, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		status_t err = -errno;
+		close(desc);
+		return err;
+	}
+
+	broker_hello hello;
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = BINDER_BROKER_MAGIC;
+	hello.protocol_version = BINDER_CURRENT_PROTOCOL_VERSION;
+	hello.pid = getpid();
+	hello.vm_start = (uint64_t)(uintptr_t)m_vmStart;
+	hello.vm_size = m_vmSize;
+
+	// Every connection carries the memfd; the broker keeps the first one
+	// it sees for this process and closes the rest.
+	iovec iov = { &hello, sizeof(hello) };
+	char control[CMSG_SPACE(sizeof(int))];
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &m_memDesc, sizeof(int));
+
+	ssize_t amt;
+	do {
+		amt = sendmsg(desc, &msg, MSG_NOSIGNAL);
+	} while (amt < 0 && errno == EINTR);
+
+	broker_reply reply;
+	status_t err = (amt == (ssize_t)sizeof(hello)) ? recv_all(desc, &reply, sizeof(reply)) : -errno;
+	if (err == B_OK) err = reply.status;
+	if (err != B_OK) {
+		if (err == -EPROTO) {
+			ErrFatalError("Binder broker protocol does not match user space protocol!");
+		}
+		close(desc);
+		return err;
+	}
+	if (outFeatures) *outFeatures = reply.features;
+	return desc;
+}
+
+int32_t BrokerBinderTransport::OpenThread()
+{
+	int32_t desc = m_spareDesc;
+	if (desc >= 0 && compare_and_swap32(&m_spareDesc, desc, -1)) return desc;
+
+	desc = _Connect();
+	if (desc < 0) {
+		berr << "Connecting to binder broker '" << m_path << "' failed: " << strerror(-desc) << endl;
+	}
+	return desc;
+}
+
+void BrokerBinderTransport::CloseThread(int32_t desc)
+{
+	if (desc >= 0) close(desc);
+}
+
+status_t BrokerBinderTransport::Control(int32_t desc, uint32_t cmd, void* data, size_t size)
+{
+	if (desc < 0) return -EBADF;
+
+	switch (cmd) {
+		case BINDER_WRITE_READ:
+			return _WriteRead(desc, (binder_write_read*)data);
+		case BINDER_SET_CONTEXT_MGR:
+			return _Call(desc, BROKER_OP_SET_CONTEXT_MGR, data, size);
+		case BINDER_SET_WAKEUP_TIME:
+			return _Call(desc, BROKER_OP_SET_WAKEUP_TIME, data, size);
+		case BINDER_THREAD_EXIT:
+			return _Call(desc, BROKER_OP_THREAD_EXIT, data, size);
+	}
+	return -EINVAL;
+}
+
+status_t BrokerBinderTransport::_Call(int32_t desc, uint32_t op, const void* arg, size_t size)
+{
+	broker_request req;
+	req.op = op;
+	req.write_size = 0;
+	req.read_size = 0;
+	req.arg_size = size;
+
+	iovec iov[2] = { { &req, sizeof(req) }, { const_cast<void*>(arg), size } };
+	status_t err = send_all(desc, iov, size > 0 ? 2 : 1);
+	if (err != B_OK) return err;
+
+	broker_reply reply;
+	err = recv_all(desc, &reply, sizeof(reply));
+	return err != B_OK ? err : reply.status;
+}
+
+status_t BrokerBinderTransport::_WriteRead(int32_t desc, binder_write_read* bwr)
+{
+	broker_request req;
+	req.op = BROKER_OP_WRITE_READ;
+	req.write_size = bwr->write_size;
+	req.read_size = bwr->read_size;
+	req.arg_size = 0;
+
+	iovec iov[MAX_BROKER_IOVECS];
+	int count = 0;
+	iov[count].iov_base = &req;
+	iov[count++].iov_len = sizeof(req);
+	if (bwr->write_size > 0) {
+		iov[count].iov_base = (void*)bwr->write_buffer;
+		iov[count++].iov_len = bwr->write_size;
+	}
+
+	// The driver would copy transaction data straight out of our address
+	// space; the broker can't, so it follows the commands on the socket.
+	const uint8_t* pos = (const uint8_t*)bwr->write_buffer;
+	const uint8_t* end = pos + bwr->write_size;
+	status_t err;
+	while (pos+sizeof(int32_t) <= end) {
+		const int32_t cmd = *(const int32_t*)pos;
+		const int32_t size = broker_command_size(cmd);
+		if (size < 0) return -EINVAL;
+		pos += sizeof(int32_t);
+		if (cmd == bcTRANSACTION || cmd == bcREPLY) {
+			const binder_transaction_data* tr = (const binder_transaction_data*)pos;
+			if (count+2 > MAX_BROKER_IOVECS) {
+				if ((err=send_all(desc, iov, count)) != B_OK) return err;
+				count = 0;
+			}
+			if ((tr->flags&tfGather) != 0) {
+				// The data is in pieces; hand them all to the socket
+				// rather than copying them together.
+				const SVectorIO* gather = (const SVectorIO*)tr->data.ptr.buffer;
+				const iovec* vec = gather->Vectors();
+				const ssize_t N = gather->CountVectors();
+				for (ssize_t i=0; i<N; i++) {
+					if (count+2 > MAX_BROKER_IOVECS) {
+						if ((err=send_all(desc, iov, count)) != B_OK) return err;
+						count = 0;
+					}
+					iov[count++] = vec[i];
+				}
+			} else if (tr->data_size > 0) {
+				iov[count].iov_base = const_cast<void*>(tr->data.ptr.buffer);
+				iov[count++].iov_len = tr->data_size;
+			}
+			if (tr->offsets_size > 0) {
+				iov[count].iov_base = const_cast<void*>(tr->data.ptr.offsets);
+				iov[count++].iov_len = tr->offsets_size;
+			}
+		}
+		pos += size;
+	}
+	if (count > 0 && (err=send_all(desc, iov, count)) != B_OK) return err;
+
+	// This is where we block, just like the ioctl, until there is
+	// something to read.
+	broker_reply reply;
+	if ((err=recv_all(desc, &reply, sizeof(reply))) != B_OK) return err;
+	if (reply.read_consumed > (uint32_t)bwr->read_size) return -EPROTO;
+	if (reply.read_consumed > 0
+			&& (err=recv_all(desc, (void*)bwr->read_buffer, reply.read_consumed)) != B_OK) {
+		return err;
+	}
+
+	bwr->write_consumed = reply.write_consumed;
+	bwr->read_consumed = reply.read_consumed;
+	return reply.status;
+}
+
+// -----------------------------------------------------------
+
+BinderTransport* BinderTransport::Open(size_t vmSize)
+{
+	BinderTransport* transport = KernelBinderTransport::Open(vmSize);
+	if (transport == NULL) transport = BrokerBinderTransport::Open(vmSize);
+	return transport;
+}
+
+#if _SUPPORTS_NAMESPACE
+} }	// namespace palmos::support
+#endif
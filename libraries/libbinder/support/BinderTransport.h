@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#ifndef __SUPPORT_BINDERTRANSPORT_H
+#define __SUPPORT_BINDERTRANSPORT_H
+
+#include <support/SupportDefs.h>
+#include <support_p/binder_module.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+// -----------------------------------------------------------
+// BinderTransport
+//
+// The thing SLooper talks the bc*/br* protocol through.  On Linux
+// this is either the binder kernel module (/dev/binder) or, when
+// that is not available, the user-space broker (servers/binderd).
+// Both speak the same command protocol and both place received
+// transaction data in memory mapped read-only into this process,
+// so the rest of SLooper doesn't care which one it has.
+// -----------------------------------------------------------
+
+class BinderTransport
+{
+public:
+	//!	Open the best available transport, or return NULL if there is
+	//!	none (in which case we run single-process).
+	static	BinderTransport*	Open(size_t vmSize);
+
+	virtual						~BinderTransport();
+
+	virtual	const char*			Name() const = 0;
+
+	//!	Return the descriptor a new looper thread should use.
+	virtual	int32_t				OpenThread() = 0;
+	virtual	void				CloseThread(int32_t desc) = 0;
+
+	//!	Perform one of the BINDER_* driver ioctls.  Returns B_OK or
+	//!	a negative errno; never returns -EINTR once data was written.
+	virtual	status_t			Control(int32_t desc, uint32_t cmd, void* data, size_t size) = 0;
+
+	//!	Return true if transactions may be sent with tfGather, their
+	//!	data described by an SVectorIO instead of one buffer.
+	virtual	bool				SupportsGather() const;
+
+	//!	Return the optional protocol features (bf* flags in
+	//!	binder_module.h) the other side understands.
+	virtual	uint32_t			Features() const;
+
+protected:
+								BinderTransport();
+};
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
+
+#endif // __SUPPORT_BINDERTRANSPORT_H
@@ -164,18 +164,26 @@ SConditionVariable::~SConditionVariable()
 	fini_cv(&m_var);
 }
 
+// Bit set while a condition is opened (cvOpened in Threads.cpp).
+// Waiting on it won't block, so don't bother the blocking hook.
+static const int32_t kOpenedCondition = 0x1;
+
 void SConditionVariable::Wait()
 {
+	const bool hooked = (m_var&kOpenedCondition) == 0 && g_enterBlocking && g_enterBlocking();
 	wait_cv(&m_var, NULL);
+	if (hooked) g_exitBlocking();
 }
 
 void SConditionVariable::Wait(SLocker& locker)
 {
+	const bool hooked = (m_var&kOpenedCondition) == 0 && g_enterBlocking && g_enterBlocking();
 	// Need to do a little magic here to not trip
 	// over the lock debugging code -- let it know
 	// that we (may) no longer hold the lock.
 	wait_cv(&m_var, locker.RemoveOwnership());
 	locker.RestoreOwnership();
+	if (hooked) g_exitBlocking();
 }
 
 void SConditionVariable::Open()
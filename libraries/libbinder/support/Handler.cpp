@@ -80,19 +80,25 @@ enum {
 
 SHandler::SHandler()
 	:	m_team(SLooper::Process()), m_lock("Some SHandler"),
-		m_state(ghCanSchedule), m_next(NULL), m_prev(NULL), m_externalLock(NULL)
+		m_state(ghCanSchedule), m_pendingIndex(-1), m_pendingSeq(0),
+		m_pendingTime(B_INFINITE_TIMEOUT),
+		m_runQueue(-1), m_runNext(NULL), m_runPrev(NULL), m_externalLock(NULL)
 {
 }
 
 SHandler::SHandler(SLocker* externalLock)
 	:	m_team(SLooper::Process()), m_lock("Some SHandler"),
-		m_state(ghCanSchedule), m_next(NULL), m_prev(NULL), m_externalLock(externalLock)
+		m_state(ghCanSchedule), m_pendingIndex(-1), m_pendingSeq(0),
+		m_pendingTime(B_INFINITE_TIMEOUT),
+		m_runQueue(-1), m_runNext(NULL), m_runPrev(NULL), m_externalLock(externalLock)
 {
 }
 
 SHandler::SHandler(const SContext& /*context*/)
 	:	m_team(SLooper::Process()), m_lock("Some SHandler"),
-		m_state(ghCanSchedule), m_next(NULL), m_prev(NULL), m_externalLock(NULL)
+		m_state(ghCanSchedule), m_pendingIndex(-1), m_pendingSeq(0),
+		m_pendingTime(B_INFINITE_TIMEOUT),
+		m_runQueue(-1), m_runNext(NULL), m_runPrev(NULL), m_externalLock(NULL)
 {
 }
 
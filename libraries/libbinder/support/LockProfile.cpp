@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include <support_p/LockProfile.h>
+
+#include <support/CallStack.h>
+#include <support/Debug.h>
+#include <support/KeyedVector.h>
+#include <support/StringIO.h>
+#include <support/Vector.h>
+
+#if !LIBBE_BOOTSTRAP
+#include <support/Context.h>
+#include <storage/IndexedDataNode.h>
+#endif
+
+#include <SysThread.h>
+#include <SysThreadConcealed.h>
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+#if _SUPPORTS_NAMESPACE
+using namespace palmos::storage;
+#endif
+
+int32_t g_lockProfilePeriod = 0;
+int32_t g_lockProfileCount = 0;
+
+char g_lockProfileEnvVar[] = "LOCK_PROFILE";
+static BDebugInteger<g_lockProfileEnvVar, 0, 0, 1000000> g_lockProfileEnv;
+char g_lockProfileStackDepthEnvVar[] = "LOCK_PROFILE_STACK_DEPTH";
+static BDebugInteger<g_lockProfileStackDepthEnvVar, 8, 1, B_CALLSTACK_DEPTH> g_lockProfileStackDepthEnv;
+
+static int32_t g_lockProfileStackDepth = 8;
+
+// Distinct call sites kept per lock; the rest are only counted.
+static const size_t kMaxCallers = 64;
+// Call sites reported per lock, most frequent first.
+static const size_t kReportCallers = 10;
+
+struct lock_stats
+{
+	SString								name;
+	int64_t								acquisitions;
+	int64_t								contentions;
+	nsecs_t								waitTime;
+	nsecs_t								maxWait;
+	int64_t								holds;
+	nsecs_t								holdTime;
+	nsecs_t								maxHold;
+	SKeyedVector<SCallStack, int32_t>	callers;
+	int32_t								otherCallers;
+
+	lock_stats() { reset(); }
+	void reset()
+	{
+		acquisitions = contentions = holds = 0;
+		waitTime = maxWait = holdTime = maxHold = 0;
+		callers.MakeEmpty();
+		otherCallers = 0;
+	}
+};
+
+// All of this is protected by a raw critical section rather than an
+// SLocker, which would recursively report itself.  Nothing done while
+// holding it may take an SLocker either.
+static SysCriticalSectionType g_statsLock = sysCriticalSectionInitializer;
+static SVector<lock_stats*>* g_stats = NULL;
+static SKeyedVector<SString, size_t>* g_statsByName = NULL;
+static SKeyedVector<const char*, lock_stats*>* g_statsByPointer = NULL;
+
+static struct lock_profile_init
+{
+	lock_profile_init()
+	{
+		set_lock_profiling(g_lockProfileEnv.Get(), g_lockProfileStackDepthEnv.Get());
+	}
+} g_lockProfileInit;
+
+static lock_stats* stats_for_l(const char* name)
+{
+	if (g_stats == NULL) {
+		g_stats = new SVector<lock_stats*>;
+		g_statsByName = new SKeyedVector<SString, size_t>;
+		g_statsByPointer = new SKeyedVector<const char*, lock_stats*>;
+	}
+
+	// Most names are string constants, so try the pointer first.
+	bool found;
+	lock_stats* stats = g_statsByPointer->ValueFor(name, &found);
+	if (found) return stats;
+
+	const SString key(name);
+	const size_t index = g_statsByName->ValueFor(key, &found);
+	if (found) {
+		stats = g_stats->ItemAt(index);
+	} else {
+		stats = new lock_stats;
+		stats->name = key;
+		g_statsByName->AddItem(key, g_stats->AddItem(stats));
+	}
+	g_statsByPointer->AddItem(name, stats);
+	return stats;
+}
+
+void lock_profile_acquired(const char* name, nsecs_t waited, bool contended)
+{
+	SCallStack stack;
+	if (contended) stack.Update(2, g_lockProfileStackDepth);
+
+	SysCriticalSectionEnter(&g_statsLock);
+	lock_stats* stats = stats_for_l(name);
+	stats->acquisitions++;
+	stats->waitTime += waited;
+	if (waited > stats->maxWait) stats->maxWait = waited;
+	if (contended) {
+		stats->contentions++;
+		bool found;
+		int32_t& count = stats->callers.EditValueFor(stack, &found);
+		if (found) count++;
+		else if (stats->callers.CountItems() < kMaxCallers) stats->callers.AddItem(stack, 1);
+		else stats->otherCallers++;
+	}
+	SysCriticalSectionExit(&g_statsLock);
+}
+
+void lock_profile_released(const char* name, nsecs_t held)
+{
+	SysCriticalSectionEnter(&g_statsLock);
+	lock_stats* stats = stats_for_l(name);
+	stats->holds++;
+	stats->holdTime += held;
+	if (held > stats->maxHold) stats->maxHold = held;
+	SysCriticalSectionExit(&g_statsLock);
+}
+
+void set_lock_profiling(int32_t period, int32_t stackDepth)
+{
+	if (period < 0) period = 0;
+	if (stackDepth < 1) stackDepth = 1;
+	if (stackDepth > B_CALLSTACK_DEPTH) stackDepth = B_CALLSTACK_DEPTH;
+	g_lockProfileStackDepth = stackDepth;
+	g_lockProfilePeriod = period;
+}
+
+void reset_lock_profiling()
+{
+	SysCriticalSectionEnter(&g_statsLock);
+	if (g_stats != NULL) {
+		const size_t N = g_stats->CountItems();
+		for (size_t i=0; i<N; i++) g_stats->ItemAt(i)->reset();
+	}
+	SysCriticalSectionExit(&g_statsLock);
+}
+
+size_t count_lock_profiles()
+{
+	SysCriticalSectionEnter(&g_statsLock);
+	const size_t count = g_stats ? g_stats->CountItems() : 0;
+	SysCriticalSectionExit(&g_statsLock);
+	return count;
+}
+
+SString lock_profile_name_at(size_t index)
+{
+	SString name;
+	SysCriticalSectionEnter(&g_statsLock);
+	if (g_stats && index < g_stats->CountItems()) name = g_stats->ItemAt(index)->name;
+	SysCriticalSectionExit(&g_statsLock);
+	return name;
+}
+
+ssize_t lock_profile_index_of(const SString& name)
+{
+	ssize_t index = B_ENTRY_NOT_FOUND;
+	SysCriticalSectionEnter(&g_statsLock);
+	if (g_statsByName) {
+		bool found;
+		const size_t i = g_statsByName->ValueFor(name, &found);
+		if (found) index = i;
+	}
+	SysCriticalSectionExit(&g_statsLock);
+	return index;
+}
+
+SValue lock_profile_value_at(size_t index)
+{
+	// Copy the numbers out, then build the value without the lock
+	// held: symbol lookup and text formatting take SLockers.
+	SValue result;
+	SVector<SCallStack> stacks;
+	SVector<int32_t> counts;
+	int32_t otherCallers = 0;
+	SysCriticalSectionEnter(&g_statsLock);
+	const bool valid = g_stats && index < g_stats->CountItems();
+	if (valid) {
+		const lock_stats* stats = g_stats->ItemAt(index);
+		result.JoinItem(SValue::String("acquisitions"), SValue::Int64(stats->acquisitions));
+		result.JoinItem(SValue::String("contentions"), SValue::Int64(stats->contentions));
+		result.JoinItem(SValue::String("wait_time"), SValue::Time(stats->waitTime));
+		result.JoinItem(SValue::String("max_wait_time"), SValue::Time(stats->maxWait));
+		result.JoinItem(SValue::String("holds"), SValue::Int64(stats->holds));
+		result.JoinItem(SValue::String("hold_time"), SValue::Time(stats->holdTime));
+		result.JoinItem(SValue::String("max_hold_time"), SValue::Time(stats->maxHold));
+		for (size_t i=0; i<stats->callers.CountItems(); i++) {
+			stacks.AddItem(stats->callers.KeyAt(i));
+			counts.AddItem(stats->callers.ValueAt(i));
+		}
+		otherCallers = stats->otherCallers;
+	}
+	SysCriticalSectionExit(&g_statsLock);
+	if (!valid) return SValue::Status(B_ENTRY_NOT_FOUND);
+
+	// Report the busiest call sites, symbolized here where the
+	// addresses mean something.
+	SValue callers;
+	for (size_t n=0; n<kReportCallers; n++) {
+		ssize_t best = -1;
+		for (size_t i=0; i<counts.CountItems(); i++) {
+			if (counts[i] > 0 && (best < 0 || counts[i] > counts[best])) best = i;
+		}
+		if (best < 0) break;
+
+		sptr<BStringIO> sio(new BStringIO);
+		stacks[best].LongPrint(sio.ptr());
+		SValue caller;
+		caller.JoinItem(SValue::String("count"), SValue::Int32(counts[best]));
+		caller.JoinItem(SValue::String("stack"), SValue::String(sio->String()));
+		callers.JoinItem(SValue::Int32(n), caller);
+		counts.EditItemAt(best) = 0;
+	}
+	if (otherCallers > 0) {
+		callers.JoinItem(SValue::String("other"), SValue::Int32(otherCallers));
+	}
+	if (callers.IsDefined()) result.JoinItem(SValue::String("callers"), callers);
+
+	return result;
+}
+
+#if !LIBBE_BOOTSTRAP
+
+// A live, read-only view of the lock profile.  Each entry is named
+// after a lock and its value is what lock_profile_value_at() returns.
+class LockProfileNode : public BIndexedDataNode
+{
+public:
+	LockProfileNode()
+		:	BIndexedDataNode(IDatum::READ_ONLY)
+	{
+	}
+
+	virtual	ssize_t EntryIndexOfLocked(const SString& entry) const
+	{
+		return lock_profile_index_of(entry);
+	}
+
+	virtual	SString EntryNameAtLocked(size_t index) const
+	{
+		return lock_profile_name_at(index);
+	}
+
+	virtual	size_t CountEntriesLocked() const
+	{
+		return count_lock_profiles();
+	}
+
+	virtual	SValue ValueAtLocked(size_t index) const
+	{
+		return lock_profile_value_at(index);
+	}
+
+	virtual	status_t StoreValueAtLocked(size_t /*index*/, const SValue& /*value*/)
+	{
+		return B_PERMISSION_DENIED;
+	}
+
+	virtual	bool AllowDataAtLocked(size_t /*index*/) const
+	{
+		return true;
+	}
+};
+
+static int32_t g_lockProfilePublished = 0;
+
+status_t publish_lock_profile()
+{
+	// Two callers racing here both publish the same path, which is
+	// harmless.
+	if (g_lockProfilePublished) return B_OK;
+
+	SString path(B_LOCK_PROFILE_PATH);
+	path.PathAppend(SValue::Int32(SysProcessID()).AsString());
+	sptr<INode> node(new LockProfileNode);
+	const status_t err = SContext::UserContext().Publish(path, SValue::Binder(node->AsBinder()));
+	if (err == B_OK) g_lockProfilePublished = 1;
+	return err;
+}
+
+#endif
+
+#if _SUPPORTS_NAMESPACE
+} }	// namespace palmos::support
+#endif
@@ -17,6 +17,7 @@
 #include <support/TLS.h>
 
 #include <support_p/DebugLock.h>
+#include <support_p/LockProfile.h>
 #include <support_p/SupportMisc.h>
 
 #include <stdio.h>
@@ -325,6 +326,11 @@ static inline void unlock_gehnaphore(volatile int32_t* value)
 	g_threadDirectFuncs.criticalSectionExit((SysCriticalSectionType*)value);
 }
 
+static inline bool busy_gehnaphore(volatile int32_t* value)
+{
+	return *value != (int32_t)sysCriticalSectionInitializer;
+}
+
 inline void restore_ownership_gehnaphore(volatile int32_t* /*value*/)
 {
 }
@@ -376,6 +382,11 @@ inline void unlock_gehnaphore(volatile int32_t* value)
 	else if (*value) reinterpret_cast<DebugLock*>(*value)->Unlock();
 }
 
+inline bool busy_gehnaphore(volatile int32_t* value)
+{
+	return !LockDebugLevel() && *value != (int32_t)sysCriticalSectionInitializer;
+}
+
 inline void restore_ownership_gehnaphore(volatile int32_t* value)
 {
 	if (LockDebugLevel() && *value) reinterpret_cast<DebugLock*>(*value)->RestoreOwnership();
@@ -427,11 +438,17 @@ namespace support {
 //#pragma mark -
 
 SLocker::SLocker()
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(NULL), m_heldSince(0)
+#endif
 {
 	init_gehnaphore(&m_lockValue);
 }
 
 SLocker::SLocker(const char* name)
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(name), m_heldSince(0)
+#endif
 {
 	init_gehnaphore(&m_lockValue, name);
 }
@@ -441,17 +458,59 @@ SLocker::~SLocker()
 	fini_gehnaphore(&m_lockValue);
 }
 
+enter_blocking_func g_enterBlocking = NULL;
+exit_blocking_func g_exitBlocking = NULL;
+
 lock_status_t SLocker::Lock()
 {
-	lock_gehnaphore(&m_lockValue);
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) {
+		_LockSampled(false);
+		return lock_status_t((void (*)(void*))_UnlockFunc, this);
+	}
+#endif
+
+	// If we are going to have to wait for the lock, let the blocking
+	// hook know.  (LockQuick() is for short holds, so it doesn't.)
+	if (busy_gehnaphore(&m_lockValue) && g_enterBlocking && g_enterBlocking()) {
+		lock_gehnaphore(&m_lockValue);
+		g_exitBlocking();
+	} else {
+		lock_gehnaphore(&m_lockValue);
+	}
 	return lock_status_t((void (*)(void*))unlock_gehnaphore, (void*)&m_lockValue);
 }
 
 void SLocker::LockQuick()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) _LockSampled(true);
+	else
+#endif
 	lock_gehnaphore(&m_lockValue);
 }
 
+#if SUPPORTS_LOCK_PROFILE
+void SLocker::_LockSampled(bool quick)
+{
+	const bool contended = busy_gehnaphore(&m_lockValue);
+	const nsecs_t start = SysGetRunTime();
+	if (!quick && contended && g_enterBlocking && g_enterBlocking()) {
+		lock_gehnaphore(&m_lockValue);
+		g_exitBlocking();
+	} else {
+		lock_gehnaphore(&m_lockValue);
+	}
+	m_heldSince = SysGetRunTime();
+	lock_profile_acquired(m_name, m_heldSince-start, contended);
+}
+
+void SLocker::_UnlockFunc(SLocker* l)
+{
+	l->Unlock();
+}
+#endif
+
 bool SLocker::IsLocked() const
 {
 #if !SUPPORTS_LOCK_DEBUG
@@ -471,6 +530,16 @@ void SLocker::Yield()
 
 void SLocker::Unlock()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_heldSince != 0) {
+		// Report after releasing; the profiler has its own lock.
+		const nsecs_t held = SysGetRunTime() - m_heldSince;
+		m_heldSince = 0;
+		unlock_gehnaphore(&m_lockValue);
+		lock_profile_released(m_name, held);
+		return;
+	}
+#endif
 	unlock_gehnaphore(&m_lockValue);
 }
 
@@ -481,6 +550,14 @@ void SLocker::RestoreOwnership()
 
 volatile int32_t* SLocker::RemoveOwnership()
 {
+	// A condition variable is about to release the lock behind our
+	// back, so end a sampled hold here.
+#if SUPPORTS_LOCK_PROFILE
+	if (m_heldSince != 0) {
+		lock_profile_released(m_name, SysGetRunTime() - m_heldSince);
+		m_heldSince = 0;
+	}
+#endif
 	return remove_ownership_gehnaphore(&m_lockValue);
 }
 
@@ -491,6 +568,9 @@ volatile int32_t* SLocker::RemoveOwnership()
 //#pragma mark -
 
 SNestedLocker::SNestedLocker()
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(NULL), m_heldSince(0)
+#endif
 {
 	init_gehnaphore(&m_lockValue);
 	m_owner = B_NO_INIT;
@@ -498,6 +578,9 @@ SNestedLocker::SNestedLocker()
 }
 
 SNestedLocker::SNestedLocker(const char* name)
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(name), m_heldSince(0)
+#endif
 {
 	init_gehnaphore(&m_lockValue, name);
 	m_owner = B_NO_INIT;
@@ -515,7 +598,7 @@ lock_status_t SNestedLocker::Lock()
 	if (me == m_owner) {
 		m_ownerCount++;
 	} else {
-		lock_gehnaphore(&m_lockValue);
+		_LockOuter();
 		m_ownerCount = 1;
 		m_owner = me;
 	}
@@ -528,7 +611,7 @@ void SNestedLocker::LockQuick()
 	if (me == m_owner) {
 		m_ownerCount++;
 	} else {
-		lock_gehnaphore(&m_lockValue);
+		_LockOuter();
 		m_ownerCount = 1;
 		m_owner = me;
 	}
@@ -545,10 +628,35 @@ void SNestedLocker::Yield()
 	}
 }
 
+void SNestedLocker::_LockOuter()
+{
+#if SUPPORTS_LOCK_PROFILE
+	// Only the outermost acquisition is profiled.
+	if (m_name != NULL && sample_lock_profile()) {
+		const bool contended = busy_gehnaphore(&m_lockValue);
+		const nsecs_t start = SysGetRunTime();
+		lock_gehnaphore(&m_lockValue);
+		m_heldSince = SysGetRunTime();
+		lock_profile_acquired(m_name, m_heldSince-start, contended);
+		return;
+	}
+#endif
+	lock_gehnaphore(&m_lockValue);
+}
+
 void SNestedLocker::_UnlockFunc(SNestedLocker* l)
 {
 	if (--l->m_ownerCount) return;
 	l->m_owner = B_NO_INIT;
+#if SUPPORTS_LOCK_PROFILE
+	if (l->m_heldSince != 0) {
+		const nsecs_t held = SysGetRunTime() - l->m_heldSince;
+		l->m_heldSince = 0;
+		unlock_gehnaphore(&l->m_lockValue);
+		lock_profile_released(l->m_name, held);
+		return;
+	}
+#endif
 	unlock_gehnaphore(&l->m_lockValue);
 }
 
@@ -574,23 +682,69 @@ int32_t SNestedLocker::NestingLevel() const
 //#pragma mark -
 
 SReadWriteLocker::SReadWriteLocker()
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(NULL), m_writeHeldSince(0)
+#endif
 {
 	pthread_rwlock_init(&m_lock, NULL);
 }
 
+SReadWriteLocker::SReadWriteLocker(const char* name)
+#if SUPPORTS_LOCK_PROFILE
+	:	m_name(name), m_writeHeldSince(0)
+#endif
+{
+	(void)name;
+	pthread_rwlock_init(&m_lock, NULL);
+}
+
 SReadWriteLocker::~SReadWriteLocker()
 {
 	pthread_rwlock_destroy(&m_lock);
 }
 
+#if SUPPORTS_LOCK_PROFILE
+// Readers overlap, so only the wait for a read lock is profiled;
+// write locks report both their wait and their hold time.
+void SReadWriteLocker::_ReadLockSampled()
+{
+	const nsecs_t start = SysGetRunTime();
+	const bool contended = pthread_rwlock_tryrdlock(&m_lock) != 0;
+	if (contended) pthread_rwlock_rdlock(&m_lock);
+	lock_profile_acquired(m_name, SysGetRunTime()-start, contended);
+}
+
+void SReadWriteLocker::_WriteLockSampled()
+{
+	const nsecs_t start = SysGetRunTime();
+	const bool contended = pthread_rwlock_trywrlock(&m_lock) != 0;
+	if (contended) pthread_rwlock_wrlock(&m_lock);
+	m_writeHeldSince = SysGetRunTime();
+	lock_profile_acquired(m_name, m_writeHeldSince-start, contended);
+}
+
+void SReadWriteLocker::_WriteUnlockFunc(SReadWriteLocker* l)
+{
+	l->WriteUnlock();
+}
+#endif
+
 lock_status_t SReadWriteLocker::ReadLock()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) _ReadLockSampled();
+	else
+#endif
 	pthread_rwlock_rdlock(&m_lock);
 	return lock_status_t((void (*)(void*))pthread_rwlock_unlock, (void*)&m_lock);
 }
 
 void SReadWriteLocker::ReadLockQuick()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) _ReadLockSampled();
+	else
+#endif
 	pthread_rwlock_rdlock(&m_lock);
 }
 
@@ -601,17 +755,36 @@ void SReadWriteLocker::ReadUnlock()
 
 lock_status_t SReadWriteLocker::WriteLock()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) {
+		_WriteLockSampled();
+		return lock_status_t((void (*)(void*))_WriteUnlockFunc, this);
+	}
+#endif
 	pthread_rwlock_wrlock(&m_lock);
 	return lock_status_t((void (*)(void*))pthread_rwlock_unlock, (void*)&m_lock);
 }
 
 void SReadWriteLocker::WriteLockQuick()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_name && sample_lock_profile()) _WriteLockSampled();
+	else
+#endif
 	pthread_rwlock_wrlock(&m_lock);
 }
 
 void SReadWriteLocker::WriteUnlock()
 {
+#if SUPPORTS_LOCK_PROFILE
+	if (m_writeHeldSince != 0) {
+		const nsecs_t held = SysGetRunTime() - m_writeHeldSince;
+		m_writeHeldSince = 0;
+		pthread_rwlock_unlock(&m_lock);
+		lock_profile_released(m_name, held);
+		return;
+	}
+#endif
 	pthread_rwlock_unlock(&m_lock);
 }
 #else
@@ -635,6 +808,13 @@ SReadWriteLocker::SReadWriteLocker()
 	}
 }
 
+SReadWriteLocker::SReadWriteLocker(const char* /*name*/)
+{
+	if (SysSemaphoreCreate(0x0000ffff, 0x0000ffff, 0, &m_sem) != B_OK) {
+		DbgOnlyFatalError("Couldn't create semaphore");
+	}
+}
+
 SReadWriteLocker::~SReadWriteLocker()
 {
 	SysSemaphoreDestroy(m_sem);
@@ -664,6 +844,127 @@ void SReadWriteLocker::WriteUnlock()
 
 #endif // TARGET_HOST != TARGET_HOST_WIN32
 
+// -----------------------------------------------------------------
+// ----------------------- SReadMostlyLocker -----------------------
+// -----------------------------------------------------------------
+
+//#pragma mark -
+
+SReadMostlyLocker::SReadMostlyLocker()
+	:	m_writer(0)
+{
+	for (size_t i=0; i<kReaderSlots; i++) m_slots[i].count = 0;
+}
+
+SReadMostlyLocker::SReadMostlyLocker(const char* name)
+	:	m_writeLock(name), m_writer(0)
+{
+	for (size_t i=0; i<kReaderSlots; i++) m_slots[i].count = 0;
+}
+
+SReadMostlyLocker::~SReadMostlyLocker()
+{
+}
+
+static inline size_t current_reader_slot(size_t slots)
+{
+	// Thread handles are heap addresses; drop the low bits, which
+	// are mostly the same from one thread to the next.
+	const size_t me = (size_t)SysCurrentThread();
+	return ((me>>4)^(me>>10)) % slots;
+}
+
+volatile int32_t* SReadMostlyLocker::_LockReadSlot()
+{
+	volatile int32_t* count = &m_slots[current_reader_slot(kReaderSlots)].count;
+
+	while (true) {
+		atomic_add(count, 1);
+		if (m_writer == 0) return count;
+
+		// A writer is waiting or running.  Back out so it can
+		// drain, and wait for it on its lock.
+		atomic_add(count, -1);
+		m_writeLock.Lock();
+		m_writeLock.Unlock();
+	}
+}
+
+void SReadMostlyLocker::_ReadUnlockFunc(volatile int32_t* count)
+{
+	atomic_add(count, -1);
+}
+
+void SReadMostlyLocker::_WaitForReaders()
+{
+	for (size_t i=0; i<kReaderSlots; i++) {
+		int32_t spins = 0;
+		while (m_slots[i].count != 0) {
+			if (++spins < 100) continue;
+			SysThreadDelay(B_MICROSECONDS(10), B_RELATIVE_TIMEOUT);
+		}
+	}
+}
+
+lock_status_t SReadMostlyLocker::ReadLock()
+{
+	return lock_status_t((void (*)(void*))_ReadUnlockFunc, (void*)_LockReadSlot());
+}
+
+void SReadMostlyLocker::ReadLockQuick()
+{
+	_LockReadSlot();
+}
+
+void SReadMostlyLocker::ReadUnlock()
+{
+	atomic_add(&m_slots[current_reader_slot(kReaderSlots)].count, -1);
+}
+
+void SReadMostlyLocker::_WriteUnlockFunc(SReadMostlyLocker* l)
+{
+	l->WriteUnlock();
+}
+
+lock_status_t SReadMostlyLocker::WriteLock()
+{
+	WriteLockQuick();
+	return lock_status_t((void (*)(void*))_WriteUnlockFunc, this);
+}
+
+void SReadMostlyLocker::WriteLockQuick()
+{
+	// The writer lock keeps out other writers and parks readers
+	// that arrive while we are here.
+	m_writeLock.Lock();
+	atomic_or(&m_writer, 1);
+	_WaitForReaders();
+}
+
+void SReadMostlyLocker::WriteUnlock()
+{
+	atomic_and(&m_writer, 0);
+	m_writeLock.Unlock();
+}
+
+void SReadMostlyLocker::Synchronize()
+{
+	// Readers count themselves and then read; we have stored and now
+	// read the counts.  The locked operation keeps our loads below from
+	// moving ahead of the caller's stores, so a reader that isn't counted
+	// yet will see what the caller stored.
+	int32_t fence = 0;
+	atomic_add(&fence, 0);
+
+	for (size_t i=0; i<kReaderSlots; i++) {
+		if (m_slots[i].count != 0) {
+			WriteLockQuick();
+			WriteUnlock();
+			return;
+		}
+	}
+}
+
 #if _SUPPORTS_NAMESPACE
 } }	// namespace palmos::support
 #endif
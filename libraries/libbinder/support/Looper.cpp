@@ -11,6 +11,7 @@
  */
 
 #include "LooperPrv.h"
+#include <support_p/SupportMisc.h>
 #include <SysThreadConcealed.h>
 
 // -----------------------------------------------------------
@@ -131,6 +132,8 @@ void __initialize_looper()
 {
 	g_registeredLock = new SLocker("Registered Loopers");
 	__initialize_looper_platform();
+	g_enterBlocking = SLooper::_EnterBlocking;
+	g_exitBlocking = SLooper::_ExitBlocking;
 
 	// Under Windows and PalmOS, we do not yet have the
 	// full binder process model implemented.  If it was,
@@ -152,6 +155,8 @@ void __stop_looper()
 
 void __terminate_looper()
 {
+	g_enterBlocking = NULL;
+	g_exitBlocking = NULL;
 	__terminate_looper_platform();
 	delete g_registeredLock;
 	g_registeredLock = NULL;
@@ -169,7 +174,8 @@ SLooper::SLooper(const sptr<BProcess>& team)
 		m_priority(-1),
 		m_flags(0),
 		m_lastError(B_OK),
-		m_nextRegistered(NULL)
+		m_nextRegistered(NULL),
+		m_runQueue(-1)
 {
 	tls_set(TLS,this);
 
@@ -384,6 +390,27 @@ SLooper::_ClearSchedulingResumed()
 	This()->m_flags &= ~kSchedulingResumed;
 }
 
+bool
+SLooper::_EnterBlocking()
+{
+	// Only a thread running a handler holds an event slot worth giving
+	// up, and only once: the hook itself takes locks.
+	SLooper* me = (SLooper*)tls_get(TLS);
+	if (me == NULL || me == (SLooper*)1) return false;
+	if ((me->m_flags&(kDispatchingHandler|kHandlerBlocked)) != kDispatchingHandler) return false;
+	me->m_flags |= kHandlerBlocked;
+	me->m_team->HandlerBlocked();
+	return true;
+}
+
+void
+SLooper::_ExitBlocking()
+{
+	SLooper* me = (SLooper*)tls_get(TLS);
+	me->m_team->HandlerUnblocked();
+	me->m_flags &= ~kHandlerBlocked;
+}
+
 #if BINDER_DEBUG_LIB
 int32_t SLooper::_ThreadEntry(void *arg)
 {
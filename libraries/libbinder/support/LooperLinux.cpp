@@ -17,12 +17,17 @@
 #include <support/StopWatch.h>
 #include <support/Handler.h>
 #include <support/INode.h>
+#include <support/VectorIO.h>
 #include <SysThread.h>
 #include <SysThreadConcealed.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/mman.h>
+#include <sys/shm.h>
 #include <syslog.h>
 #include <ErrorMgr.h>
 #include <support/CallStack.h>
@@ -30,6 +35,8 @@
 #include <support_p/binder_module.h>
 #include <support_p/RBinder.h>
 
+#include "BinderTransport.h"
+
 #if _SUPPORTS_NAMESPACE
 namespace palmos {
 namespace support {
@@ -53,14 +60,110 @@ namespace support {
 #	define BUILD_TYPE_STRING "Release"
 #endif
 
-#define ioctl_binder(fd, op, ptr, size) ioctl(fd, op, ptr)
-
 static SLooper::catch_root_func g_catchRootFunc = NULL;
 static bool s_managesContexts = false;
-static int32_t s_binderDesc = -1;
-static void *s_vmstart = MAP_FAILED;
+static BinderTransport* s_transport = NULL;
 static int32_t g_openBuffers = 0;
 
+// Transaction data this large or larger goes through shared memory.
+// Off by default: the segments are owner-only, so it only works between
+// processes of the same user.
+char g_sharedTransactionEnvVar[] = "BINDER_SHM_THRESHOLD";
+static BDebugInteger<g_sharedTransactionEnvVar, 0, 0, 0x7fffffff> g_sharedTransactionEnv;
+static ssize_t g_sharedTransactionThreshold = -1;
+
+// What a tfSharedMemory transaction carries in place of its data.
+struct shared_transaction
+{
+	int32_t		id;
+	uint32_t	size;
+	// Also stored just after the data.  Nobody but the sender's user can
+	// read the segment, so a matching key tells the receiver that the
+	// segment was made for this transaction, rather than being some other
+	// segment the sender named.  Never 0.
+	uint64_t	key;
+};
+
+static volatile int32_t g_randomFD = -1;
+
+static uint64_t make_segment_key()
+{
+	int32_t fd = g_randomFD;
+	if (fd < 0) {
+		fd = open("/dev/urandom", O_RDONLY);
+		if (fd < 0) return 0;
+		if (!compare_and_swap32(&g_randomFD, -1, fd)) {
+			close(fd);
+			fd = g_randomFD;
+		}
+	}
+	uint64_t key;
+	if (read(fd, &key, sizeof(key)) != sizeof(key)) return 0;
+	return key;
+}
+
+static void* create_shared_transaction(const SParcel& data, shared_transaction* desc)
+{
+	const ssize_t size = data.Length();
+	// The receiver won't take a segment without a key.
+	desc->key = make_segment_key();
+	if (desc->key == 0) return NULL;
+	// Only our own user may attach it; the id of every segment is
+	// visible to everyone in /proc/sysvipc/shm.
+	const int id = shmget(IPC_PRIVATE, size + sizeof(desc->key), 0600);
+	if (id == -1) return NULL;
+	void* base = shmat(id, NULL, 0);
+	// Destroy it right away, so it goes away with the last process
+	// detached from it no matter what.  Linux still lets the receiver
+	// attach to it by its id.
+	shmctl(id, IPC_RMID, NULL);
+	if (base == (void*)-1) return NULL;
+	
+	const SVectorIO* gather = data.GatherVectors();
+	if (gather != NULL) gather->Write(base, size);
+	else memcpy(base, data.Data(), size);
+	
+	desc->id = id;
+	desc->size = size;
+	memcpy((uint8_t*)base + size, &desc->key, sizeof(desc->key));
+	return base;
+}
+
+static void free_shared_transaction(const void* data, ssize_t /*len*/, void* /*context*/)
+{
+	shmdt(data);
+}
+
+static void map_shared_transaction(SParcel& buffer)
+{
+	shared_transaction desc;
+	struct shmid_ds info;
+	void* base = (void*)-1;
+	// The sender may name any segment at all, so only take one that
+	// looks like it was made for a transaction by our own user: removed,
+	// owner-only, and exactly the size of the data plus its key.  The
+	// size must be checked before attaching, so we don't read past the
+	// end of the segment because of it.
+	if (buffer.Read(&desc, sizeof(desc)) == sizeof(desc) && desc.key != 0
+			&& shmctl(desc.id, IPC_STAT, &info) == 0
+			&& info.shm_perm.cuid == geteuid()
+			&& (info.shm_perm.mode & 0777) == 0600
+			&& (info.shm_perm.mode & SHM_DEST) != 0
+			&& info.shm_segsz == desc.size + sizeof(desc.key)
+			&& (base=shmat(desc.id, NULL, SHM_RDONLY)) != (void*)-1) {
+		// Nothing is read out of it unless the key matches as well.
+		if (memcmp((const uint8_t*)base + desc.size, &desc.key, sizeof(desc.key)) != 0) {
+			shmdt(base);
+			base = (void*)-1;
+		}
+	}
+	
+	// Give back the driver's buffer; from here on the parcel is the segment.
+	buffer.Free();
+	if (base != (void*)-1) buffer.Reference(base, desc.size, free_shared_transaction, NULL);
+	else buffer.Reference(NULL, B_BAD_VALUE);
+}
+
 #if BINDER_DEBUG_MSGS
 static const char *inString[] = {
 	"brOK",
@@ -97,15 +200,15 @@ SLooper::BecomeContextManager(ContextPermissionCheckFunc checkFunc, void* userDa
 		g_binderContextAccess->Lock();
 		g_binderContextCheckFunc = checkFunc;
 		g_binderContextUserData = userData;
-		if (s_binderDesc >= 0) {
+		if (s_transport != NULL) {
 			int dummy = 0;
-			status_t result = ioctl_binder(s_binderDesc, BINDER_SET_CONTEXT_MGR, &dummy, sizeof(dummy));
-			if (result == 0) {
+			status_t result = s_transport->Control(SLooper::This()->m_binderDesc, BINDER_SET_CONTEXT_MGR, &dummy, sizeof(dummy));
+			if (result == B_OK) {
 				s_managesContexts = true;
-			} else if (result == -1) {
+			} else {
 				g_binderContextCheckFunc = NULL;
 				g_binderContextUserData = NULL;
-				berr << "binder ioctl to become context manager failed: " << strerror(errno) << endl;
+				berr << "binder ioctl to become context manager failed: " << strerror(-result) << endl;
 			}
 		} else {
 			// If there is no driver, our only world is the local
@@ -118,34 +221,6 @@ SLooper::BecomeContextManager(ContextPermissionCheckFunc checkFunc, void* userDa
 	return s_managesContexts;
 }
 
-static int32_t g_haveVersion = 0;
-
-static int32_t open_binder(int ignored)
-{
-	int32_t fd = open("/dev/binder", O_RDWR);
-	if (fd >= 0) {
-		fcntl(fd, F_SETFD, FD_CLOEXEC);
-		if (!g_haveVersion) {
-			binder_version_t vers;
-			status_t result = ioctl_binder(fd, BINDER_VERSION, &vers, sizeof(vers));
-			if (result == -1) {
-				berr << "binder ioctl to obtain version failed: " << strerror(errno) << endl;
-				close(fd);
-				fd = -1;
-			}
-			if (result != 0 || vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
-				ErrFatalError("Binder driver protocol does not match user space protocol!");
-				close(fd);
-				fd = -1;
-			}
-		}
-		
-	} else {
-		berr << "Opening '/dev/binder' failed: " << strerror(errno) << endl;
-	}
-	return fd;
-}
-
 void __initialize_looper_platform()
 {
 	//printf("__initialize_looper_platform()\n");
@@ -155,17 +230,9 @@ void __initialize_looper_platform()
 	g_systemDirectoryLock = new SLocker("g_systemDirectory");
 	g_systemDirectory = new SString();
 
-	s_binderDesc = open_binder(0);
-	if (s_binderDesc >= 0) {
-		// mmap the binder, providing a chunk of virtual address space to receive transactions.
-		s_vmstart = mmap(0, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, s_binderDesc, 0);
-		if (s_vmstart == MAP_FAILED) {
-			// *sigh*
-			berr << "Using /dev/binder failed: unable to mmap transaction memory." << endl;
-			close(s_binderDesc);
-			s_binderDesc = -1;
-		}
-	} else {
+	// Use the binder driver if we have one, else the user-space broker.
+	s_transport = BinderTransport::Open(BINDER_VM_SIZE);
+	if (s_transport == NULL) {
 		// Prime the thread pool.
 		SLooper::SpawnLooper();
 	}
@@ -201,8 +268,8 @@ void __terminate_looper_platform()
 	delete g_systemDirectory;
 	g_systemDirectory = NULL;
 
-	if (s_vmstart != MAP_FAILED) munmap(s_vmstart, BINDER_VM_SIZE);
-	if (s_binderDesc >= 0) close(s_binderDesc);
+	delete s_transport;
+	s_transport = NULL;
 }
 
 SContext get_default_context()
@@ -298,8 +365,7 @@ void SLooper::_ConstructPlatform()
 	SysThreadExitCallbackID idontcare;
 	SysThreadInstallExitCallback(_DeleteSelf, this, &idontcare);
 
-	pthread_cond_init(&m_condition, NULL);
-	pthread_mutex_init(&m_mutex, NULL);
+	m_binderDesc = s_transport ? s_transport->OpenThread() : -1;
 	
 #if BINDER_DEBUG_MSGS
 	// berr	<< "SLooper: enter new looper #" << Process()->LooperCount() << " " << this << /* " ==> Thread=" << find_thread(NULL) << ", keyId=" << m_keyID << */ endl;
@@ -310,8 +376,11 @@ void SLooper::_DestroyPlatform()
 {
 	int dummy = 0;
 	status_t result = B_OK;
-	if (s_binderDesc >= 0)
-		ioctl_binder(s_binderDesc, BINDER_THREAD_EXIT, &dummy, sizeof(dummy));
+	if (s_transport && m_binderDesc >= 0) {
+		s_transport->Control(m_binderDesc, BINDER_THREAD_EXIT, &dummy, sizeof(dummy));
+		s_transport->CloseThread(m_binderDesc);
+		m_binderDesc = -1;
+	}
 #if BINDER_DEBUG_MSGS
 	// berr	<< "SLooper: exit new looper #" << Process()->LooperCount() << " " << this << /* " ==> Thread=" << find_thread(NULL) <<  ", keyId=" << m_keyID << */ endl;
 #endif
@@ -336,11 +405,27 @@ status_t SLooper::SpawnLooper()
 	return err;
 }
 
+const char* SLooper::TransportName()
+{
+	return s_transport != NULL ? s_transport->Name() : "none";
+}
+
+ssize_t SLooper::SharedTransactionThreshold()
+{
+	return g_sharedTransactionThreshold >= 0
+		? g_sharedTransactionThreshold : g_sharedTransactionEnv.Get();
+}
+
+void SLooper::SetSharedTransactionThreshold(ssize_t bytes)
+{
+	g_sharedTransactionThreshold = bytes;
+}
+
 static bool g_singleProcess = false;
 static bool g_knowSingleProcess = false;
 bool SLooper::SupportsProcesses()
 {
-	return s_binderDesc >= 0;
+	return s_transport != NULL;
 	
 	if (!g_knowSingleProcess) {
 		char* singleproc = getenv("BINDER_SINGLE_PROCESS");
@@ -392,8 +477,8 @@ bool SLooper::_SetNextEventTime(nsecs_t when, int32_t priority)
 	// FFB: specifying a relative time makes the kernel driver much simpler, for now.
 	wakeup.time = when - SysGetRunTime();
 	wakeup.priority = priority;
-	if (s_binderDesc >= 0) {
-		ioctl_binder(s_binderDesc, BINDER_SET_WAKEUP_TIME, &wakeup, sizeof(wakeup));
+	if (s_transport != NULL) {
+		s_transport->Control(looper->m_binderDesc, BINDER_SET_WAKEUP_TIME, &wakeup, sizeof(wakeup));
 	
 		// return false to indicate that the driver will take care
 		// of scheduling the next event.
@@ -536,18 +621,27 @@ int32_t SLooper::_LoopTransactionSelf()
 }
 */
 
+// An idle looper parks on its own m_signaled word, so waking it is a
+// single FUTEX_WAKE aimed at exactly that thread.
+static inline int futex_wait(volatile int32_t* addr, int32_t value, const struct timespec* timeout)
+{
+	return syscall(SYS_futex, (int32_t*)addr, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+static inline int futex_wake(volatile int32_t* addr, int32_t count)
+{
+	return syscall(SYS_futex, (int32_t*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
 void SLooper::_Signal()
 {
-	// Do we need the locks?
-	m_signalLock.Lock();
-	m_signaled++;
-	int result = pthread_cond_broadcast(&m_condition);
-	m_signalLock.Unlock();
+	SysAtomicInc32(&m_signaled);
+	futex_wake(&m_signaled, 1);
 }
 
 int32_t SLooper::_LoopSelf()
 {
-	if (s_binderDesc >= 0) {
+	if (s_transport != NULL) {
 		// Loop style when working with the driver.
 		// berr << "SLooper::_LoopSelf(): entering " << this << " (" << m_thid << ")@" << system_time() << endl;
 		// The main thread may be calling us after doing initialization.
@@ -624,68 +718,46 @@ int32_t SLooper::_LoopSelf()
 		// store the time we started to block at
 		m_lastTimeISlept = SysGetRunTime();
 
-
-		struct timespec abstime;
-		clock_gettime(CLOCK_REALTIME, &abstime);
-		
-		// residue of nanoseconds: nanoseconds fragment from realtime, with
-		// total timeout (in nanoseconds): we have to carry seconds into 
-		// the realtime seconds
-		nsecs_t part_abs_nano = abstime.tv_nsec + timeout;
-
-		abstime.tv_sec += part_abs_nano / B_ONE_SECOND;
-		abstime.tv_nsec = part_abs_nano % B_ONE_SECOND;
-		if (abstime.tv_nsec < 0) 
-		{ 
-			// requires tv_nsec to be signed field
-			// the residue of a negative timeout can result
-			// in a negative nanoseconds field. Since it will
-			// be abolutely less than one second, we can compensate
-			// simply by borrowing back one second
-			abstime.tv_sec -= 1;
-			abstime.tv_nsec += B_ONE_SECOND;
-		}
-		
-		// By the time we get here, a negative timeout has been converted
-		// into an absolute timeout. It is in the past, but should still be
-		// a legal timespec
-	
+		// Park until _Signal() bumps m_signaled or the timeout elapses.
+		// The futex only sleeps while m_signaled is still zero, so a
+		// signal that arrives before we get here is never lost.
 		int result = 0;
-		m_signalLock.Lock();
 		if (m_signaled == 0)
 		{
-			m_signalLock.Unlock();
-			pthread_mutex_lock(&m_mutex);
-			result = pthread_cond_timedwait(&m_condition, &m_mutex, &abstime);
-			pthread_mutex_unlock(&m_mutex);
-			m_signalLock.Lock();
+			if (timeout > 0)
+			{
+				struct timespec reltime;
+				reltime.tv_sec = timeout / B_ONE_SECOND;
+				reltime.tv_nsec = timeout % B_ONE_SECOND;
+				if (futex_wait(&m_signaled, 0, &reltime) < 0) result = errno;
+			}
+			else
+			{
+				result = ETIMEDOUT;
+			}
 		}
-		m_signalLock.Unlock();
 
 		//berr << "Looper " << this << " woke up! " << result << endl;
 		
+		if (m_signaled != 0)
+		{
+			// I didn't time out.  This only happens if someone raises my event,
+			// which means they popped me off the stack to be rescheduled.  Push
+			// back on and continue to pick up the new timeout.
+	//		berr << "Looper " << this << " poked!  Push and continue. GetNext() = " << looper->GetNext() << " result = " << result << endl;
+			Process()->PushLooper(looper);
+			SysAtomicDec32(&m_signaled);
+			continue;
+		}
+
 		if (result != ETIMEDOUT)
 		{
-			if (result == B_OK)
-			{
-				// I didn't time out.  This only happens if someone raises my event,
-				// which means they popped me off the stack to be rescheduled.  Push
-				// back on and continue to pick up the new timeout.
-		//		berr << "Looper " << this << " poked!  Push and continue. GetNext() = " << looper->GetNext() << " result = " << result << endl;
-				Process()->PushLooper(looper);
-				m_signalLock.Lock();
-				m_signaled--;
-				m_signalLock.Unlock();
-			}
-			else
+			// Woken without a signal (EINTR or a spurious wakeup); just
+			// pick up the new timeout and park again.
+			if (result != 0 && result != EINTR && result != EAGAIN)
 			{
-				berr << "[SLooper]: pthread_cond_timedwait returned: " << strerror(result) << endl;
-			  	if (result == EINVAL)
-				{
-					berr << indent << SPrintf("abstime = (%d,%d)", abstime.tv_sec, abstime.tv_nsec) << endl;  
-				}
-
-				DbgOnlyFatalError("pthread_cond_timedwait returned an unusual status");
+				berr << "[SLooper]: futex wait returned: " << strerror(result) << endl;
+				DbgOnlyFatalError("futex wait returned an unusual status");
 			}
 			continue;
 		}
@@ -923,6 +995,7 @@ SLooper::_HandleCommand(int32_t cmd)
 			SParcel buffer(tr.data.ptr.buffer, tr.data_size, _BufferFree, this);
 			// syslog(LOG_DEBUG, "brTRANSACTION data: %d, offsets: %d\n", tr.data_size, tr.offsets_size);
 			buffer.SetBinderOffsets(tr.data.ptr.offsets, tr.offsets_size, false);
+			if ((tr.flags&tfSharedMemory) != 0) map_shared_transaction(buffer);
 			m_priority = tr.priority;
 			
 #if BINDER_TRANSACTION_MSGS
@@ -949,14 +1022,23 @@ SLooper::_HandleCommand(int32_t cmd)
 #endif
 
 				sptr<BBinder> b((BBinder*)tr.target.ptr);
-				SParcel reply(_BufferReply, this);
-				const status_t error = b->Transact(tr.code, buffer, &reply, 0);
-				if (error < B_OK) reply.Reference(NULL, error);
+				if ((tr.flags&tfOneWay) != 0) {
+					// The sender isn't waiting, so there is nobody to reply to.
+					if (buffer.ErrorCheck() == B_OK) b->Transact(tr.code, buffer, NULL, 0);
+				} else {
+					SParcel reply(_BufferReply, this);
+					status_t error = buffer.ErrorCheck();
+					if (error == B_OK) error = b->Transact(tr.code, buffer, &reply, 0);
+					if (error < B_OK) reply.Reference(NULL, error);
 #if BINDER_TRANSACTION_MSGS
-				bout << "Replying with: " << reply << endl;
+					bout << "Replying with: " << reply << endl;
 #endif
-				reply.Reply();
+					reply.Reply();
+				}
 				
+			} else if ((tr.flags&tfOneWay) != 0) {
+				berr << "Aieee! We got a one-way transaction for the context manager!" << endl;
+
 			} else {
 				// Transactions against the NULL binder always go to the context manager.
 				SParcel reply(_BufferReply, this);
@@ -1019,6 +1101,10 @@ SLooper::_WaitForCompletion(SParcel *reply, status_t *acquireResult)
 	// Remember current thread priority, so any transactions executed
 	// during this time don't disrupt it.
 	const int32_t curPriority = m_priority;
+
+	// A synchronous call from a handler may block for a long time, so let
+	// another handler have its event slot in the meantime.
+	const bool blocking = (reply != NULL || acquireResult != NULL) && _EnterBlocking();
 	
 	while (1) {
 		if ((err=_TransactWithDriver()) < B_OK) break;
@@ -1034,6 +1120,12 @@ SLooper::_WaitForCompletion(SParcel *reply, status_t *acquireResult)
 #endif
 		if (cmd == brTRANSACTION_COMPLETE) {
 			if (!reply && !acquireResult) break;
+		} else if (cmd == brFAILED_REPLY) {
+			// The driver couldn't deliver the transaction.
+			err = B_ERROR;
+			if (acquireResult) *acquireResult = B_ERROR;
+			else if (reply) reply->Reference(NULL, B_ERROR);
+			break;
 		} else if (cmd == brDEAD_REPLY) {
 			// The target is gone!
 			err = B_BINDER_DEAD;
@@ -1057,6 +1149,7 @@ SLooper::_WaitForCompletion(SParcel *reply, status_t *acquireResult)
 				ErrFatalError("Bad read!");
 				if (amt >= B_OK) amt = B_BAD_VALUE;
 				if (reply) reply->Reference(NULL, amt);
+				if (blocking) _ExitBlocking();
 				return (m_lastError = amt);
 			}
 			if (reply) {
@@ -1086,6 +1179,8 @@ SLooper::_WaitForCompletion(SParcel *reply, status_t *acquireResult)
 			break;
 		} else if ((err = _HandleCommand(cmd))) break;
 	}
+
+	if (blocking) _ExitBlocking();
 	
 	// Restore last thread priority.
 	_SetThreadPriority(curPriority);
@@ -1137,7 +1232,7 @@ SLooper::_Reply(uint32_t flags, const SParcel& data)
 status_t
 SLooper::_TransactWithDriver(bool doRead)
 {
-	if (s_binderDesc < 0)
+	if (s_transport == NULL || m_binderDesc < 0)
 		return B_UNSUPPORTED;	// XXX Should have a better error code.
 	
 	// The goal here is to perform as few binder transactions as possible.
@@ -1187,12 +1282,9 @@ SLooper::_TransactWithDriver(bool doRead)
 	bwr.read_consumed = 0;
 	ssize_t err = -EINTR;
 	while (!m_signaled && err == -EINTR) {
-		if (ioctl_binder(s_binderDesc,BINDER_WRITE_READ,&bwr,sizeof(bwr)) >= 0)
-			err = B_OK;
-		else
-			err = -errno;
+		err = s_transport->Control(m_binderDesc,BINDER_WRITE_READ,&bwr,sizeof(bwr));
 		//if (err == -EINTR)
-		//	berr << SPrintf("%s:ioctl_binder returned EINTR\n\t\t%u written\n\t\t%u read\n", __func__, bwr.write_consumed, bwr.read_consumed);
+		//	berr << SPrintf("%s:Control returned EINTR\n\t\t%u written\n\t\t%u read\n", __func__, bwr.write_consumed, bwr.read_consumed);
 	}
 	if (err >= 0) {
 		//berr << "Wrote " << bwr.write_size << ", expected " << outAvail << endl;
@@ -1234,8 +1326,17 @@ SLooper::_WriteTransaction(int32_t cmd, uint32_t binderFlags, int32_t handle, ui
 	tr.flags = binderFlags&~tfInline;
 	tr.priority = m_priority;
 	if (static_cast<ssize_t>((tr.data_size=data.Length())) >= 0) {
-		// Send this parcel's data through the binder.
-		tr.data.ptr.buffer = data.Data();
+		// Send this parcel's data through the binder.  If it holds
+		// large buffers by reference and the transport can send them
+		// where they are, pass the pieces instead of flattening.
+		const SVectorIO* gather;
+		if (s_transport != NULL && s_transport->SupportsGather()
+				&& (gather=data.GatherVectors()) != NULL) {
+			tr.flags |= tfGather;
+			tr.data.ptr.buffer = gather;
+		} else {
+			tr.data.ptr.buffer = data.Data();
+		}
 		tr.offsets_size = data.BinderOffsetsLength();
 		tr.data.ptr.offsets = data.BinderOffsetsData();
 #if BINDER_BUFFER_MSGS
@@ -1272,7 +1373,7 @@ SLooper::_WriteTransaction(int32_t cmd, uint32_t binderFlags, int32_t handle, ui
 
 status_t
 SLooper::Transact(int32_t handle, uint32_t code, const SParcel& data,
-	SParcel* reply, uint32_t /*flags*/)
+	SParcel* reply, uint32_t flags)
 {
 	if (data.ErrorCheck() != B_OK) {
 		// Reflect errors back to caller.
@@ -1287,14 +1388,38 @@ SLooper::Transact(int32_t handle, uint32_t code, const SParcel& data,
 		<< ": " << data << endl;
 #endif
 
-	status_t err = _WriteTransaction(bcTRANSACTION, 0, handle, code, data);
+	// A one-way call only waits for the transaction to be queued.
+	const bool oneWay = (flags&B_TRANSACT_ONE_WAY) != 0 && reply == NULL
+		&& s_transport != NULL && (s_transport->Features()&bfOneWay) != 0;
+
+	// Large data goes through a shared memory segment.  The receiver
+	// attaches to it before replying, so we can let go of it as soon as
+	// we have the reply.  (A one-way call has no reply to wait for, so
+	// it always copies.)
+	SParcel shared;
+	void* sharedBase = NULL;
+	const ssize_t threshold = SharedTransactionThreshold();
+	if (!oneWay && threshold > 0 && data.Length() >= threshold && data.BinderOffsetsLength() == 0
+			&& s_transport != NULL && (s_transport->Features()&bfSharedMemory) != 0) {
+		shared_transaction desc;
+		if ((sharedBase=create_shared_transaction(data, &desc)) != NULL) {
+			shared.Copy(&desc, sizeof(desc));
+		}
+	}
+	
+	status_t err = sharedBase != NULL
+		? _WriteTransaction(bcTRANSACTION, tfSharedMemory, handle, code, shared)
+		: _WriteTransaction(bcTRANSACTION, oneWay ? tfOneWay : 0, handle, code, data);
 	if (err < B_OK) {
+		if (sharedBase != NULL) shmdt(sharedBase);
 		if (reply) reply->Reference(NULL, err);
 		return err;
 	}
 	
 	BEGIN_BINDER_CALL();
-	if (reply) {
+	if (oneWay) {
+		err = _WaitForCompletion(NULL);
+	} else if (reply) {
 		err = _WaitForCompletion(reply);
 		if (err == errNone) err = reply->ErrorCheck();
 	} else {
@@ -1304,6 +1429,8 @@ SLooper::Transact(int32_t handle, uint32_t code, const SParcel& data,
 	}
 	FINISH_BINDER_CALL();
 	
+	if (sharedBase != NULL) shmdt(sharedBase);
+	
 #if BINDER_TRANSACTION_MSGS
 	if (reply)
 		bout << "Received reply: " << *reply << endl;
@@ -121,7 +121,9 @@ extern BDebugInteger<g_ipcProfileSymbols, 1, 0, 1> g_profileSymbols;
 // -----------------------------------------------------------
 
 enum {
-	kSchedulingResumed	= 0x00000001
+	kSchedulingResumed	= 0x00000001,
+	kDispatchingHandler	= 0x00000002,	// running a handler's HandleMessage()
+	kHandlerBlocked		= 0x00000004	// ...which has given up its event slot
 };
 
 #if _SUPPORTS_NAMESPACE
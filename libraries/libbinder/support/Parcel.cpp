@@ -16,6 +16,8 @@
 #include <support/StdIO.h>
 #include <support/Value.h>
 #include <support/String.h>
+#include <support/SharedBuffer.h>
+#include <support/VectorIO.h>
 
 #include <support_p/SupportMisc.h>
 #include <support_p/ValueMapFormat.h>
@@ -53,98 +55,357 @@ namespace palmos {
 namespace support {
 #endif
 
-#define USE_PARCEL_POOL 0
-#define PARCEL_POOL_STATS 0
-
-// Class Members
-static SParcel*	g_parcel_pool = 0;
-static size_t	g_parcel_pool_count = 0;
-#define MAX_TRANSACTION_SIZE	4096
-#define MAX_POOL_SIZE			16
-#if PARCEL_POOL_STATS
-static size_t	g_parcel_pool_hits = 0;
-static size_t	g_parcel_pool_trys = 0;
-static size_t	g_parcel_pool_high = 0;
+// ======================================================================
+// Parcel cache
+// ======================================================================
+
+char g_parcelCacheEnvVar[] = "PARCEL_CACHE";
+static BDebugInteger<g_parcelCacheEnvVar, 1, 0, 1> g_parcelCacheEnv;
+char g_parcelCacheStatsEnvVar[] = "PARCEL_CACHE_STATS";
+static BDebugInteger<g_parcelCacheStatsEnvVar, 0, 0, 1> g_parcelCacheStatsEnv;
+
+// Cached parcels are sorted by the size of their buffer.  A parcel goes
+// in the largest class its buffer can hold, so anything taken from a
+// class has room for at least that many bytes.  The first class is the
+// parcel's inline buffer; parcels bigger than the last are deleted.
+static const ssize_t kParcelClassSizes[] = { 32, 256, 1024, 4096, 16384, 65536 };
+enum { kNumParcelClasses = sizeof(kParcelClassSizes)/sizeof(kParcelClassSizes[0]) };
+
+// How many parcels of each class a thread holds on to.  When a thread
+// has too many, it hands half of them (a magazine) to the depot; when it
+// runs out, it takes a magazine back.
+static const int32_t kThreadSlots[kNumParcelClasses] = { 16, 16, 16, 8, 4, 2 };
+enum { kMaxThreadSlots = 16 };
+enum { kDepotMagazines = 4 };
+
+struct parcel_cache_counters
+{
+	int32_t					gets;
+	int32_t					threadHits;
+	int32_t					depotHits;
+	int32_t					puts;
+	int32_t					depotPuts;
+	int32_t					deletes;
+};
+
+struct parcel_thread_cache
+{
+	parcel_thread_cache*	next;
+	parcel_cache_counters	counters;
+	int32_t					counts[kNumParcelClasses];
+	SParcel*				parcels[kNumParcelClasses][kMaxThreadSlots];
+};
+
+// The depot, the list of thread caches and the counters of threads that
+// have exited are protected by g_parcel_pool_lock.
+static SParcel*				g_depot[kNumParcelClasses][kDepotMagazines*kMaxThreadSlots/2];
+static int32_t				g_depotCounts[kNumParcelClasses];
+static parcel_thread_cache*	g_parcelCaches = NULL;
+static parcel_cache_counters g_retiredCounters;
+static bool					g_parcelCacheTSDAllocated = false;
+static SysTSDSlotID			g_parcelCacheTSD;
+#if SUPPORTS_THREAD_KEYWORD
+static __thread parcel_thread_cache* t_parcelCache = NULL;
 #endif
 
-parcel_pool_cleanup::~parcel_pool_cleanup()
+static void standard_free(const void* data, ssize_t, void*)
 {
-	while (g_parcel_pool) {
-		SParcel *p = g_parcel_pool;
-		g_parcel_pool = *((SParcel **)p->EditData());
-		delete p;
-	}
-#if PARCEL_POOL_STATS
-	bout << SPrintf("SParcel pool: %lu/%lu = %2.6f, high water mark: %lu", g_parcel_pool_hits, g_parcel_pool_trys, (double)g_parcel_pool_hits/g_parcel_pool_trys, g_parcel_pool_high) << endl;
-#endif
+	free(const_cast<void*>(data));
 }
 
-parcel_pool_cleanup::parcel_pool_cleanup()
+static inline int32_t magazine_size(size_t sc)
 {
+	return kThreadSlots[sc]/2;
 }
 
-static void standard_free(const void* data, ssize_t, void*)
+static inline size_t class_for_size(size_t size)
 {
-	free(const_cast<void*>(data));
+	size_t sc = 0;
+	while (sc < kNumParcelClasses && kParcelClassSizes[sc] < (ssize_t)size) sc++;
+	return sc;
 }
 
-SParcel *
-SParcel::GetParcel(void)
+static inline size_t class_for_parcel(const SParcel* parcel)
 {
-#if USE_PARCEL_POOL
-	SParcel *p = 0;
-	g_parcel_pool_lock.LockQuick();
-#if PARCEL_POOL_STATS
-		g_parcel_pool_trys++;
-#endif
-		if (g_parcel_pool) {
-#if PARCEL_POOL_STATS
-			g_parcel_pool_hits++;
+	size_t sc = kNumParcelClasses-1;
+	while (sc > 0 && kParcelClassSizes[sc] > parcel->Avail()) sc--;
+	return sc;
+}
+
+static void add_counters(parcel_cache_counters* to, const parcel_cache_counters& from)
+{
+	to->gets += from.gets;
+	to->threadHits += from.threadHits;
+	to->depotHits += from.depotHits;
+	to->puts += from.puts;
+	to->depotPuts += from.depotPuts;
+	to->deletes += from.deletes;
+}
+
+// Hand everything back when the thread exits; whatever doesn't fit in
+// the depot is deleted.
+static void release_parcel_cache(void* data)
+{
+	parcel_thread_cache* cache = (parcel_thread_cache*)data;
+#if SUPPORTS_THREAD_KEYWORD
+	t_parcelCache = NULL;
 #endif
-			p = g_parcel_pool;
-			g_parcel_pool = *((SParcel **)p->EditData());
-			g_parcel_pool_count--;
-		} else p = new SParcel(MAX_TRANSACTION_SIZE);
+
+	SParcel* extra[kNumParcelClasses*kMaxThreadSlots];
+	int32_t numExtra = 0;
+
+	g_parcel_pool_lock.LockQuick();
+	for (size_t sc=0; sc<kNumParcelClasses; sc++) {
+		const int32_t room = kDepotMagazines*magazine_size(sc);
+		for (int32_t i=0; i<cache->counts[sc]; i++) {
+			if (g_depotCounts[sc] < room) g_depot[sc][g_depotCounts[sc]++] = cache->parcels[sc][i];
+			else extra[numExtra++] = cache->parcels[sc][i];
+		}
+	}
+	parcel_thread_cache** pos = &g_parcelCaches;
+	while (*pos != cache) pos = &(*pos)->next;
+	*pos = cache->next;
+	cache->counters.deletes += numExtra;
+	add_counters(&g_retiredCounters, cache->counters);
 	g_parcel_pool_lock.Unlock();
-	return p;
+
+	while (numExtra > 0) delete extra[--numExtra];
+	free(cache);
+}
+
+static inline parcel_thread_cache* current_parcel_cache()
+{
+#if SUPPORTS_THREAD_KEYWORD
+	return t_parcelCache;
 #else
-	return new SParcel(-1);
+	if (!g_parcelCacheTSDAllocated) return NULL;
+	return (parcel_thread_cache*)g_threadDirectFuncs.tsdGet(g_parcelCacheTSD);
+#endif
+}
+
+static parcel_thread_cache* attach_parcel_cache()
+{
+	parcel_thread_cache* cache = (parcel_thread_cache*)calloc(1, sizeof(parcel_thread_cache));
+	if (cache == NULL) return NULL;
+
+	g_parcel_pool_lock.LockQuick();
+	if (!g_parcelCacheTSDAllocated) {
+		SysTSDAllocate(&g_parcelCacheTSD, release_parcel_cache, sysTSDAnonymous);
+		g_parcelCacheTSDAllocated = true;
+	}
+	cache->next = g_parcelCaches;
+	g_parcelCaches = cache;
+	g_parcel_pool_lock.Unlock();
+
+	// The TSD slot is what gets us told when the thread exits.
+	g_threadDirectFuncs.tsdSet(g_parcelCacheTSD, cache);
+#if SUPPORTS_THREAD_KEYWORD
+	t_parcelCache = cache;
 #endif
+	return cache;
+}
+
+static bool refill_from_depot(parcel_thread_cache* cache, size_t sc)
+{
+	// Not worth taking the lock just to find it empty.
+	if (g_depotCounts[sc] == 0) return false;
+
+	g_parcel_pool_lock.LockQuick();
+	int32_t count = g_depotCounts[sc];
+	if (count > magazine_size(sc)) count = magazine_size(sc);
+	g_depotCounts[sc] -= count;
+	memcpy(cache->parcels[sc], &g_depot[sc][g_depotCounts[sc]], count*sizeof(SParcel*));
+	g_parcel_pool_lock.Unlock();
+
+	cache->counts[sc] = count;
+	return count > 0;
+}
+
+static void flush_to_depot(parcel_thread_cache* cache, size_t sc)
+{
+	// The oldest parcels go; the ones just used are still warm.
+	const int32_t count = magazine_size(sc);
+	bool stored = false;
+
+	g_parcel_pool_lock.LockQuick();
+	if (g_depotCounts[sc] + count <= kDepotMagazines*count) {
+		memcpy(&g_depot[sc][g_depotCounts[sc]], cache->parcels[sc], count*sizeof(SParcel*));
+		g_depotCounts[sc] += count;
+		stored = true;
+	}
+	g_parcel_pool_lock.Unlock();
+
+	if (stored) {
+		cache->counters.depotPuts++;
+	} else {
+		for (int32_t i=0; i<count; i++) delete cache->parcels[sc][i];
+		cache->counters.deletes += count;
+	}
+	cache->counts[sc] -= count;
+	memmove(cache->parcels[sc], &cache->parcels[sc][count], cache->counts[sc]*sizeof(SParcel*));
+}
+
+parcel_pool_cleanup::~parcel_pool_cleanup()
+{
+	if (g_parcelCacheStatsEnv.Get()) {
+		bout << "SParcel cache: " << parcel_cache_stats() << endl;
+	}
+
+	g_parcel_pool_lock.LockQuick();
+	for (size_t sc=0; sc<kNumParcelClasses; sc++) {
+		while (g_depotCounts[sc] > 0) delete g_depot[sc][--g_depotCounts[sc]];
+	}
+	g_parcel_pool_lock.Unlock();
+}
+
+parcel_pool_cleanup::parcel_pool_cleanup()
+{
+}
+
+SValue parcel_cache_stats()
+{
+	SValue result;
+	result.JoinItem(SValue::String("enabled"), SValue::Bool(g_parcelCacheEnv.Get() != 0));
+
+	parcel_cache_counters counters;
+	int32_t threads = 0;
+	int32_t cached[kNumParcelClasses];
+	int32_t depot[kNumParcelClasses];
+
+	g_parcel_pool_lock.LockQuick();
+	counters = g_retiredCounters;
+	for (size_t sc=0; sc<kNumParcelClasses; sc++) {
+		cached[sc] = 0;
+		depot[sc] = g_depotCounts[sc];
+	}
+	for (parcel_thread_cache* cache = g_parcelCaches; cache != NULL; cache = cache->next) {
+		threads++;
+		add_counters(&counters, cache->counters);
+		for (size_t sc=0; sc<kNumParcelClasses; sc++) cached[sc] += cache->counts[sc];
+	}
+	g_parcel_pool_lock.Unlock();
+
+	result.JoinItem(SValue::String("threads"), SValue::Int32(threads));
+	result.JoinItem(SValue::String("gets"), SValue::Int32(counters.gets));
+	result.JoinItem(SValue::String("thread_hits"), SValue::Int32(counters.threadHits));
+	result.JoinItem(SValue::String("depot_hits"), SValue::Int32(counters.depotHits));
+	result.JoinItem(SValue::String("misses"),
+		SValue::Int32(counters.gets-counters.threadHits-counters.depotHits));
+	result.JoinItem(SValue::String("puts"), SValue::Int32(counters.puts));
+	result.JoinItem(SValue::String("depot_puts"), SValue::Int32(counters.depotPuts));
+	result.JoinItem(SValue::String("deletes"), SValue::Int32(counters.deletes));
+
+	SValue classes;
+	for (size_t sc=0; sc<kNumParcelClasses; sc++) {
+		if (cached[sc] == 0 && depot[sc] == 0) continue;
+		SValue c;
+		c.JoinItem(SValue::String("threads"), SValue::Int32(cached[sc]));
+		c.JoinItem(SValue::String("depot"), SValue::Int32(depot[sc]));
+		classes.JoinItem(SValue::Int32(kParcelClassSizes[sc]), c);
+	}
+	if (classes.IsDefined()) result.JoinItem(SValue::String("classes"), classes);
+
+	return result;
+}
+
+SParcel *
+SParcel::GetParcel(size_t sizeHint)
+{
+	const size_t first = class_for_size(sizeHint);
+	parcel_thread_cache* cache;
+
+	if (g_parcelCacheEnv.Get() == 0
+			|| ((cache=current_parcel_cache()) == NULL && (cache=attach_parcel_cache()) == NULL)) {
+		return new SParcel(sizeHint > sizeof(m_inline) ? (ssize_t)sizeHint : -1);
+	}
+
+	cache->counters.gets++;
+
+	// Smallest buffer that is big enough, first from this thread and
+	// then from the depot.
+	for (size_t sc=first; sc<kNumParcelClasses; sc++) {
+		if (cache->counts[sc] > 0) {
+			cache->counters.threadHits++;
+			return cache->parcels[sc][--cache->counts[sc]];
+		}
+	}
+	for (size_t sc=first; sc<kNumParcelClasses; sc++) {
+		if (refill_from_depot(cache, sc)) {
+			cache->counters.depotHits++;
+			return cache->parcels[sc][--cache->counts[sc]];
+		}
+	}
+
+	// Round up to the class size, so the buffer comes back to the
+	// class it was asked for.
+	if (first == 0) return new SParcel(-1);
+	return new SParcel(first < kNumParcelClasses ? kParcelClassSizes[first] : (ssize_t)sizeHint);
 }
 
 void
 SParcel::PutParcel(SParcel *parcel)
 {
-#if USE_PARCEL_POOL
-	// We don't test g_parcel_pool_count atomically.  In theory, we could blow the
-	// pool size limit, but practically speaking it shouldn't matter.
-	if ((g_parcel_pool_count >= MAX_POOL_SIZE) || (!parcel->IsCacheable())) {
-		//printf("Not Cached!\n");
+	parcel_thread_cache* cache;
+
+	// Parcels attached to a stream or waiting to send a reply aren't
+	// plain containers; they are never reused.
+	if (g_parcelCacheEnv.Get() == 0
+			|| parcel->m_reply != NULL || parcel->m_out != NULL || parcel->m_in != NULL
+			|| ((cache=current_parcel_cache()) == NULL && (cache=attach_parcel_cache()) == NULL)) {
 		delete parcel;
 		return;
 	}
 
-	//printf("Cached!\n");
+	cache->counters.puts++;
 
-	parcel->Reset();
+	parcel->m_compact = false;
+	// Keep the object even if its buffer can't be kept, such as a
+	// reply that references the driver's buffer.
+	if (parcel->IsCacheable()) {
+		parcel->Reset();
+	} else {
+		parcel->do_free();
+		parcel->Reserve(sizeof(m_inline));
+	}
 
-	g_parcel_pool_lock.LockQuick();
-		*((SParcel **)parcel->EditData()) = g_parcel_pool;
-		g_parcel_pool = parcel;
-		g_parcel_pool_count++;
-#if PARCEL_POOL_STATS
-		if (g_parcel_pool_count > g_parcel_pool_high) g_parcel_pool_high = g_parcel_pool_count;
-#endif
-	g_parcel_pool_lock.Unlock();
-#else
-	delete parcel;
-#endif
+	const size_t sc = class_for_parcel(parcel);
+	if (cache->counts[sc] == kThreadSlots[sc]) flush_to_depot(cache, sc);
+	cache->parcels[sc][cache->counts[sc]++] = parcel;
 }
 
+// ======================================================================
+// Gathered data
+// ======================================================================
+
+// Large shared buffers at least this big are written by reference.
+static const size_t kMinGatherSize = 16*1024;
+
+// Shared buffers that have been written into the parcel by reference.
+// Each segment is inserted at 'pos' of the parcel's own data, so the
+// flattened parcel is our data with the segments spliced in.
+struct SParcel::gather_info
+{
+	struct segment
+	{
+		ssize_t					pos;
+		const SSharedBuffer*	buffer;
+	};
+	
+	gather_info() : length(0) { }
+	
+	SVector<segment>	segments;
+	ssize_t				length;		// total size of all segments
+	SVectorIO			vectors;	// built by GatherVectors()
+};
+
+// ======================================================================
+// SParcel
+// ======================================================================
+
 SParcel::SParcel(ssize_t bufferSize)
 	:	m_data(NULL), m_free(NULL), m_freeContext(NULL),
 		m_reply(NULL), m_replyContext(NULL),
-		m_dirty(false), m_ownsBinders(false)
+		m_dirty(false), m_ownsBinders(false), m_compact(false), m_gather(NULL)
 {
 	if (bufferSize < 0) bufferSize = sizeof(m_inline);
 	if (bufferSize > 0) Reserve(bufferSize);
@@ -156,7 +417,7 @@ SParcel::SParcel(sptr<IByteOutput> output, sptr<IByteInput> input,
 	:	m_data(NULL), m_free(NULL), m_freeContext(NULL),
 		m_reply(NULL), m_replyContext(NULL),
 		m_out(output), m_in(input), m_seek(seek),
-		m_dirty(false), m_ownsBinders(false)
+		m_dirty(false), m_ownsBinders(false), m_compact(false), m_gather(NULL)
 {
 	if (bufferSize < 0) bufferSize = sizeof(m_inline);
 	if (bufferSize > 0) Reserve(bufferSize);
@@ -168,7 +429,7 @@ SParcel::SParcel(reply_func replyFunc, void* replyContext)
 		m_free(NULL), m_freeContext(NULL),
 		m_reply(replyFunc), m_replyContext(replyContext),
 		m_base(0), m_pos(0),
-		m_dirty(false), m_ownsBinders(false)
+		m_dirty(false), m_ownsBinders(false), m_compact(false), m_gather(NULL)
 {
 	Reserve(sizeof(m_inline));
 }
@@ -180,7 +441,7 @@ SParcel::SParcel(const void* data, ssize_t len,
 		m_free(freeFunc), m_freeContext(freeContext),
 		m_reply(replyFunc), m_replyContext(replyContext),
 		m_base(0), m_pos(0),
-		m_dirty(false), m_ownsBinders(false)
+		m_dirty(false), m_ownsBinders(false), m_compact(false), m_gather(NULL)
 {
 }
 
@@ -192,17 +453,19 @@ SParcel::~SParcel()
 
 const void* SParcel::Data() const
 {
+	if (m_gather) const_cast<SParcel*>(this)->flatten();
 	return m_data;
 }
 
 void* SParcel::EditData()
 {
+	if (m_gather) flatten();
 	return m_data;
 }
 
 ssize_t SParcel::Length() const
 {
-	return m_length;
+	return (m_gather && m_length >= 0) ? (m_length + m_gather->length) : m_length;
 }
 
 ssize_t SParcel::Avail() const
@@ -224,9 +487,37 @@ status_t SParcel::ErrorCheck() const
 	return m_length >= B_OK ? B_OK : m_length;
 }
 
+char g_compactEffectsEnvVar[] = "BINDER_COMPACT_VALUES";
+static BDebugInteger<g_compactEffectsEnvVar, 1, 0, 1> g_compactEffectsEnv;
+
+// -1 until SetCompactEffects() overrides the environment.
+static int32_t g_compactEffects = -1;
+
+void SParcel::SetCompactValues(bool compact)
+{
+	m_compact = compact;
+}
+
+bool SParcel::IsCompactValues() const
+{
+	return m_compact;
+}
+
+bool SParcel::CompactEffects()
+{
+	const int32_t compact = g_compactEffects;
+	return (compact >= 0 ? compact : g_compactEffectsEnv.Get()) != 0;
+}
+
+void SParcel::SetCompactEffects(bool enabled)
+{
+	g_compactEffects = enabled ? 1 : 0;
+}
+
 bool SParcel::IsCacheable() const
 {
-	return m_avail == MAX_TRANSACTION_SIZE && m_free == standard_free;
+	return m_data != NULL && (m_data == m_inline || m_free == standard_free)
+		&& m_avail <= kParcelClassSizes[kNumParcelClasses-1];
 }
 
 void SParcel::Reference(const void* data, ssize_t len, free_func freeFunc, void* context)
@@ -289,6 +580,8 @@ void* SParcel::Alloc(ssize_t len)
 
 void* SParcel::ReAlloc(ssize_t len)
 {
+	if (m_gather) flatten();
+	
 	if (m_length < 0) {
 		return NULL;
 		
@@ -326,6 +619,8 @@ void* SParcel::ReAlloc(ssize_t len)
 
 void SParcel::Transfer(SParcel* src)
 {
+	if (src->m_gather) src->flatten();
+	
 	if (src->m_data != src->m_inline) {
 		// The data is stored outside of the buffer object.
 		if (src->m_free || !src->m_data) {
@@ -376,26 +671,22 @@ status_t SParcel::SetValues(const SValue* value1, ...)
 	static const int32_t MAX_COUNT = 10;
 	const SValue* values[MAX_COUNT];
 	int32_t count = 0, i;
-	ssize_t size = 0;
 	
 	//berr << "SParcel::SetValues {" << endl << indent;
 	
+	// The values are archived in one pass; the parcel grows as needed
+	// rather than walking every value up front to size it.
 	va_list vl;
 	va_start(vl,value1);
 	while (value1 && count < MAX_COUNT) {
-		const ssize_t amt = value1->ArchivedSize();
-		if (amt < B_OK) return (m_length=amt);
-		//bout << "(" << amt << " bytes): " << *value1 << endl;
-		size += amt;
 		values[count++] = value1;
 		value1 = va_arg(vl,SValue*);
 	}
 	va_end(vl);
 	//berr << dedent << "}" << endl;
 
-	Reserve(sizeof(int32_t)+size);
+	Reserve(sizeof(int32_t));
 	if (m_length < B_OK) return m_length;
-	SetPosition(0);
 	
 	WriteInt32(B_HOST_TO_LENDIAN_INT32(count));
 	
@@ -486,17 +777,51 @@ void SParcel::Free()
 
 off_t SParcel::Position() const
 {
-	return m_base+m_pos;
+	// While gathering we are always writing at the end of the parcel,
+	// after all of the external segments.
+	return m_base + m_pos + (m_gather ? m_gather->length : 0);
 }
 
 void SParcel::SetPosition(off_t pos)
 {
+	if (m_gather) flatten();
 	if (pos < m_base || pos > (m_base+m_length)) ErrFatalError("Not yet implemented");
 	m_pos = (ssize_t)(pos-m_base);
 }
 
+bool SParcel::CanPatchData() const
+{
+	return m_out == NULL;
+}
+
+status_t SParcel::PatchData(off_t pos, const void* data, size_t len)
+{
+	if (m_out != NULL || m_length < 0) return B_UNSUPPORTED;
+	
+	// Find where the data is in our own buffer, skipping over any
+	// gathered segments in front of it.
+	ssize_t phys = (ssize_t)(pos-m_base);
+	if (m_gather) {
+		ssize_t ext = 0;
+		const size_t N = m_gather->segments.CountItems();
+		for (size_t i=0; i<N; i++) {
+			const gather_info::segment& seg = m_gather->segments.ItemAt(i);
+			if (phys+(ssize_t)len <= seg.pos+ext) break;
+			const ssize_t segLen = seg.buffer->Length();
+			if (phys < seg.pos+ext+segLen) return B_BAD_VALUE;
+			ext += segLen;
+		}
+		phys -= ext;
+	}
+	
+	if (phys < 0 || (phys+(ssize_t)len) > m_length) return B_BAD_VALUE;
+	memcpy(m_data+phys, data, len);
+	return B_OK;
+}
+
 status_t SParcel::SetLength(ssize_t len)
 {
+	if (m_gather) flatten();
 	if (len < 0) len = 0;
 	if (len > m_avail) {
 		if (ReAlloc(len) == NULL) return B_NO_MEMORY;
@@ -805,10 +1130,48 @@ ssize_t SParcel::WriteLargeData(uint32_t packedType, size_t length, const void*
 	return result >= 0 ? B_BAD_DATA : result;
 }
 
+ssize_t SParcel::WriteLargeData(uint32_t packedType, const SSharedBuffer* buffer)
+{
+	const size_t length = buffer->Length();
+	
+	// Small buffers are cheaper to copy than to track, and streaming
+	// parcels must write everything to their output anyway.
+	if (length < kMinGatherSize || m_out != NULL || m_in != NULL || m_length < 0) {
+		return WriteLargeData(packedType, length, buffer->Data());
+	}
+	
+	ssize_t result = WriteSmallData(packedType, length);
+	if (result != sizeof(large_flat_header)) return result >= 0 ? B_BAD_DATA : result;
+	
+	if (m_gather == NULL) m_gather = new B_NO_THROW gather_info;
+	gather_info::segment seg;
+	seg.pos = m_pos;
+	seg.buffer = buffer;
+	if (m_gather == NULL || m_gather->segments.AddItem(seg) < B_OK) {
+		if ((result=WritePadded(buffer->Data(), length)) >= 0) return result + sizeof(large_flat_header);
+		return result;
+	}
+	buffer->IncUsers();
+	m_gather->length += length;
+	
+	// The alignment padding lives in our own data, right after the
+	// point where the buffer is inserted.
+	const size_t padding = value_data_align(length) - length;
+	if (padding > 0) {
+		static const uint8_t zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		if ((result=Write(zeros, padding)) < B_OK) return result;
+	}
+	
+	return sizeof(large_flat_header) + length + padding;
+}
+
 ssize_t SParcel::WriteBinder(const flat_binder_object& val)
 {
 	ssize_t err;
 	
+	// Binder offsets are relative to the flattened parcel.
+	if (m_gather) flatten();
+	
 	// Allocate enough for the binder in this parcel
 	const ssize_t need = m_pos+sizeof(val);
 	if (need > m_avail) {
@@ -963,6 +1326,12 @@ ssize_t SParcel::WriteTypedData(type_code type, const void *value)
 		{
 			const SString *s = reinterpret_cast<const SString*>(value);
 			size_t size = s->Length()+1;	// including null terminator
+			if (type == B_STRING_TYPE && size >= kMinGatherSize) {
+				const SSharedBuffer* buf = s->SharedBuffer();
+				if (buf && buf->Length() == size) {
+					return WriteLargeData(B_PACK_LARGE_TYPE(B_STRING_TYPE), buf);
+				}
+			}
 			return WriteTypeHeaderAndData(B_STRING_TYPE, s->String(), size);
 		}
 
@@ -1831,6 +2200,7 @@ const sptr<ITextOutput>& operator<<(const sptr<ITextOutput>& io, const SParcel&
 
 void SParcel::Reset()
 {
+	if (m_gather) release_gather();
 	if (m_ownsBinders) release_binders();
 	m_binders.MakeEmpty();
 	if (m_data == m_inline) m_avail = sizeof(m_inline);
@@ -1844,6 +2214,7 @@ void SParcel::Reset()
 void SParcel::do_free()
 {
 	if (m_dirty) Flush();
+	if (m_gather) release_gather();
 	if (m_ownsBinders) release_binders();
 	if (m_free) m_free(m_data, m_avail, m_freeContext);
 	m_binders.MakeEmpty();
@@ -1856,6 +2227,78 @@ void SParcel::do_free()
 	m_pos = 0;
 }
 
+void SParcel::flatten()
+{
+	if (m_length < 0) {
+		release_gather();
+		return;
+	}
+	
+	const ssize_t extLen = m_gather->length;
+	const ssize_t total = m_length + extLen;
+	uint8_t* data = static_cast<uint8_t*>(malloc(total));
+	if (data == NULL) {
+		do_free();
+		m_length = m_avail = B_NO_MEMORY;
+		return;
+	}
+	
+	uint8_t* out = data;
+	ssize_t from = 0;
+	const size_t N = m_gather->segments.CountItems();
+	for (size_t i=0; i<N; i++) {
+		const gather_info::segment& seg = m_gather->segments.ItemAt(i);
+		memcpy(out, m_data+from, seg.pos-from);
+		out += seg.pos-from;
+		memcpy(out, seg.buffer->Data(), seg.buffer->Length());
+		out += seg.buffer->Length();
+		from = seg.pos;
+	}
+	memcpy(out, m_data+from, m_length-from);
+	release_gather();
+	
+	if (m_free) {
+		if (!m_ownsBinders && m_binders.CountItems() > 0) {
+			acquire_binders();
+			m_ownsBinders = true;
+		}
+		m_free(m_data, m_avail, m_freeContext);
+	}
+	m_free = standard_free;
+	m_freeContext = NULL;
+	m_data = data;
+	m_pos += extLen;
+	m_length = m_avail = total;
+}
+
+void SParcel::release_gather()
+{
+	const size_t N = m_gather->segments.CountItems();
+	for (size_t i=0; i<N; i++) {
+		m_gather->segments.ItemAt(i).buffer->DecUsers();
+	}
+	delete m_gather;
+	m_gather = NULL;
+}
+
+const SVectorIO* SParcel::GatherVectors() const
+{
+	if (m_gather == NULL || m_length < 0) return NULL;
+	
+	SVectorIO& vec = m_gather->vectors;
+	vec.MakeEmpty();
+	ssize_t from = 0;
+	const size_t N = m_gather->segments.CountItems();
+	for (size_t i=0; i<N; i++) {
+		const gather_info::segment& seg = m_gather->segments.ItemAt(i);
+		if (seg.pos > from && vec.AddVector(m_data+from, seg.pos-from) < B_OK) return NULL;
+		if (vec.AddVector(const_cast<void*>(seg.buffer->Data()), seg.buffer->Length()) < B_OK) return NULL;
+		from = seg.pos;
+	}
+	if (m_length > from && vec.AddVector(m_data+from, m_length-from) < B_OK) return NULL;
+	return &vec;
+}
+
 void SParcel::acquire_binders()
 {
 	const int32_t N = m_binders.CountItems();
@@ -23,7 +23,10 @@
 #include <support/StdIO.h>
 #include <support/String.h>
 #include <support/SupportDefs.h>
+#include <support/TLS.h>
 
+#include <support_p/AtomAllocator.h>
+#include <support_p/LockProfile.h>
 #include <support_p/RBinder.h>
 #include <support_p/WindowsCompatibility.h>
 #include <support_p/SupportMisc.h>
@@ -95,13 +98,27 @@ struct BProcess::ImageData
 #endif
 };
 
+/**************************************************************************************/
+
+struct BProcess::RunQueue
+{
+	RunQueue() : lock("BProcess run queue"), head(NULL), tail(NULL), owner(0) { }
+
+	SLocker				lock;
+	BHandler*			head;
+	BHandler*			tail;
+	volatile int32_t	owner;		// non-zero while a looper dispatches from it
+};
+
 /**************************************************************************************/
 static uint32_t s_processID = ~0U;
 
 BProcess::BProcess(team_id tid)
 	: m_id(tid)
 	, m_lock("BProcess access")
-	, m_pendingHandlers(NULL)
+	, m_pendingSeq(0)
+	, m_runQueues(new RunQueue[MAX_RUN_QUEUES])
+	, m_readyHandlers(0)
 	, m_nextEventTime(B_INFINITE_TIMEOUT)
 	, m_maxEventConcurrency(4)
 	, m_currentEventConcurrency(0)
@@ -109,6 +126,7 @@ BProcess::BProcess(team_id tid)
 	, m_imageData(new ImageData)
 	, m_handleRefLock("BProcess handle ref access")
 	, m_remoteRefsReleased(false)
+	, m_handleReaders("BProcess handle readers")
 
 	// These are used when running without the driver.	
 	, m_shutdown(false)
@@ -122,6 +140,8 @@ BProcess::BProcess(team_id tid)
 	
 	INFO(bout << "************* Creating BProcess " << this << " (id " << m_id << ") *************" << endl;)
 
+	for (size_t i=0; i<HANDLE_SEGMENTS; i++) m_handleSegments[i] = NULL;
+
 	m_lock.LockQuick();
 	IncrementLoopers();
 	m_lock.Unlock();
@@ -132,6 +152,18 @@ BProcess::PrintBinderReferences(void)
 {
 }
 
+SValue
+BProcess::AtomAllocatorStats(void)
+{
+	return atom_allocator_stats();
+}
+
+SValue
+BProcess::ParcelCacheStats(void)
+{
+	return parcel_cache_stats();
+}
+
 void
 BProcess::RestartMallocProfiling(void)
 {
@@ -180,6 +212,21 @@ BProcess::SetBinderIPCProfiling(bool enabled, int32_t dumpPeriod, int32_t maxIte
 	(void)enabled; (void)dumpPeriod; (void)maxItems; (void)stackDepth;
 }
 
+void
+BProcess::SetLockProfiling(int32_t samplePeriod, int32_t stackDepth)
+{
+	set_lock_profiling(samplePeriod, stackDepth);
+#if !LIBBE_BOOTSTRAP
+	if (samplePeriod > 0) publish_lock_profile();
+#endif
+}
+
+void
+BProcess::RestartLockProfiling(void)
+{
+	reset_lock_profiling();
+}
+
 void
 BProcess::CatchHandleRelease(const sptr<IBinder>& remoteObject, catchReleaseFunc callbackFunc)
 {
@@ -193,6 +240,8 @@ BProcess::~BProcess()
 	ReleaseRemoteReferences();
 	delete m_imageData;
 	m_imageData = NULL;
+	delete[] m_runQueues;
+	for (size_t i=0; i<HANDLE_SEGMENTS; i++) free((void*)m_handleSegments[i]);
 }
 
 void BProcess::ReleaseRemoteReferences()
@@ -229,32 +278,196 @@ void BProcess::InitAtom()
 
 /* ------------------------ Messaging ------------------------ */
 
-bool BProcess::InsertHandler(BHandler **handlerP, BHandler *handler)
+// Pending handlers are kept in a binary min-heap so that scheduling,
+// unscheduling and popping the next handler are all O(log n), no matter
+// how many handlers have delayed messages.  Handlers due at the same time
+// are ordered by when they were scheduled, so none of them can starve.
+
+bool BProcess::PendingBefore(const BHandler* a, const BHandler* b)
 {
-	BHandler *p = *handlerP;
+	if (a->m_pendingTime != b->m_pendingTime) return a->m_pendingTime < b->m_pendingTime;
+	return int32_t(a->m_pendingSeq - b->m_pendingSeq) < 0;
+}
 
-	if (!p) {
-		*handlerP = handler;
-		handler->m_next = handler->m_prev = NULL;
-		return true;
+void BProcess::SiftPendingUp(size_t index)
+{
+	BHandler** heap = m_pendingHandlers.EditArray();
+	BHandler* handler = heap[index];
+	while (index > 0) {
+		const size_t parent = (index-1)/2;
+		if (!PendingBefore(handler, heap[parent])) break;
+		heap[index] = heap[parent];
+		heap[index]->m_pendingIndex = index;
+		index = parent;
+	}
+	heap[index] = handler;
+	handler->m_pendingIndex = index;
+}
+
+void BProcess::SiftPendingDown(size_t index)
+{
+	BHandler** heap = m_pendingHandlers.EditArray();
+	const size_t count = m_pendingHandlers.CountItems();
+	BHandler* handler = heap[index];
+	while (1) {
+		size_t child = index*2 + 1;
+		if (child >= count) break;
+		if (child+1 < count && PendingBefore(heap[child+1], heap[child])) child++;
+		if (!PendingBefore(heap[child], handler)) break;
+		heap[index] = heap[child];
+		heap[index]->m_pendingIndex = index;
+		index = child;
+	}
+	heap[index] = handler;
+	handler->m_pendingIndex = index;
+}
+
+void BProcess::InsertHandler(BHandler *handler)
+{
+	handler->m_pendingTime = handler->NextMessageTime(NULL);
+
+	// If this thread is dispatching messages and the handler is already
+	// due, put it on the thread's own run queue.  The thread will get to
+	// it without touching the process lock, unless another looper steals
+	// it first.
+	SLooper* me = (SLooper*)tls_get(SLooper::TLS);
+	if (me != NULL && me != (SLooper*)1 && me->m_runQueue >= 0
+			&& handler->m_pendingTime <= approx_SysGetRunTime()) {
+		PushReadyHandler(me->m_runQueue, handler);
+		return;
 	}
 
-	const nsecs_t msgTime = handler->NextMessageTime(NULL);
-	if (p->NextMessageTime(NULL) > msgTime) {
-		(*handlerP)->m_prev = handler;
-		*handlerP = handler;
-		handler->m_next = p;
-		handler->m_prev = NULL;
+	handler->m_pendingSeq = m_pendingSeq++;
+	SiftPendingUp(m_pendingHandlers.AddItem(handler));
+}
+
+void BProcess::RemovePendingHandler(size_t index)
+{
+	const size_t last = m_pendingHandlers.CountItems()-1;
+	m_pendingHandlers[index]->m_pendingIndex = -1;
+	if (index != last) {
+		BHandler* moved = m_pendingHandlers[last];
+		m_pendingHandlers.EditItemAt(index) = moved;
+		m_pendingHandlers.RemoveItemsAt(last);
+		if (index > 0 && PendingBefore(moved, m_pendingHandlers[(index-1)/2]))
+			SiftPendingUp(index);
+		else
+			SiftPendingDown(index);
 	} else {
-		while (p->m_next && (p->m_next->NextMessageTime(NULL) < msgTime)) p = p->m_next;
-		handler->m_next = p->m_next;
-		handler->m_prev = p;
-		if (p->m_next) p->m_next->m_prev = handler;
-		p->m_next = handler;
+		m_pendingHandlers.RemoveItemsAt(last);
+	}
+}
+
+inline BHandler* BProcess::NextPendingHandler() const
+{
+	return m_pendingHandlers.CountItems() > 0 ? m_pendingHandlers[0] : NULL;
+}
+
+// Each looper running DispatchMessage() owns one run queue.  Handlers that
+// become ready while it dispatches are pushed there (with the process
+// lock held, so a handler can't be scheduled twice), and popped with only
+// the queue's lock.  A looper whose queue is empty, and which has no timed
+// handlers due, steals from the other queues before it gives up.
+//
+// Lock order is m_lock, then a run queue's lock, then the handler's lock.
+
+int32_t BProcess::AcquireRunQueue()
+{
+	for (int32_t i=0; i<MAX_RUN_QUEUES; i++) {
+		if (m_runQueues[i].owner == 0 && compare_and_swap32(&m_runQueues[i].owner, 0, 1))
+			return i;
+	}
+	return -1;
+}
+
+void BProcess::ReleaseRunQueue(int32_t queue)
+{
+	if (queue >= 0) compare_and_swap32(&m_runQueues[queue].owner, 1, 0);
+}
+
+int32_t BProcess::LockRunQueueOf(BHandler* handler)
+{
+	// Only pops can move a handler off its run queue without m_lock,
+	// so if it is still there once we hold the queue, it stays there.
+	const int32_t queue = handler->m_runQueue;
+	if (queue < 0) return -1;
+	m_runQueues[queue].lock.LockQuick();
+	if (handler->m_runQueue == queue) return queue;
+	m_runQueues[queue].lock.Unlock();
+	return -1;
+}
+
+bool BProcess::UnlinkHandler(BHandler* handler, int32_t lockedQueue)
+{
+	if (lockedQueue >= 0) {
+		RunQueue& q = m_runQueues[lockedQueue];
+		if (handler->m_runPrev) handler->m_runPrev->m_runNext = handler->m_runNext;
+		else q.head = handler->m_runNext;
+		if (handler->m_runNext) handler->m_runNext->m_runPrev = handler->m_runPrev;
+		else q.tail = handler->m_runPrev;
+		handler->m_runNext = handler->m_runPrev = NULL;
+		handler->m_runQueue = -1;
+		SysAtomicDec32(&m_readyHandlers);
+		q.lock.Unlock();
+		return true;
 	}
+
+	if (handler->m_pendingIndex >= 0) {
+		RemovePendingHandler(handler->m_pendingIndex);
+		return true;
+	}
+
 	return false;
 }
 
+void BProcess::PushReadyHandler(int32_t queue, BHandler* handler)
+{
+	RunQueue& q = m_runQueues[queue];
+	q.lock.LockQuick();
+	handler->m_runNext = NULL;
+	handler->m_runPrev = q.tail;
+	if (q.tail) q.tail->m_runNext = handler;
+	else q.head = handler;
+	q.tail = handler;
+	handler->m_runQueue = queue;
+	SysAtomicInc32(&m_readyHandlers);
+	q.lock.Unlock();
+}
+
+BHandler* BProcess::PopReadyHandler(int32_t queue)
+{
+	RunQueue& q = m_runQueues[queue];
+	if (q.head == NULL) return NULL;
+
+	q.lock.LockQuick();
+	BHandler* handler = q.head;
+	if (handler) {
+		q.head = handler->m_runNext;
+		if (q.head) q.head->m_runPrev = NULL;
+		else q.tail = NULL;
+		handler->m_runNext = NULL;
+		handler->m_runQueue = -1;
+		SysAtomicDec32(&m_readyHandlers);
+		// Must happen before the queue is released, so a concurrent
+		// ScheduleHandler() sees the handler as running, not scheduled.
+		handler->defer_scheduling();
+	}
+	q.lock.Unlock();
+	return handler;
+}
+
+BHandler* BProcess::StealReadyHandler(int32_t home)
+{
+	if (m_readyHandlers <= 0) return NULL;
+	for (int32_t i=1; i<=MAX_RUN_QUEUES; i++) {
+		const int32_t queue = (home+i)%MAX_RUN_QUEUES;
+		if (queue == home) continue;
+		BHandler* handler = PopReadyHandler(queue);
+		if (handler) return handler;
+	}
+	return NULL;
+}
+
 nsecs_t BProcess::GetNextEventTime() const
 {
 	m_lock.LockQuick();
@@ -372,7 +585,8 @@ bool BProcess::PopLooper(SLooper* looper, nsecs_t when)
 		poped = true;
 	}
 
-	nsecs_t nextTime = m_pendingHandlers ? m_pendingHandlers->NextMessageTime(NULL) : B_INFINITE_TIMEOUT;
+	BHandler* next = NextPendingHandler();
+	nsecs_t nextTime = next ? next->NextMessageTime(NULL) : B_INFINITE_TIMEOUT;
 	
 	if ((m_idleCount == 1 || m_loopers < m_minLoopers) && (m_loopers < m_maxLoopers) && (approx_SysGetRunTime() >= nextTime))
 	{
@@ -518,15 +732,7 @@ void BProcess::UnscheduleHandler(BHandler *handler, bool lock)
 {
 	if (lock) m_lock.LockQuick();
 
-	const bool hadRef =
-		((m_pendingHandlers == handler) || handler->m_prev || handler->m_next);
-
-	if (hadRef) {
-		if (m_pendingHandlers == handler)	m_pendingHandlers = handler->m_next;
-		if (handler->m_next)				handler->m_next->m_prev = handler->m_prev;
-		if (handler->m_prev)				handler->m_prev->m_next = handler->m_next;
-		handler->m_prev = handler->m_next = NULL;
-	}
+	const bool hadRef = UnlinkHandler(handler, LockRunQueueOf(handler));
 
 	if (lock) m_lock.Unlock();
 
@@ -538,16 +744,23 @@ bool BProcess::ScheduleNextEvent()
 //	bout << "BProcess::ScheduleNextEvent (" << SysCurrentThread() << ")@" << SysGetRunTime() << endl;
 
 	// Don't schedule the next event if it would introduce too much concurrency.
-	// XXX TO DO -- need to allow scheduling the next event if all currently
-	// running handlers are blocked.
+	// (Handlers that are blocked don't count; see HandlerBlocked().)
 	if (m_currentEventConcurrency >= m_maxEventConcurrency) {
 		return false;
 	}
 
 	int32_t priority = B_NORMAL_PRIORITY;
-	const nsecs_t nextTime	= m_pendingHandlers
-								? m_pendingHandlers->NextMessageTime(&priority)
-								: B_INFINITE_TIMEOUT;
+	BHandler* next = NextPendingHandler();
+	nsecs_t nextTime	= next
+							? next->NextMessageTime(&priority)
+							: B_INFINITE_TIMEOUT;
+
+	// Handlers waiting on a run queue are ready now; get another looper
+	// in to steal them.
+	if (m_readyHandlers > 0) {
+		const nsecs_t now = approx_SysGetRunTime();
+		if (now < nextTime) nextTime = now;
+	}
 	
 	if (nextTime < m_nextEventTime) {
 #if 0
@@ -561,18 +774,40 @@ bool BProcess::ScheduleNextEvent()
 	return false;
 }
 
+// A handler running on this thread is about to block (waiting on a
+// transaction reply, a contended lock or a condition), so give its event
+// slot to another handler until it wakes up.  When it does it takes the
+// slot back unconditionally, so for a short while there may be more than
+// m_maxEventConcurrency handlers running.
+void BProcess::HandlerBlocked()
+{
+	m_lock.LockQuick();
+	m_currentEventConcurrency--;
+	ScheduleNextHandler();		// releases the lock
+}
+
+void BProcess::HandlerUnblocked()
+{
+	m_lock.LockQuick();
+	m_currentEventConcurrency++;
+	m_lock.Unlock();
+}
+
 void BProcess::ScheduleHandler(BHandler *handler)
 {
 //	bout << "BProcess::ScheduleHandler: (" << SysCurrentThread() << ")@" << SysGetRunTime() << endl;
 	m_lock.LockQuick();
+	// Hold the handler's run queue while deciding, so no looper can take
+	// the handler off it in the meantime.
+	const int32_t queue = LockRunQueueOf(handler);
 	const BHandler::scheduling s = handler->start_schedule();
 	if (s != BHandler::CANCEL_SCHEDULE) {
 		handler->IncRefs(this);
-		UnscheduleHandler(handler,false);
-		InsertHandler(&m_pendingHandlers,handler);
+		if (UnlinkHandler(handler, queue)) handler->DecRefs(this);
 		handler->done_schedule();
+		InsertHandler(handler);
 	} else {
-		UnscheduleHandler(handler,false);
+		if (UnlinkHandler(handler, queue)) handler->DecRefs(this);
 	}
 	
 	ScheduleNextHandler();		//  releases the lock
@@ -610,6 +845,7 @@ void BProcess::DispatchMessage(SLooper* looper)
 	BHandler* handler = NULL;
 	int32_t priority = B_NORMAL_PRIORITY;
 	bool firstTime = true;
+	uint32_t dispatched = 0;
 	
 	m_lock.LockQuick();
 	//DbgOnlyFatalErrorIf(m_currentEventConcurrency >= m_maxEventConcurrency, "We have gone past the limit on concurrent handlers!");
@@ -622,37 +858,61 @@ void BProcess::DispatchMessage(SLooper* looper)
 	// The binder driver clears its event time when processing an event,
 	// so we always must inform it if there is another one to schedule.
 	m_nextEventTime = B_INFINITE_TIMEOUT;
+	m_lock.Unlock();
+
+	// Handlers we make ready from now on go on our own run queue.  (We
+	// may be nested inside another dispatch on this thread, if a handler
+	// is waiting on a transaction.)
+	const int32_t outerQueue = looper->m_runQueue;
+	const int32_t home = AcquireRunQueue();
+	looper->m_runQueue = home;
 	
 	nsecs_t curTime = exact_SysGetRunTime();
 
 	while (1) {
-		if ((handler = m_pendingHandlers) != NULL
-				&& handler->NextMessageTime(&priority) <= curTime) {
-			m_pendingHandlers = handler->m_next;
-			handler->m_next = handler->m_prev = NULL;
-			if (m_pendingHandlers) m_pendingHandlers->m_prev = NULL;
-			handler->defer_scheduling();
-		} else {
+		// Our own ready handlers come first, since they don't need the
+		// process lock.  Every few messages look at the timed handlers
+		// first instead, so a busy run queue can't starve them.
+		handler = NULL;
+		if (home >= 0 && (++dispatched & 7) != 0) handler = PopReadyHandler(home);
+		if (handler == NULL) {
+			m_lock.LockQuick();
+			if ((handler = NextPendingHandler()) != NULL
+					&& handler->m_pendingTime <= curTime) {
+				RemovePendingHandler(0);
+				handler->defer_scheduling();
+			} else {
+				handler = NULL;
+			}
+			m_lock.Unlock();
+		}
+		if (handler == NULL && home >= 0) handler = PopReadyHandler(home);
+		if (handler == NULL) handler = StealReadyHandler(home);
+		if (handler == NULL) {
 			// Nothing to do right now, time to leave.
 			break;
 		}
+		handler->NextMessageTime(&priority);
 		
 		// If this is the first time through the loop, we need to schedule
 		// the next pending handler so that another SLooper thread can be
 		// activated to execute it.
 		if (firstTime) {
+			m_lock.LockQuick();
 			ScheduleNextEvent();
+			m_lock.Unlock();
 			firstTime = false;
 		}
 
-		// We are now going to enter user code, don't hold the lock.
-		m_lock.Unlock();
-		
 		if (handler->AttemptAcquire(this)) {
 shortcutDispatch:
 			// bout << "BProcess: Thread " << SysCurrentThread() << " dispatch to " << handler << " at pri " << priority << endl;
 			looper->_SetThreadPriority(priority);
+			// Let the blocking hooks know this thread is in a handler.
+			const int32_t outerFlags = looper->m_flags&(kDispatchingHandler|kHandlerBlocked);
+			looper->m_flags = (looper->m_flags&~kHandlerBlocked) | kDispatchingHandler;
 			handler->dispatch_message();
+			looper->m_flags = (looper->m_flags&~(kDispatchingHandler|kHandlerBlocked)) | outerFlags;
 			// bout << "BProcess: Thread " << SysCurrentThread() << " returned from dispatch!" << endl;
 
 			// Update our concept of the time.
@@ -665,7 +925,9 @@ shortcutDispatch:
 			m_lock.LockQuick();
 			// We can do this if...  there is a pending message and it is next...
 			const nsecs_t when = handler->NextMessageTime(&priority);
-			if (m_pendingHandlers == NULL || when <= m_pendingHandlers->NextMessageTime(NULL)) {
+			const BHandler* next = NextPendingHandler();
+			if ((next == NULL || when <= next->m_pendingTime)
+					&& (home < 0 || m_runQueues[home].head == NULL)) {
 				// And ResumeScheduling() wasn't called while processing the message...
 				if (ResumingScheduling()) {
 					// The above flagged that this thread called ResumeScheduling(), but it
@@ -687,13 +949,16 @@ shortcutDispatch:
 			handler->Release(this);
 		}
 		handler->DecRefs(this);
-
-		m_lock.LockQuick();
 	}
 
-	// We have handled all available messages.  While still holding the
-	// lock, reduce concurrency and schedule the next event to make sure
+	// Our run queue is empty, and only this thread adds to it.
+	looper->m_runQueue = outerQueue;
+	ReleaseRunQueue(home);
+
+	// We have handled all available messages.  While holding the lock,
+	// reduce concurrency and schedule the next event to make sure
 	// the binder is up-to-date about when it is to occur.
+	m_lock.LockQuick();
 	m_currentEventConcurrency--;
 	ScheduleNextEvent();
 
@@ -719,13 +984,47 @@ void BProcess::ClearSchedulingResumed()
 
 /* ------------------------ Binder Handles ------------------------ */
 
-IBinder* & BProcess::BinderForHandle(int32_t handle)
+// Which segment of the handle table 'handle' is in, and where.
+static inline size_t handle_segment(uint32_t handle, size_t shift, uint32_t* index)
+{
+	uint32_t q = (handle>>shift) + 1;
+	size_t segment = 0;
+	while ((q >>= 1) != 0) segment++;
+	*index = handle - ((((uint32_t)1<<segment)-1)<<shift);
+	return segment;
+}
+
+IBinder* volatile* BProcess::HandleSlot(int32_t handle, bool create)
 {
-	if (m_handleRefs.CountItems() <= (uint32_t)handle) {
-		m_handleRefs.SetCapacity(handle+1);
-		while (m_handleRefs.CountItems() <= (uint32_t)handle) m_handleRefs.AddItem(NULL);
+	if (handle < 0) return NULL;
+
+	uint32_t index;
+	const size_t seg = handle_segment(handle, HANDLE_SEGMENT_SHIFT, &index);
+	IBinder* volatile* segment = m_handleSegments[seg];
+	if (segment == NULL) {
+		if (!create) return NULL;
+
+		// Creation only happens with m_handleRefLock held, so nobody
+		// else can be adding this segment.  The swap makes sure the
+		// zeroed slots are visible before the segment is.
+		segment = (IBinder* volatile*)calloc((size_t)1<<(seg+HANDLE_SEGMENT_SHIFT), sizeof(IBinder*));
+		if (segment == NULL) return NULL;
+		compare_and_swap_ptr((void* volatile*)&m_handleSegments[seg], NULL, (void*)segment);
 	}
-	return m_handleRefs.EditItemAt(handle);
+	return segment + index;
+}
+
+// Look up the proxy for 'handle' without taking m_handleRefLock.
+// Returns it with a new weak reference, or NULL if there isn't one
+// that is still alive.
+IBinder* BProcess::AttemptWeakProxyForHandle(int32_t handle)
+{
+	m_handleReaders.ReadLockQuick();
+	IBinder* volatile* slot = HandleSlot(handle, false);
+	IBinder* b = slot ? *slot : NULL;
+	if (b != NULL && !b->AttemptIncWeak((void*)s_processID)) b = NULL;
+	m_handleReaders.ReadUnlock();
+	return b;
 }
 
 #if COUNT_PROXIES
@@ -745,7 +1044,8 @@ BProcess::GetStrongProxyForHandle(int32_t handle)
 	DAP(GetStrongProxyForHandle);
 	sptr<IBinder> r;
 
-	{
+	IBinder* b = AttemptWeakProxyForHandle(handle);
+	if (b == NULL) {
 		SNestedLocker::Autolock _l(m_handleRefLock);
 	
 #if COUNT_PROXIES
@@ -764,31 +1064,35 @@ BProcess::GetStrongProxyForHandle(int32_t handle)
 #endif
 #endif
 
-		IBinder* &b = BinderForHandle(handle);
+		IBinder* volatile* slot = HandleSlot(handle, true);
+		if (slot == NULL) return r;
 	
-		// We need to create a new BpBinder if there isn't currently one, OR we
-		// are unable to acquire a weak reference on this current one.  See comment
-		// in GetWeakProxyForHandle() for more info about this.
+		// Someone may have created the proxy since we looked.  If
+		// not, or if the one there is going away, we need a new
+		// BpBinder.  See GetWeakProxyForHandle() for more info.
+		b = *slot;
 		if (b == NULL || !b->AttemptIncWeak((void*)s_processID)) {
 			b = new B_NO_THROW BpBinder(handle);
 			r = b;
+			*slot = b;
 #if HANDLE_DEBUG_MSGS
 			bout << SPrintf("BProcess Creating strong BpBinder 0x%08x for handle %04x", b, handle) << endl;
 #endif
-		} else {
-			// This little bit of nastyness is to allow us to add a primary
-			// reference to the remote proxy when this team doesn't have one
-			// but another team is sending the handle to us.
-			b->ForceIncStrong((void*)s_processID);
-			r = b;
-			B_DEC_STRONG(b, (void*)s_processID);
-			B_DEC_WEAK(b, (void*)s_processID); // FFB: safe
-#if HANDLE_DEBUG_MSGS
-			bout << SPrintf("BProcess Forcing a strong BpBinder 0x%08x for handle %04x", b, handle) << endl;
-#endif
+			return r;
 		}
 	}
 
+	// This little bit of nastyness is to allow us to add a primary
+	// reference to the remote proxy when this team doesn't have one
+	// but another team is sending the handle to us.
+	b->ForceIncStrong((void*)s_processID);
+	r = b;
+	B_DEC_STRONG(b, (void*)s_processID);
+	B_DEC_WEAK(b, (void*)s_processID); // FFB: safe
+#if HANDLE_DEBUG_MSGS
+	bout << SPrintf("BProcess Forcing a strong BpBinder 0x%08x for handle %04x", b, handle) << endl;
+#endif
+
 	return r;
 }
 
@@ -799,7 +1103,8 @@ BProcess::GetWeakProxyForHandle(int32_t handle)
 	DAP(GetWeakProxyForHandle);
 	wptr<IBinder> r;
 
-	{
+	IBinder* b = AttemptWeakProxyForHandle(handle);
+	if (b == NULL) {
 		SNestedLocker::Autolock _l(m_handleRefLock);
 	
 #if 0
@@ -818,30 +1123,35 @@ BProcess::GetWeakProxyForHandle(int32_t handle)
 		}
 #endif
 
-		IBinder* &b = BinderForHandle(handle);
+		IBinder* volatile* slot = HandleSlot(handle, true);
+		if (slot == NULL) return r;
 		
 		// We need to create a new BpBinder if there isn't currently one, OR we
 		// are unable to acquire a weak reference on this current one.  The
 		// AttemptIncWeak() is safe because we know the BpBinder destructor will always
-		// call ExpungeHandle(), which acquires the same lock we are holding now.
+		// call ExpungeHandle(), which waits for lookups that could still be
+		// looking at it.
 		// We need to do this because there is a race condition between someone
 		// releasing a reference on this BpBinder, and a new reference on its handle
 		// arriving from the driver.
+		b = *slot;
 		if (b == NULL || !b->AttemptIncWeak((void*)s_processID)) {
 			b = new B_NO_THROW BpBinder(handle);
 			r = b;
+			*slot = b;
 #if HANDLE_DEBUG_MSGS
 			bout << SPrintf("BProcess Creating weak BpBinder 0x%08x for handle %04x", b, handle) << endl;
 #endif
-		} else {
-			r = b;
-			b->DecWeak((void*)s_processID);
-#if HANDLE_DEBUG_MSGS
-			bout << SPrintf("BProcess already had weak BpBinder 0x%08x for handle %04x", b, handle) << endl;
-#endif
+			return r;
 		}
 	}
 
+	r = b;
+	b->DecWeak((void*)s_processID);
+#if HANDLE_DEBUG_MSGS
+	bout << SPrintf("BProcess already had weak BpBinder 0x%08x for handle %04x", b, handle) << endl;
+#endif
+
 	return r;
 }
 
@@ -849,24 +1159,32 @@ BProcess::GetWeakProxyForHandle(int32_t handle)
 void
 BProcess::ExpungeHandle(int32_t handle, IBinder* binder)
 {
-	SNestedLocker::Autolock _l(m_handleRefLock);
-	
-	IBinder* &b = BinderForHandle(handle);
+	{
+		SNestedLocker::Autolock _l(m_handleRefLock);
+		
+		IBinder* volatile* slot = HandleSlot(handle, false);
 #if HANDLE_DEBUG_MSGS
-	bout << "BProcess Expunging BpBinder " << b << " for handle " << handle << endl;
+		bout << "BProcess Expunging BpBinder " << (slot ? *slot : NULL) << " for handle " << handle << endl;
 #endif
 
 #ifdef TRACK_CLASS_NAME
-	TEST_TRACKED_CLASS(handle);
-	if (tracked) {
-		bout << "Pr #" << SysProcessID() << ": BProcess::ExpungeHandle(" << (void*)handle << ", " << binder << ")" << endl;
-	}
+		TEST_TRACKED_CLASS(handle);
+		if (tracked) {
+			bout << "Pr #" << SysProcessID() << ": BProcess::ExpungeHandle(" << (void*)handle << ", " << binder << ")" << endl;
+		}
 #endif
 
-	// This handle may have already been replaced with a new BpBinder
-	// (if someone failed the AttemptIncWeak() above); we don't want
-	// to overwrite it.
-	if (b == binder) b = NULL;
+		// This handle may have already been replaced with a new BpBinder
+		// (if someone failed the AttemptIncWeak() above); we don't want
+		// to overwrite it.
+		if (slot != NULL && *slot == binder) *slot = NULL;
+	}
+
+	// A lookup may have read 'binder' out of the table just before
+	// it was removed.  Its AttemptIncWeak() will fail, but the memory
+	// has to stay around until it is done, so wait for all of them.
+	// Usually there are none, and this doesn't lock anything.
+	m_handleReaders.Synchronize();
 }
 
 void BProcess::StrongHandleGone(IBinder* binder)
@@ -39,7 +39,8 @@ using namespace palmos::support;
 #endif
 
 BpBinder::BpBinder(int32_t handle)
-	: m_handle(handle), m_lock("BpBinder"), m_obituaries(NULL), m_alive(true)
+	: m_handle(handle), m_lock("BpBinder"), m_obituaries(NULL), m_alive(true),
+	  m_invokeById(true), m_compactValues(true), m_oneWay(true), m_oneWayAccepted(false)
 {
 #if RBINDER_DEBUG_MSGS
 	printf("*** BpBinder(): IncRefs %p descriptor %ld\n", this, m_handle);
@@ -147,13 +148,33 @@ BpBinder::Effect(const SValue &in, const SValue &inBindings, const SValue &outBi
 	
 	const SValue *outBindingsP = outBindings.IsDefined() ? &outBindings : NULL;
 	const SValue *inBindingsP = (outBindingsP || (!inBindings.IsWild())) ? &inBindings : NULL;
+
+	// Offer the compact encoding unless the target has turned it down
+	// before.  Only when there is a reply, so a refusal can be seen.
+	const bool compact = out && m_compactValues && SParcel::CompactEffects();
+	buffer->SetCompactValues(compact);
 	ssize_t result = buffer->SetValues(&in,inBindingsP,outBindingsP,NULL);
 	if (result >= B_OK) {
 		SParcel *reply = SParcel::GetParcel();
 #if BINDER_DEBUG_MSGS
 		berr << "BpBinder::Effect " << *buffer << endl;
 #endif
-		result = Transact(B_EFFECT_TRANSACTION,*buffer,out ? reply : NULL,0);
+		if (compact) {
+			reply->SetCompactValues(true);
+			result = Transact(B_EFFECT_COMPACT_TRANSACTION,*buffer,reply,0);
+			if (result == B_BINDER_UNKNOWN_TRANSACT) {
+				// The target doesn't know the compact encoding (it may
+				// be an older process); use the standard one from now on.
+				m_compactValues = false;
+				buffer->SetCompactValues(false);
+				reply->SetCompactValues(false);
+				reply->Reset();
+				result = buffer->SetValues(&in,inBindingsP,outBindingsP,NULL);
+				if (result >= B_OK) result = Transact(B_EFFECT_TRANSACTION,*buffer,reply,0);
+			}
+		} else {
+			result = Transact(B_EFFECT_TRANSACTION,*buffer,out ? reply : NULL,0);
+		}
 		if (result >= B_OK) {
 			if (out && (result=reply->GetValues(1, out)) >= 1) result = out->ErrorCheck();
 			else if (result >= B_OK) result = reply->ErrorCheck();
@@ -245,6 +266,56 @@ BpBinder::AutobinderInvoke(const BAutobinderDef* def, void** params, void *resul
 	SParcel *parcel = SParcel::GetParcel();
 	SParcel *reply = SParcel::GetParcel();
 
+	// A oneway method doesn't wait for the target to run the call.  It
+	// goes by name, since a call that fails later can't come back and
+	// ask for it.  The first one waits for the target to queue it, to
+	// find out whether it can; after that they are sent one-way and
+	// we don't wait at all.
+	if ((def->flags&B_AUTOBINDER_ONE_WAY) != 0 && m_oneWay) {
+		parcel->WriteInt32(def->index);
+		parcel->WriteValue(def->key());
+
+		err = autobinder_marshal_args(pi, pi_end, B_IN_PARAM, params, *parcel, &dirs);
+		if (err < 0) goto clean_up;
+
+		if (m_oneWayAccepted) {
+			err = Transact(B_INVOKE_ONEWAY_TRANSACTION, *parcel, NULL, B_TRANSACT_ONE_WAY);
+			goto clean_up;
+		}
+
+		err = Transact(B_INVOKE_ONEWAY_TRANSACTION, *parcel, NULL);
+		if (err != B_BINDER_UNKNOWN_TRANSACT) {
+			if (err == B_OK) m_oneWayAccepted = true;
+			goto clean_up;
+		}
+
+		// The target doesn't queue calls (it may have its own
+		// Transact()); wait for them from now on.
+		m_oneWay = false;
+		parcel->Reset();
+		dirs = 0;
+	}
+
+	// If the interface has method IDs and the target hasn't turned
+	// them down before, send the ID instead of the name.
+	if (def->methodID != 0 && m_invokeById && autobinder_invoke_by_id()) {
+		parcel->WriteInt32(def->index);
+		parcel->WriteInt32(def->methodID);
+
+		err = autobinder_marshal_args(pi, pi_end, B_IN_PARAM, params, *parcel, &dirs);
+		if (err < 0) goto clean_up;
+
+		err = Transact(B_INVOKE_ID_TRANSACTION, *parcel, reply);
+		if (err != B_BINDER_UNKNOWN_TRANSACT) goto got_reply;
+
+		// The target doesn't know this method by ID (it may not be
+		// pidgen code at all); use the name from now on.
+		m_invokeById = false;
+		parcel->Reset();
+		reply->Reset();
+		dirs = 0;
+	}
+
 	// write index and name of the function
 	parcel->WriteInt32(def->index);
 	parcel->WriteValue(def->key());
@@ -256,6 +327,8 @@ BpBinder::AutobinderInvoke(const BAutobinderDef* def, void** params, void *resul
 	
 	// invoke it!
 	err = Transact(B_INVOKE_TRANSACTION, *parcel, reply);
+
+got_reply:
 	if (err != B_OK) goto clean_up;
 	
 	if (inv->returnType != B_UNDEFINED_TYPE || (dirs&B_OUT_PARAM) != 0) {
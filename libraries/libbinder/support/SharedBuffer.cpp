@@ -36,78 +36,154 @@ namespace support {
 
 // --------------------------------------------------------------------
 
-static SysCriticalSectionType g_poolLock = sysCriticalSectionInitializer;
-static const SSharedBuffer** g_pool = NULL;
+// The buffer pool is a hash table split into shards by the hash of the
+// data, each with its own lock, so threads pooling different data
+// rarely wait for each other.  Each shard is open-addressed with linear
+// probing; entries are removed by shifting the rest of their run back,
+// so there are no tombstones.
+//
+// Lookups take the shard lock too; they are not lock-free.  The last
+// reference to a pooled buffer can go away at any time, freeing it, so
+// a lookup without the lock could find a buffer that is being freed.
+
+enum { POOL_SHARDS = 16, POOL_SHARD_SHIFT = 28, MIN_POOL_TABLE = 16 };
+enum { CACHE_LINE_SIZE = 64 };
+
+struct pool_entry
+{
+	uint32_t				hash;
+	const SSharedBuffer*	buffer;		// NULL if the slot is empty
+};
+
+struct pool_shard
+{
+	SysCriticalSectionType	lock;
+	pool_entry*				entries;
+	size_t					mask;		// table size - 1
+	size_t					count;
+	// Fill out a cache line, so that threads in different shards
+	// don't write to the same one.
+	char					pad[CACHE_LINE_SIZE - sizeof(SysCriticalSectionType)
+								- sizeof(pool_entry*) - 2*sizeof(size_t)];
+};
+
+#if defined(__GNUC__)
+static pool_shard g_pool[POOL_SHARDS] __attribute__((aligned(CACHE_LINE_SIZE)));
+#else
+static pool_shard g_pool[POOL_SHARDS];
+#endif
+#if PRINT_POOL_METRICS
 static size_t g_poolSize = 0;
-static size_t g_poolAvail = 0;
 static size_t g_poolMemSize = 0;
+#endif
 
-static inline void lock_pool() { g_threadDirectFuncs.criticalSectionEnter(&g_poolLock); }
-static inline void unlock_pool() { g_threadDirectFuncs.criticalSectionExit(&g_poolLock); }
+static inline uint32_t hash_buffer(const SSharedBuffer* buffer)
+{
+	return hash_bytes(buffer->Data(), buffer->Length());
+}
+
+static inline pool_shard& shard_for(uint32_t hash)
+{
+	return g_pool[hash>>POOL_SHARD_SHIFT];
+}
+
+static inline void lock_pool(pool_shard& shard) { g_threadDirectFuncs.criticalSectionEnter(&shard.lock); }
+static inline void unlock_pool(pool_shard& shard) { g_threadDirectFuncs.criticalSectionExit(&shard.lock); }
 
 void __terminate_shared_buffer(void)
 {
-	if (g_pool) {
-		free(g_pool);
-		g_pool = NULL;
-		g_poolSize = g_poolAvail = 0;
+	for (size_t i=0; i<POOL_SHARDS; i++) {
+		if (g_pool[i].entries) {
+			free(g_pool[i].entries);
+			g_pool[i].entries = NULL;
+			g_pool[i].mask = g_pool[i].count = 0;
+		}
 	}
 }
 
-bool find_in_pool(const SSharedBuffer* buffer, size_t* pos)
+// Look for a buffer with the same data.  Returns true and its slot if
+// found, otherwise false and the empty slot where it would go.
+static bool find_in_pool(const pool_shard& shard, const SSharedBuffer* buffer,
+	uint32_t hash, size_t* pos)
 {
-	ssize_t mid, low = 0, high = ((ssize_t)g_poolSize)-1;
-	while (low <= high) {
-		mid = (low + high)/2;
-		const int32_t cmp = buffer->Compare(g_pool[mid]);
-		if (cmp < 0) {
-			high = mid-1;
-		} else if (cmp > 0) {
-			low = mid+1;
-		} else {
-			*pos = mid;
+	if (shard.entries == NULL) return false;
+
+	size_t i = hash & shard.mask;
+	const pool_entry* e;
+	while ((e=shard.entries+i)->buffer != NULL) {
+		if (e->hash == hash && buffer->Compare(e->buffer) == 0) {
+			*pos = i;
 			return true;
 		}
+		i = (i+1) & shard.mask;
 	}
 	
-	*pos = low;
+	*pos = i;
 	return false;
 }
 
-bool add_to_pool(const SSharedBuffer* buffer, size_t pos)
+static bool grow_pool(pool_shard& shard)
 {
-	size_t newSize = g_poolSize+1;
-	if (newSize > g_poolAvail) {
-		size_t newAvail = ((g_poolAvail+2)*3)/2;
-		void* newPool = realloc(g_pool, newAvail*sizeof(SSharedBuffer*));
-		if (!newPool) return false;
-		g_pool = (const SSharedBuffer**)newPool;
-		g_poolAvail = newAvail;
+	const size_t newSize = shard.entries ? (shard.mask+1)*2 : MIN_POOL_TABLE;
+	pool_entry* entries = (pool_entry*)calloc(newSize, sizeof(pool_entry));
+	if (entries == NULL) return false;
+
+	for (size_t i=0; shard.entries != NULL && i<=shard.mask; i++) {
+		const pool_entry& e = shard.entries[i];
+		if (e.buffer == NULL) continue;
+		size_t j = e.hash & (newSize-1);
+		while (entries[j].buffer != NULL) j = (j+1) & (newSize-1);
+		entries[j] = e;
 	}
-	
-	if (pos < g_poolSize) {
-		memmove(g_pool+pos+1, g_pool+pos, (g_poolSize-pos)*sizeof(SSharedBuffer*));
+	free(shard.entries);
+	shard.entries = entries;
+	shard.mask = newSize-1;
+	return true;
+}
+
+// 'pos' is the slot find_in_pool() returned.
+static bool add_to_pool(pool_shard& shard, const SSharedBuffer* buffer, uint32_t hash, size_t pos)
+{
+	// Keep the table at most half full.
+	if (shard.entries == NULL || (shard.count+1)*2 > shard.mask+1) {
+		if (!grow_pool(shard)) return false;
+		find_in_pool(shard, buffer, hash, &pos);
 	}
-	g_pool[pos] = buffer;
-	g_poolSize = newSize;
+
+	shard.entries[pos].hash = hash;
+	shard.entries[pos].buffer = buffer;
+	shard.count++;
 #if PRINT_POOL_METRICS
+	g_poolSize++;
 	g_poolMemSize += USED_SIZE(buffer->Length());
 	bout << "Buffer: " << SHexDump(buffer->Data(), buffer->Length()) << endl;
-	printf("Added to shared buffer pool at %d: count=%d, mem=%d\n", pos, g_poolSize, g_poolMemSize);
+	printf("Added to shared buffer pool: count=%d, mem=%d\n", g_poolSize, g_poolMemSize);
 #endif
 	return true;
 }
 
-void remove_from_pool(size_t pos)
+static void remove_from_pool(pool_shard& shard, size_t pos)
 {
 #if PRINT_POOL_METRICS
-	g_poolMemSize -= USED_SIZE(g_pool[pos]->Length());
-	bout << "Buffer: " << SHexDump(g_pool[pos]->Data(), g_pool[pos]->Length()) << endl;
-	printf("Removed from shared buffer pool at %d: count=%d, mem=%d\n", pos, g_poolSize-1, g_poolMemSize);
-#endif
-	if (pos < (g_poolSize-1)) memmove(g_pool+pos, g_pool+pos+1, (g_poolSize-pos-1)*sizeof(SSharedBuffer*));
-	g_pool[g_poolSize-1] = NULL;
 	g_poolSize--;
+	g_poolMemSize -= USED_SIZE(shard.entries[pos].buffer->Length());
+	bout << "Buffer: " << SHexDump(shard.entries[pos].buffer->Data(), shard.entries[pos].buffer->Length()) << endl;
+	printf("Removed from shared buffer pool: count=%d, mem=%d\n", g_poolSize, g_poolMemSize);
+#endif
+	// Move later entries of the run into the hole, unless that would
+	// put them before the slot they hash to.
+	size_t hole = pos;
+	size_t i = pos;
+	for (;;) {
+		i = (i+1) & shard.mask;
+		if (shard.entries[i].buffer == NULL) break;
+		const size_t home = shard.entries[i].hash & shard.mask;
+		if (hole <= i ? (hole < home && home <= i) : (hole < home || home <= i)) continue;
+		shard.entries[hole] = shard.entries[i];
+		hole = i;
+	}
+	shard.entries[hole].buffer = NULL;
+	shard.count--;
 }
 
 // --------------------------------------------------------------------
@@ -152,29 +228,31 @@ inline void SSharedBuffer::SetLength(size_t len)
 
 bool SSharedBuffer::unpool() const
 {
-	lock_pool();
+	const uint32_t hash = hash_buffer(this);
+	pool_shard& shard = shard_for(hash);
+	lock_pool(shard);
 
 	// Okay, anything could have happened before we mucked with the
 	// ref count and got the pool locked.  In particular, someone could
 	// have come in and gotten a hold on this shared buffer before we
 	// locked the pool...  if that happened, we'd better not free it!
 	if ((m_users>>B_BUFFER_USERS_SHIFT) != 0) {
-		unlock_pool();
+		unlock_pool(shard);
 		return false;
 	}
 
 	// Looks like we should indeed remove this from the pool.
 	size_t pos;
-	if (find_in_pool(this, &pos)) {
-		remove_from_pool(pos);
-		unlock_pool();
+	if (find_in_pool(shard, this, hash, &pos) && shard.entries[pos].buffer == this) {
+		remove_from_pool(shard, pos);
+		unlock_pool(shard);
 		return true;
 	}
 
 	// Gack, this shouldn't happen!  Oh well, better to leak than
 	// to crash.
 	DbgOnlyFatalError("SSharedBuffer: a buffer disappeared from the pool!");
-	unlock_pool();
+	unlock_pool(shard);
 	return false;
 }
 
@@ -336,14 +414,16 @@ const SSharedBuffer* SSharedBuffer::Pool() const
 {
 	if (m_users&(B_STATIC_USERS|B_POOLED_USERS)) return this;
 
-	lock_pool();
+	const uint32_t hash = hash_buffer(this);
+	pool_shard& shard = shard_for(hash);
+	lock_pool(shard);
 
 	const SSharedBuffer* pooled = this;
 	if ((pooled->m_users&B_POOLED_USERS) == 0) {
 
 		size_t pos;
-		if (find_in_pool(this, &pos)) {
-			pooled = g_pool[pos];
+		if (find_in_pool(shard, this, hash, &pos)) {
+			pooled = shard.entries[pos].buffer;
 #if PRINT_POOL_METRICS
 			static size_t g_savedMem = 0;
 			g_savedMem += USED_SIZE(pooled->Length());
@@ -359,15 +439,15 @@ const SSharedBuffer* SSharedBuffer::Pool() const
 				pooled->DecUsers();
 				pooled = copy;
 			}
-			if (add_to_pool(pooled, pos)) {
-				g_threadDirectFuncs.atomicOr32((uint32_t volatile *)&m_users, B_POOLED_USERS);
+			if (add_to_pool(shard, pooled, hash, pos)) {
+				g_threadDirectFuncs.atomicOr32((uint32_t volatile *)&pooled->m_users, B_POOLED_USERS);
 			}
 		}
 
 	}
 
 outahere:
-	unlock_pool();
+	unlock_pool(shard);
 	return pooled;
 }
 
@@ -87,7 +87,7 @@ char g_ipcProfileSymbols[] = "BINDER_IPC_PROFILE_SYMBOLS";
 BDebugInteger<g_ipcProfileSymbols, 1, 0, 1> g_profileSymbols;
 #endif
 
-SLocker	g_parcel_pool_lock;
+SLocker	g_parcel_pool_lock("SParcel cache");
 parcel_pool_cleanup g_parcel_pool_cleanup;
 
 #if TARGET_HOST == TARGET_HOST_PALMOS
@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 #include <unistd.h>
 #include <SysThreadConcealed.h>
 #include <cxxabi.h>
@@ -67,8 +69,6 @@ struct our_thread_init_record
 	pid_t tid;	// The linux thread ID. There is no API to retrieve this from a pthread ID, so we must have the new thread retrieve it.
 	sem_t preroll;
 	sem_t startup;
-	sem_t blockThread; // used for critical sections
-	our_thread_init_record * nextWaitingThread; // linked list of waiting threads, for critical sections
 	
 	char * name;
 	our_thread_group_record * group;
@@ -106,8 +106,6 @@ our_thread_init_record *  SetupPrimaryThread()
 	threadRecord->name = "Primary";
 	threadRecord->group = NULL;
 	
-	sem_init(&threadRecord->blockThread, 0, 0);
-	
 	pthread_setspecific(currentThreadRecord, threadRecord);
 	
 	return threadRecord;
@@ -228,7 +226,6 @@ void cleanup(void * arg)
 
 	pthread_setspecific(currentThreadRecord, 0);
 	
-	sem_destroy(&thread->blockThread);
 	sem_destroy(&thread->startup);
 	sem_destroy(&thread->preroll);
 	
@@ -423,7 +420,6 @@ extern "C" status_t SysThreadCreate(
 	
 	sem_init(&threadRecord->preroll, 0, 0);
 	sem_init(&threadRecord->startup, 0, 0);
-	sem_init(&threadRecord->blockThread, 0, 0);
 	
 	threadRecord->magic = our_thread_init_record_MAGIC;
 	threadRecord->group = NULL;
@@ -441,7 +437,6 @@ extern "C" status_t SysThreadCreate(
 	if (err) {
 		sem_destroy(&threadRecord->preroll);
 		sem_destroy(&threadRecord->startup);
-		sem_destroy(&threadRecord->blockThread);
 		free(threadRecord);
 		printf("THREAD FAILED TO BE CREATED!\n");
 		return err;
@@ -608,7 +603,7 @@ extern "C" status_t  SysThreadChangePriority(SysHandle thread, uint8_t priority)
 extern "C" void
 SysCriticalSectionInit(SysCriticalSectionType *iCS)
 {
-	iCS = sysCriticalSectionInitializer;
+	*(volatile int32_t *)iCS = sysCriticalSectionInitializer;
 }
 
 extern "C" void
@@ -617,217 +612,196 @@ SysCriticalSectionDestroy(SysCriticalSectionType *iCS)
 	(void)iCS;
 }
 
-extern "C" void
-SysCriticalSectionEnter(SysCriticalSectionType *iCS)
+/*
+ * Critical sections and condition variables are futexes.  Only the
+ * first 32 bits of a SysCriticalSectionType or SysConditionVariableType
+ * are used, so they behave the same on 32 and 64 bit hosts and fit in
+ * the int32_t that SLocker and SConditionVariable keep them in.
+ */
+
+static inline int
+futex_wait(volatile int32_t *addr, int32_t value)
 {
-	our_thread_init_record * ourselves;
-	our_thread_init_record * old;
-	uint32_t retry;
-	uint32_t zero;
-	
-	SysCurrentThread(); // Make sure thread record for primary thread has been created
+	return syscall(SYS_futex, (int32_t*)addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
 
-	ourselves = (our_thread_init_record*)pthread_getspecific(currentThreadRecord);
-	
-	assert(ourselves);
-	assert(ourselves->magic == our_thread_init_record_MAGIC);
+static inline int
+futex_wake(volatile int32_t *addr, int32_t count)
+{
+	return syscall(SYS_futex, (int32_t*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
 
+static inline int32_t
+atomic_swap(volatile int32_t *addr, int32_t value)
+{
+	int32_t old;
 	do {
-		old= (our_thread_init_record*)*((uint32_t volatile *)iCS);
-		ourselves->nextWaitingThread = old;
-
-		retry= SysAtomicCompareAndSwap32(
-						(volatile uint32_t *)iCS,
-						(uint32_t)old,
-						(uint32_t)ourselves
-					);
-	} while(retry);
-
-	if(old) {
-		zero= 0;
-		int result;
-		while ((result = sem_wait(&ourselves->blockThread)) == -1 && errno == EINTR)
-			;
-	}
+		old= *addr;
+	} while(SysAtomicCompareAndSwap32((volatile uint32_t *)addr, (uint32_t)old, (uint32_t)value));
+	return old;
 }
 
-extern "C" void
-SysCriticalSectionExit(SysCriticalSectionType *iCS)
+static inline void
+cpu_relax()
 {
-	our_thread_init_record * ourselves;
-	our_thread_init_record *curr;
-	uint32_t * volatile *prev;
-	uint32_t retry;
-	
-	SysCurrentThread();
+#if defined(__i386__) || defined(__x86_64__)
+	asm volatile("pause" ::: "memory");
+#else
+	asm volatile("" ::: "memory");
+#endif
+}
 
-	ourselves = (our_thread_init_record*)pthread_getspecific(currentThreadRecord);
+enum {
+	csUnlocked = sysCriticalSectionInitializer,
+	csLocked = 1,
+	csContended = 2		/* locked, and threads may be sleeping on it */
+};
 
-	assert(ourselves);
-	assert(ourselves->magic == our_thread_init_record_MAGIC);
+/*
+ * How many times to poll a held critical section before going to sleep
+ * on it.  Spinning only pays off when the holder can be running on
+ * another CPU at the same time.
+ */
+static int32_t
+critical_section_spin()
+{
+	static int32_t spin = -1;
+	if (spin < 0) {
+		spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 100 : 0;
+	}
+	return spin;
+}
 
+extern "C" void
+SysCriticalSectionEnter(SysCriticalSectionType *iCS)
+{
+	volatile int32_t *word = (volatile int32_t *)iCS;
+	int32_t i;
 
-	do {
-		prev= (uint32_t * volatile *)(iCS);
-		curr= (our_thread_init_record*)*prev;
+	if(SysAtomicCompareAndSwap32((volatile uint32_t *)word, csUnlocked, csLocked) == 0) {
+		return;
+	}
 
-		while(curr != ourselves) {
-		
-			assert(curr->magic == our_thread_init_record_MAGIC);
-			
-			prev= (uint32_t**)(&curr->nextWaitingThread);
-			curr= (our_thread_init_record*)*prev;
+	/*
+	 * Spin a little, in case the holder is about to leave.  Give up
+	 * as soon as someone is sleeping on it, since the holder is then
+	 * going to hand it to them anyway.
+	 */
+	for(i= critical_section_spin(); i > 0; i--) {
+		const int32_t state= *word;
+		if(state == csUnlocked) {
+			if(SysAtomicCompareAndSwap32((volatile uint32_t *)word, csUnlocked, csLocked) == 0) {
+				return;
+			}
+		} else if(state == csContended) {
+			break;
 		}
+		cpu_relax();
+	}
 
-		if(prev!= (uint32_t* volatile *)iCS) {
-			/*
-			 * easy part, we are not the head of the queue
-			 * so we can freely fix the queue without
-			 * concurrency issues.
-			 */
-			our_thread_init_record *otherThread;
-
-			otherThread= (our_thread_init_record*)(((uint32_t)prev)-offsetof(our_thread_init_record,nextWaitingThread));
-
-			assert(otherThread->magic == our_thread_init_record_MAGIC);
-
-			*prev= 0;
-			sem_post(&otherThread->blockThread);
-			retry= 0;
-		} else {
-			/*
-			 * this is the tricky part, we are the only thread
-			 * in the list so prev is aliased to iCS... we need
-			 * to do an atomic operation since some may be trying
-			 * to enter the critical section.
-			 *
-			 * Note that this retry business is not particulary
-			 * expensive, since the inner loop took only 1
-			 * iteration in the first pass of the outer one, and
-			 * the second pass will involve no atomic operations
-			 * at all.
-			 *
-			 * Note also that if the CompareAndSwap succeeds
-			 * there is no thread to wake up.
-			 */
-			retry= SysAtomicCompareAndSwap32(
-							(volatile uint32_t *)iCS,
-							(uint32_t)ourselves,
-							0
-						);
-		}
-	} while(retry);
+	/*
+	 * Mark it contended and sleep until it is released.  We don't
+	 * know if anyone else is still waiting, so we keep it marked
+	 * contended once we get it.
+	 */
+	while(atomic_swap(word, csContended) != csUnlocked) {
+		futex_wait(word, csContended);
+	}
 }
 
+extern "C" void
+SysCriticalSectionExit(SysCriticalSectionType *iCS)
+{
+	volatile int32_t *word = (volatile int32_t *)iCS;
+
+	if(SysAtomicDec32(word) != csLocked) {
+		*word= csUnlocked;
+		futex_wake(word, 1);
+	}
+}
 
 
-#define sysConditionVariableOpened 1
+/*
+ * The low bit of a condition variable is set while it is opened, and
+ * the next bit while there are threads waiting on it.  Open() and
+ * Broadcast() advance the remaining bits, which is what waiting
+ * threads look for to know they have been released.
+ */
+enum {
+	cvOpened = 0x1,
+	cvWaiters = 0x2,
+	cvGeneration = 0x4
+};
 
 extern "C" void
 SysConditionVariableWait(SysConditionVariableType *iCV, SysCriticalSectionType *iOptionalCS)
 {
-	our_thread_init_record * ourselves;
-	our_thread_init_record * old;
-	uint32_t retry;
-
-	SysCurrentThread();
-
-	ourselves = (our_thread_init_record*)pthread_getspecific(currentThreadRecord);
-
-	assert(ourselves);
-	assert(ourselves->magic == our_thread_init_record_MAGIC);
+	volatile int32_t *word = (volatile int32_t *)iCV;
+	int32_t state;
 
 	/*
-	 * If the condition is not opened, push this thread
-	 * on to the list of those waiting.
+	 * If the condition is not opened, note that there is a
+	 * thread waiting on it.
 	 */
-	do {
-		old= (our_thread_init_record*)*((uint32_t volatile *)iCV);
-
-		if ((uint32_t)old== sysConditionVariableOpened) {
-			break;
+	while(1) {
+		state= *word;
+		if(state & cvOpened) {
+			return;
 		}
-
-		ourselves->nextWaitingThread = old;
-
-		retry= SysAtomicCompareAndSwap32(
-						(volatile uint32_t *)iCV,
-						(uint32_t)old,
-						(uint32_t)ourselves
-					);
-	} while(retry);
-
-	/*
-	 * Now wait for the condition to be opened if it
-	 * previously wasn't.
-	 */
-	if((uint32_t)old!= sysConditionVariableOpened) {
-		if(iOptionalCS) {
-			SysCriticalSectionExit(iOptionalCS);
+		if(state & cvWaiters) {
+			break;
 		}
-
-		int result;
-		while ((result = sem_wait(&ourselves->blockThread)) == -1 && errno == EINTR)
-			;
-
-		if (iOptionalCS) {
-			SysCriticalSectionEnter(iOptionalCS);
+		if(SysAtomicCompareAndSwap32((volatile uint32_t *)word,
+				(uint32_t)state, (uint32_t)(state|cvWaiters)) == 0) {
+			state|= cvWaiters;
+			break;
 		}
 	}
-}
-
-static void
-wake_up_condition(our_thread_init_record *curr)
-{
-	our_thread_init_record *next;
 
 	/*
-	 * Iterate through the list, clearing it and waking
-	 * up its threads.
+	 * Now wait for the condition to be opened or broadcast.
 	 */
-	while(curr != sysConditionVariableInitializer) {
+	if(iOptionalCS) {
+		SysCriticalSectionExit(iOptionalCS);
+	}
 
-		assert(curr->magic == our_thread_init_record_MAGIC);
+	while(*word == state) {
+		futex_wait(word, state);
+	}
 
-		next = curr->nextWaitingThread;
-		curr->nextWaitingThread = (our_thread_init_record*)sysConditionVariableInitializer;
-		sem_post(&curr->blockThread);
-		curr = next;
+	if(iOptionalCS) {
+		SysCriticalSectionEnter(iOptionalCS);
 	}
 }
 
 extern "C" void
 SysConditionVariableOpen(SysConditionVariableType *iCV)
 {
-	our_thread_init_record *curr;
-	uint32_t retry;
+	volatile int32_t *word = (volatile int32_t *)iCV;
+	int32_t state;
 
 	/*
-	 * Atomically open the condition and retrieve the list of
+	 * Atomically open the condition and release the
 	 * waiting threads.
 	 */
 	do {
-		curr= (our_thread_init_record*)*(uint32_t * volatile *)(iCV);
-		if ((uint32_t)curr == sysConditionVariableOpened) {
-			curr = (our_thread_init_record*)sysConditionVariableInitializer;
-			break;
+		state= *word;
+		if(state & cvOpened) {
+			return;
 		}
+	} while(SysAtomicCompareAndSwap32((volatile uint32_t *)word, (uint32_t)state,
+				(uint32_t)(((state+cvGeneration)&~cvWaiters)|cvOpened)));
 
-		retry= SysAtomicCompareAndSwap32(
-						(volatile uint32_t *)iCV,
-						(uint32_t)curr,
-						(uint32_t)sysConditionVariableOpened
-					);
-	} while(retry);
-
-	wake_up_condition(curr);
+	if(state & cvWaiters) {
+		futex_wake(word, INT_MAX);
+	}
 }
 
 extern "C" void
 SysConditionVariableClose(SysConditionVariableType *iCV)
 {
-	uint32_t curr;
-	uint32_t retry;
+	volatile int32_t *word = (volatile int32_t *)iCV;
+	int32_t state;
 
 	/*
 	 * Atomically transition the condition variable
@@ -835,41 +809,31 @@ SysConditionVariableClose(SysConditionVariableType *iCV)
 	 * opened, leave it as-is.
 	 */
 	do {
-		curr= *(volatile uint32_t *)iCV;
-		if (curr != sysConditionVariableOpened) {
-			break;
+		state= *word;
+		if(!(state & cvOpened)) {
+			return;
 		}
-
-		retry= SysAtomicCompareAndSwap32(
-						(volatile uint32_t *)iCV,
-						curr,
-						(uint32_t)sysConditionVariableInitializer
-					);
-	} while(retry);
+	} while(SysAtomicCompareAndSwap32((volatile uint32_t *)word, (uint32_t)state,
+				(uint32_t)(state&~cvOpened)));
 }
 
 extern "C" void
 SysConditionVariableBroadcast(SysConditionVariableType *iCV)
 {
-	uint32_t *curr;
-	uint32_t retry;
+	volatile int32_t *word = (volatile int32_t *)iCV;
+	int32_t state;
 
 	/*
-	 * Atomically retrieve and clear the list of
-	 * waiting threads.
+	 * Atomically release the waiting threads, leaving the
+	 * condition closed.
 	 */
 	do {
-		curr= *(uint32_t * volatile *)(iCV);
-
-		retry= SysAtomicCompareAndSwap32(
-						(volatile uint32_t *)iCV,
-						(uint32_t)curr,
-						(uint32_t)sysConditionVariableInitializer
-					);
-	} while(retry);
+		state= *word;
+	} while(SysAtomicCompareAndSwap32((volatile uint32_t *)word, (uint32_t)state,
+				(uint32_t)((state+cvGeneration)&~(cvOpened|cvWaiters))));
 
-	if(curr!= (uint32_t *)sysConditionVariableOpened) {
-		wake_up_condition((our_thread_init_record*)curr);
+	if(state & cvWaiters) {
+		futex_wake(word, INT_MAX);
 	}
 }
 
@@ -1362,6 +1362,8 @@ ssize_t SValue::ArchivedSize() const
 
 ssize_t SValue::Archive(SParcel& into) const
 {
+	if (into.IsCompactValues()) return archive_compact(into);
+
 	const uint32_t len = B_UNPACK_TYPE_LENGTH(m_type);
 
 	// Small data value.
@@ -1392,24 +1394,36 @@ ssize_t SValue::Archive(SParcel& into) const
 
 	// Large data value.
 	if (len == B_TYPE_LENGTH_LARGE) {
-		FINISH_ARCHIVE(into.WriteLargeData(m_type, m_data.buffer->Length(), m_data.buffer->Data()));
+		FINISH_ARCHIVE(into.WriteLargeData(m_type, m_data.buffer));
 	}
 
 	// Else -- it's a map.
 
 	DbgOnlyFatalErrorIf(len != B_TYPE_LENGTH_MAP, "Archiving with unexpected length!");
 
+	// If the map's size isn't already known, write it with an empty
+	// header and fill that in afterwards, rather than walking the whole
+	// map once to size it and again to write it.
+	ssize_t mapSize = m_data.map->CachedArchivedSize();
+	if (mapSize < 0 && !into.CanPatchData()) mapSize = m_data.map->ArchivedSize();
+	
 	value_map_header header;
 	header.header.type = kMapTypeCode;
-	header.header.length = sizeof(value_map_info) + value_data_align(m_data.map->ArchivedSize());
+	header.header.length = sizeof(value_map_info) + (mapSize >= 0 ? value_data_align(mapSize) : 0);
 	header.info.count = m_data.map->CountMaps();
 	header.info.order = 1;
 
+	const off_t headerPos = into.Position();
 	ssize_t err;
 	if ((err=into.Write(&header, sizeof(header))) < 0) return err;
 
 	err = m_data.map->Archive(into);
 	if (err >= B_OK) {
+		if (mapSize < 0) {
+			header.header.length = sizeof(value_map_info) + value_data_align(err);
+			const status_t patched = into.PatchData(headerPos, &header, sizeof(header));
+			if (patched < B_OK) return patched;
+		}
 		FINISH_ARCHIVE((sizeof(header)+err));
 	}
 
@@ -1432,6 +1446,13 @@ ssize_t SValue::Archive(const sptr<IByteOutput>& into) const
 ssize_t SValue::Unarchive(SParcel& from)
 {
 	if (is_defined()) Undefine();
+	if (from.IsCompactValues()) {
+		const size_t start = (size_t)from.Position();
+		size_t pos = start;
+		const status_t err = unarchive_compact(from, (const uint8_t*)from.Data(), from.Length(), &pos);
+		from.SetPosition(pos);
+		return err < B_OK ? err : (ssize_t)(pos-start);
+	}
 	return unarchive_internal(from, 0x7fffffff);
 }
 
@@ -1481,7 +1502,8 @@ ssize_t SValue::unarchive_internal(SParcel& from, size_t avail)
 		DbgOnlyFatalErrorIf(sizeof(value_map_info) != sizeof(small_flat_data), "Ooops!");
 		if ((err=from.ReadSmallData((small_flat_data*)&info)) == sizeof(info)) {
 			ssize_t retErr;	// don't use err so ADS doesn't alias it.
-			BValueMap* obj = BValueMap::Create(from, avail-sizeof(value_map_header), info.count, &retErr);
+			BValueMap* obj = BValueMap::Create(from, avail-sizeof(value_map_header), info.count,
+				info.order, &retErr);
 			err = retErr;
 			if (err >= 0) {
 				// Plug in this value.
@@ -1505,6 +1527,257 @@ ssize_t SValue::Unarchive(const sptr<IByteInput>& from)
 	return Unarchive(p);
 }
 
+// ------------------------------------------------------------------------
+// Compact archives
+
+// Each value in a compact archive starts with one of these tags.  The
+// common simple types have a tag of their own; anything else carries
+// its packed type code.  Integers and lengths are LEB128 varints, and
+// nothing is padded except binder objects, which the driver needs to
+// find aligned.
+enum {
+	kCompactUndefined = 0,
+	kCompactWild,
+	kCompactNull,
+	kCompactFalse,
+	kCompactTrue,
+	kCompactInt32,		// zigzag varint
+	kCompactInt64,		// zigzag varint
+	kCompactString,		// varint length, then the characters without terminator
+	kCompactMap,		// varint count, then each key and value
+	kCompactObject,		// zeros to a 4 byte boundary, then a flat_binder_object
+	kCompactSmall,		// varint packed type, then 0 to 4 bytes of data
+	kCompactLarge		// varint packed type, varint length, then the data
+};
+
+// A tag, two varints and small data.
+static const size_t kMaxCompactHeader = 1 + 10 + 10 + B_TYPE_LENGTH_MAX;
+
+static inline size_t put_varint(uint8_t* out, uint64_t val)
+{
+	size_t n = 0;
+	while (val >= 0x80) {
+		out[n++] = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+	out[n++] = (uint8_t)val;
+	return n;
+}
+
+static inline bool get_varint(const uint8_t* data, size_t end, size_t* pos, uint64_t* out)
+{
+	uint64_t val = 0;
+	size_t p = *pos;
+	for (uint32_t shift=0; shift<64 && p<end; shift+=7) {
+		const uint8_t b = data[p++];
+		val |= uint64_t(b&0x7f) << shift;
+		if ((b&0x80) == 0) {
+			*pos = p;
+			*out = val;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline uint64_t zigzag_encode(int64_t val)
+{
+	return (uint64_t(val) << 1) ^ uint64_t(val >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t val)
+{
+	return int64_t(val >> 1) ^ -int64_t(val & 1);
+}
+
+ssize_t SValue::archive_compact(SParcel& into) const
+{
+	uint8_t head[kMaxCompactHeader];
+	size_t n = 0;
+	ssize_t err;
+	const uint32_t len = B_UNPACK_TYPE_LENGTH(m_type);
+
+	// Small data value.
+	if (len <= B_TYPE_LENGTH_MAX) {
+		if (is_error()) return ErrorCheck();
+
+		if (is_object()) {
+			// The binder goes through the parcel as usual, so that its
+			// references and offset are tracked.
+			head[n++] = kCompactObject;
+			while (((size_t)into.Position()+n) & 3) head[n++] = 0;
+			if ((err=into.Write(head, n)) < B_OK) return err;
+			if ((err=into.WriteBinder(*reinterpret_cast<const small_flat_data*>(this))) < B_OK) return err;
+			return n + err;
+		}
+
+		if (m_type == kUndefinedTypeCode) {
+			head[n++] = kCompactUndefined;
+		} else if (m_type == kWildTypeCode) {
+			head[n++] = kCompactWild;
+		} else if (m_type == kNullTypeCode) {
+			head[n++] = kCompactNull;
+		} else if (m_type == B_PACK_SMALL_TYPE(B_BOOL_TYPE, 1)) {
+			head[n++] = m_data.local[0] ? kCompactTrue : kCompactFalse;
+		} else if (m_type == B_PACK_SMALL_TYPE(B_INT32_TYPE, sizeof(int32_t))) {
+			head[n++] = kCompactInt32;
+			n += put_varint(head+n, zigzag_encode(m_data.integer));
+		} else if (B_UNPACK_TYPE_CODE(m_type) == B_STRING_TYPE && len > 0
+				&& m_data.string[len-1] == 0) {
+			head[n++] = kCompactString;
+			n += put_varint(head+n, len-1);
+			memcpy(head+n, m_data.local, len-1);
+			n += len-1;
+		} else {
+			head[n++] = kCompactSmall;
+			n += put_varint(head+n, m_type);
+			memcpy(head+n, m_data.local, len);
+			n += len;
+		}
+		return into.Write(head, n);
+	}
+
+	// Large data value.
+	if (len == B_TYPE_LENGTH_LARGE) {
+		const uint8_t* data = (const uint8_t*)m_data.buffer->Data();
+		size_t size = m_data.buffer->Length();
+		if (m_type == B_PACK_LARGE_TYPE(B_INT64_TYPE) && size == sizeof(int64_t)) {
+			int64_t val;
+			memcpy(&val, data, sizeof(val));
+			head[n++] = kCompactInt64;
+			n += put_varint(head+n, zigzag_encode(val));
+			return into.Write(head, n);
+		}
+		if (B_UNPACK_TYPE_CODE(m_type) == B_STRING_TYPE && data[size-1] == 0) {
+			size--;
+			head[n++] = kCompactString;
+			n += put_varint(head+n, size);
+		} else {
+			head[n++] = kCompactLarge;
+			n += put_varint(head+n, m_type);
+			n += put_varint(head+n, size);
+		}
+		if ((err=into.Write(head, n)) < B_OK) return err;
+		if ((err=into.Write(data, size)) < B_OK) return err;
+		return n + size;
+	}
+
+	// Else -- it's a map.
+
+	DbgOnlyFatalErrorIf(len != B_TYPE_LENGTH_MAP, "Archiving with unexpected length!");
+
+	const BValueMap* map = m_data.map;
+	const size_t count = map->CountMaps();
+	head[n++] = kCompactMap;
+	n += put_varint(head+n, count);
+	if ((err=into.Write(head, n)) < B_OK) return err;
+
+	ssize_t total = n;
+	for (size_t i=0; i<count; i++) {
+		const BValueMap::pair& p = map->MapAt(i);
+		if ((err=p.key.archive_compact(into)) < B_OK) return err;
+		total += err;
+		if ((err=p.value.archive_compact(into)) < B_OK) return err;
+		total += err;
+	}
+	return total;
+}
+
+status_t SValue::unarchive_compact(SParcel& from, const uint8_t* data, size_t end, size_t* pos)
+{
+	// Like unarchive_internal(), this may be called on uninitialized
+	// memory, so nothing is freed on the way in.
+	uint64_t val, size;
+	void* buf;
+
+	if (*pos >= end) goto error;
+
+	m_data.uinteger = 0;
+	switch (data[(*pos)++]) {
+		case kCompactUndefined:
+			m_type = kUndefinedTypeCode;
+			return B_OK;
+		case kCompactWild:
+			m_type = kWildTypeCode;
+			return B_OK;
+		case kCompactNull:
+			m_type = kNullTypeCode;
+			return B_OK;
+		case kCompactFalse:
+		case kCompactTrue:
+			m_type = B_PACK_SMALL_TYPE(B_BOOL_TYPE, 1);
+			m_data.local[0] = data[*pos-1] == kCompactTrue;
+			return B_OK;
+		case kCompactInt32:
+			if (!get_varint(data, end, pos, &val)) break;
+			m_type = B_PACK_SMALL_TYPE(B_INT32_TYPE, sizeof(int32_t));
+			m_data.integer = (int32_t)zigzag_decode(val);
+			return B_OK;
+		case kCompactInt64: {
+			if (!get_varint(data, end, pos, &val)) break;
+			const int64_t i64 = zigzag_decode(val);
+			if ((buf=alloc_data(B_INT64_TYPE, sizeof(i64))) == NULL) return ErrorCheck();
+			memcpy(buf, &i64, sizeof(i64));
+			return B_OK;
+		}
+		case kCompactString:
+			if (!get_varint(data, end, pos, &size) || size > end-*pos) break;
+			if ((buf=alloc_data(B_STRING_TYPE, (size_t)size+1)) == NULL) return ErrorCheck();
+			memcpy(buf, data+*pos, (size_t)size);
+			static_cast<char*>(buf)[size] = 0;
+			*pos += (size_t)size;
+			return B_OK;
+		case kCompactSmall:
+			if (!get_varint(data, end, pos, &val) || val > 0xffffffff
+					|| B_UNPACK_TYPE_LENGTH(val) > B_TYPE_LENGTH_MAX) break;
+			size = B_UNPACK_TYPE_LENGTH(val);
+			if (size > end-*pos) break;
+			m_type = (uint32_t)val;
+			// Objects must come through the parcel, which owns their references.
+			if (is_object()) break;
+			memcpy(m_data.local, data+*pos, (size_t)size);
+			*pos += (size_t)size;
+			return B_OK;
+		case kCompactLarge:
+			if (!get_varint(data, end, pos, &val) || val > 0xffffffff
+					|| B_UNPACK_TYPE_LENGTH(val) != B_TYPE_LENGTH_LARGE) break;
+			if (!get_varint(data, end, pos, &size) || size > end-*pos
+					|| size <= B_TYPE_LENGTH_MAX) break;
+			if ((buf=alloc_data(B_UNPACK_TYPE_CODE(val), (size_t)size)) == NULL) return ErrorCheck();
+			memcpy(buf, data+*pos, (size_t)size);
+			*pos += (size_t)size;
+			return B_OK;
+		case kCompactMap: {
+			// Every pair takes at least two bytes.
+			if (!get_varint(data, end, pos, &val) || val == 0 || val > (end-*pos)/2) break;
+			status_t err;
+			BValueMap* map = BValueMap::CreateCompact(from, data, end, pos, (size_t)val, &err);
+			if (map == NULL) {
+				m_type = kUndefinedTypeCode;
+				return set_error(err);
+			}
+			m_type = kMapTypeCode;
+			m_data.map = map;
+			CHECK_INTEGRITY(*this);
+			return B_OK;
+		}
+		case kCompactObject: {
+			*pos = (*pos+3) & ~(size_t)3;
+			if (*pos > end) break;
+			from.SetPosition(*pos);
+			const ssize_t err = unarchive_internal(from, end-*pos);
+			if (err < B_OK) return err;
+			*pos = (size_t)from.Position();
+			if (is_object()) return B_OK;
+			FreeData();
+		} break;
+	}
+
+error:
+	m_type = kUndefinedTypeCode;
+	return set_error(B_BAD_DATA);
+}
+
 // ------------------------------------------------------------------------
 
 // This is a comparison between values with two nice properties:
@@ -1533,6 +1806,9 @@ int32_t SValue::Compare(const SValue& o) const
 				? ( (m_data.integer < o.m_data.integer) ? -1 : 1 )
 				: 0;
 		case B_TYPE_LENGTH_LARGE:
+			// Pooled data, such as map keys, is usually the same buffer.
+			if (m_data.buffer == o.m_data.buffer)
+				return 0;
 			len = m_data.buffer->Length();
 			if (len != o.m_data.buffer->Length())
 				return len < o.m_data.buffer->Length() ? -1 : 1;
@@ -1582,6 +1858,8 @@ int32_t SValue::compare(uint32_t type, const void* data, size_t length) const
 			len = m_data.buffer->Length();
 			if (len != length)
 				return len < length ? -1 : 1;
+			if (data == m_data.buffer->Data())
+				return 0;
 			return memcmp(m_data.buffer->Data(), data, len);
 	}
 	return 0;
@@ -3770,9 +4048,13 @@ const SValue& SValue::ReplaceValues(const SValue* newValues, const size_t* indic
 				if (idx < mapCount) {
 					// this can't use BeginEditMap / EndEditMap since that normalizes the undefined
 					// values, and doing that will screw up our indices.
-					BValueMap::pair& p = (BValueMap::pair&)(*map)->MapAt(idx);
-					p.value = newValues[i];
-					DbgOnlyFatalErrorIf(p.value.IsDefined() == false, "ReplaceValues cannot be used with undefined values");
+					SValue* value = (*map)->EditValueAt(idx);
+					if (value == NULL) {
+						set_error(B_NO_MEMORY);
+						break;
+					}
+					*value = newValues[i];
+					DbgOnlyFatalErrorIf(value->IsDefined() == false, "ReplaceValues cannot be used with undefined values");
 				}
 			}
 		}
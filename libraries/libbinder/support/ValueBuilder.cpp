@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+#include <support/ValueBuilder.h>
+
+#include <support_p/ValueMap.h>
+
+#include <stdlib.h>
+#include <new>
+
+#include "ValueInternal.h"
+
+#if _SUPPORTS_NAMESPACE
+namespace palmos {
+namespace support {
+#endif
+
+/**************************************************************************************/
+
+SValueBuilder::SValueBuilder()
+	:	m_items(NULL), m_count(0), m_avail(0)
+{
+}
+
+SValueBuilder::~SValueBuilder()
+{
+	MakeEmpty();
+	free(m_items);
+}
+
+void SValueBuilder::AddItem(const SValue& key, const SValue& value)
+{
+	if (!key.is_defined() || !value.is_defined()) return;
+
+	// These are the cases where SValue::JoinItem() does something
+	// other than add or join a single mapping.  Since they can depend
+	// on what is already there, get that in order first.
+	if (key.is_wild() || key.is_map() || key.is_error()
+			|| value.is_error() || value.is_null()) {
+		flush();
+		m_value.JoinItem(key, value);
+		return;
+	}
+
+	// Nothing can be joined into an error or wild value.
+	if (m_value.is_final()) return;
+
+	if (m_count == m_avail) {
+		const size_t avail = m_avail ? m_avail*2 : 16;
+		SValue* items = (SValue*)malloc(sizeof(SValue)*avail*2);
+		if (items == NULL) {
+			flush();
+			m_value.set_error(B_NO_MEMORY);
+			return;
+		}
+		if (m_count > 0) BMoveBefore(items, m_items, m_count*2);
+		free(m_items);
+		m_items = items;
+		m_avail = avail;
+	}
+
+	new (m_items+m_count*2) SValue(key);
+	new (m_items+m_count*2+1) SValue(value);
+	m_count++;
+}
+
+SValue SValueBuilder::Build()
+{
+	flush();
+	SValue result;
+	result.Swap(m_value);
+	return result;
+}
+
+void SValueBuilder::JoinInto(SValue& target)
+{
+	flush();
+	if (!target.is_defined()) target.Swap(m_value);
+	else if (m_value.is_defined()) target.Join(m_value);
+	m_value.Undefine();
+}
+
+void SValueBuilder::MakeEmpty()
+{
+	for (size_t i=0; i<m_count*2; i++) m_items[i].~SValue();
+	m_count = 0;
+	m_value.Undefine();
+}
+
+void SValueBuilder::flush()
+{
+	if (m_count == 0) return;
+
+	// The items are moved into the map, whether or not it is created.
+	BValueMap* map = BValueMap::CreateUnsorted(m_items, m_count);
+	m_count = 0;
+	if (map == NULL) {
+		m_value.set_error(B_NO_MEMORY);
+		return;
+	}
+
+	SValue items;
+	items.m_type = kMapTypeCode;
+	items.m_data.map = map;
+	if (!m_value.is_defined()) m_value.Swap(items);
+	else m_value.Join(items);
+}
+
+#if _SUPPORTS_NAMESPACE
+} } // namespace palmos::support
+#endif
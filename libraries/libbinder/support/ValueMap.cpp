@@ -16,6 +16,7 @@
 #include <support/Parcel.h>
 #include <support/MemoryStore.h>
 #include <support/StdIO.h>
+#include <support/atomic.h>
 
 #include <stdio.h>
 #include <DebugMgr.h>
@@ -30,24 +31,104 @@
 
 #define PROFILE_VALUE_MAP 0
 
+// Number of lookups a large map must see, without being changed in
+// between, before it is worth building a hash index for it.
+#define HASH_INDEX_MIN_LOOKUPS 4
+
 #if _SUPPORTS_NAMESPACE
 namespace palmos {
 namespace support {
 #endif
 
+// Chunked maps.  A map is normally one array of mappings, so changing a
+// map that has been copied means copying all of it first.  Services that
+// hand out snapshots of a large state tree and then change one key pay
+// for that every time.  Once a map has CHUNKED_MIN_MAPS mappings it is
+// instead kept as a table of chunks of up to CHUNK_PAIRS mappings each,
+// in order.  Copies of the map share the chunks, each of which counts
+// its users, and a change copies only the table and the chunk it touches.
+// The mappings are still numbered from 0 in order, so MapAt() and
+// everything built on it work unchanged.
+
+struct BValueMap::chunk
+{
+	int32_t		users;
+	int32_t		count;
+	pair		pairs[1];
+};
+
+struct BValueMap::chunk_table
+{
+	int32_t		count;
+	int32_t		avail;
+	struct entry {
+		ssize_t		first;	// index of the chunk's first mapping
+		chunk*		data;
+	}			entries[1];
+};
+
+// What only large maps need.  It is kept in the same allocation, just
+// before the map, so that the small maps most values are made of don't
+// carry it.  Maps from the pool are small; any other map is large.
+
+struct BValueMap::large_state
+{
+	hash_index*		index;
+	chunk_table*	chunks;		// the mappings, if CHUNKED_MAP
+	int32_t			lookups;
+	int32_t			reserved;	// keeps the map after it 8-byte aligned
+};
+
 // Some addition private inline functions
 
-inline void BValueMap::Construct(int32_t avail)
+inline BValueMap::large_state* BValueMap::Large() const
+{
+	DbgOnlyFatalErrorIf((m_flags&LARGE_MAP) == 0, "Not a large BValueMap");
+	return reinterpret_cast<large_state*>(const_cast<BValueMap*>(this)) - 1;
+}
+
+inline BValueMap::chunk_table* BValueMap::Chunks() const
+{
+	return Large()->chunks;
+}
+
+inline void BValueMap::Construct(int32_t avail, uint32_t flags)
 {
 	m_users = 1;
+	m_flags = flags;
 	m_dataSize = B_ERROR;
 	m_size = 0;
 	m_avail = avail;
 	m_editIndex = -1;
+	if ((flags&LARGE_MAP) != 0) {
+		large_state* large = Large();
+		large->index = NULL;
+		large->chunks = NULL;
+		large->lookups = 0;
+	}
+}
+
+inline void BValueMap::FreeHashIndex()
+{
+	if ((m_flags&LARGE_MAP) == 0) return;
+
+	large_state* large = Large();
+	if (large->index) {
+		free(large->index);
+		large->index = NULL;
+	}
+	large->lookups = 0;
 }
 
 inline void BValueMap::Destroy()
 {
+	FreeHashIndex();
+
+	if ((m_flags&CHUNKED_MAP) != 0) {
+		FreeChunks();
+		return;
+	}
+
 	SValue* pos = (SValue*)m_maps;
 	SValue* end = pos + (m_size*2);
 	while (pos < end) {
@@ -58,11 +139,21 @@ inline void BValueMap::Destroy()
 
 // The pool
 
-enum { MAX_POOL_SIZE = 6 };
-static const int32_t size_to_pool[] = { 0, 0, 1, 1, 2, 2, 2 };
-static const int32_t pool_to_size[] = { 1, 3, MAX_POOL_SIZE };
+// Maps with up to MAX_POOL_SIZE entries are allocated in one of three
+// sizes and recycled.  Since growing from one entry goes straight to the
+// second size, maps of up to four entries (argument maps, message
+// payloads, bindings) are reallocated at most once while being built.
+enum { MAX_POOL_SIZE = 8 };
+static const int32_t size_to_pool[] = { 0, 0, 1, 1, 1, 2, 2, 2, 2 };
+static const int32_t pool_to_size[] = { 1, 4, MAX_POOL_SIZE };
 static const int32_t max_in_pool[] = { 20, 10, 5 };
 
+static bool					g_valueMapCacheTSDAllocated = false;
+static SysTSDSlotID			g_valueMapCacheTSD;
+#if SUPPORTS_THREAD_KEYWORD
+static __thread BValueMapPool::thread_cache* t_valueMapCache = NULL;
+#endif
+
 BValueMapPool::BValueMapPool()
 	: m_lock("BValueMap Pool"), m_hits(0), m_misses(0)
 {
@@ -74,7 +165,7 @@ BValueMapPool::~BValueMapPool()
 	for (int32_t i=0; i<NUM_POOLS; i++) {
 		BValueMap* map = m_pools[i].objects;
 		while (map) {
-			BValueMap* next = (BValueMap*)(map->m_users);
+			BValueMap* next = *(BValueMap**)map->m_maps;
 			free(map);
 			map = next;
 		}
@@ -84,38 +175,89 @@ BValueMapPool::~BValueMapPool()
 	m_lock.Unlock();
 }
 
+BValueMapPool::thread_cache* BValueMapPool::CurrentCache()
+{
+#if SUPPORTS_THREAD_KEYWORD
+	thread_cache* cache = t_valueMapCache;
+#else
+	thread_cache* cache = g_valueMapCacheTSDAllocated
+		? (thread_cache*)g_threadDirectFuncs.tsdGet(g_valueMapCacheTSD) : NULL;
+#endif
+	if (cache != NULL) return cache;
+
+	cache = (thread_cache*)calloc(1, sizeof(thread_cache));
+	if (cache == NULL) return NULL;
+
+	m_lock.LockQuick();
+	if (!g_valueMapCacheTSDAllocated) {
+		SysTSDAllocate(&g_valueMapCacheTSD, ReleaseCache, sysTSDAnonymous);
+		g_valueMapCacheTSDAllocated = true;
+	}
+	m_lock.Unlock();
+
+	// The TSD slot is what gets us told when the thread exits.
+	g_threadDirectFuncs.tsdSet(g_valueMapCacheTSD, cache);
+#if SUPPORTS_THREAD_KEYWORD
+	t_valueMapCache = cache;
+#endif
+	return cache;
+}
+
+void BValueMapPool::ReleaseCache(void* data)
+{
+	thread_cache* cache = (thread_cache*)data;
+#if SUPPORTS_THREAD_KEYWORD
+	t_valueMapCache = NULL;
+#endif
+
+	for (int32_t i=0; i<NUM_POOLS; i++) {
+		while (cache->counts[i] > 0) {
+			g_valueMapPool.PutShared(cache->objects[i][--cache->counts[i]]);
+		}
+	}
+	free(cache);
+}
+
 BValueMap* BValueMapPool::Create(size_t initSize)
 {
 	if (initSize <= MAX_POOL_SIZE) {
-		m_lock.LockQuick();
-		pool& p = m_pools[size_to_pool[initSize]];
-		BValueMap* map = p.objects;
+		const int32_t whichPool = size_to_pool[initSize];
+		thread_cache* cache = CurrentCache();
+		BValueMap* map = NULL;
+		if (cache != NULL && cache->counts[whichPool] > 0) {
+			map = cache->objects[whichPool][--cache->counts[whichPool]];
+		} else {
+			m_lock.LockQuick();
+			pool& p = m_pools[whichPool];
+			map = p.objects;
+			if (map) {
+				p.objects = *(BValueMap**)map->m_maps;
+				p.count--;
+			}
+			m_lock.Unlock();
+		}
 		if (map) {
-			p.objects = (BValueMap*)map->m_users;
-			p.count--;
-			map->m_users = 1;
-			map->m_dataSize = B_ERROR;
-			map->m_size = 0;
+			map->Construct(map->m_avail, 0);
 #if BUILD_TYPE == BUILD_TYPE_DEBUG && PROFILE_VALUE_MAP
 			g_threadDirectFuncs.atomicInc32(&m_hits);
 #endif
-			m_lock.Unlock();
 			return map;
 		}
-		m_lock.Unlock();
-		initSize = pool_to_size[size_to_pool[initSize]];
+		initSize = pool_to_size[whichPool];
 	}
 
 #if BUILD_TYPE == BUILD_TYPE_DEBUG && PROFILE_VALUE_MAP
 	g_threadDirectFuncs.atomicDec32(&m_misses);
 #endif
 
+	if (initSize > MAX_POOL_SIZE) return BValueMap::CreateLarge(initSize);
+
 	BValueMap* map;
 	if (initSize <= 1)
 		map = (BValueMap*)malloc(sizeof(BValueMap));
 	else
 		map = (BValueMap*)malloc(sizeof(BValueMap)+(sizeof(BValueMap::pair)*(initSize-1)));
-	if (map) map->Construct(initSize);
+	if (map) map->Construct(initSize, 0);
 	return map;
 }
 
@@ -123,21 +265,35 @@ void BValueMapPool::Delete(BValueMap* map)
 {
 	map->Destroy();
 
-	if (map->m_avail <= MAX_POOL_SIZE) {
-		m_lock.LockQuick();
-		const int32_t whichPool = size_to_pool[map->m_avail];
-		pool& p = m_pools[whichPool];
-		if (p.count <= max_in_pool[whichPool]) {
-			map->m_users = (int32_t)p.objects;
-			p.objects = map;
-			p.count++;
-			DbgOnlyFatalErrorIf(map->m_avail != pool_to_size[whichPool], "BValueMap pool error");
-			DbgOnlyFatalErrorIf(map->m_editIndex >= 0, "BValueMap pool error");
-			m_lock.Unlock();
-			return;
-		}
+	if ((map->m_flags&BValueMap::LARGE_MAP) != 0) {
+		free(map->Large());
+		return;
+	}
+
+	const int32_t whichPool = size_to_pool[map->m_avail];
+	DbgOnlyFatalErrorIf(map->m_avail != pool_to_size[whichPool], "BValueMap pool error");
+	DbgOnlyFatalErrorIf(map->m_editIndex >= 0, "BValueMap pool error");
+	thread_cache* cache = CurrentCache();
+	if (cache != NULL && cache->counts[whichPool] < THREAD_SLOTS) {
+		cache->objects[whichPool][cache->counts[whichPool]++] = map;
+		return;
+	}
+	PutShared(map);
+}
+
+void BValueMapPool::PutShared(BValueMap* map)
+{
+	m_lock.LockQuick();
+	const int32_t whichPool = size_to_pool[map->m_avail];
+	pool& p = m_pools[whichPool];
+	if (p.count <= max_in_pool[whichPool]) {
+		*(BValueMap**)map->m_maps = p.objects;
+		p.objects = map;
+		p.count++;
 		m_lock.Unlock();
+		return;
 	}
+	m_lock.Unlock();
 
 	free(map);
 }
@@ -162,7 +318,20 @@ BValueMap* BValueMap::Create(size_t initSize)
 	return g_valueMapPool.Create(initSize);
 }
 
-BValueMap* BValueMap::Create(SParcel& from, size_t avail, size_t count, ssize_t* out_size)
+BValueMap* BValueMap::CreateLarge(size_t avail)
+{
+	if (avail < 1) avail = 1;
+	large_state* large = (large_state*)malloc(sizeof(large_state) + sizeof(BValueMap)
+		+ sizeof(pair)*(avail-1));
+	if (large == NULL) return NULL;
+
+	BValueMap* map = reinterpret_cast<BValueMap*>(large+1);
+	map->Construct(avail, LARGE_MAP);
+	return map;
+}
+
+BValueMap* BValueMap::Create(SParcel& from, size_t avail, size_t count, int32_t ordered,
+							 ssize_t* out_size)
 {
 	ssize_t size;
 	ssize_t remain = avail;
@@ -186,7 +355,17 @@ BValueMap* BValueMap::Create(SParcel& from, size_t avail, size_t count, ssize_t*
 		}
 		
 		This->m_size = count;
-		*out_size = This->m_dataSize = (avail-remain);
+		*out_size = (avail-remain);
+		// SValue always writes its maps in order and says so in the
+		// header.  Anything else is put in order rather than leaving
+		// a map that lookups can't search.
+		if (ordered == 1 || This->IsSorted()) {
+			This->m_dataSize = *out_size;
+			return This;
+		}
+
+		This = Sort(This);
+		if (This == NULL) *out_size = B_NO_MEMORY;
 		return This;
 	}
 
@@ -203,8 +382,163 @@ error:
 	return NULL;
 }
 
+BValueMap* BValueMap::CreateCompact(SParcel& from, const uint8_t* data, size_t end,
+									size_t* pos, size_t count, status_t* out_err)
+{
+	status_t err = B_NO_MEMORY;
+	size_t i = 0;
+	pair* p;
+	
+	// The archived size isn't known here; m_dataSize is the size of the
+	// standard encoding, so it is left to be computed if needed.
+	BValueMap* This = Create(count);
+	if (This != NULL) {
+		p = This->m_maps;
+		for (i=0; i<count; i++) {
+			if ((err=p->key.unarchive_compact(from, data, end, pos)) < B_OK) {
+				goto error;
+			}
+			if ((err=p->value.unarchive_compact(from, data, end, pos)) < B_OK) {
+				p->key.~SValue();
+				goto error;
+			}
+			p++;
+		}
+		
+		// Only SValue writes this encoding, always in order.
+		This->m_size = count;
+		return This;
+	}
+
+error:
+	*out_err = err;
+
+	if (This) {
+		This->m_size = i;
+		This->DecUsers();
+	}
+
+	return NULL;
+}
+
+BValueMap* BValueMap::CreateUnsorted(SValue* pairs, size_t count)
+{
+	BValueMap* This = Create(count);
+	int32_t* order = (int32_t*)malloc(sizeof(int32_t)*count*2);
+	size_t i;
+	if (This == NULL || (order == NULL && count > 0)) {
+		for (i=0; i<count*2; i++) pairs[i].~SValue();
+		if (This) This->DecUsers();
+		free(order);
+		return NULL;
+	}
+
+	// Put the indices of the pairs in order.  Input that is already
+	// sorted, such as a dump of another map, needs only one pass.
+	bool sorted = true;
+	for (i=0; i<count; i++) {
+		order[i] = i;
+		if (sorted && i > 0 && SValue::compare_map(pairs+(i-1)*2, pairs+(i-1)*2+1,
+				pairs+i*2, pairs+i*2+1) >= 0) {
+			sorted = false;
+		}
+	}
+	if (!sorted) {
+		// Bottom-up merge sort, which keeps pairs for the same
+		// mapping in the order they were given.
+		int32_t* from = order;
+		int32_t* to = order+count;
+		for (size_t width=1; width<count; width*=2) {
+			for (size_t lo=0; lo<count; lo+=width*2) {
+				const size_t mid = lo+width < count ? lo+width : count;
+				const size_t hi = lo+width*2 < count ? lo+width*2 : count;
+				size_t a=lo, b=mid, k=lo;
+				while (a < mid && b < hi) {
+					const SValue* pa = pairs+from[a]*2;
+					const SValue* pb = pairs+from[b]*2;
+					to[k++] = SValue::compare_map(pb, pb+1, pa, pa+1) < 0 ? from[b++] : from[a++];
+				}
+				while (a < mid) to[k++] = from[a++];
+				while (b < hi) to[k++] = from[b++];
+			}
+			int32_t* tmp = from;
+			from = to;
+			to = tmp;
+		}
+		if (from != order) memcpy(order, from, sizeof(int32_t)*count);
+	}
+
+	pair* dst = This->m_maps;
+	ssize_t size = 0;
+	for (i=0; i<count; i++) {
+		SValue* src = pairs+order[i]*2;
+		if (size > 0 && SValue::compare_map(&dst[size-1].key, &dst[size-1].value, src, src+1) == 0) {
+			// Same mapping; as with SValue::JoinItem().  For a wild
+			// key the value is the mapping, so there is nothing to join.
+			if (!src->is_wild()) dst[size-1].value.Join(src[1]);
+			src[0].~SValue();
+			src[1].~SValue();
+		} else {
+			BMoveBefore((SValue*)(dst+size), src, 2);
+			size++;
+		}
+	}
+	This->m_size = size;
+
+	free(order);
+	return This;
+}
+
+bool BValueMap::IsSorted() const
+{
+	for (ssize_t i=1; i<m_size; i++) {
+		if (SValue::compare_map(&m_maps[i-1].key, &m_maps[i-1].value,
+				&m_maps[i].key, &m_maps[i].value) >= 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+BValueMap* BValueMap::Sort(BValueMap* map)
+{
+	BValueMap* sorted = CreateUnsorted((SValue*)map->m_maps, map->m_size);
+	map->m_size = 0;
+	map->DecUsers();
+	return sorted;
+}
+
 BValueMap* BValueMap::Clone() const
 {
+	if ((m_flags&CHUNKED_MAP) != 0) {
+		// Share the chunks; only the table that indexes them is copied.
+		const chunk_table* chunks = Chunks();
+		BValueMap* map = CreateLarge(1);
+		chunk_table* table = map ? NewChunkTable(chunks->count) : NULL;
+		if (table == NULL) {
+			if (map) map->DecUsers();
+			return NULL;
+		}
+		for (int32_t i=0; i<chunks->count; i++) {
+			table->entries[i] = chunks->entries[i];
+			g_threadDirectFuncs.atomicInc32(&table->entries[i].data->users);
+		}
+		table->count = chunks->count;
+		map->Large()->chunks = table;
+		map->m_flags |= CHUNKED_MAP;
+		map->m_size = m_size;
+		map->m_dataSize = m_dataSize;
+		return map;
+	}
+
+	if (m_size >= CHUNKED_MIN_MAPS) {
+		// Being copied to be changed, so make the copy one that is
+		// cheap to copy again.
+		BValueMap* map = CreateChunked(const_cast<pair*>(m_maps), m_size, false);
+		if (map) map->m_dataSize = m_dataSize;
+		return map;
+	}
+
 	BValueMap* map = Create(m_size);
 	if (map) {
 		map->m_dataSize = m_dataSize;
@@ -266,8 +600,11 @@ ssize_t BValueMap::Archive(SParcel& into) const
 		total += size;
 	}
 	
+	// Remember the size for the next time, until the map changes.
+	m_dataSize = total;
+	
 	#if VALIDATES_VALUE
-		if (total != ArchivedSize()) {
+		if (total != ComputeArchivedSize()) {
 			bout << "Written size: " << total << ", Expected: " << ArchivedSize() << endl;
 			bout << "The data so far: " << into << endl;
 			ErrFatalError("Cached size wrong!");
@@ -283,6 +620,17 @@ int32_t BValueMap::Compare(const BValueMap& o) const
 	const int32_t N2 = o.CountMaps();
 	if (N != N2) return N < N2 ? -1 : 1;
 
+	if (((m_flags|o.m_flags)&CHUNKED_MAP) != 0) {
+		for (int32_t i=0; i<N; i++) {
+			const pair& a = MapAt(i);
+			const pair& b = o.MapAt(i);
+			int32_t c = a.key.Compare(b.key);
+			if (c == 0) c = a.value.Compare(b.value);
+			if (c != 0) return c;
+		}
+		return 0;
+	}
+
 	const SValue* p1 = (const SValue*)m_maps;
 	const SValue* p2 = (const SValue*)o.m_maps;
 	const SValue* e2 = p2 + N*2;
@@ -301,6 +649,17 @@ int32_t BValueMap::LexicalCompare(const BValueMap& o) const
 	const int32_t N2 = o.CountMaps();
 	const int32_t N = N1 < N2 ? N1 : N2;
 
+	if (((m_flags|o.m_flags)&CHUNKED_MAP) != 0) {
+		for (int32_t i=0; i<N; i++) {
+			const pair& a = MapAt(i);
+			const pair& b = o.MapAt(i);
+			int32_t c = a.key.Compare(b.key);
+			if (c == 0) c = a.value.Compare(b.value);
+			if (c != 0) return c;
+		}
+		return N1 < N2 ? -1 : (N2 < N1 ? 1 : 0);
+	}
+
 	const SValue* p1 = (const SValue*)m_maps;
 	const SValue* p2 = (const SValue*)o.m_maps;
 	const SValue* e2 = p2 + N*2;
@@ -351,6 +710,11 @@ status_t BValueMap::RemoveMap(BValueMap** This, const SValue& key, const SValue&
 void BValueMap::RemoveMapAt(BValueMap** This, size_t index)
 {
 	DbgOnlyFatalErrorIf((*This)->m_size < 0 || index >= (size_t)(*This)->m_size, "Bad args to RemoveMapAt()");
+	if (((*This)->m_flags&CHUNKED_MAP) != 0) {
+		(*This)->ChunkedRemoveAt(index);
+		return;
+	}
+
 	pair* p = (*This)->m_maps + index;
 	p->key.~SValue();
 	p->value.~SValue();
@@ -385,6 +749,7 @@ void BValueMap::RemoveMapAt(BValueMap** This, size_t index)
 
 	(*This)->m_size = size;
 	(*This)->m_dataSize = B_ERROR;
+	(*This)->FreeHashIndex();
 }
 
 status_t BValueMap::RenameMap(BValueMap** This, const SValue& old_key, const SValue& new_key)
@@ -394,7 +759,7 @@ status_t BValueMap::RenameMap(BValueMap** This, const SValue& old_key, const SVa
 	if (!old_key.is_wild() && old_key.is_defined() && new_key.is_specified()) {
 		ssize_t old_index, new_index;
 		if ((*This)->GetIndexOf(old_key, B_WILD_VALUE, reinterpret_cast<size_t*>(&old_index))) {
-			const SValue value((*This)->m_maps[old_index].value);
+			const SValue value((*This)->MapAt(old_index).value);
 			if (!(*This)->GetIndexOf(new_key, value, reinterpret_cast<size_t*>(&new_index))) {
 				RemoveMapAt(This, old_index);
 				const ssize_t error = AddMapAt(This, new_index > old_index ? new_index-1 : new_index, new_key, value);
@@ -413,8 +778,9 @@ SValue *BValueMap::BeginEditMapAt(BValueMap** This, size_t index)
 	DbgOnlyFatalErrorIf((*This)->m_size < 0 || index >= (size_t)(*This)->m_size, "Bad args to RemoveMapAt()");
 	ErrFatalErrorIf((*This)->m_editIndex >= 0, "Can't edit more than one item at a time.");
 		
-	(*This)->m_editIndex = index;
-	return &((*This)->m_maps[index].value);
+	SValue* value = (*This)->EditValueAt(index);
+	if (value != NULL) (*This)->m_editIndex = index;
+	return value;
 }
 
 void BValueMap::EndEditMapAt(BValueMap** _This)
@@ -423,7 +789,7 @@ void BValueMap::EndEditMapAt(BValueMap** _This)
 
 	ErrFatalErrorIf(This->m_editIndex < 0, "Value not being edited.");
 
-	pair& p = This->m_maps[This->m_editIndex];
+	const pair& p = This->MapAt(This->m_editIndex);
 	const int32_t index = This->m_editIndex;
 	This->m_editIndex = -1;
 	This->m_dataSize = B_ERROR;
@@ -431,8 +797,34 @@ void BValueMap::EndEditMapAt(BValueMap** _This)
 	if (!p.value.IsDefined()) RemoveMapAt(_This, index);
 }
 
+SValue* BValueMap::EditValueAt(size_t index)
+{
+	DbgOnlyFatalErrorIf(IsShared(), "EditValueAt() called on a shared BValueMap");
+	if ((m_flags&CHUNKED_MAP) == 0) return &m_maps[index].value;
+
+	const int32_t c = ChunkFor(index);
+	chunk* data = EditChunk(c);
+	return data ? &data->pairs[index-Chunks()->entries[c].first].value : NULL;
+}
+
 void BValueMap::Pool()
 {
+	if ((m_flags&CHUNKED_MAP) != 0) {
+		// Chunks shared with other maps are left alone: copying them
+		// here would undo the sharing, and other threads may be
+		// reading them.
+		const chunk_table* table = Chunks();
+		for (int32_t c=0; c<table->count; c++) {
+			chunk* data = table->entries[c].data;
+			if (data->users > 1) continue;
+			for (int32_t i=0; i<data->count; i++) {
+				data->pairs[i].key.Pool();
+				data->pairs[i].value.Pool();
+			}
+		}
+		return;
+	}
+
 	const size_t N = CountMaps();
 
 	for (size_t i=0; i<N; i++) {
@@ -444,51 +836,450 @@ void BValueMap::Pool()
 
 bool BValueMap::GetIndexOf(uint32_t type, const void* data, size_t length, size_t* index) const
 {
-	ssize_t mid, low = 0, high = m_size-1;
+	const pair* maps = m_maps;
+	ssize_t base = 0, mid, low = 0, high = m_size-1;
+	if ((m_flags&CHUNKED_MAP) != 0) {
+		// Find the last chunk that starts at or before the key, and
+		// search only that.
+		const chunk_table* chunks = Chunks();
+		int32_t c = 0, last = chunks->count-1;
+		while (c < last) {
+			const int32_t m = (c + last + 1)/2;
+			if (chunks->entries[m].data->pairs[0].key.compare(type, data, length) <= 0) c = m;
+			else last = m-1;
+		}
+		maps = chunks->entries[c].data->pairs;
+		base = chunks->entries[c].first;
+		high = chunks->entries[c].data->count-1;
+	}
 	while (low <= high) {
 		mid = (low + high)/2;
-		const int32_t cmp = m_maps[mid].key.compare(type, data, length);
+		const int32_t cmp = maps[mid].key.compare(type, data, length);
 		if (cmp > 0) {
 			high = mid-1;
 		} else if (cmp < 0) {
 			low = mid+1;
 		} else {
-			*index = mid;
+			*index = base+mid;
 			return true;
 		}
 	}
 	
-	*index = low;
+	*index = base+low;
 	return false;
 }
 
 bool BValueMap::GetIndexOf(const SValue& k, const SValue& v, size_t* index) const
 {
-	ssize_t mid, low = 0, high = m_size-1;
+	const pair* maps = m_maps;
+	ssize_t base = 0, mid, low = 0, high = m_size-1;
+	if ((m_flags&CHUNKED_MAP) != 0) {
+		const chunk_table* chunks = Chunks();
+		int32_t c = 0, last = chunks->count-1;
+		while (c < last) {
+			const int32_t m = (c + last + 1)/2;
+			const pair& first = chunks->entries[m].data->pairs[0];
+			if (SValue::compare_map(&first.key, &first.value, &k, &v) <= 0) c = m;
+			else last = m-1;
+		}
+		maps = chunks->entries[c].data->pairs;
+		base = chunks->entries[c].first;
+		high = chunks->entries[c].data->count-1;
+	}
 	while (low <= high) {
 		mid = (low + high)/2;
-		const int32_t cmp = SValue::compare_map(&m_maps[mid].key, &m_maps[mid].value, &k, &v);
+		const int32_t cmp = SValue::compare_map(&maps[mid].key, &maps[mid].value, &k, &v);
 		if (cmp > 0) {
 			high = mid-1;
 		} else if (cmp < 0) {
 			low = mid+1;
 		} else {
-			*index = mid;
+			*index = base+mid;
 			return true;
 		}
 	}
 	
-	*index = low;
+	*index = base+low;
 	return false;
 }
 
+// The hash index.  Keys are kept sorted so that maps can be compared,
+// iterated and archived in order, but that leaves a lookup doing
+// O(log N) full key comparisons.  Once a large map has been looked up
+// a few times without changing, we build an open-addressed hash table
+// over its simple keys next to the sorted array and look keys up there
+// instead.  Any change to the keys throws the table away; maps that
+// are being built never get one.  The table is created on demand by
+// const lookups of what may be a shared map, so it is published with
+// an atomic swap.
+
+struct BValueMap::hash_index
+{
+	uint32_t	mask;
+	int32_t		wildCount;	// keys not in the table because they are wild
+	int32_t		slots[1];	// index of the mapping + 1, or 0 if empty
+};
+
+static inline uint32_t hash_key(uint32_t type, const void* data, size_t length)
+{
+	return hash_bytes(data, length, hash_bytes(&type, sizeof(type)));
+}
+
+const BValueMap::hash_index* BValueMap::HashIndex() const
+{
+	large_state* large = Large();
+	hash_index* index = large->index;
+	if (index != NULL || ++large->lookups < HASH_INDEX_MIN_LOOKUPS) return index;
+
+	size_t cap = 1;
+	while (cap < (size_t)m_size*2) cap <<= 1;
+	index = (hash_index*)malloc(sizeof(hash_index) + sizeof(int32_t)*(cap-1));
+	if (index == NULL) {
+		large->lookups = 0;
+		return NULL;
+	}
+
+	memset(index->slots, 0, sizeof(int32_t)*cap);
+	index->mask = cap-1;
+	index->wildCount = 0;
+	for (ssize_t i=0; i<m_size; i++) {
+		const SValue& key = MapAt(i).key;
+		const uint32_t len = B_UNPACK_TYPE_LENGTH(key.m_type);
+		uint32_t h;
+		if (key.is_wild()) {
+			index->wildCount++;
+			continue;
+		} else if (len <= B_TYPE_LENGTH_MAX) {
+			h = hash_key(key.m_type, key.m_data.local, len);
+		} else if (len == B_TYPE_LENGTH_LARGE) {
+			h = hash_key(key.m_type, key.m_data.buffer->Data(), key.m_data.buffer->Length());
+		} else {
+			// Maps as keys are rare enough that they are left to
+			// the binary search.
+			continue;
+		}
+		h &= index->mask;
+		while (index->slots[h] != 0) h = (h+1) & index->mask;
+		index->slots[h] = i+1;
+	}
+
+	if (!compare_and_swap_ptr(reinterpret_cast<void* volatile*>(&large->index),
+							  NULL, index)) {
+		// Another thread got there first.
+		free(index);
+		index = large->index;
+	}
+	return index;
+}
+
+ssize_t BValueMap::LookupHashed(const hash_index* index, uint32_t type,
+	const void* data, size_t length) const
+{
+	uint32_t h = hash_key(type, data, length) & index->mask;
+	int32_t slot;
+	while ((slot=index->slots[h]) != 0) {
+		if (MapAt(slot-1).key.compare(type, data, length) == 0) return slot-1;
+		h = (h+1) & index->mask;
+	}
+	return B_NAME_NOT_FOUND;
+}
+
+ssize_t BValueMap::HashedIndexFor(const SValue& key, const SValue& value) const
+{
+	const hash_index* index = HashIndex();
+	if (index != NULL) {
+		const uint32_t len = B_UNPACK_TYPE_LENGTH(key.m_type);
+		if (key.is_wild()) {
+			// Looking in a set; only a miss can be answered here.
+			if (index->wildCount == 0) return B_NAME_NOT_FOUND;
+		} else if (len <= B_TYPE_LENGTH_MAX) {
+			return LookupHashed(index, key.m_type, key.m_data.local, len);
+		} else if (len == B_TYPE_LENGTH_LARGE) {
+			return LookupHashed(index, key.m_type,
+				key.m_data.buffer->Data(), key.m_data.buffer->Length());
+		}
+	}
+
+	size_t i;
+	return GetIndexOf(key, value, &i) ? i : B_NAME_NOT_FOUND;
+}
+
+ssize_t BValueMap::HashedIndexFor(uint32_t type, const void* data, size_t length) const
+{
+	const hash_index* index = HashIndex();
+	if (index != NULL) {
+		const uint32_t len = B_UNPACK_TYPE_LENGTH(type);
+		return LookupHashed(index, type, data, len <= B_TYPE_LENGTH_MAX ? len : length);
+	}
+
+	size_t i;
+	return GetIndexOf(type, data, length, &i) ? i : B_NAME_NOT_FOUND;
+}
+
+BValueMap::chunk* BValueMap::NewChunk()
+{
+	chunk* data = (chunk*)malloc(sizeof(chunk) + sizeof(pair)*(CHUNK_PAIRS-1));
+	if (data) {
+		data->users = 1;
+		data->count = 0;
+	}
+	return data;
+}
+
+void BValueMap::ReleaseChunk(chunk* data)
+{
+	if (g_threadDirectFuncs.atomicDec32(&data->users) == 1) {
+		SValue* pos = (SValue*)data->pairs;
+		SValue* end = pos + (data->count*2);
+		while (pos < end) {
+			pos->~SValue();
+			pos++;
+		}
+		free(data);
+	}
+}
+
+BValueMap::chunk_table* BValueMap::NewChunkTable(int32_t avail)
+{
+	if (avail < 1) avail = 1;
+	chunk_table* table = (chunk_table*)malloc(sizeof(chunk_table)
+		+ sizeof(chunk_table::entry)*(avail-1));
+	if (table) {
+		table->count = 0;
+		table->avail = avail;
+	}
+	return table;
+}
+
+void BValueMap::FreeChunks()
+{
+	large_state* large = Large();
+	for (int32_t i=0; i<large->chunks->count; i++) ReleaseChunk(large->chunks->entries[i].data);
+	free(large->chunks);
+	large->chunks = NULL;
+	m_flags &= ~CHUNKED_MAP;
+}
+
+BValueMap* BValueMap::CreateChunked(pair* pairs, size_t count, bool move)
+{
+	const int32_t N = (count + CHUNK_FILL - 1)/CHUNK_FILL;
+	BValueMap* map = CreateLarge(1);
+	chunk_table* table = map ? NewChunkTable(N) : NULL;
+	if (table == NULL) {
+		if (map) map->DecUsers();
+		return NULL;
+	}
+	map->Large()->chunks = table;
+	map->m_flags |= CHUNKED_MAP;
+
+	// Get all of the memory before touching the mappings, so that they
+	// are left where they were if we fail.
+	int32_t i;
+	for (i=0; i<N; i++) {
+		chunk* data = NewChunk();
+		if (data == NULL) {
+			map->DecUsers();
+			return NULL;
+		}
+		table->entries[i].first = i*CHUNK_FILL;
+		table->entries[i].data = data;
+		table->count++;
+	}
+
+	// Chunks start partly empty, so that most additions don't split one.
+	for (i=0; i<N; i++) {
+		chunk* data = table->entries[i].data;
+		const size_t first = table->entries[i].first;
+		data->count = count-first < CHUNK_FILL ? count-first : CHUNK_FILL;
+		if (move) {
+			BMoveBefore((SValue*)data->pairs, (SValue*)(pairs+first), data->count*2);
+		} else {
+			for (int32_t j=0; j<data->count; j++) new (data->pairs+j) pair(pairs[first+j]);
+		}
+	}
+	map->m_size = count;
+	return map;
+}
+
+int32_t BValueMap::ChunkFor(size_t index) const
+{
+	// The last chunk starting at or before the index.  An index just past
+	// the end lands in the last chunk.  Nothing is remembered between
+	// lookups, since a map may be read from many threads at once.
+	const chunk_table* table = Chunks();
+	int32_t low = 0, high = table->count-1;
+	while (low < high) {
+		const int32_t mid = (low + high + 1)/2;
+		if ((size_t)table->entries[mid].first <= index) low = mid;
+		else high = mid-1;
+	}
+	return low;
+}
+
+const BValueMap::pair& BValueMap::ChunkedMapAt(size_t index) const
+{
+	const chunk_table::entry& e = Chunks()->entries[ChunkFor(index)];
+	return e.data->pairs[index-e.first];
+}
+
+BValueMap::chunk* BValueMap::EditChunk(int32_t which)
+{
+	chunk* data = Chunks()->entries[which].data;
+	if (data->users > 1) {
+		chunk* copy = NewChunk();
+		if (copy == NULL) return NULL;
+		for (int32_t i=0; i<data->count; i++) new (copy->pairs+i) pair(data->pairs[i]);
+		copy->count = data->count;
+		ReleaseChunk(data);
+		Chunks()->entries[which].data = copy;
+		data = copy;
+	}
+	return data;
+}
+
+ssize_t BValueMap::ChunkedAddAt(size_t index, const SValue& key, const SValue& value)
+{
+	int32_t c = ChunkFor(index);
+	size_t offset = index - Chunks()->entries[c].first;
+
+	if (Chunks()->entries[c].data->count >= CHUNK_PAIRS) {
+		// Full; split it in two.
+		if (Chunks()->count >= Chunks()->avail) {
+			const int32_t avail = (Chunks()->avail*3)/2 + 1;
+			chunk_table* table = (chunk_table*)realloc(Chunks(), sizeof(chunk_table)
+				+ sizeof(chunk_table::entry)*(avail-1));
+			if (table == NULL) return B_NO_MEMORY;
+			table->avail = avail;
+			Large()->chunks = table;
+		}
+		chunk* right = NewChunk();
+		if (right == NULL) return B_NO_MEMORY;
+		chunk* left = EditChunk(c);
+		if (left == NULL) {
+			ReleaseChunk(right);
+			return B_NO_MEMORY;
+		}
+
+		const int32_t half = CHUNK_PAIRS/2;
+		right->count = left->count - half;
+		BMoveBefore((SValue*)right->pairs, (SValue*)(left->pairs+half), right->count*2);
+		left->count = half;
+
+		chunk_table::entry* e = Chunks()->entries;
+		memmove(e+c+2, e+c+1, sizeof(chunk_table::entry)*(Chunks()->count-c-1));
+		e[c+1].first = e[c].first + half;
+		e[c+1].data = right;
+		Chunks()->count++;
+
+		if (offset > (size_t)half) {
+			c++;
+			offset -= half;
+		}
+	}
+
+	chunk* data = EditChunk(c);
+	if (data == NULL) return B_NO_MEMORY;
+
+	pair* p = data->pairs + offset;
+	if ((int32_t)offset < data->count) {
+		BMoveAfter((SValue*)(p+1), (SValue*)p, (data->count-offset)*2);
+	}
+	new (&(p->key)) SValue(key);
+	new (&(p->value)) SValue(value);
+	data->count++;
+
+	for (int32_t i=c+1; i<Chunks()->count; i++) Chunks()->entries[i].first++;
+	m_size++;
+	FreeHashIndex();
+	return (ssize_t)index;
+}
+
+void BValueMap::ChunkedRemoveAt(size_t index)
+{
+	int32_t c = ChunkFor(index);
+	chunk* data = EditChunk(c);
+	if (data == NULL) {
+		DbgOnlyFatalError("Out of memory removing from a BValueMap");
+		return;
+	}
+
+	const size_t offset = index - Chunks()->entries[c].first;
+	pair* p = data->pairs + offset;
+	p->key.~SValue();
+	p->value.~SValue();
+	data->count--;
+	if ((int32_t)offset < data->count) {
+		BMoveBefore((SValue*)p, (SValue*)(p+1), (data->count-offset)*2);
+	}
+
+	for (int32_t i=c+1; i<Chunks()->count; i++) Chunks()->entries[i].first--;
+	m_size--;
+	m_dataSize = B_ERROR;
+	FreeHashIndex();
+
+	if (m_size == 0) {
+		// Back to an ordinary empty map.
+		FreeChunks();
+		return;
+	}
+
+	if (data->count == 0) {
+		ReleaseChunk(data);
+		chunk_table::entry* e = Chunks()->entries;
+		memmove(e+c, e+c+1, sizeof(chunk_table::entry)*(Chunks()->count-c-1));
+		Chunks()->count--;
+		return;
+	}
+
+	// Keep chunks from getting too sparse.
+	if (c+1 == Chunks()->count) c--;
+	if (c >= 0 && Chunks()->entries[c].data->count + Chunks()->entries[c+1].data->count
+			<= CHUNK_PAIRS/2) {
+		MergeChunks(c);
+	}
+}
+
+void BValueMap::MergeChunks(int32_t left)
+{
+	chunk* data = EditChunk(left);
+	if (data == NULL) return;
+
+	chunk* next = Chunks()->entries[left+1].data;
+	pair* dst = data->pairs + data->count;
+	const bool shared = next->users > 1;
+	if (shared) {
+		for (int32_t i=0; i<next->count; i++) new (dst+i) pair(next->pairs[i]);
+	} else {
+		BMoveBefore((SValue*)dst, (SValue*)next->pairs, next->count*2);
+	}
+	data->count += next->count;
+	if (!shared) next->count = 0;
+	ReleaseChunk(next);
+
+	chunk_table::entry* e = Chunks()->entries;
+	memmove(e+left+1, e+left+2, sizeof(chunk_table::entry)*(Chunks()->count-left-2));
+	Chunks()->count--;
+}
+
 ssize_t BValueMap::AddMapAt(BValueMap** This, size_t index, const SValue& key, const SValue& value)
 {
 	DbgOnlyFatalErrorIf((*This)->m_size < 0 || index > (size_t)(*This)->m_size, "Bad args to RemoveMapAt()");
 	const ssize_t size = (*This)->m_size;
 	ErrFatalErrorIf(size < 0, "gotcha!");
+	if (((*This)->m_flags&CHUNKED_MAP) != 0) return (*This)->ChunkedAddAt(index, key, value);
+
 	pair* cur = (*This)->m_maps;
 	if ((ssize_t)size >= (*This)->m_avail) {
+		if (size >= CHUNKED_MIN_MAPS) {
+			// Too big to keep copying in one piece; switch to chunks.
+			BValueMap* more = CreateChunked(cur, size, true);
+			if (more == NULL) return B_NO_MEMORY;
+			(*This)->m_size = 0;
+			(*This)->DecUsers();
+			*This = more;
+			return more->ChunkedAddAt(index, key, value);
+		}
+
 		// Create new, larger, stronger, better BValueMap.
 		const size_t new_size = ((size+1)*3)/2;
 		BValueMap* more = Create(new_size);
@@ -511,8 +1302,11 @@ ssize_t BValueMap::AddMapAt(BValueMap** This, size_t index, const SValue& key, c
 		cur = dst;
 
 	// Grow in-place.
-	} else if ((ssize_t)index < size) {
-		BMoveAfter((SValue*)(cur+index+1), (SValue*)(cur+index), (size-index)*2);
+	} else {
+		if ((ssize_t)index < size) {
+			BMoveAfter((SValue*)(cur+index+1), (SValue*)(cur+index), (size-index)*2);
+		}
+		(*This)->FreeHashIndex();
 	}
 
 	new (&(cur[index].key)) SValue(key);
@@ -39,6 +39,7 @@ BXML2ValueCreator::BXML2ValueCreator(SValue &targetValue, const SValue &attribut
 										const SValue& references)
 	:m_resources(resources)
 	,m_targetValue(targetValue)
+	,m_targetItems(NULL)
 	,m_status(B_OK)
 	,m_references(references)
 	,m_isReference(false)
@@ -122,7 +123,9 @@ BXML2ValueCreator::OnStartTag(	SString			& name,
 	if (m_status != B_OK) return m_status;
 	if (m_isReference) return B_BAD_VALUE;
 	if (name != "value") return B_BAD_VALUE;
-	newCreator = new BXML2ValueCreator(m_value, attributes, m_resources, m_references);
+	BXML2ValueCreator* child = new BXML2ValueCreator(m_value, attributes, m_resources, m_references);
+	child->m_targetItems = &m_items;
+	newCreator = child;
 	return B_OK;
 }
 
@@ -162,6 +165,8 @@ BXML2ValueCreator::Done()
 {
 	if (m_status != B_OK) return m_status;
 
+	m_items.JoinInto(m_value);
+
 	if (m_isReference) {
 		// m_value is already the value
 	}
@@ -322,7 +327,8 @@ BXML2ValueCreator::Done()
 	
 	m_data.Truncate(0);
 	
-	m_targetValue.JoinItem(m_key, m_value);
+	if (m_targetItems) m_targetItems->AddItem(m_key, m_value);
+	else m_targetValue.JoinItem(m_key, m_value);
 	return B_OK;
 }
 
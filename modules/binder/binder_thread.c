@@ -407,6 +407,15 @@ binder_thread_Control(binder_thread_t *that, unsigned int cmd, void *buffer)
 				result = 0;
 			}
 			break;
+		case BINDER_FEATURES:
+			if (size >= sizeof(binder_features_t)) {
+				binder_features_t *feat = (binder_features_t*)buffer;
+				// tfSharedMemory and tfOneWay are passed through with the
+				// other user flags.
+				feat->features = bfSharedMemory|bfOneWay;
+				result = 0;
+			}
+			break;
 		default:
 			break;
 	}
@@ -1331,6 +1340,12 @@ binder_thread_Read(binder_thread_t *that, void *buffer, int size, signed long *c
 						}
 #endif
 					}
+				} else if (binder_transaction_IsOneWay(t)) {
+					/*	Nobody waits for a reply: the transaction has no
+						sender, so the receiver just frees it when done. */
+					DPRINTF(2, (KERN_WARNING "*** Thread %d sending one-way %p\n", that->m_thid, t));
+					if (t->target) binder_node_Send(t->target, t);
+					else binder_transaction_Destroy(t);
 				} else {
 					t->sender = that;
 					BND_ACQUIRE(binder_thread, that, WEAK, t);
@@ -24,21 +24,21 @@
 #include <linux/mm.h> // for page_address()
 
 enum {
-	tfUserFlags		= 0x000F,
+	tfUserFlags		= 0x003F,
 
 	tfIsReply		= 0x0100,
 	tfIsEvent		= 0x0200,
 	tfIsAcquireReply	= 0x0400,
 	tfIsDeadReply		= 0x0800,
-	tfIsFailedReply		= 0x0020,
-	tfIsFreePending		= 0x0040,
+	tfIsFailedReply		= 0x10000,
+	tfIsFreePending		= 0x20000,
 	
 	tfAttemptAcquire	= 0x1000,
 	tfRelease		= 0x2000,
 	tfDecRefs		= 0x3000,
 	tfRefTransaction	= 0xF000,
 	
-	tfReferenced		= 0x0080
+	tfReferenced		= 0x40000
 };
 
 typedef struct binder_transaction {
@@ -49,7 +49,7 @@ typedef struct binder_transaction {
 
 	u32				code;
 	struct binder_proc *		team;	// do we need this?  Won't sender or receiver's m_team do?
-	u16				flags;
+	u32				flags;
 	s16				priority;
 	size_t				data_size;
 	size_t				offsets_size;
@@ -98,6 +98,7 @@ status_t				binder_transaction_CopyTransactionData(binder_transaction_t *that, s
 #define binder_transaction_UserFlags(that) ((that)->flags & tfUserFlags)
 #define binder_transaction_RefFlags(that) ((that)->flags & tfRefTransaction)
 #define binder_transaction_IsInline(that) ((that)->flags & tfInline)
+#define binder_transaction_IsOneWay(that) ((that)->flags & tfOneWay)
 #define binder_transaction_IsRootObject(that) ((that)->flags & tfRootObject)
 #define binder_transaction_IsReply(that) ((that)->flags & tfIsReply)
 #define binder_transaction_IsEvent(that) ((that)->flags & tfIsEvent)
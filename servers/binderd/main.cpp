@@ -0,0 +1,1746 @@
+/*
+ * Copyright (c) 2005 Palmsource, Inc.
+ *
+ * This software is licensed as described in the file LICENSE, which
+ * you should have received as part of this distribution. The terms
+ * are also available at http://www.openbinder.org/license.html.
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals. For the exact contribution history, see the revision
+ * history and logs, available at http://www.openbinder.org
+ */
+
+// binderd -- a user-space stand-in for the binder kernel module.
+//
+// Processes that can't open /dev/binder connect here instead (see
+// libbinder's BinderTransport.cpp and support_p/binder_broker.h).  Each
+// connection is one binder thread.  The broker keeps the same node and
+// descriptor bookkeeping the driver does (modules/binder), routes
+// transactions and replies between threads, and copies transaction
+// data directly into the receiving process's shared transaction memory.
+//
+// Everything runs on one thread out of a poll() loop, so none of the
+// state below needs locking.  The sockets are non-blocking: what each
+// connection sends is collected in its input buffer, and a request is
+// only handled once all of it has arrived, so a slow or stalled client
+// can't hold up the others.
+
+#include <support/SupportDefs.h>
+#include <support_p/binder_broker.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if _SUPPORTS_NAMESPACE
+using namespace palmos::support;
+#endif
+
+#define DPRINTF(x) //printf x
+
+#define NODE_HASH_SIZE		64
+#define MAX_WRITE_SIZE		(256*1024)
+// Transaction memory is 8MB (BINDER_VM_SIZE), so no transaction larger
+// than this could be delivered anyway.
+#define MAX_PAYLOAD_SIZE	(16*1024*1024)
+#define MAX_MESSAGE_SIZE	(sizeof(broker_request)+MAX_WRITE_SIZE+MAX_PAYLOAD_SIZE)
+// How long a client may leave its reply unread before we give up on it.
+#define SEND_TIMEOUT_MS		5000
+#define MAX_SPAWNED_LOOPERS	15
+#define BUFFER_ALIGN(x)		(((x)+7)&~(size_t)7)
+
+struct bb_proc;
+struct bb_thread;
+struct bb_ref;
+
+// A binder object living in some process.
+struct bb_node
+{
+	bb_node*	hashNext;
+	bb_proc*	owner;		// NULL once the owning process is gone
+	void*		ptr;
+	void*		cookie;
+	int32_t		strong;		// held by descriptors with strong refs and by buffers
+	int32_t		weak;
+	bool		hasStrong;	// owner has been sent brACQUIRE
+	bool		hasWeak;	// owner has been sent brINCREFS
+	bb_ref*		refs;		// descriptors on this node, in all processes
+};
+
+// A process's descriptor (handle) for a node.
+struct bb_ref
+{
+	bb_ref*		nodeNext;
+	bb_proc*	proc;
+	bb_node*	node;
+	int32_t		handle;
+	int32_t		strong;
+	int32_t		weak;
+};
+
+// A reference a transaction buffer keeps until it is freed.
+struct bb_hold
+{
+	bb_node*	node;
+	bb_ref*		ref;
+	bool		strong;
+};
+
+struct bb_buffer
+{
+	bb_buffer*	next;
+	size_t		offset;
+	size_t		size;
+	bb_hold*	holds;
+	int32_t		holdCount;
+};
+
+struct bb_extent
+{
+	bb_extent*	next;
+	size_t		offset;
+	size_t		size;
+};
+
+enum {
+	WORK_TRANSACTION,
+	WORK_REPLY,
+	WORK_DEAD_REPLY,
+	WORK_COMPLETE,
+	WORK_REFS,
+	WORK_ACQUIRE_RESULT,
+	WORK_ATTEMPT_ACQUIRE,
+	WORK_EVENT,
+	WORK_SPAWN,
+	WORK_ERROR
+};
+
+struct bb_work
+{
+	bb_work*	next;
+	int32_t		type;
+	int32_t		cmd;		// WORK_REFS
+	int32_t		value;		// WORK_ACQUIRE_RESULT, WORK_ERROR
+	int32_t		priority;
+	uint32_t	code;
+	uint32_t	flags;
+	void*		ptr;
+	void*		cookie;
+	bb_buffer*	buffer;
+	size_t		dataSize;
+	size_t		offsetsSize;
+	bb_thread*	from;		// who gets the reply / acquire result
+	bb_ref*		ref;		// WORK_ATTEMPT_ACQUIRE
+};
+
+struct bb_queue
+{
+	bb_work*	head;
+	bb_work*	tail;
+};
+
+// A transaction a thread is currently executing and must reply to.
+struct bb_txn
+{
+	bb_txn*		next;
+	bb_thread*	from;
+};
+
+enum {
+	THREAD_REGISTERED	= 0x01,
+	THREAD_ENTERED		= 0x02
+};
+
+struct bb_thread
+{
+	bb_thread*	next;
+	bb_thread*	procNext;
+	bb_proc*	proc;		// NULL until the hello arrives
+	int			fd;
+	uint32_t	flags;
+	bool		dead;
+	bool		blocked;	// waiting in a read
+	uint32_t	readSize;
+	uint32_t	blockSeq;
+	int32_t		outstanding;	// replies / results we owe this thread
+	bb_queue	todo;
+	bb_txn*		stack;
+	bb_work*	attempt;	// brATTEMPT_ACQUIRE this thread is answering
+	uint8_t*	in;			// received, not yet handled
+	size_t		inLength;
+	size_t		inSize;
+	int			inFd;		// descriptor that came with it (the hello's memfd)
+};
+
+struct bb_proc
+{
+	bb_proc*	next;
+	pid_t		pid;
+	int			memfd;
+	uint8_t*	base;
+	uint64_t	clientBase;
+	size_t		size;
+	bb_extent*	free;
+	bb_buffer*	buffers;
+	bb_node*	nodes[NODE_HASH_SIZE];
+	bb_ref**	refs;
+	int32_t		refCapacity;
+	bb_queue	todo;
+	bb_thread*	threads;
+	bool		spawnPending;
+	bool		finished;
+	bool		stopOnRelease;
+	bb_node*	root;
+	int64_t		wakeupAt;
+	int32_t		wakeupPriority;
+};
+
+// A root object published (via tfRootObject) before anyone asked for it.
+struct bb_root
+{
+	bb_root*	next;
+	pid_t		pid;
+	uint8_t*	data;
+	size_t		dataSize;
+	size_t		offsetsSize;
+	bb_node**	nodes;
+	bool*		strong;
+	int32_t		count;
+};
+
+struct bb_root_waiter
+{
+	bb_root_waiter*	next;
+	pid_t			pid;
+	bb_thread*		thread;
+};
+
+static bb_proc* g_procs = NULL;
+static bb_thread* g_threads = NULL;
+static bb_proc* g_contextManager = NULL;
+static bb_root* g_roots = NULL;
+static bb_root_waiter* g_rootWaiters = NULL;
+static uint32_t g_blockSeq = 0;
+static const int64_t kNoWakeup = 0x7fffffffffffffffLL;
+
+static void node_inc(bb_node* node, bool strong, bb_thread* via);
+static void node_dec(bb_node* node, bool strong);
+static void finish_proc(bb_proc* proc);
+
+static int64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------
+// Socket helpers
+// -----------------------------------------------------------
+
+// Read whatever the socket has into the thread's input buffer.
+// Returns -1 if the connection is closed or broken.
+static int read_input(bb_thread* t)
+{
+	while (true) {
+		if (t->inLength == t->inSize) {
+			// Leave the rest in the socket until this much is handled.
+			if (t->inSize >= MAX_MESSAGE_SIZE) return 0;
+			size_t size = t->inSize ? t->inSize*2 : 4096;
+			if (size > MAX_MESSAGE_SIZE) size = MAX_MESSAGE_SIZE;
+			uint8_t* in = (uint8_t*)realloc(t->in, size);
+			if (!in) return -1;
+			t->in = in;
+			t->inSize = size;
+		}
+
+		char control[CMSG_SPACE(sizeof(int))];
+		iovec iov = { t->in+t->inLength, t->inSize-t->inLength };
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t amt = recvmsg(t->fd, &msg, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+		if (amt < 0 && errno == EINTR) continue;
+		if (amt < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		if (amt == 0) return -1;
+
+		for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+				int fd;
+				memcpy(&fd, CMSG_DATA(c), sizeof(int));
+				if (t->inFd < 0) t->inFd = fd;
+				else close(fd);
+			}
+		}
+		t->inLength += amt;
+		if ((size_t)amt < iov.iov_len) return 0;
+	}
+}
+
+// Size of the next message in the thread's input buffer: 0 if not
+// enough of it has arrived to tell, -1 if it is malformed.
+static ssize_t next_message_size(bb_thread* t)
+{
+	if (!t->proc) return sizeof(broker_hello);
+	if (t->inLength < sizeof(broker_request)) return 0;
+
+	const broker_request* req = (const broker_request*)t->in;
+	if (req->op != BROKER_OP_WRITE_READ) {
+		if (req->arg_size > MAX_WRITE_SIZE) return -1;
+		return sizeof(broker_request)+req->arg_size;
+	}
+
+	if (req->write_size > MAX_WRITE_SIZE) return -1;
+	size_t size = sizeof(broker_request)+req->write_size;
+	if (t->inLength < size) return 0;
+
+	// The data of each transaction follows the commands.
+	const uint8_t* pos = t->in+sizeof(broker_request);
+	const uint8_t* end = pos+req->write_size;
+	while (pos+sizeof(int32_t) <= end) {
+		const int32_t cmd = *(const int32_t*)pos;
+		const int32_t cmdSize = broker_command_size(cmd);
+		pos += sizeof(int32_t);
+		if (cmdSize < 0 || pos+cmdSize > end) return -1;
+		if (cmd == bcTRANSACTION || cmd == bcREPLY) {
+			const binder_transaction_data* tr = (const binder_transaction_data*)pos;
+			if (tr->data_size > MAX_PAYLOAD_SIZE || tr->offsets_size > MAX_PAYLOAD_SIZE) return -1;
+			size += tr->data_size+tr->offsets_size;
+			if (size > MAX_MESSAGE_SIZE) return -1;
+		}
+		pos += cmdSize;
+	}
+	return size;
+}
+
+// Wait for room to send; the client is normally sitting in a read
+// waiting for exactly this, so the wait is short.
+static int wait_writable(int fd)
+{
+	pollfd pfd = { fd, POLLOUT, 0 };
+	int result;
+	do {
+		result = poll(&pfd, 1, SEND_TIMEOUT_MS);
+	} while (result < 0 && errno == EINTR);
+	return (result > 0 && (pfd.revents&POLLOUT)) ? 0 : -1;
+}
+
+static int send_reply(bb_thread* t, int32_t status, uint32_t written, const void* data, uint32_t size,
+	uint32_t features = 0)
+{
+	broker_reply reply;
+	reply.status = status;
+	reply.write_consumed = written;
+	reply.read_consumed = size;
+	reply.features = features;
+
+	iovec iov[2] = { { &reply, sizeof(reply) }, { const_cast<void*>(data), size } };
+	int count = size > 0 ? 2 : 1;
+	iovec* cur = iov;
+	while (count > 0) {
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = cur;
+		msg.msg_iovlen = count;
+		ssize_t amt = sendmsg(t->fd, &msg, MSG_NOSIGNAL);
+		if (amt < 0 && errno == EINTR) continue;
+		if (amt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(t->fd) == 0) continue;
+		if (amt < 0) {
+			t->dead = true;
+			return -1;
+		}
+		while (count > 0 && (size_t)amt >= cur->iov_len) {
+			amt -= cur->iov_len;
+			cur++;
+			count--;
+		}
+		if (count > 0) {
+			cur->iov_base = (uint8_t*)cur->iov_base + amt;
+			cur->iov_len -= amt;
+		}
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------
+// Work queues
+// -----------------------------------------------------------
+
+static bb_work* new_work(int32_t type)
+{
+	bb_work* w = (bb_work*)calloc(1, sizeof(bb_work));
+	w->type = type;
+	return w;
+}
+
+static void enqueue(bb_queue* q, bb_work* w)
+{
+	w->next = NULL;
+	if (q->tail) q->tail->next = w;
+	else q->head = w;
+	q->tail = w;
+}
+
+static bb_work* dequeue(bb_queue* q)
+{
+	bb_work* w = q->head;
+	if (w) {
+		q->head = w->next;
+		if (!q->head) q->tail = NULL;
+		w->next = NULL;
+	}
+	return w;
+}
+
+static void queue_simple(bb_thread* t, int32_t type, int32_t value = 0)
+{
+	bb_work* w = new_work(type);
+	w->value = value;
+	enqueue(&t->todo, w);
+}
+
+// Reference commands for a node go to 'via' if it is a thread of the
+// owning process (so they arrive before its brTRANSACTION_COMPLETE, just
+// like the driver writes them into the sender's read buffer), else to
+// the owner's process queue.
+static void queue_refs(bb_node* node, int32_t cmd, bb_thread* via)
+{
+	if (!node->owner || node->owner->finished) return;
+	bb_work* w = new_work(WORK_REFS);
+	w->cmd = cmd;
+	w->ptr = node->ptr;
+	w->cookie = node->cookie;
+	if (via && via->proc == node->owner && !via->dead) enqueue(&via->todo, w);
+	else enqueue(&node->owner->todo, w);
+}
+
+// -----------------------------------------------------------
+// Transaction memory
+// -----------------------------------------------------------
+
+static bb_buffer* alloc_buffer(bb_proc* proc, size_t size)
+{
+	size = BUFFER_ALIGN(size ? size : 1);
+	bb_extent** e = &proc->free;
+	while (*e && (*e)->size < size) e = &(*e)->next;
+	if (!*e) return NULL;
+
+	bb_buffer* b = (bb_buffer*)calloc(1, sizeof(bb_buffer));
+	b->offset = (*e)->offset;
+	b->size = size;
+	(*e)->offset += size;
+	(*e)->size -= size;
+	if ((*e)->size == 0) {
+		bb_extent* gone = *e;
+		*e = gone->next;
+		free(gone);
+	}
+	b->next = proc->buffers;
+	proc->buffers = b;
+	return b;
+}
+
+static void add_hold(bb_buffer* b, bb_node* node, bb_ref* ref, bool strong)
+{
+	b->holds = (bb_hold*)realloc(b->holds, (b->holdCount+1)*sizeof(bb_hold));
+	b->holds[b->holdCount].node = node;
+	b->holds[b->holdCount].ref = ref;
+	b->holds[b->holdCount].strong = strong;
+	b->holdCount++;
+}
+
+static void ref_dec(bb_ref* ref, bool strong);
+
+static void free_buffer(bb_proc* proc, bb_buffer* b)
+{
+	bb_buffer** p = &proc->buffers;
+	while (*p && *p != b) p = &(*p)->next;
+	if (*p) *p = b->next;
+
+	for (int32_t i=0; i<b->holdCount; i++) {
+		if (b->holds[i].ref) ref_dec(b->holds[i].ref, b->holds[i].strong);
+		else node_dec(b->holds[i].node, b->holds[i].strong);
+	}
+	free(b->holds);
+
+	// Return the range to the (offset-sorted) free list, coalescing.
+	bb_extent** e = &proc->free;
+	bb_extent* prev = NULL;
+	while (*e && (*e)->offset < b->offset) {
+		prev = *e;
+		e = &(*e)->next;
+	}
+	if (prev && prev->offset+prev->size == b->offset) {
+		prev->size += b->size;
+		if (prev->next && prev->offset+prev->size == prev->next->offset) {
+			bb_extent* gone = prev->next;
+			prev->size += gone->size;
+			prev->next = gone->next;
+			free(gone);
+		}
+	} else if (*e && b->offset+b->size == (*e)->offset) {
+		(*e)->offset = b->offset;
+		(*e)->size += b->size;
+	} else {
+		bb_extent* n = (bb_extent*)malloc(sizeof(bb_extent));
+		n->offset = b->offset;
+		n->size = b->size;
+		n->next = *e;
+		*e = n;
+	}
+	free(b);
+}
+
+// SLooper sends buffer addresses as 32-bit values.
+static bb_buffer* find_buffer(bb_proc* proc, uint32_t clientPtr)
+{
+	for (bb_buffer* b = proc->buffers; b; b = b->next) {
+		if ((uint32_t)(proc->clientBase+b->offset) == clientPtr) return b;
+	}
+	return NULL;
+}
+
+// -----------------------------------------------------------
+// Nodes and descriptors
+// -----------------------------------------------------------
+
+static inline uint32_t hash_ptr(void* ptr)
+{
+	return (uint32_t)(((uintptr_t)ptr >> 3) % NODE_HASH_SIZE);
+}
+
+static bb_node* get_node(bb_proc* proc, void* ptr, void* cookie)
+{
+	bb_node** head = &proc->nodes[hash_ptr(ptr)];
+	for (bb_node* n = *head; n; n = n->hashNext) {
+		if (n->ptr == ptr) return n;
+	}
+	bb_node* n = (bb_node*)calloc(1, sizeof(bb_node));
+	n->owner = proc;
+	n->ptr = ptr;
+	n->cookie = cookie;
+	n->hashNext = *head;
+	*head = n;
+	return n;
+}
+
+static void maybe_free_node(bb_node* node)
+{
+	if (node->strong || node->weak || node->refs) return;
+	if (node->hasStrong || node->hasWeak) return;
+	if (node->owner) {
+		bb_node** p = &node->owner->nodes[hash_ptr(node->ptr)];
+		while (*p && *p != node) p = &(*p)->hashNext;
+		if (*p) *p = node->hashNext;
+		if (node->owner->root == node) node->owner->root = NULL;
+	}
+	free(node);
+}
+
+static void node_inc(bb_node* node, bool strong, bb_thread* via)
+{
+	if (strong) {
+		if (node->strong++ == 0 && !node->hasStrong && node->owner) {
+			node->hasStrong = true;
+			queue_refs(node, brACQUIRE, via);
+		}
+	} else {
+		if (node->weak++ == 0 && !node->hasWeak && node->owner) {
+			node->hasWeak = true;
+			queue_refs(node, brINCREFS, via);
+		}
+	}
+}
+
+static void node_dec(bb_node* node, bool strong)
+{
+	if (strong) {
+		if (--node->strong == 0 && node->hasStrong) {
+			node->hasStrong = false;
+			queue_refs(node, brRELEASE, NULL);
+			bb_proc* owner = node->owner;
+			if (owner && owner->stopOnRelease && owner->root == node) finish_proc(owner);
+		}
+	} else {
+		if (--node->weak == 0 && node->hasWeak) {
+			node->hasWeak = false;
+			queue_refs(node, brDECREFS, NULL);
+		}
+	}
+	maybe_free_node(node);
+}
+
+static bb_ref* lookup_ref(bb_proc* proc, int32_t handle)
+{
+	if (handle <= 0 || handle >= proc->refCapacity) return NULL;
+	return proc->refs[handle];
+}
+
+static bb_ref* get_ref(bb_proc* proc, bb_node* node)
+{
+	for (bb_ref* r = node->refs; r; r = r->nodeNext) {
+		if (r->proc == proc) return r;
+	}
+
+	// Descriptor 0 is the context manager; hand out the lowest free one.
+	int32_t handle = 1;
+	while (handle < proc->refCapacity && proc->refs[handle]) handle++;
+	if (handle >= proc->refCapacity) {
+		int32_t cap = proc->refCapacity ? proc->refCapacity*2 : 32;
+		proc->refs = (bb_ref**)realloc(proc->refs, cap*sizeof(bb_ref*));
+		memset(proc->refs+proc->refCapacity, 0, (cap-proc->refCapacity)*sizeof(bb_ref*));
+		proc->refCapacity = cap;
+	}
+
+	bb_ref* r = (bb_ref*)calloc(1, sizeof(bb_ref));
+	r->proc = proc;
+	r->node = node;
+	r->handle = handle;
+	r->nodeNext = node->refs;
+	node->refs = r;
+	proc->refs[handle] = r;
+	return r;
+}
+
+static void ref_inc(bb_ref* ref, bool strong, bb_thread* via)
+{
+	if (strong) {
+		if (ref->strong++ == 0) node_inc(ref->node, true, via);
+	} else {
+		if (ref->weak++ == 0) node_inc(ref->node, false, via);
+	}
+}
+
+static void ref_dec(bb_ref* ref, bool strong)
+{
+	bb_node* node = ref->node;
+	if (strong) {
+		if (ref->strong <= 0) return;
+		if (--ref->strong == 0) node_dec(node, true);
+	} else {
+		if (ref->weak <= 0) return;
+		if (--ref->weak == 0) node_dec(node, false);
+	}
+	if (ref->strong == 0 && ref->weak == 0) {
+		bb_ref** p = &node->refs;
+		while (*p && *p != ref) p = &(*p)->nodeNext;
+		if (*p) *p = ref->nodeNext;
+		ref->proc->refs[ref->handle] = NULL;
+		free(ref);
+		maybe_free_node(node);
+	}
+}
+
+// -----------------------------------------------------------
+// Binder object translation (ConvertToNodes/ConvertFromNodes in
+// the driver, done here in one step since we already know the target).
+// -----------------------------------------------------------
+
+static bb_node* object_to_node(bb_proc* from, flat_binder_object* flat, bool* strong, bool root)
+{
+	switch (flat->type) {
+		case kPackedLargeBinderType:
+		case kPackedLargeBinderWeakType: {
+			*strong = flat->type == kPackedLargeBinderType;
+			if (!flat->binder) return NULL;
+			bb_node* n = get_node(from, flat->binder, flat->cookie);
+			if (root && *strong) from->root = n;
+			return n;
+		}
+		case kPackedLargeBinderHandleType:
+		case kPackedLargeBinderWeakHandleType: {
+			*strong = flat->type == kPackedLargeBinderHandleType;
+			bb_ref* r = lookup_ref(from, flat->handle);
+			return r ? r->node : NULL;
+		}
+	}
+	return (bb_node*)-1;
+}
+
+static void node_to_object(bb_proc* to, bb_buffer* buffer, bb_node* node, bool strong,
+	flat_binder_object* flat, bb_thread* via)
+{
+	if (!node) {
+		flat->type = strong ? kPackedLargeBinderType : kPackedLargeBinderWeakType;
+		flat->binder = NULL;
+		flat->cookie = NULL;
+	} else if (node->owner == to) {
+		flat->type = strong ? kPackedLargeBinderType : kPackedLargeBinderWeakType;
+		flat->binder = node->ptr;
+		flat->cookie = node->cookie;
+		// Keep the node around until the buffer is freed.
+		node_inc(node, strong, via);
+		add_hold(buffer, node, NULL, strong);
+	} else {
+		bb_ref* r = get_ref(to, node);
+		// The receiver's descriptor keeps a reference until the buffer
+		// is freed, by which time the proxy has acquired its own.
+		ref_inc(r, strong, via);
+		add_hold(buffer, NULL, r, strong);
+		flat->type = strong ? kPackedLargeBinderHandleType : kPackedLargeBinderWeakHandleType;
+		flat->handle = r->handle;
+		flat->cookie = NULL;
+	}
+}
+
+static bool check_offsets(const uint8_t* data, size_t dataSize, const size_t* offs, size_t count)
+{
+	for (size_t i=0; i<count; i++) {
+		if (offs[i] > dataSize || dataSize-offs[i] < sizeof(flat_binder_object)) return false;
+		if (offs[i]%sizeof(uint32_t) != 0) return false;
+	}
+	(void)data;
+	return true;
+}
+
+static bool translate(bb_proc* from, bb_proc* to, bb_buffer* buffer, uint8_t* data,
+	size_t dataSize, const size_t* offs, size_t count, bool root, bb_thread* via)
+{
+	if (!check_offsets(data, dataSize, offs, count)) return false;
+	for (size_t i=0; i<count; i++) {
+		flat_binder_object* flat = (flat_binder_object*)(data+offs[i]);
+		bool strong = true;
+		bb_node* node = object_to_node(from, flat, &strong, root);
+		if (node == (bb_node*)-1) return false;
+		node_to_object(to, buffer, node, strong, flat, via);
+	}
+	return true;
+}
+
+// -----------------------------------------------------------
+// Root objects
+// -----------------------------------------------------------
+
+static void free_root(bb_root* root)
+{
+	for (int32_t i=0; i<root->count; i++) {
+		if (root->nodes[i]) node_dec(root->nodes[i], root->strong[i]);
+	}
+	free(root->nodes);
+	free(root->strong);
+	free(root->data);
+	free(root);
+}
+
+static void deliver_root(bb_root* root, bb_thread* waiter)
+{
+	bb_proc* to = waiter->proc;
+	bb_buffer* b = alloc_buffer(to, BUFFER_ALIGN(root->dataSize)+root->offsetsSize);
+	if (!b) {
+		queue_simple(waiter, WORK_ERROR, -ENOMEM);
+		free_root(root);
+		return;
+	}
+	uint8_t* data = to->base+b->offset;
+	memcpy(data, root->data, root->dataSize);
+	memcpy(data+BUFFER_ALIGN(root->dataSize), root->data+BUFFER_ALIGN(root->dataSize), root->offsetsSize);
+	const size_t* offs = (const size_t*)(root->data+BUFFER_ALIGN(root->dataSize));
+	for (int32_t i=0; i<root->count; i++) {
+		node_to_object(to, b, root->nodes[i], root->strong[i],
+			(flat_binder_object*)(data+offs[i]), waiter);
+	}
+
+	bb_work* w = new_work(WORK_REPLY);
+	w->flags = tfRootObject;
+	w->buffer = b;
+	w->dataSize = root->dataSize;
+	w->offsetsSize = root->offsetsSize;
+	enqueue(&waiter->todo, w);
+
+	free_root(root);
+}
+
+static int publish_root(bb_thread* t, const binder_transaction_data* tr, const uint8_t* payload)
+{
+	bb_proc* proc = t->proc;
+	bb_root* root = (bb_root*)calloc(1, sizeof(bb_root));
+	root->pid = proc->pid;
+	root->dataSize = tr->data_size;
+	root->offsetsSize = tr->offsets_size;
+	root->data = (uint8_t*)malloc(BUFFER_ALIGN(tr->data_size)+tr->offsets_size+1);
+	memcpy(root->data, payload, tr->data_size);
+	memcpy(root->data+BUFFER_ALIGN(tr->data_size), payload+tr->data_size, tr->offsets_size);
+
+	const size_t* offs = (const size_t*)(root->data+BUFFER_ALIGN(tr->data_size));
+	size_t count = tr->offsets_size/sizeof(size_t);
+	if (!check_offsets(root->data, tr->data_size, offs, count)) {
+		free(root->data);
+		free(root);
+		return -1;
+	}
+	root->nodes = (bb_node**)calloc(count+1, sizeof(bb_node*));
+	root->strong = (bool*)calloc(count+1, sizeof(bool));
+	for (size_t i=0; i<count; i++) {
+		bool strong = true;
+		bb_node* n = object_to_node(proc, (flat_binder_object*)(root->data+offs[i]), &strong, true);
+		if (n == (bb_node*)-1) n = NULL;
+		root->nodes[i] = n;
+		root->strong[i] = strong;
+		root->count++;
+		if (n) node_inc(n, strong, t);
+	}
+
+	bb_root_waiter** w = &g_rootWaiters;
+	while (*w && (*w)->pid != proc->pid) w = &(*w)->next;
+	if (*w) {
+		bb_root_waiter* waiter = *w;
+		*w = waiter->next;
+		deliver_root(root, waiter->thread);
+		free(waiter);
+	} else {
+		root->next = g_roots;
+		g_roots = root;
+	}
+	return 0;
+}
+
+static void retrieve_root(bb_thread* t, pid_t pid)
+{
+	t->outstanding++;
+	bb_root** r = &g_roots;
+	while (*r && (*r)->pid != pid) r = &(*r)->next;
+	if (*r) {
+		bb_root* root = *r;
+		*r = root->next;
+		deliver_root(root, t);
+		return;
+	}
+	bb_root_waiter* w = (bb_root_waiter*)malloc(sizeof(bb_root_waiter));
+	w->pid = pid;
+	w->thread = t;
+	w->next = g_rootWaiters;
+	g_rootWaiters = w;
+}
+
+// -----------------------------------------------------------
+// Transactions
+// -----------------------------------------------------------
+
+// @a payload points at the transaction's data and offsets, which
+// follow the commands; it is moved past them.
+static int handle_transaction(bb_thread* t, const binder_transaction_data* tr, bool isReply,
+	const uint8_t*& payload)
+{
+	bb_proc* proc = t->proc;
+	const uint8_t* const tdata = payload;
+	const size_t payloadSize = tr->data_size+tr->offsets_size;
+	const bool oneWay = !isReply && (tr->flags&tfOneWay) != 0;
+
+	payload += payloadSize;
+	if (tr->offsets_size%sizeof(size_t) != 0) return -1;
+
+	if (isReply && (tr->flags&tfRootObject)) {
+		if (publish_root(t, tr, tdata) != 0) return -1;
+		queue_simple(t, WORK_COMPLETE);
+		return 0;
+	}
+
+	bb_proc* target = NULL;
+	bb_thread* dest = NULL;
+	void* ptr = NULL;
+	void* cookie = NULL;
+
+	if (isReply) {
+		bb_txn* txn = t->stack;
+		if (!txn) return -1;
+		t->stack = txn->next;
+		dest = txn->from;
+		free(txn);
+		if (dest && !dest->dead) target = dest->proc;
+	} else {
+		t->outstanding++;
+		if (tr->target.handle == 0) {
+			target = g_contextManager;
+		} else {
+			bb_ref* r = lookup_ref(proc, tr->target.handle);
+			if (r && r->node->owner) {
+				target = r->node->owner;
+				ptr = r->node->ptr;
+				cookie = r->node->cookie;
+			}
+		}
+	}
+
+	if (!target || target->finished) {
+		DPRINTF(("binderd: %s to dead target from %d\n", isReply ? "reply" : "transaction", proc->pid));
+		// Nobody waits on a one-way call, so it is just dropped.
+		if (oneWay) t->outstanding--;
+		queue_simple(t, (isReply || oneWay) ? WORK_COMPLETE : WORK_DEAD_REPLY);
+		return 0;
+	}
+
+	bb_buffer* b = alloc_buffer(target, BUFFER_ALIGN(tr->data_size)+tr->offsets_size);
+	if (!b) {
+		fprintf(stderr, "binderd: out of transaction memory in %d (%lu bytes)\n",
+			target->pid, (unsigned long)payloadSize);
+		if (isReply) {
+			queue_simple(dest, WORK_ERROR, -ENOMEM);
+			queue_simple(t, WORK_COMPLETE);
+		} else {
+			queue_simple(t, WORK_ERROR, -ENOMEM);
+		}
+		return 0;
+	}
+
+	uint8_t* data = target->base+b->offset;
+	size_t* offs = (size_t*)(data+BUFFER_ALIGN(tr->data_size));
+	memcpy(data, tdata, tr->data_size);
+	memcpy(offs, tdata+tr->data_size, tr->offsets_size);
+	if (!translate(proc, target, b, data, tr->data_size, offs, tr->offsets_size/sizeof(size_t),
+			(tr->flags&tfRootObject) != 0, t)) {
+		fprintf(stderr, "binderd: bad binder object in transaction from %d\n", proc->pid);
+		free_buffer(target, b);
+		if (isReply) {
+			queue_simple(dest, WORK_ERROR, -EINVAL);
+			queue_simple(t, WORK_COMPLETE);
+		} else {
+			queue_simple(t, WORK_ERROR, -EINVAL);
+		}
+		return 0;
+	}
+
+	bb_work* w = new_work(isReply ? WORK_REPLY : WORK_TRANSACTION);
+	w->code = tr->code;
+	w->flags = tr->flags&~tfGather;
+	w->priority = tr->priority;
+	w->ptr = ptr;
+	w->cookie = cookie;
+	w->buffer = b;
+	w->dataSize = tr->data_size;
+	w->offsetsSize = tr->offsets_size;
+
+	if (isReply) {
+		enqueue(&dest->todo, w);
+	} else if (oneWay) {
+		// No reply will come back, so the sender is done with it now.
+		// It can't be nested into a waiting thread either; that thread
+		// would run it in the middle of an unrelated call.
+		t->outstanding--;
+		enqueue(&target->todo, w);
+	} else {
+		w->from = t;
+		// If a thread of the target is waiting on us (directly or
+		// further up the call chain), it gets the nested call.
+		for (bb_txn* txn = t->stack; txn; txn = txn->next) {
+			if (txn->from && txn->from->proc == target && !txn->from->dead) {
+				dest = txn->from;
+				break;
+			}
+		}
+		enqueue(dest ? &dest->todo : &target->todo, w);
+	}
+
+	queue_simple(t, WORK_COMPLETE);
+	return 0;
+}
+
+static void attempt_acquire(bb_thread* t, int32_t priority, int32_t handle)
+{
+	t->outstanding++;
+	bb_ref* r = lookup_ref(t->proc, handle);
+	if (!r || !r->node->owner || r->node->owner->finished) {
+		queue_simple(t, WORK_DEAD_REPLY);
+		return;
+	}
+	bb_node* node = r->node;
+	if (node->strong > 0 && node->hasStrong) {
+		ref_inc(r, true, t);
+		queue_simple(t, WORK_ACQUIRE_RESULT, 1);
+		return;
+	}
+
+	// Only the owner can tell whether the object is still alive.
+	bb_work* w = new_work(WORK_ATTEMPT_ACQUIRE);
+	w->priority = priority;
+	w->ptr = node->ptr;
+	w->cookie = node->cookie;
+	w->from = t;
+	w->ref = r;
+	ref_inc(r, false, t);
+	enqueue(&node->owner->todo, w);
+}
+
+static void acquire_result(bb_thread* t, int32_t success)
+{
+	bb_work* w = t->attempt;
+	if (!w) return;
+	t->attempt = NULL;
+
+	bb_ref* r = w->ref;
+	if (success) {
+		// The owner already did the IncStrong() for us; use it if the
+		// node needs one, otherwise give it back.
+		bb_node* node = r->node;
+		if (!node->hasStrong && r->strong == 0) {
+			node->hasStrong = true;
+			ref_inc(r, true, NULL);
+		} else {
+			ref_inc(r, true, NULL);
+			queue_refs(node, brRELEASE, NULL);
+		}
+	}
+	if (w->from && !w->from->dead) queue_simple(w->from, WORK_ACQUIRE_RESULT, success ? 1 : 0);
+	ref_dec(r, false);
+	free(w);
+}
+
+static void set_wakeup(bb_proc* proc, const binder_wakeup_time* wakeup)
+{
+	const int64_t now = now_ns();
+	if (wakeup->time >= kNoWakeup-now) {
+		proc->wakeupAt = kNoWakeup;
+	} else {
+		proc->wakeupAt = now + (wakeup->time > 0 ? wakeup->time : 0);
+		proc->wakeupPriority = wakeup->priority;
+	}
+}
+
+// -----------------------------------------------------------
+// Commands
+// -----------------------------------------------------------
+
+// The transaction data follows the commands, starting at @a end.
+static int handle_commands(bb_thread* t, const uint8_t* pos, const uint8_t* end)
+{
+	const uint8_t* payload = end;
+	bb_proc* proc = t->proc;
+	while (pos+sizeof(int32_t) <= end) {
+		const int32_t cmd = *(const int32_t*)pos;
+		const int32_t size = broker_command_size(cmd);
+		pos += sizeof(int32_t);
+		if (size < 0 || pos+size > end) {
+			fprintf(stderr, "binderd: bad command %d from %d\n", cmd, proc->pid);
+			return -1;
+		}
+		const int32_t* args = (const int32_t*)pos;
+		pos += size;
+
+		switch (cmd) {
+			case bcTRANSACTION:
+			case bcREPLY:
+				if (handle_transaction(t, (const binder_transaction_data*)args, cmd == bcREPLY, payload) != 0)
+					return -1;
+				break;
+			case bcFREE_BUFFER: {
+				bb_buffer* b = find_buffer(proc, (uint32_t)args[0]);
+				if (b) free_buffer(proc, b);
+				else fprintf(stderr, "binderd: bcFREE_BUFFER of unknown buffer from %d\n", proc->pid);
+			} break;
+			case bcINCREFS:
+			case bcACQUIRE: {
+				bb_ref* r = lookup_ref(proc, args[0]);
+				if (r) ref_inc(r, cmd == bcACQUIRE, t);
+			} break;
+			case bcRELEASE:
+			case bcDECREFS: {
+				bb_ref* r = lookup_ref(proc, args[0]);
+				if (r) ref_dec(r, cmd == bcRELEASE);
+			} break;
+			case bcATTEMPT_ACQUIRE:
+				attempt_acquire(t, args[0], args[1]);
+				break;
+			case bcACQUIRE_RESULT:
+				acquire_result(t, args[0]);
+				break;
+			case bcRETRIEVE_ROOT_OBJECT:
+				retrieve_root(t, (pid_t)args[0]);
+				break;
+			case bcREGISTER_LOOPER:
+				t->flags |= THREAD_REGISTERED;
+				proc->spawnPending = false;
+				break;
+			case bcENTER_LOOPER:
+				t->flags |= THREAD_ENTERED;
+				break;
+			case bcEXIT_LOOPER:
+				t->flags &= ~THREAD_ENTERED;
+				break;
+			case bcSTOP_SELF:
+				if (args[0]) finish_proc(proc);
+				else proc->stopOnRelease = true;
+				break;
+			case bcSTOP_PROCESS: {
+				bb_ref* r = lookup_ref(proc, args[0]);
+				bb_proc* owner = r ? r->node->owner : NULL;
+				if (owner) {
+					if (args[1]) finish_proc(owner);
+					else owner->stopOnRelease = true;
+				}
+			} break;
+			default:
+				// bcINCREFS_DONE, bcACQUIRE_DONE, bcNOOP, bcSYNC, ... need nothing.
+				break;
+		}
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------
+// Processes and threads
+// -----------------------------------------------------------
+
+static bb_proc* find_proc(pid_t pid)
+{
+	for (bb_proc* p = g_procs; p; p = p->next) {
+		if (p->pid == pid) return p;
+	}
+	return NULL;
+}
+
+static bb_proc* new_proc(pid_t pid, int memfd, const broker_hello& hello)
+{
+	struct stat st;
+	if (memfd < 0 || fstat(memfd, &st) != 0 || (uint64_t)st.st_size < hello.vm_size) return NULL;
+	void* base = mmap(NULL, hello.vm_size, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (base == MAP_FAILED) return NULL;
+
+	bb_proc* p = (bb_proc*)calloc(1, sizeof(bb_proc));
+	p->pid = pid;
+	p->memfd = memfd;
+	p->base = (uint8_t*)base;
+	p->clientBase = hello.vm_start;
+	p->size = hello.vm_size;
+	p->free = (bb_extent*)malloc(sizeof(bb_extent));
+	p->free->next = NULL;
+	p->free->offset = 0;
+	p->free->size = p->size;
+	p->wakeupAt = kNoWakeup;
+	p->next = g_procs;
+	g_procs = p;
+	return p;
+}
+
+// Throw away work that will never be delivered, telling anyone
+// waiting on it that the other side is gone.
+static void discard_work(bb_proc* owner, bb_work* w)
+{
+	switch (w->type) {
+		case WORK_TRANSACTION:
+			if (w->from && !w->from->dead) queue_simple(w->from, WORK_DEAD_REPLY);
+			free_buffer(owner, w->buffer);
+			break;
+		case WORK_REPLY:
+			free_buffer(owner, w->buffer);
+			break;
+		case WORK_ATTEMPT_ACQUIRE:
+			if (w->from && !w->from->dead) queue_simple(w->from, WORK_DEAD_REPLY);
+			ref_dec(w->ref, false);
+			break;
+	}
+	free(w);
+}
+
+static void forget_thread(bb_thread* gone)
+{
+	// Nobody may reply to, or deliver results to, this thread any more.
+	for (bb_thread* t = g_threads; t; t = t->next) {
+		for (bb_txn* txn = t->stack; txn; txn = txn->next) {
+			if (txn->from == gone) txn->from = NULL;
+		}
+		for (bb_work* w = t->todo.head; w; w = w->next) {
+			if (w->from == gone) w->from = NULL;
+		}
+		if (t->attempt && t->attempt->from == gone) t->attempt->from = NULL;
+	}
+	for (bb_proc* p = g_procs; p; p = p->next) {
+		for (bb_work* w = p->todo.head; w; w = w->next) {
+			if (w->from == gone) w->from = NULL;
+		}
+	}
+	bb_root_waiter** w = &g_rootWaiters;
+	while (*w) {
+		if ((*w)->thread == gone) {
+			bb_root_waiter* old = *w;
+			*w = old->next;
+			free(old);
+		} else {
+			w = &(*w)->next;
+		}
+	}
+}
+
+static void remove_proc(bb_proc* proc)
+{
+	DPRINTF(("binderd: process %d is gone\n", proc->pid));
+
+	if (g_contextManager == proc) g_contextManager = NULL;
+	proc->finished = true;
+
+	bb_work* w;
+	while ((w=dequeue(&proc->todo)) != NULL) discard_work(proc, w);
+	while (proc->buffers) free_buffer(proc, proc->buffers);
+
+	// Let go of everything we hold in other processes.
+	for (int32_t i=1; i<proc->refCapacity; i++) {
+		bb_ref* r = proc->refs[i];
+		if (!r) continue;
+		if (r->strong > 0) {
+			r->strong = 1;
+			ref_dec(r, true);
+		}
+		r = proc->refs[i];
+		if (r && r->weak > 0) {
+			r->weak = 1;
+			ref_dec(r, false);
+		}
+	}
+	free(proc->refs);
+	proc->refs = NULL;
+	proc->refCapacity = 0;
+
+	// Our own nodes live on, dead, for as long as others have descriptors.
+	for (int32_t i=0; i<NODE_HASH_SIZE; i++) {
+		bb_node* n = proc->nodes[i];
+		while (n) {
+			bb_node* next = n->hashNext;
+			n->owner = NULL;
+			n->hashNext = NULL;
+			n->hasStrong = n->hasWeak = false;
+			maybe_free_node(n);
+			n = next;
+		}
+		proc->nodes[i] = NULL;
+	}
+
+	bb_root** r = &g_roots;
+	while (*r) {
+		if ((*r)->pid == proc->pid) {
+			bb_root* old = *r;
+			*r = old->next;
+			free_root(old);
+		} else {
+			r = &(*r)->next;
+		}
+	}
+	bb_root_waiter** rw = &g_rootWaiters;
+	while (*rw) {
+		if ((*rw)->pid == proc->pid) {
+			bb_root_waiter* old = *rw;
+			*rw = old->next;
+			queue_simple(old->thread, WORK_DEAD_REPLY);
+			free(old);
+		} else {
+			rw = &(*rw)->next;
+		}
+	}
+
+	while (proc->free) {
+		bb_extent* e = proc->free;
+		proc->free = e->next;
+		free(e);
+	}
+	munmap(proc->base, proc->size);
+	close(proc->memfd);
+
+	bb_proc** p = &g_procs;
+	while (*p && *p != proc) p = &(*p)->next;
+	if (*p) *p = proc->next;
+	free(proc);
+}
+
+static void remove_thread(bb_thread* t)
+{
+	// Whoever is waiting on a transaction this thread was executing
+	// gets a dead reply.
+	while (t->stack) {
+		bb_txn* txn = t->stack;
+		t->stack = txn->next;
+		if (txn->from && !txn->from->dead) queue_simple(txn->from, WORK_DEAD_REPLY);
+		free(txn);
+	}
+	if (t->attempt) {
+		bb_work* w = t->attempt;
+		t->attempt = NULL;
+		if (w->from && !w->from->dead) queue_simple(w->from, WORK_ACQUIRE_RESULT, 0);
+		ref_dec(w->ref, false);
+		free(w);
+	}
+	forget_thread(t);
+
+	bb_proc* proc = t->proc;
+	bb_work* w;
+	while ((w=dequeue(&t->todo)) != NULL) {
+		if (proc) discard_work(proc, w);
+		else free(w);
+	}
+
+	bb_thread** p = &g_threads;
+	while (*p && *p != t) p = &(*p)->next;
+	if (*p) *p = t->next;
+
+	if (proc) {
+		bb_thread** pt = &proc->threads;
+		while (*pt && *pt != t) pt = &(*pt)->procNext;
+		if (*pt) *pt = t->procNext;
+		if (!proc->threads) remove_proc(proc);
+	}
+
+	close(t->fd);
+	if (t->inFd >= 0) close(t->inFd);
+	free(t->in);
+	free(t);
+}
+
+static void finish_proc(bb_proc* proc)
+{
+	if (proc->finished) return;
+	DPRINTF(("binderd: stopping process %d\n", proc->pid));
+	proc->finished = true;
+	proc->stopOnRelease = false;
+	bb_work* w;
+	while ((w=dequeue(&proc->todo)) != NULL) discard_work(proc, w);
+}
+
+// -----------------------------------------------------------
+// Requests
+// -----------------------------------------------------------
+
+static void handle_hello(bb_thread* t)
+{
+	broker_hello hello;
+	memcpy(&hello, t->in, sizeof(hello));
+
+	int memfd = t->inFd;
+	t->inFd = -1;
+
+	int32_t status = 0;
+	if (hello.magic != BINDER_BROKER_MAGIC || hello.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		status = -EPROTO;
+	} else {
+		// Trust the kernel about who is on the other end.
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		pid_t pid = (getsockopt(t->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) ? cred.pid : hello.pid;
+
+		bb_proc* proc = find_proc(pid);
+		if (proc) {
+			if (memfd >= 0) close(memfd);
+			memfd = -1;
+		} else {
+			proc = new_proc(pid, memfd, hello);
+			if (proc) memfd = -1;
+		}
+		if (proc) {
+			t->proc = proc;
+			t->procNext = proc->threads;
+			proc->threads = t;
+			DPRINTF(("binderd: new thread in %d\n", pid));
+		} else {
+			status = -EINVAL;
+		}
+	}
+	if (memfd >= 0) close(memfd);
+
+	// Transaction flags are passed through untouched, so tfSharedMemory
+	// already reaches the receiver; tfOneWay is handled above.
+	send_reply(t, status, 0, NULL, 0, status == 0 ? (bfSharedMemory|bfOneWay) : 0);
+	if (status != 0) t->dead = true;
+}
+
+// Handle one complete request at the front of the thread's input buffer.
+static void handle_request(bb_thread* t)
+{
+	if (t->blocked) {
+		// A thread only talks to us again after we answer it.
+		t->dead = true;
+		return;
+	}
+
+	broker_request req;
+	memcpy(&req, t->in, sizeof(req));
+	const uint8_t* args = t->in+sizeof(req);
+
+	bb_proc* proc = t->proc;
+	switch (req.op) {
+		case BROKER_OP_WRITE_READ: {
+			if (handle_commands(t, args, args+req.write_size) != 0) {
+				t->dead = true;
+				return;
+			}
+			if (proc->finished) {
+				send_reply(t, -ECONNREFUSED, req.write_size, NULL, 0);
+			} else if (req.read_size == 0) {
+				send_reply(t, 0, req.write_size, NULL, 0);
+			} else {
+				// Answered by dispatch() once there is something to read.
+				t->blocked = true;
+				t->readSize = req.read_size;
+				t->blockSeq = ++g_blockSeq;
+			}
+		} break;
+
+		case BROKER_OP_SET_CONTEXT_MGR: {
+			int32_t status = 0;
+			if (g_contextManager && g_contextManager != proc) status = -EBUSY;
+			else g_contextManager = proc;
+			send_reply(t, status, 0, NULL, 0);
+		} break;
+
+		case BROKER_OP_SET_WAKEUP_TIME: {
+			binder_wakeup_time wakeup;
+			if (req.arg_size != sizeof(wakeup)) {
+				t->dead = true;
+				return;
+			}
+			memcpy(&wakeup, args, sizeof(wakeup));
+			set_wakeup(proc, &wakeup);
+			send_reply(t, 0, 0, NULL, 0);
+		} break;
+
+		case BROKER_OP_THREAD_EXIT: {
+			send_reply(t, 0, 0, NULL, 0);
+			t->dead = true;
+		} break;
+
+		default:
+			t->dead = true;
+			break;
+	}
+}
+
+// Read what the connection has sent, and handle every message that
+// has arrived completely.
+static void handle_input(bb_thread* t)
+{
+	if (read_input(t) != 0) {
+		t->dead = true;
+		return;
+	}
+
+	while (!t->dead) {
+		const ssize_t size = next_message_size(t);
+		if (size < 0) {
+			t->dead = true;
+			break;
+		}
+		if (size == 0 || (size_t)size > t->inLength) break;
+
+		if (!t->proc) handle_hello(t);
+		else handle_request(t);
+
+		// Move the next message (if any) to the front.
+		t->inLength -= size;
+		memmove(t->in, t->in+size, t->inLength);
+	}
+
+	// Don't hold on to the room a big transaction needed.
+	if (t->inLength == 0 && t->inSize > MAX_WRITE_SIZE) {
+		free(t->in);
+		t->in = NULL;
+		t->inSize = 0;
+	}
+}
+
+// -----------------------------------------------------------
+// Delivery
+// -----------------------------------------------------------
+
+static inline bool is_idle_looper(bb_thread* t)
+{
+	return t->blocked && !t->dead && (t->flags&(THREAD_REGISTERED|THREAD_ENTERED))
+		&& t->outstanding == 0 && !t->stack && !t->attempt && !t->todo.head;
+}
+
+static void write_tr(uint8_t*& pos, int32_t cmd, bb_proc* proc, const bb_work* w)
+{
+	binder_transaction_data tr;
+	memset(&tr, 0, sizeof(tr));
+	tr.target.ptr = w->ptr;
+	tr.cookie = w->cookie;
+	tr.code = w->code;
+	tr.flags = w->flags;
+	tr.priority = w->priority;
+	tr.data_size = w->dataSize;
+	tr.offsets_size = w->offsetsSize;
+	tr.data.ptr.buffer = (const void*)(uintptr_t)(proc->clientBase+w->buffer->offset);
+	tr.data.ptr.offsets = (const void*)(uintptr_t)(proc->clientBase+w->buffer->offset+BUFFER_ALIGN(w->dataSize));
+	*(int32_t*)pos = cmd;
+	memcpy(pos+sizeof(int32_t), &tr, sizeof(tr));
+	pos += sizeof(int32_t)+sizeof(tr);
+}
+
+static inline void write_int(uint8_t*& pos, int32_t value)
+{
+	*(int32_t*)pos = value;
+	pos += sizeof(int32_t);
+}
+
+static size_t work_size(const bb_work* w)
+{
+	switch (w->type) {
+		case WORK_TRANSACTION:
+		case WORK_REPLY:			return sizeof(int32_t)+sizeof(binder_transaction_data);
+		case WORK_REFS:				return 3*sizeof(int32_t);
+		case WORK_ATTEMPT_ACQUIRE:	return 4*sizeof(int32_t);
+		case WORK_ACQUIRE_RESULT:
+		case WORK_EVENT:
+		case WORK_ERROR:			return 2*sizeof(int32_t);
+	}
+	return sizeof(int32_t);
+}
+
+// Fill a blocked thread's read buffer from its queue and answer it.
+static void flush_thread(bb_thread* t)
+{
+	static uint8_t* out = NULL;
+	static size_t outSize = 0;
+	if (t->readSize > outSize) {
+		out = (uint8_t*)realloc(out, t->readSize);
+		outSize = t->readSize;
+	}
+
+	bb_proc* proc = t->proc;
+	uint8_t* pos = out;
+	bb_work* w;
+	while ((w=t->todo.head) != NULL && (size_t)(pos-out)+work_size(w) <= t->readSize) {
+		dequeue(&t->todo);
+		bool keep = false;
+		switch (w->type) {
+			case WORK_TRANSACTION: {
+				write_tr(pos, brTRANSACTION, proc, w);
+				// A one-way transaction gets no bcREPLY to match up.
+				if ((w->flags&tfOneWay) != 0) break;
+				bb_txn* txn = (bb_txn*)malloc(sizeof(bb_txn));
+				txn->from = w->from;
+				txn->next = t->stack;
+				t->stack = txn;
+			} break;
+			case WORK_REPLY:
+				write_tr(pos, brREPLY, proc, w);
+				t->outstanding--;
+				break;
+			case WORK_DEAD_REPLY:
+				write_int(pos, brDEAD_REPLY);
+				t->outstanding--;
+				break;
+			case WORK_COMPLETE:
+				write_int(pos, brTRANSACTION_COMPLETE);
+				break;
+			case WORK_REFS:
+				write_int(pos, w->cmd);
+				write_int(pos, (int32_t)(intptr_t)w->ptr);
+				write_int(pos, (int32_t)(intptr_t)w->cookie);
+				break;
+			case WORK_ACQUIRE_RESULT:
+				write_int(pos, brACQUIRE_RESULT);
+				write_int(pos, w->value);
+				t->outstanding--;
+				break;
+			case WORK_ATTEMPT_ACQUIRE:
+				write_int(pos, brATTEMPT_ACQUIRE);
+				write_int(pos, w->priority);
+				write_int(pos, (int32_t)(intptr_t)w->ptr);
+				write_int(pos, (int32_t)(intptr_t)w->cookie);
+				t->attempt = w;
+				keep = true;
+				break;
+			case WORK_EVENT:
+				write_int(pos, brEVENT_OCCURRED);
+				write_int(pos, w->priority);
+				break;
+			case WORK_SPAWN:
+				write_int(pos, brSPAWN_LOOPER);
+				break;
+			case WORK_ERROR:
+				write_int(pos, brERROR);
+				write_int(pos, w->value);
+				t->outstanding--;
+				break;
+		}
+		if (!keep) free(w);
+	}
+
+	if (pos == out) return;
+	t->blocked = false;
+	send_reply(t, 0, 0, out, pos-out);
+}
+
+static void dispatch()
+{
+	const int64_t now = now_ns();
+
+	for (bb_proc* p = g_procs; p; p = p->next) {
+		if (p->finished) {
+			// Everybody still waiting on the driver gets told to go away.
+			for (bb_thread* t = p->threads; t; t = t->procNext) {
+				if (t->blocked && !t->dead) {
+					t->blocked = false;
+					send_reply(t, -ECONNREFUSED, 0, NULL, 0);
+				}
+			}
+			continue;
+		}
+
+		if (p->wakeupAt <= now) {
+			p->wakeupAt = kNoWakeup;
+			bb_work* w = new_work(WORK_EVENT);
+			w->priority = p->wakeupPriority;
+			enqueue(&p->todo, w);
+		}
+
+		// Hand process work to idle loopers, most recently idle first.
+		while (p->todo.head) {
+			bb_thread* best = NULL;
+			for (bb_thread* t = p->threads; t; t = t->procNext) {
+				if (is_idle_looper(t) && (!best || t->blockSeq > best->blockSeq)) best = t;
+			}
+			if (!best) break;
+			enqueue(&best->todo, dequeue(&p->todo));
+		}
+
+		// Nobody to take the rest; ask for another looper.
+		if (p->todo.head && !p->spawnPending) {
+			int32_t spawned = 0;
+			bb_thread* asker = NULL;
+			for (bb_thread* t = p->threads; t; t = t->procNext) {
+				if (t->flags&THREAD_REGISTERED) spawned++;
+				if (t->blocked && !t->dead && !asker) asker = t;
+			}
+			if (asker && spawned < MAX_SPAWNED_LOOPERS) {
+				queue_simple(asker, WORK_SPAWN);
+				p->spawnPending = true;
+			}
+		}
+	}
+
+	for (bb_thread* t = g_threads; t; t = t->next) {
+		if (t->blocked && !t->dead && t->todo.head) flush_thread(t);
+	}
+}
+
+static int next_timeout()
+{
+	int64_t next = kNoWakeup;
+	for (bb_proc* p = g_procs; p; p = p->next) {
+		if (!p->finished && p->wakeupAt < next) next = p->wakeupAt;
+	}
+	if (next == kNoWakeup) return -1;
+	int64_t delta = next - now_ns();
+	if (delta <= 0) return 0;
+	return (int)((delta+999999)/1000000);
+}
+
+// -----------------------------------------------------------
+
+static int open_socket(const char* path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		close(fd);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = getenv(BINDER_BROKER_ENV);
+	if (argc > 1) path = argv[1];
+	if (path == NULL || *path == 0) path = BINDER_BROKER_DEFAULT_PATH;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int listenFd = open_socket(path);
+	if (listenFd < 0) {
+		fprintf(stderr, "binderd: unable to listen on '%s': %s\n", path, strerror(errno));
+		return 1;
+	}
+	printf("binderd: listening on '%s'\n", path);
+
+	pollfd* fds = NULL;
+	bb_thread** owners = NULL;
+	int capacity = 0;
+
+	while (true) {
+		int count = 1;
+		for (bb_thread* t = g_threads; t; t = t->next) count++;
+		if (count > capacity) {
+			capacity = count*2;
+			fds = (pollfd*)realloc(fds, capacity*sizeof(pollfd));
+			owners = (bb_thread**)realloc(owners, capacity*sizeof(bb_thread*));
+		}
+
+		fds[0].fd = listenFd;
+		fds[0].events = POLLIN;
+		owners[0] = NULL;
+		int n = 1;
+		for (bb_thread* t = g_threads; t; t = t->next, n++) {
+			fds[n].fd = t->fd;
+			fds[n].events = POLLIN;
+			owners[n] = t;
+		}
+
+		int result = poll(fds, n, next_timeout());
+		if (result < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "binderd: poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		if (fds[0].revents&POLLIN) {
+			int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC|SOCK_NONBLOCK);
+			if (fd >= 0) {
+				bb_thread* t = (bb_thread*)calloc(1, sizeof(bb_thread));
+				t->fd = fd;
+				t->inFd = -1;
+				t->next = g_threads;
+				g_threads = t;
+			}
+		}
+
+		for (int i=1; i<n; i++) {
+			bb_thread* t = owners[i];
+			if (!fds[i].revents || t->dead) continue;
+			if (fds[i].revents&(POLLERR|POLLNVAL)) t->dead = true;
+			else handle_input(t);
+		}
+
+		// Deliver, then clean up after anyone who left (which can
+		// produce more to deliver).
+		bool reaped;
+		do {
+			dispatch();
+			reaped = false;
+			bb_thread* t = g_threads;
+			while (t) {
+				bb_thread* next = t->next;
+				if (t->dead) {
+					remove_thread(t);
+					reaped = true;
+				}
+				t = next;
+			}
+		} while (reaped);
+	}
+
+	close(listenFd);
+	unlink(path);
+	return 0;
+}
@@ -206,6 +206,12 @@ FunctionPrototype::AddParameter(const SString &type, const SString &name)
 	m_params.AddItem(p);
 }
 
+bool
+FunctionPrototype::IsConst() const
+{
+	return (m_cv & CONST) != 0;
+}
+
 void
 FunctionPrototype::Output(const sptr<ITextOutput> &stream, int32_t flags) const
 {
@@ -119,6 +119,7 @@ class FunctionPrototype : public Expression
 public:
 					FunctionPrototype(const SString &return_type, const SString &name, uint32_t linkage, uint32_t cv = 0, const SString & clas = SString(""));
 	void			AddParameter(const SString &type, const SString &name);
+	bool			IsConst() const;
 	enum {
 		nolinkage = 1,
 		classname = 2
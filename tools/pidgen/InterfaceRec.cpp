@@ -680,6 +680,20 @@ InterfaceRec::AddProperty(SString aId, const sptr<IDLType>& aType, const sptr<ID
 }			
 
 
+// A oneway call has nothing to send back.
+static bool
+IsValidOneWay(const sptr<IDLMethod>& method)
+{
+	if (method->ReturnType()->GetName() != "void") return false;
+
+	const int32_t paramCount = method->CountParams();
+	for (int32_t i = 0; i < paramCount; i++) {
+		const uint32_t direction = method->ParamAt(i)->m_type->GetDirection();
+		if (direction == kOut || direction == kInOut) return false;
+	}
+	return true;
+}
+
 status_t
 InterfaceRec::AddMethod(const sptr<IDLMethod>& method)
 {
@@ -687,6 +701,10 @@ InterfaceRec::AddMethod(const sptr<IDLMethod>& method)
 		berr << "*** DUPLICATE METHOD: " << method->ID() << endl;
 		return B_NAME_IN_USE;
 	}
+	if (method->HasAttribute(kOneWay) && !IsValidOneWay(method)) {
+		berr << "*** ONEWAY METHOD MUST RETURN void AND TAKE ONLY [in] PARAMETERS: " << method->ID() << endl;
+		method->SetAttributes(method->GetAttributes() & ~kOneWay);
+	}
 	m_methods.AddItem(method);
 	return B_OK;
 }
@@ -39,7 +39,8 @@ enum AttributeKind {
 	kOptional		= 0x00000040,	// parameter
 	kLocal			= 0x00000080,	// method or interface
 	kReserved		= 0x00000100,	// method or property
-	kAutoMarshal	= 0x00000200	// type: use autobinder marshalling
+	kAutoMarshal	= 0x00000200,	// type: use autobinder marshalling
+	kOneWay			= 0x00000400	// method: don't wait for it to run
 };
 const uint32_t kDirectionMask = kIn + kOut + kInOut;
 
@@ -17,6 +17,7 @@
 
 #include <support/StdIO.h>
 #include <ctype.h>
+#include <stdio.h>
 
 // No longer printing keys in public headers, as we can't export data.
 // Maybe some day this will change.
@@ -1065,6 +1066,28 @@ MethodParamList(const sptr<IDLMethod> &method)
 	return params;
 }
 
+// Stable ID sent in place of a method's name by B_INVOKE_ID_TRANSACTION.
+// This is a 32-bit FNV-1a hash of "Interface.Method", so it only changes
+// when the method is renamed or moved; 0 is reserved for "no ID".
+static SString
+AutobinderMethodID(const SString& iface, const SString& method)
+{
+	SString name(iface);
+		name += ".";
+		name += method;
+
+	uint32_t hash = 2166136261U;
+	for (const char* p = name.String(); *p; p++) {
+		hash ^= (uint8_t)*p;
+		hash *= 16777619U;
+	}
+	if (hash == 0) hash = 1;
+
+	char buf[16];
+	sprintf(buf, "0x%08lxU", (unsigned long)hash);
+	return SString(buf);
+}
+
 // defs for the autobinder
 status_t
 WriteAutobinderDefs(sptr<ITextOutput> stream, InterfaceRec *base, SVector<InterfaceRec*> &recs, SString noid)
@@ -1236,6 +1259,7 @@ WriteAutobinderDefs(sptr<ITextOutput> stream, InterfaceRec *base, SVector<Interf
 				autobinderdef_initializer->AddItem(new StringLiteral(get_name));
 				autobinderdef_initializer->AddItem(new StringLiteral("NULL"));
 				autobinderdef_initializer->AddItem(new StringLiteral("0"));
+				autobinderdef_initializer->AddItem(new StringLiteral("0"));
 
 			sptr<VariableDefinition> autobinder_def = new VariableDefinition(SString("BAutobinderDef"),
 																			autobinderdef_name, CONST,
@@ -1336,6 +1360,8 @@ WriteAutobinderDefs(sptr<ITextOutput> stream, InterfaceRec *base, SVector<Interf
 				autobinderdef_initializer->AddItem(new StringLiteral("NULL"));
 				autobinderdef_initializer->AddItem(new StringLiteral(address_of_invoke_def_name));
 				autobinderdef_initializer->AddItem(new StringLiteral("0"));
+				autobinderdef_initializer->AddItem(new StringLiteral(AutobinderMethodID(rec->ID(), method->ID())));
+				autobinderdef_initializer->AddItem(new StringLiteral(method->HasAttribute(kOneWay) ? "B_AUTOBINDER_ONE_WAY" : "0"));
 
 			sptr<VariableDefinition> autobinder_def = new VariableDefinition(SString("BAutobinderDef"),
 																			autobinderdef_name, CONST,
@@ -1518,6 +1544,13 @@ OutputTransact(const sptr<ITextOutput> &stream, InterfaceRec* base, const SStrin
 	if (base->HasAttribute(kLocal) == false) {
 		stream << "#if USE_AUTOBINDER" << endl;
 		stream << "	status_t err;" << endl;
+		stream << "	if (code == B_INVOKE_ID_TRANSACTION) {" << endl;
+		stream << "" << endl;
+		stream << "		// no SValue fallback here; if the ID doesn't match, the caller resends by name." << endl;
+		stream << "		return execute_autobinder(code, " << CastExpression(kThis, base) << ", data, reply," << endl;
+		stream << "									" << autobinder_defs << ", sizeof(" << autobinder_defs << ")/sizeof(" << autobinder_defs << "[0])," << endl;
+		stream << "									B_ACTIONS_SORTED_BY_KEY);" << endl;
+		stream << "	}" << endl;
 		stream << "	if (code == B_INVOKE_TRANSACTION || code == B_GET_TRANSACTION || code == B_PUT_TRANSACTION) {" << endl;
 		stream << "" << endl;
 		stream << "		// in case execute_autobinder fails, save the position, so that the regular" << endl;
@@ -1572,7 +1605,7 @@ autobinder_array_entry(uint32_t direction, bool optional, const SString& origina
 static sptr<Function>
 AutobinderRemoteFunction(const sptr<FunctionPrototype> &proto, SString noid,
 							const SVector<sptr<IDLType> > &params, SString effect_method_def,
-							const sptr<IDLType> &return_type, SString func)
+							const sptr<IDLType> &return_type, SString func, bool async = false)
 {
 	sptr<Function> hook = new Function(proto);
 
@@ -1724,6 +1757,19 @@ AutobinderRemoteFunction(const sptr<FunctionPrototype> &proto, SString noid,
 		args_variable_name = "args";
 	}
 	
+	if (async) {
+		// The arguments are marshalled before StartAutobinder() returns,
+		// so pointing at our locals is fine.
+		hook->AddItem(new StringLiteral("sptr<SAsyncTransaction> txn = new SAsyncTransaction"));
+		if (proto->IsConst()) {
+			hook->AddItem(new Literal(true, "txn->StartAutobinder(const_cast<I%s*>(this)->AsBinder(), &%s, %s)", noid.String(), effect_method_def.String(), args_variable_name.String()));
+		} else {
+			hook->AddItem(new Literal(true, "txn->StartAutobinder(AsBinder(), &%s, %s)", effect_method_def.String(), args_variable_name.String()));
+		}
+		hook->AddItem(new StringLiteral("return txn"));
+		return hook;
+	}
+
 	// return value
 	bool has_return = return_type != NULL && return_type->GetName() != "void";
 	SString rv_variable_name("NULL");
@@ -1995,6 +2041,64 @@ WriteAutobinderRemote(InterfaceRec* base, const SVector<InterfaceRec*>& recs, SS
 	}
 }
 
+// asynchronous variants of the interface's methods; without the
+// autobinder there is nothing to send them with, so they just fail
+void
+WriteAutobinderAsync(InterfaceRec* rec, SString noid, const sptr<ITextOutput> &stream, bool supported = true)
+{
+	SString i_class_name;
+		i_class_name += "I";
+		i_class_name += noid;
+
+	stream << "/* Asynchronous Methods */" << endl;
+	int32_t methodCount = rec->CountMethods();
+	for (int32_t i_method = 0; i_method < methodCount; i_method++) {
+		sptr<IDLMethod> method = rec->MethodAt(i_method);
+		if (!HasAsyncVariant(method)) continue;
+
+		SString name(method->ID());
+			name += "Async";
+		sptr<FunctionPrototype> method_prototype = new FunctionPrototype(SString("sptr<SAsyncTransaction>"),
+													name, 0,
+													method->IsConst() ? CONST : 0, i_class_name);
+		size_t paramCount = method->CountParams();
+		for (size_t i_param = 0; i_param < paramCount; i_param++) {
+			SString name("a");
+			name << i_param;
+			method_prototype->AddParameter(TypeToCPPType(kInsideClassScope, method->ParamAt(i_param)->m_type, true), name);
+		}
+
+		SString autobinderdef_name;
+			autobinderdef_name += noid;
+			autobinderdef_name += "_";
+			autobinderdef_name += method->ID();
+			autobinderdef_name += "_autobinderdef";
+		SVector<sptr<IDLType> > params = MethodParamList(method);
+
+		sptr<Function> method_func;
+		if (supported) {
+			method_func = AutobinderRemoteFunction(method_prototype, noid,
+												params, autobinderdef_name,
+												method->ReturnType(), method->ID(), true);
+		} else {
+			method_func = new Function(method_prototype);
+			if (paramCount > 0) {
+				sptr<ParameterUse> dummyUsage = new ParameterUse();
+				for (size_t i_param = 0; i_param < paramCount; i_param++) {
+					SString varname("a");
+					varname << i_param;
+					dummyUsage->AddParameter(varname);
+				}
+				method_func->AddItem(dummyUsage.ptr());
+			}
+			method_func->AddItem(new StringLiteral("sptr<SAsyncTransaction> txn = new SAsyncTransaction"));
+			method_func->AddItem(new StringLiteral("txn->Fail(B_UNSUPPORTED)"));
+			method_func->AddItem(new StringLiteral("return txn"));
+		}
+		method_func->Output(stream);
+	}
+}
+
 void WriteFunctionBodyStub(sptr<ITextOutput> stream, InterfaceRec* base, sptr<IDLMethod> method, SString className) 
 {
 	// The function body for a local stub
@@ -2734,6 +2838,7 @@ status_t WriteCPP(sptr<ITextOutput> stream,
 				if (g_writeAutobinder) {
 					stream << "#if USE_AUTOBINDER" << endl;
 					WriteAutobinderRemote(rec, allInterfaces, noid, stream);
+					WriteAutobinderAsync(rec, noid, stream);
 					stream << "#else // USE_AUTOBINDER" << endl;
 				}
 
@@ -2743,6 +2848,8 @@ status_t WriteCPP(sptr<ITextOutput> stream,
 				stream << "// non USE_AUTOBINDER implementation not currently supported" << endl;
 				// WriteRemoteClass(stream, rec, allInterfaces, noid);
 				if (g_writeAutobinder) {
+					// The interface header declares these either way.
+					WriteAutobinderAsync(rec, noid, stream, false);
 					stream << "#endif // USE_AUTOBINDER" << endl;
 				}
 
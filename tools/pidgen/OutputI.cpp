@@ -77,6 +77,34 @@ WritePropertyDeclarations(sptr<ITextOutput> stream, sptr<IDLNameType> propertyTy
 	}
 }
 
+// Start the method on a looper thread and return without waiting
+// for it; see SAsyncTransaction.
+static void
+WriteAsyncMethodDeclaration(sptr<ITextOutput> stream, sptr<IDLMethod> method)
+{
+	SString type("sptr<SAsyncTransaction>");
+	stream << "//!\tAsynchronous " << method->ID() << "(); see SAsyncTransaction." << endl;
+	stream << "\t\t" << type << PadString(type, TYPE_TABS) << method->ID() << "Async(";
+
+	int32_t paramCount = method->CountParams();
+	for (int32_t i_param = 0; i_param < paramCount; i_param++) {
+		sptr<IDLNameType> nt = method->ParamAt(i_param);
+		SString ptype = TypeToCPPType(kInsideClassScope, nt->m_type, true); 
+		stream << ptype << " " << nt->m_id;
+		if (nt->m_type->HasAttribute(kOptional)) {
+			stream << " = " << TypeToDefaultValue(kInsideClassScope, nt->m_type);
+		}
+		if (i_param < paramCount-1) {
+			stream << ", ";
+		}
+	}
+	stream << ")";
+	if (method->IsConst()) {
+		stream << " const";
+	}
+	stream << ";" << endl;
+}
+
 static void
 WriteMethodDeclaration(sptr<ITextOutput> stream, sptr<IDLMethod> method, bool inInterface)
 {
@@ -172,6 +200,10 @@ WriteIHeader(sptr<ITextOutput> stream, SVector<InterfaceRec *> &recs,
 	stream << "#include <support/Binder.h>" << endl;
 	stream << "#include <support/Context.h>" << endl;
 	stream << "#include <support/String.h>" << endl;
+	if (g_writeAutobinder) {
+		// For the asynchronous methods.
+		stream << "#include <support/AsyncTransaction.h>" << endl;
+	}
 	stream << endl;
 
 	size_t count = headers.CountItems();
@@ -331,6 +363,21 @@ WriteIHeader(sptr<ITextOutput> stream, SVector<InterfaceRec *> &recs,
 				WriteMethodDeclaration(stream, method, true);
 			}
 
+			if (g_writeAutobinder && rec->HasAttribute(kLocal) == false) {
+				bool first = true;
+				for (int32_t i_method = 0; i_method < methodCount; i_method++) {
+					sptr<IDLMethod> method = rec->MethodAt(i_method);
+					if (!HasAsyncVariant(method)) continue;
+					if (first) {
+						stream << endl;
+						stream << "/* ------- Asynchronous Methods ----------- */" << endl;
+						first = false;
+					}
+					stream << endl;
+					WriteAsyncMethodDeclaration(stream, method);
+				}
+			}
+
 			if (eventCount != 0) {
 				stream << endl;
 				stream << "/* ------- Events ------------------------ */" << endl;
@@ -75,6 +75,20 @@ IsAutobinderType(const sptr<IDLType> &type)
 		 || ((st->GetAttributes()&kAutoMarshal) != 0);
 }
 
+bool
+HasAsyncVariant(const sptr<IDLMethod> &method)
+{
+	if (method->HasAttribute(kLocal) || method->HasAttribute(kReserved)) return false;
+	if (method->HasAttribute(kOneWay)) return false;
+
+	const int32_t paramCount = method->CountParams();
+	for (int32_t i = 0; i < paramCount; i++) {
+		const uint32_t direction = method->ParamAt(i)->m_type->GetDirection();
+		if (direction == kOut || direction == kInOut) return false;
+	}
+	return true;
+}
+
 // clients can use kInsideClassScope so they don't need to pass the interface
 // to TypeToCPPType, but they'd better be prepared to use the naked typedef
 // at that point for the resulting file to compile correctly
@@ -69,6 +69,10 @@ void AddFromSValueStatements(const InterfaceRec* rec,
 bool IsAutoMarshalType(const sptr<IDLType> &type);
 bool IsAutobinderType(const sptr<IDLType> &type);
 
+// Methods that only take input parameters also get an asynchronous
+// "Async" variant in the interface class (oneway methods don't need one).
+bool HasAsyncVariant(const sptr<IDLMethod> &method);
+
 int32_t CountStringTabs(const SString& str, int32_t tabLen=4);
 const char* PadString(const SString& str, int32_t fieldTabs, int32_t tabLen=4);
 
@@ -123,7 +123,7 @@ copy_elements(InterfaceRec* dest, InterfaceRec* source)
 %token <_anything> J_IN				// attribute
 %token <_anything> J_OUT			// attribute
 %token <_anything> J_INOUT			// attribute 
-%token <_anything> J_ONEWAY			// not used
+%token <_anything> J_ONEWAY			// attribute (on method)
 %token <_anything> J_READONLY		// attribute
 %token <_anything> J_LOCAL			// attribute (on interface, property or method)
 %token <_anything> J_WEAK			// attribute
@@ -2507,6 +2507,16 @@ return_attribute
 	 	#endif
 		$$->SetAttribute(kReserved);
 	}
+	| J_ONEWAY {
+		#ifdef IDLDEBUG
+			bout << "rule<<<return_attribute - oneway " << endl<< endl; 
+	 	#endif
+		$$=new IDLType();
+		#ifdef IDLDEBUG
+			$$->IncStrong(NULL);
+	 	#endif
+		$$->SetAttribute(kOneWay);
+	}
 	;
 
 /*90*/	